@@ -0,0 +1,239 @@
+#include "Bug3Protocol.h"
+#include <QRegExp>
+#include <string.h>
+
+namespace Bug3
+{
+    static const double ADCStep = 1.02 * 1.225 / 1024.0;    // units = V, same as DAQ::BugTask::ADCStep
+
+    /// incoming data is such that 0v = 1023, because incoming samples are 11-bit. normalize so that 0v = 0 and promote to 16-bit
+    static inline int16 adcToSample(int v) { return int16((v - int(ADCOffset)) * int16(32)); }
+
+    BlockMetaData::BlockMetaData() { ::memset(this, 0, sizeof(*this)); /*zero out all data.. yay!*/ }
+    BlockMetaData::BlockMetaData(const BlockMetaData &o) { *this = o; }
+    BlockMetaData & BlockMetaData::operator=(const BlockMetaData & o) { ::memcpy(this, &o, sizeof(o)); return *this; }
+
+    StreamParser::Item StreamParser::next(const char *data, unsigned len, unsigned & pos)
+    {
+        if (state > int(NTextFields)) { block.clear(); state = 0; } // previous call returned a TextBlock
+        raw = 0;
+        while (pos < len) {
+            if (data[pos] == '\0') {
+                // binary frame
+                if (len - pos < sizeof(FrameHeader)) return NeedMore;
+                FrameHeader h;
+                memcpy(&h, data+pos, sizeof(h));
+                if (h.magic[1] != 'B' || h.magic[2] != '3' || h.magic[3] != 'B' || h.headerBytes < sizeof(FrameHeader)) {
+                    ++nbadframes; ++pos; // garbage, resync
+                    continue;
+                }
+                const unsigned frameBytes = unsigned(h.headerBytes) + h.payloadBytes;
+                if (len - pos < frameBytes) return NeedMore;
+                const unsigned start = pos;
+                pos += frameBytes;
+                if (h.version != BinaryVersion || h.payloadBytes != sizeof(RawBlock)) { ++nbadframes; continue; } // from the future, skip it
+                raw = data + start + h.headerBytes;
+                // a binary frame is a whole block.  Any text block in progress (say, just the "---> Console" line that
+                // bug3_spikegl.exe used to send before each frame) is abandoned, so that the lines after this are ordinary lines again.
+                state = 0; block.clear();
+                return BinaryBlock;
+            }
+            const char *nl = reinterpret_cast<const char *>(memchr(data+pos, '\n', len-pos));
+            if (!nl) return NeedMore;
+            const unsigned start = pos;
+            pos = unsigned(nl - data) + 1;
+            lin = QString::fromLatin1(data+start, int(pos-start)).trimmed();
+            if (lin.startsWith("---> Console")) {
+                ++nlines;
+                state = 1;
+            } else if (state) {
+                ++nlines;
+                static QRegExp blkSepRE("[}{]"); ///< made static here to compile the RE only once.. performance optimization
+                // we are in parsing mode..
+                QStringList nv = lin.split(blkSepRE, QString::SkipEmptyParts);
+                if (nv.count() == 2) {
+                    block[nv.first()] = nv.last();
+                    if (++state > int(NTextFields)) return TextBlock;
+                }
+            } else
+                return Line;
+        }
+        return NeedMore;
+    }
+
+    Decoder::Decoder(int nChans, unsigned which)
+        : nchans(nChans), whichTTLs(which)
+    {
+        for (int i = 0, n = 0; i < int(TotalTTLChans); ++i) {
+            // make the TTL line number -> our_channelid
+            // (because TTL10 from bug3 may not always be our TTL10 if say the ttl chans we have on are like 0,1,3,5,10,
+            // then TTL 10 is really 4 for us!
+            ttlDest[i] = -1;
+            if (whichTTLs & (0x1<<i)) {
+                if (int(BaseNChans)+n < nchans) ttlDest[i] = int(BaseNChans)+n;
+                ++n;
+            }
+        }
+    }
+
+    void Decoder::decodeBinary(const char *rawPtr, int16 *samps, BlockMetaData & meta) const
+    {
+        RawBlock b;
+        memcpy(&b, rawPtr, sizeof(b)); // rawPtr is wherever the frame landed in the input buffer, so may be misaligned
+
+        for (int ch = 0; ch < int(TotalNeuralChans); ++ch) {
+            const quint16 *in = b.neural[ch];
+            int16 *out = samps + ch;
+            for (int j = 0; j < int(ScansPerBlock); ++j, out += nchans)
+                *out = adcToSample(in[j]);
+        }
+        // EMG, AUX and TTL come in once per frame: repeat each sample 16 times to match the neural rate
+        for (int frame = 0; frame < int(FramesPerBlock); ++frame) {
+            int16 *scan = samps + frame*(int(NeuralSamplesPerFrame)*nchans);
+            int16 v[BaseNChans-TotalNeuralChans+TotalTTLChans];
+            int dest[BaseNChans-TotalNeuralChans+TotalTTLChans];
+            int n = 0;
+            for (int ch = 0; ch < int(TotalEMGChans); ++ch, ++n)
+                v[n] = adcToSample(b.emg[ch][frame]), dest[n] = int(TotalNeuralChans)+ch;
+            for (int ch = 0; ch < int(TotalAuxChans); ++ch, ++n)
+                v[n] = adcToSample(b.aux[ch][frame]), dest[n] = int(TotalNeuralChans+TotalEMGChans)+ch;
+            for (int ttl = 0; ttl < int(TotalTTLChans); ++ttl)
+                if (ttlDest[ttl] > -1)
+                    v[n] = (b.ttl[frame] & (0x1<<ttl)) ? 32767 : 0, dest[n++] = ttlDest[ttl];
+            for (int ix = 0; ix < int(NeuralSamplesPerFrame); ++ix, scan += nchans)
+                for (int i = 0; i < n; ++i)
+                    scan[dest[i]] = v[i];
+        }
+
+        double avgVunreg = 0.0;
+        for (int frame = 0; frame < int(FramesPerBlock); ++frame)
+            avgVunreg += ADCStep * double(int(b.aux[1][frame]) - int(ADCOffset));
+        avgVunreg = avgVunreg / (double)FramesPerBlock;
+        if (avgVunreg < 0.0) avgVunreg = 0.0;
+        if (avgVunreg > 6.0) avgVunreg = 6.0;
+        meta.avgVunreg = avgVunreg;
+
+        for (int frame = 0; frame < int(FramesPerBlock); ++frame) {
+            meta.chipID[frame] = b.chipID[frame];
+            meta.chipFrameCounter[frame] = b.chipFrameCounter[frame];
+            meta.frameMarkerCorrelation[frame] = b.frameMarkerCorrelation[frame];
+            meta.boardFrameCounter[frame] = b.boardFrameCounter[frame];
+            meta.boardFrameTimer[frame] = b.boardFrameTimer[frame];
+        }
+        meta.BER = b.BER;
+        meta.WER = b.WER;
+        meta.missingFrameCount = b.missingFrameCount;
+        meta.falseFrameCount = b.falseFrameCount;
+        meta.comm_absTimeNS = b.comm_absTimeNS;
+        meta.creation_absTimeNS = b.creation_absTimeNS;
+    }
+
+    /// pops the next number off of `nums' for frame-data key `what', warning (once per key) if there are none left
+    static QString popNum(QStringList & nums, const char *what, const QString & v, bool & warned, QStringList *warnings)
+    {
+        if (nums.empty()) {
+            if (!warned && warnings) warnings->push_back(QString("Bug3: Internal problem -- ran out of ") + what + " in frame `" + v + "'");
+            warned = true;
+            return "0";
+        }
+        QString num = nums.front();
+        nums.pop_front();
+        return num;
+    }
+
+    /// parses the channel number out of keys like NEU_3, returns 0 if it can't
+    static int keyChan(const QString & k, int nchans, QStringList *warnings)
+    {
+        QStringList knv = k.split("_");
+        int chan = 0;
+        bool ok = false;
+        if (knv.count() == 2) {
+            chan = knv.last().toInt(&ok);
+            if (chan < 0 || chan >= nchans) { chan = 0; ok = false; }
+        }
+        if (!ok && warnings) warnings->push_back(QString("Bug3: Internal problem -- parse error on ") + k.left(4) + " key.");
+        return chan;
+    }
+
+    void Decoder::decodeText(const QMap<QString, QString> & blk, int16 *samps, BlockMetaData & meta, QStringList *warnings) const
+    {
+        for (QMap<QString,QString>::const_iterator it = blk.begin(); it != blk.end(); ++it) {
+            const QString & k = it.key(), & v(it.value());
+            bool warned = false, ok = false;
+            if (k.startsWith("NEU_")) {
+                const int neur_chan = keyChan(k, TotalNeuralChans, warnings);
+                QStringList nums = v.split(",");
+                for (int frame = 0; frame < int(FramesPerBlock); ++frame) {
+                    for (int neurix = 0; neurix < int(NeuralSamplesPerFrame); ++neurix) {
+                        QString num = popNum(nums, "neural samples", v, warned, warnings);
+                        int samp = num.toUShort(&ok);
+                        if (!ok && warnings) warnings->push_back("Bug3: Internal error -- parse error while reading neuronal sample `" + num + "'");
+                        samps[ frame*(NeuralSamplesPerFrame*nchans) + neurix*nchans + neur_chan ] = adcToSample(samp);
+                    }
+                }
+            } else if (k.startsWith("EMG_") || k.startsWith("AUX_")) {
+                const bool emg = k.startsWith("EMG_");
+                const int chan = keyChan(k, emg ? int(TotalEMGChans) : int(TotalAuxChans), warnings);
+                const int destChan = emg ? int(TotalNeuralChans)+chan : int(TotalNeuralChans+TotalEMGChans)+chan;
+                QStringList nums = v.split(",");
+                double avgVunreg = 0.0;
+                for (int frame = 0; frame < int(FramesPerBlock); ++frame) {
+                    QString num = popNum(nums, emg ? "EMG samples" : "AUX samples", v, warned, warnings);
+                    int samp = num.toUShort(&ok);
+                    if (!ok && warnings) warnings->push_back("Bug3: Internal error -- parse error while reading emg sample `" + num + "'");
+                    if (!emg && chan == 1) avgVunreg += ADCStep * double(samp - int(ADCOffset));
+                    const int16 s = adcToSample(samp);
+                    for (int ix = 0; ix < int(NeuralSamplesPerFrame); ++ix) // need to produce 16 samples for each 1 emg sample read in order to match neuronal rate!
+                        samps[ frame*(NeuralSamplesPerFrame*nchans) + ix*nchans + destChan ] = s;
+                }
+                if (!emg && chan == 1) {
+                    avgVunreg = avgVunreg / (double)FramesPerBlock;
+                    if (avgVunreg < 0.0) avgVunreg = 0.0;
+                    if (avgVunreg > 6.0) avgVunreg = 6.0;
+                    meta.avgVunreg = avgVunreg;
+                }
+            } else if (k.startsWith("TTL_")) {
+                // don't grab all ttl chans here, since we only really support a subset of them
+                const int ttl_chan = keyChan(k, TotalTTLChans, warnings);
+                const int destChan = ttlDest[ttl_chan];
+                if (destChan < 0) continue;
+                QStringList nums = v.split(",");
+                for (int frame = 0; frame < int(FramesPerBlock); ++frame) {
+                    QString num = popNum(nums, "TTL samples", v, warned, warnings);
+                    int samp = num.toUShort(&ok);
+                    if (!ok && warnings) warnings->push_back("Bug3: Internal error -- parse error while reading ttl sample `" + num + "'");
+                    if (samp) samp = 32767; // normalize high to maxV
+                    for (int ix = 0; ix < int(NeuralSamplesPerFrame); ++ix)
+                        samps[ frame*(NeuralSamplesPerFrame*nchans) + ix*nchans + destChan ] = int16(samp);
+                }
+            } else if (k.startsWith("CHIPID") || k.startsWith("CHIP_FC") || k.startsWith("FRAME_MARKER_COR")
+                       || k.startsWith("BOARD_FC") || k.startsWith("BOARD_FRAME_TIMER")) {
+                QStringList nums = v.split(",");
+                for (int frame = 0; frame < int(FramesPerBlock); ++frame) {
+                    QString num = popNum(nums, "per-frame data", v, warned, warnings);
+                    if (k.startsWith("CHIPID")) meta.chipID[frame] = num.toUShort(&ok);
+                    else if (k.startsWith("CHIP_FC")) meta.chipFrameCounter[frame] = num.toInt(&ok);
+                    else if (k.startsWith("FRAME_MARKER_COR")) meta.frameMarkerCorrelation[frame] = num.toUShort(&ok);
+                    else if (k.startsWith("BOARD_FC")) meta.boardFrameCounter[frame] = num.toInt(&ok);
+                    else meta.boardFrameTimer[frame] = num.toInt(&ok);
+                    if (!ok && warnings) warnings->push_back("Bug3: Internal error -- parse error while reading " + k + " `" + num + "'");
+                }
+            } else if (k.startsWith("BER")) {
+                meta.BER = v.toDouble(&ok);
+            } else if (k.startsWith("WER")) {
+                meta.WER = v.toDouble(&ok);
+            } else if (k.startsWith("MISSING_FC")) {
+                meta.missingFrameCount = v.toInt(&ok);
+            } else if (k.startsWith("FALSE_FC")) {
+                meta.falseFrameCount = v.toInt(&ok);
+            } else if (k.startsWith("COMM_ABSTIMENS")) {
+                meta.comm_absTimeNS = v.toULongLong(&ok);
+            } else if (k.startsWith("CREATION_ABSTIMENS")) {
+                meta.creation_absTimeNS = v.toULongLong(&ok);
+            } else
+                continue; // unknown keys are ignored
+            if (!ok && warnings && (k.startsWith("BER") || k.startsWith("WER") || k.startsWith("MISSING_FC") || k.startsWith("FALSE_FC") || k.contains("ABSTIMENS")))
+                warnings->push_back("Bug3: Internal problem -- error parsing " + k + " `" + v + "'");
+        }
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef Bug3Protocol_H
+#define Bug3Protocol_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include "TypeDefs.h"
+
+/** Decoding of the block stream the bug3_spikegl.exe subprocess writes to its stdout.
+
+    Blocks come in one of two formats, freely interleaved with the subprocess's ordinary text
+    output lines ("USRMSG: ...", etc):
+
+    - text (the original protocol): a "---> Console data out..." line followed by one
+      `KEY{v0,v1,...}' line per field.  Easy to eyeball, but parsing it is expensive.
+
+    - binary: a FrameHeader followed by exactly FrameHeader::payloadBytes of RawBlock.
+      The header starts with a NUL byte, which can never start a text line, so the two
+      can be told apart at any line boundary.
+
+    SpikeGL asks for binary blocks by setting BUG3_BLOCK_FORMAT=binary in the subprocess's
+    environment.  A subprocess that understands it says so with a "BLOCKFORMAT: binary <version>"
+    line before it sends any data; an older one ignores the variable and keeps sending text,
+    which is still fully supported.  BUG3_BLOCK_FORMAT=both makes the subprocess emit every
+    block in both formats, which is what bug3replay (see bug3replay.cpp) wants for its captures.
+
+    Only depends on QtCore so that it may be shared with the bug3replay tool. */
+namespace Bug3
+{
+    // some useful constants for the bug3 USB-based acquisition.  see also DAQ::BugTask
+    enum {
+        ADCOffset = 1023,
+        FramesPerBlock = 40,
+        NeuralSamplesPerFrame = 16,
+        ScansPerBlock = FramesPerBlock*NeuralSamplesPerFrame, // 640
+        TotalNeuralChans = 10,
+        TotalEMGChans = 4,
+        TotalAuxChans = 2,
+        TotalTTLChans = 11,
+        BaseNChans = TotalNeuralChans+TotalEMGChans+TotalAuxChans,
+        NTextFields = TotalNeuralChans+TotalEMGChans+TotalAuxChans+TotalTTLChans+11, ///< number of KEY{} lines in a text block
+    };
+
+    /// Appended to each page of Bug3 scans in the shared sample buffer.  Also known as DAQ::BugTask::BlockMetaData.
+    struct BlockMetaData {
+        quint64 blockNum; ///< sequential number. incremented for each new block
+        int boardFrameCounter[FramesPerBlock];
+        int boardFrameTimer[FramesPerBlock];
+        int chipFrameCounter[FramesPerBlock];
+        quint16 chipID[FramesPerBlock];
+        quint16 frameMarkerCorrelation[FramesPerBlock];
+        int missingFrameCount;
+        int falseFrameCount;
+        double BER, WER; ///< bit error rate and word error rate
+        double avgVunreg; ///< computed value derived from the "AUX" voltage channel.  Avg of all frames.  To save time we compute it on-the-fly as well.
+        u64 comm_absTimeNS, creation_absTimeNS; ///< timestamp ultimately coming off the CPU TSC that went with the block when it was created (creation_) and when it was sent down the pipe to SpikeGL (comm_)
+
+        BlockMetaData();
+        BlockMetaData(const BlockMetaData &o);
+        BlockMetaData & operator=(const BlockMetaData & o);
+    };
+
+    enum { BinaryVersion = 1 };
+
+    /// Precedes each binary block.  All fields little-endian.
+    struct FrameHeader {
+        char magic[4];        ///< "\0B3B"
+        quint16 version;      ///< BinaryVersion
+        quint16 headerBytes;  ///< sizeof(FrameHeader), lets later versions grow the header
+        quint32 payloadBytes; ///< sizeof(RawBlock) for version 1
+        quint32 reserved;
+    };
+
+    /// The version 1 binary payload: the same fields as the text format, in the same units (raw 11-bit ADC counts, etc),
+    /// laid out so that every member is naturally aligned with no padding.
+    struct RawBlock {
+        quint16 neural[TotalNeuralChans][ScansPerBlock];
+        quint16 emg[TotalEMGChans][FramesPerBlock];
+        quint16 aux[TotalAuxChans][FramesPerBlock];
+        quint16 ttl[FramesPerBlock]; ///< bit i is TTL line i
+        quint16 chipID[FramesPerBlock];
+        qint32 chipFrameCounter[FramesPerBlock];
+        quint16 frameMarkerCorrelation[FramesPerBlock];
+        qint32 boardFrameCounter[FramesPerBlock];
+        qint32 boardFrameTimer[FramesPerBlock];
+        quint64 creation_absTimeNS, comm_absTimeNS;
+        double BER, WER;
+        qint32 missingFrameCount, falseFrameCount;
+    };
+
+    /// Splits the subprocess's stdout into text lines, text blocks and binary blocks.
+    class StreamParser
+    {
+    public:
+        StreamParser() : state(0), nlines(0), nbadframes(0) {}
+
+        enum Item {
+            NeedMore = 0, ///< the rest of the data is an incomplete line or frame -- call again once more data has arrived
+            Line,         ///< an ordinary text line (not part of a block), see line()
+            TextBlock,    ///< a complete text block, see textBlock()
+            BinaryBlock   ///< a complete binary block, see rawBlock()
+        };
+
+        /// Looks at data[pos..len), consumes the next item and advances pos past it.
+        Item next(const char *data, unsigned len, unsigned & pos);
+
+        const QString & line() const { return lin; }
+        const QMap<QString, QString> & textBlock() const { return block; }
+        /// valid until the next call to next().  Points into the data passed to next(), and so may be unaligned -- use memcpy.
+        const char *rawBlock() const { return raw; }
+
+        quint64 linesParsed() const { return nlines; }
+        /// frames that started with a NUL but had a bad header, skipped byte-by-byte
+        unsigned badFrames() const { return nbadframes; }
+
+    private:
+        int state;
+        quint64 nlines;
+        unsigned nbadframes;
+        QString lin;
+        QMap<QString, QString> block;
+        const char *raw;
+    };
+
+    /// Turns a block, in either format, into nChans x ScansPerBlock interleaved samples plus metadata, exactly
+    /// the way SpikeGL has always done it for the text format: samples are offset and scaled to 16-bit, EMG/AUX/TTL
+    /// samples are repeated to the neural rate, and only the TTL lines set in whichTTLs are kept (packed).
+    /// Channels the block doesn't supply are left untouched, so zero `samps' first.
+    class Decoder
+    {
+    public:
+        Decoder(int nChans, unsigned whichTTLs);
+
+        /// The original QString based decoder.  Problems are appended to `warnings' (if not null).
+        void decodeText(const QMap<QString, QString> & blk, int16 *samps, BlockMetaData & meta, QStringList *warnings = 0) const;
+        /// `raw' points to a RawBlock, possibly unaligned.  Doesn't allocate.
+        void decodeBinary(const char *raw, int16 *samps, BlockMetaData & meta) const;
+
+    private:
+        int nchans;
+        unsigned whichTTLs;
+        int ttlDest[TotalTTLChans]; ///< output channel for each TTL line, or -1 if not kept
+    };
+}
+
+#endif
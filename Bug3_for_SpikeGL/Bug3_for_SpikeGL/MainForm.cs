@@ -167,8 +167,14 @@ namespace Bug3
             public int errTolerance = 6; // out of 144?
             public int hpfCutoff = 0; // <= 0 == off, otherwise value is in Hz
             public bool notchFilter = false; // if true, enable software notch filter on incoming data
+            public bool textBlocks = true; // console data blocks in the original KEY{...} text format
+            public bool binaryBlocks = false; // console data blocks in the binary format, see SpikeGL's Bug3Protocol.h
         }
 
+        // binary block format version, must match Bug3::BinaryVersion in SpikeGL's Bug3Protocol.h
+        public const int BinaryBlockVersion = 1;
+        public const int BinaryBlockHeaderBytes = 16;
+
         public ConfigParams Params = new ConfigParams();
 
         private void ParseParams()
@@ -232,6 +238,15 @@ namespace Bug3
                 Params.notchFilter = true;
 
             }
+            if (null != (s = Environment.GetEnvironmentVariable("BUG3_BLOCK_FORMAT"))) // text, binary or both
+            {
+                s = s.ToLower();
+                Params.textBlocks = s != "binary";
+                Params.binaryBlocks = s == "binary" || s == "both";
+                // SpikeGL only switches to binary decoding once it sees this line, so an older SpikeGL just keeps getting text
+                if (Params.binaryBlocks) Console.WriteLine("BLOCKFORMAT: " + (Params.textBlocks ? "both" : "binary") + " " + BinaryBlockVersion);
+                else Console.WriteLine("BLOCKFORMAT: text");
+            }
         }
 
         public MainForm()
@@ -998,6 +1013,61 @@ namespace Bug3
 
         private static System.Int64 t0 = 0;
         private static System.Int64 lastBlockSentTS = 0;
+        private static Stream rawStdout = null;
+        private static MemoryStream binaryBlock = null;
+
+        // Writes one block in the binary format: a 16-byte header ("\0B3B", version, header size, payload size, reserved)
+        // followed by the fields in the same order and units as the text format.  Layout must match Bug3::RawBlock.
+        private void writeBinaryBlock(USBData data, bool[,] ttls, long commTimeNS)
+        {
+            const int payloadBytes = 2 * (Constant.TotalNeuralChannels * Constant.NeuralSamplesPerFrame * Constant.FramesPerBlock
+                                          + (Constant.TotalEMGChannels + Constant.TotalAuxChannels + 3) * Constant.FramesPerBlock)
+                                     + 4 * 3 * Constant.FramesPerBlock
+                                     + 8 * 4 + 4 * 2;
+            if (binaryBlock == null) binaryBlock = new MemoryStream(BinaryBlockHeaderBytes + payloadBytes);
+            binaryBlock.SetLength(0);
+            BinaryWriter w = new BinaryWriter(binaryBlock); // little-endian
+
+            w.Write((byte)0); w.Write((byte)'B'); w.Write((byte)'3'); w.Write((byte)'B');
+            w.Write((UInt16)BinaryBlockVersion);
+            w.Write((UInt16)BinaryBlockHeaderBytes);
+            w.Write((UInt32)payloadBytes);
+            w.Write((UInt32)0);
+
+            for (int i = 0; i < Constant.TotalNeuralChannels; ++i)
+                for (int j = 0; j < Constant.NeuralSamplesPerFrame * Constant.FramesPerBlock; ++j)
+                    w.Write(data.neuralData16[i, j]);
+            for (int i = 0; i < Constant.TotalEMGChannels; ++i)
+                for (int j = 0; j < Constant.FramesPerBlock; ++j)
+                    w.Write(data.EMGData16[i, j]);
+            for (int i = 0; i < Constant.TotalAuxChannels; ++i)
+                for (int j = 0; j < Constant.FramesPerBlock; ++j)
+                    w.Write(data.auxData16[i, j]);
+            for (int j = 0; j < Constant.FramesPerBlock; ++j)
+            {
+                UInt16 bits = 0;
+                for (int i = 0; i < Constant.TotalTTLChannels; ++i)
+                    if (ttls[i, j]) bits |= (UInt16)(1 << i);
+                w.Write(bits);
+            }
+            for (int j = 0; j < Constant.FramesPerBlock; ++j) w.Write(data.chipID[j]);
+            for (int j = 0; j < Constant.FramesPerBlock; ++j) w.Write(data.chipFrameCounter[j]);
+            for (int j = 0; j < Constant.FramesPerBlock; ++j) w.Write(data.frameMarkerCorrelation[j]);
+            for (int j = 0; j < Constant.FramesPerBlock; ++j) w.Write(data.boardFrameCounter[j]);
+            for (int j = 0; j < Constant.FramesPerBlock; ++j) w.Write(data.boardFrameTimer[j]);
+            w.Write((UInt64)data.timeStampNanos);
+            w.Write((UInt64)commTimeNS);
+            w.Write(data.BER);
+            w.Write(data.WER);
+            w.Write(data.missingFrameCount);
+            w.Write(data.falseFrameCount);
+            w.Flush();
+
+            if (rawStdout == null) rawStdout = Console.OpenStandardOutput();
+            Console.Out.Flush(); // keep the frame ordered with respect to any text already written
+            rawStdout.Write(binaryBlock.GetBuffer(), 0, (int)binaryBlock.Length);
+            rawStdout.Flush();
+        }
 
         private void doConsoleDataOutput(int numPagesLeftInRAM)
         {
@@ -1006,6 +1076,16 @@ namespace Bug3
             foreach (USBData data in plotQueue)
             {
                 lastBlockSentTS = System.DateTime.Now.Ticks;
+
+                bool[,] ttls = null;
+                data.CopyTTLDataToArray(ref ttls);
+                long commTimeNS = GetAbsTimeNS();
+
+                // a binary frame is a whole block by itself.  The "---> Console" line starts a text block, so it only goes out
+                // with one, after the binary frame (SpikeGL's parser drops a text block in progress when a binary frame arrives)
+                if (Params.binaryBlocks) writeBinaryBlock(data, ttls, commTimeNS);
+                if (!Params.textBlocks) continue;
+
                 Console.WriteLine("---> Console data out called at time: " + (long)((System.DateTime.Now.Ticks - t0) / 1e4) + "ms plotQueue.Count=" + plotQueue.Count + " numPagesLeftInRAM=" + numPagesLeftInRAM);
 
                 UInt16[,] array = null;
@@ -1044,8 +1124,6 @@ namespace Bug3
                     }
                     writer.WriteLine("}");
                 }
-                bool[,] ttls = null;
-                data.CopyTTLDataToArray(ref ttls);
                 for (int i = 0; i < Constant.TotalTTLChannels; ++i)
                 {
                     writer.Write("TTL_{0:D}{{", i);
@@ -1107,9 +1185,10 @@ namespace Bug3
                 writer.WriteLine("}");
 
                 writer.Write("CREATION_ABSTIMENS{"); writer.Write(data.timeStampNanos); writer.WriteLine("}");
-                writer.Write("COMM_ABSTIMENS{"); writer.Write(GetAbsTimeNS()); writer.WriteLine("}");
-                writer.Write("BER{"); writer.Write(data.BER); writer.WriteLine("}");
-                writer.Write("WER{"); writer.Write(data.WER); writer.WriteLine("}");
+                writer.Write("COMM_ABSTIMENS{"); writer.Write(commTimeNS); writer.WriteLine("}");
+                // "R" so the text round-trips to exactly the same double as the binary format
+                writer.Write("BER{"); writer.Write(data.BER.ToString("R", System.Globalization.CultureInfo.InvariantCulture)); writer.WriteLine("}");
+                writer.Write("WER{"); writer.Write(data.WER.ToString("R", System.Globalization.CultureInfo.InvariantCulture)); writer.WriteLine("}");
                 writer.Write("MISSING_FC{"); writer.Write(data.missingFrameCount); writer.WriteLine("}");
                 writer.Write("FALSE_FC{"); writer.Write(data.falseFrameCount); writer.WriteLine("}");
 
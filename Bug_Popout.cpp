@@ -35,6 +35,7 @@ void Bug_MetaPlotThread::run()
 {
     const unsigned sleeptime_ms = taskRateHz ? qRound((double(reader.scansPerPage()) / double(taskRateHz)) * 1e3 * 0.5) : 1 ;
 
+    reader.registerReader("Bug3 Meta Plot");
     Debug() << "Bug_MetaPlotThread sleeptime_ms = " << sleeptime_ms;
 
     while (!pleaseStop) {
@@ -47,6 +48,7 @@ void Bug_MetaPlotThread::run()
             msleep(sleeptime_ms);
         }
     }
+    reader.unregisterReader();
 }
 
 Bug_Popout::Bug_Popout(DAQ::BugTask *task, QWidget *parent)
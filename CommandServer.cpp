@@ -17,10 +17,13 @@
 #include <QDir>
 #include <QDirIterator>
 #include "Sha1VerifyTask.h"
+#include "DataExporter.h"
 #include <QMutex>
 #include <QWaitCondition>
 #include "ConfigureDialogController.h"
 #include "Par2Window.h"
+#include "ScanGather.h"
+#include <vector>
 
 
 CommandServer::CommandServer(MainApp *parent)
@@ -67,6 +70,12 @@ class CommandConnection : public QThread
     QWaitCondition cond;
     volatile bool gotResponse, lastResponse;
     QVariant evtResponse;
+
+    /// SUBSCRIBE: our own reader on the samples buffer.  Only the main thread creates and deletes it, since it
+    /// owns the buffer, under subMut.  We hold subMut while reading from it.
+    QMutex subMut;
+    PagedScanReader *subReader;
+    void streamScans(const QBitArray & channelSubset, unsigned downsample, unsigned maxQueuedFrames);
     
     bool processLine(const QString & line);
     void sendOK();
@@ -82,11 +91,16 @@ public:
         
     void setResponseAndWake(const QVariant & r = QVariant()); 
     void appendContinuousResponseAndWake(const QString & l = QString::null);
+
+    /// main thread only: start (or stop) handing the pages of the samples buffer to streamScans()
+    void beginSubscription(const PagedScanReader & reader, const QString & readerName);
+    void endSubscription();
     
 protected:
     void run();         
     
     friend struct ConnSha1Verifier;
+    friend struct ConnDataExporter;
     
     void progress(int pct);
     
@@ -123,7 +137,7 @@ CommandConnection::CommandConnection(qintptr sockFd, int timeout)
 #else
 CommandConnection::CommandConnection(int sockFd, int timeout)
 #endif
-    : QThread(mainApp()), stop(false), sock(0), sockFd(sockFd), timeout(timeout)
+    : QThread(mainApp()), stop(false), sock(0), sockFd(sockFd), timeout(timeout), subReader(0)
 {    
 }
 
@@ -152,6 +166,7 @@ CommandConnection::~CommandConnection()
     if (isRunning()) terminate();
     // NB: sock is possibly leaked here!
 #endif
+    if (subReader) delete subReader, subReader = 0;
     Debug() << "deleted command connection object";
 }
 
@@ -177,6 +192,7 @@ void CommandConnection::run() {
         }
         Debug() << "Got line: " << line;
         if (line.length()) {
+            const double t0 = excessiveDebug ? Util::getTime() : 0.;
             if ( processLine(line) ) {
                 sendOK();
                 errCt = 0;
@@ -184,6 +200,7 @@ void CommandConnection::run() {
                 sendError(errMsg);
                 ++errCt;
             }
+            if (excessiveDebug) Debug() << connName << ": answered '" << line << "' in " << ((Util::getTime()-t0)*1e3) << " ms";
         }
     }
     Debug() << SockUtil::contextName() << " ended";
@@ -204,6 +221,15 @@ struct ConnSha1Verifier : public Sha1Verifier {
     void progress(int pct) { if (pct > highestProg) conn->progress(pct), highestProg = pct; }
 };
 
+struct ConnDataExporter : public DataExporter {
+    CommandConnection *conn;
+
+    ConnDataExporter(const QString & f, const ExportParams & p, CommandConnection * conn)
+        : DataExporter(f, p), conn(conn) {}
+
+    void progress(int pct) { conn->progress(pct); if (!conn->sock->isValid()) pleaseStop = true; }
+};
+
 
 /** ----------------------------------------------------------------------------
  Command Event handling for communicating with  main appliation thread 
@@ -211,8 +237,7 @@ struct ConnSha1Verifier : public Sha1Verifier {
  */
 enum EvtType {
     E_Min = QEvent::User+100,
-    E_IsConsoleHidden = E_Min,
-    E_ConsoleHide,
+    E_ConsoleHide = E_Min,
     E_ConsoleUnhide,
     E_GetParams,
     E_SetParams,
@@ -220,12 +245,11 @@ enum EvtType {
     E_StopACQ,
     E_Par2,
     E_CommConnEnded,
-    E_IsSaving,
     E_SetSaving,
     E_SetSaveFile,
     E_FastSettle,
-    E_GetScanCount,
-    E_GetChannelSubset
+    E_Subscribe,
+    E_Unsubscribe
 };
 
 struct CustomEvt : QEvent
@@ -235,6 +259,53 @@ struct CustomEvt : QEvent
     CustomEvt(int type, CommandConnection *conn) : QEvent((QEvent::Type)type), conn(conn) {}
 };
 
+/// Parses a #-separated list of channel indices, as passed to GETDAQDATA and SUBSCRIBE, into subset.  Indices that
+/// aren't acquired channels are ignored.  Returns false, leaving subset alone, if none are left.
+static bool parseChannelSubset(const QString & tok, QBitArray & subset)
+{
+    const QStringList strList = tok.split('#', QString::SkipEmptyParts);
+    const unsigned int chanNo = mainApp()->configureDialogController()->acceptedParams.nVAIChans;
+    bool any = false;
+    for (int i = 0, n = strList.size(); i < n; ++i) {
+        const unsigned int chanToSet = strList.at(i).toInt();
+        if (chanToSet >= chanNo) continue;
+        if (!any) {
+            subset.resize(chanNo);
+            subset.fill(false);
+            any = true;
+        }
+        subset.setBit(chanToSet);
+    }
+    return any;
+}
+
+/// The canonical path of file, even if it doesn't exist yet (its directory has to, for that)
+static QString canonicalPathOf(const QString & file)
+{
+    const QFileInfo fi(file);
+    if (fi.exists()) return fi.canonicalFilePath();
+    const QString dir = QFileInfo(fi.absolutePath()).canonicalFilePath();
+    return dir.isEmpty() ? fi.absoluteFilePath() : dir + "/" + fi.fileName();
+}
+
+/// True if writing the files in `written' would clobber one of the data files (.bin) in `dataFiles' or its .meta file
+static bool clobbersDataFile(const QStringList & written, const QStringList & dataFiles)
+{
+#ifdef Q_OS_WIN
+    const Qt::CaseSensitivity cs = Qt::CaseInsensitive;
+#else
+    const Qt::CaseSensitivity cs = Qt::CaseSensitive;
+#endif
+    QStringList guarded;
+    for (int i = 0; i < dataFiles.size(); ++i)
+        if (!dataFiles.at(i).isEmpty())
+            guarded << canonicalPathOf(dataFiles.at(i)) << canonicalPathOf(baseName(dataFiles.at(i)) + ".meta");
+    for (int i = 0; i < written.size(); ++i)
+        if (guarded.contains(canonicalPathOf(written.at(i)), cs))
+            return true;
+    return false;
+}
+
 bool CommandConnection::processLine(const QString & line) 
 {
     QStringList toks = line.split(QRegExp("\\s+"),  QString::SkipEmptyParts);
@@ -318,13 +389,75 @@ bool CommandConnection::processLine(const QString & line)
                 }
             }
         }
+    } else if (cmd == "EXPORTFILE") {
+        // EXPORTFILE infile outfile [format [channel_subset [from_scan [to_scan]]]]
+        // format is one of BIN, CSV, CSVINT16, CSVHEX, channel_subset is ALL or #-separated channel indices
+        QString inFile = toks.size() > 0 ? toks.at(0) : QString(), outFile = toks.size() > 1 ? toks.at(1) : QString();
+        if (!inFile.isEmpty() && !QFileInfo(inFile).isAbsolute()) inFile = mainApp()->outputDirectory() + "/" + inFile;
+        if (!outFile.isEmpty() && !QFileInfo(outFile).isAbsolute()) outFile = mainApp()->outputDirectory() + "/" + outFile;
+        const QString fmt = toks.size() > 2 ? toks.at(2).toUpper() : QString("BIN");
+        ExportParams p;
+        p.filename = outFile;
+        p.format = fmt == "BIN" ? ExportParams::Bin : ExportParams::Csv;
+        p.csvSubFormat = fmt == "CSVINT16" ? ExportParams::DecInt16 : (fmt == "CSVHEX" ? ExportParams::HexUInt16 : ExportParams::Real);
+        DataFile df;
+        if (toks.size() < 2) {
+            ret = false;
+            errMsg = "EXPORTFILE needs an input and an output file";
+        } else if (fmt != "BIN" && fmt != "CSV" && fmt != "CSVINT16" && fmt != "CSVHEX") {
+            ret = false;
+            errMsg = "Unknown export format " + fmt + ", expected one of BIN CSV CSVINT16 CSVHEX";
+        } else if (!df.openForRead(inFile)) {
+            ret = false;
+            errMsg = "Could not open " + inFile + " for reading";
+        } else {
+            const int nChans = int(df.numChans());
+            p.chanSubset.fill(true, nChans);
+            if (toks.size() > 3 && toks.at(3).toUpper() != "ALL") {
+                p.chanSubset.fill(false, nChans);
+                QStringList strList = toks.at(3).split('#', QString::SkipEmptyParts);
+                for (int i = 0; i < strList.size(); ++i) {
+                    const int c = strList.at(i).toInt();
+                    if (c >= 0 && c < nChans) p.chanSubset.setBit(c);
+                }
+            }
+            p.from = toks.size() > 4 ? toks.at(4).toLongLong() : 0;
+            p.to = toks.size() > 5 ? toks.at(5).toLongLong() : -1;
+            const qint64 nScans = qint64(df.scanCount());
+            if (p.to < 0 || p.to >= nScans) p.to = nScans - 1;
+            const QString inBin = df.fileName();
+            df.closeAndFinalize();
+
+            // a BIN export also writes a .meta next to its output
+            QStringList written(outFile);
+            if (p.format == ExportParams::Bin) written << baseName(outFile) + ".meta";
+            const MainApp::QueryState qs(mainApp()->queryState());
+
+            if (p.from < 0 || p.from > p.to) {
+                ret = false;
+                errMsg = QString("Invalid scan range %1 to %2, the file has scans 0 to %3").arg(p.from).arg(p.to).arg(nScans - 1);
+            } else if (clobbersDataFile(written, QStringList(inBin))) {
+                ret = false;
+                errMsg = "The output file " + outFile + " would overwrite the input file";
+            } else if (qs.saving && clobbersDataFile(written, QStringList(qs.currentSaveFile))) {
+                ret = false;
+                errMsg = "The output file " + outFile + " would overwrite the file being recorded";
+            } else {
+                ConnDataExporter x(inFile, p, this);
+                const DataExporter::Result r = x.exportData();
+                if (r != DataExporter::Success) {
+                    ret = false;
+                    errMsg = r == DataExporter::Canceled ? QString("Export canceled") : x.extendedError;
+                } else
+                    resp = QString().sprintf("EXPORTED %lld %.1f\n", p.to - p.from + 1, x.mbPerSecIn());
+            }
+        }
     } else if (cmd == "ISACQ") {
-        resp = mainApp()->isAcquiring() ? "1\n" : "0\n";
+        resp = mainApp()->queryState().acquiring ? "1\n" : "0\n";
     } else if (cmd == "ISINITIALIZED") {
         resp = mainApp()->busy() ? "0\n" : "1\n";
     } else if (cmd == "ISCONSOLEHIDDEN") {
-        QEvent *e = new CustomEvt(E_IsConsoleHidden,this);
-        postEventToAppAndWaitForReply(e); // resp will be filled in for us
+        resp.sprintf("%d\n", int(mainApp()->queryState().consoleHidden));
     } else if (cmd == "CONSOLEHIDE") {
         QEvent *e = new CustomEvt(E_ConsoleHide,this);
         postEventToAppAndWaitForReply(e); // resp will be filled in for us        
@@ -364,8 +497,7 @@ bool CommandConnection::processLine(const QString & line)
             errMsg = "PAR2 command requires at least 2 arguments";
         }
     } else if (cmd == "ISSAVING") {
-        QEvent *e = new CustomEvt(E_IsSaving,this);
-        postEventToAppAndWaitForReply(e); // resp will be filled in for us
+        resp.sprintf("%d\n", int(mainApp()->queryState().saving));
     } else if (cmd == "SETSAVING") {
         if (toks.size() > 0) {
             CustomEvt *e = new CustomEvt(E_SetSaving, this);
@@ -380,7 +512,7 @@ bool CommandConnection::processLine(const QString & line)
         e->param = toks.join(" ").trimmed();
         postEventToAppAndWaitForReply(e);
 	} else if (cmd == "GETCURRENTSAVEFILE") {
-		resp = mainApp()->getCurrentSaveFile();
+		resp = mainApp()->queryState().currentSaveFile;
 		if (resp.isNull()) resp = "";
 		resp = resp + "\n";
     } else if (cmd == "FASTSETTLE") {
@@ -398,20 +530,7 @@ bool CommandConnection::processLine(const QString & line)
             QBitArray channelSubset;
             if (3 <= toks.size())
             {
-                QStringList strList = toks.at(2).split('#', QString::SkipEmptyParts);
-                unsigned int chanNo = mainApp()->configureDialogController()->acceptedParams.nVAIChans;
-                unsigned int chanToSet = ~0;
-                for (int i = 0, n = strList.size(); i < n; ++i)
-                    if (chanNo > (chanToSet = strList.at(i).toInt()))
-                    {
-                        if (!bitArrayInitialized)
-                        {
-                            channelSubset.resize(chanNo);
-                            channelSubset.fill(false);
-                            bitArrayInitialized = true;
-                        }
-                        channelSubset.setBit(chanToSet);
-                    }
+                bitArrayInitialized = parseChannelSubset(toks.at(2), channelSubset);
 
 				if (!bitArrayInitialized) 					
                         Warning() << "Input channel_subset is invalid";
@@ -455,12 +574,35 @@ bool CommandConnection::processLine(const QString & line)
             Warning() << "Matlab data API facility not enabled, returning 0 for scan count";
 			resp = "0\n";
         } else {
-			QEvent *e = new CustomEvt(E_GetScanCount, this);
-			postEventToAppAndWaitForReply(e);
+			resp.sprintf("%lld\n", mainApp()->tempDataFile().getScanCount()); // thread-safe
 		}
     } else if (cmd == "GETCHANNELSUBSET") {
-		QEvent *e = new CustomEvt(E_GetChannelSubset, this);
+		resp = mainApp()->queryState().channelSubset;
+    } else if (cmd == "SUBSCRIBE") {
+        // SUBSCRIBE [channel_subset [downsample [max_queued_frames]]]
+        // channel_subset is ALL or #-separated channel indices, default is the current channel subset.  Streams pages
+        // as they are acquired, see streamScans().
+        QBitArray channelSubset;
+        if (toks.size() > 0 && toks.at(0).toUpper() == "ALL")
+            channelSubset.fill(true, mainApp()->configureDialogController()->acceptedParams.nVAIChans);
+        else if (toks.size() > 0 && !parseChannelSubset(toks.at(0), channelSubset))
+            Warning() << "Input channel_subset is invalid";
+        if (channelSubset.isEmpty())
+            channelSubset = mainApp()->configureDialogController()->acceptedParams.demuxedBitMap;
+        unsigned downsample = toks.size() > 1 ? toks.at(1).toUInt() : 1;
+        if (!downsample) downsample = 1;
+        const unsigned maxQueuedFrames = toks.size() > 2 ? toks.at(2).toUInt() : SUBSCRIBE_DEFAULT_MAX_QUEUED_FRAMES;
+
+        CustomEvt *e = new CustomEvt(E_Subscribe, this);
+        e->param = sock->peerAddress().toString() + ":" + QString::number(sock->peerPort());
         postEventToAppAndWaitForReply(e);
+        if (errMsg.length()) ret = false;
+        else {
+            streamScans(channelSubset, downsample, maxQueuedFrames);
+            postEventToAppAndWaitForReply(new CustomEvt(E_Unsubscribe, this));
+        }
+    } else if (cmd == "UNSUBSCRIBE") {
+        // ends a stream when sent during one (see streamScans()).  Otherwise there is nothing to do.
     }
     else if (cmd == "BYE" || cmd == "QUIT" || cmd == "EXIT" || cmd == "CLOSE") {
         Debug() << "Client requested shutdown, closing connection..";
@@ -496,6 +638,108 @@ void CommandConnection::progress(int pct) {
     SockUtil::send(*sock, QString().sprintf("%d\n", pct), timeout, 0, true);
 }
 
+void CommandConnection::beginSubscription(const PagedScanReader & r, const QString & readerName)
+{
+    QMutexLocker l(&subMut);
+    delete subReader;
+    subReader = new PagedScanReader(r);
+    if (!subReader->registerReader(readerName.toUtf8().constData(), PagedRingBuffer::DropPages))
+        Warning() << readerName << " could not register with the sample buffer, its lag will not be reported";
+    subReader->resetToLatest(); // live data only
+}
+
+void CommandConnection::endSubscription()
+{
+    QMutexLocker l(&subMut);
+    if (subReader) delete subReader, subReader = 0; // unregisters it, too
+}
+
+/* The SUBSCRIBE stream.  Lasts until the client sends any line (UNSUBSCRIBE, say), or until the acquisition stops.
+   First comes the line
+     SUBSCRIBED nchans scans_per_page downsample
+   then 1 binary frame per page of scans, in native byte order (little-endian on x86):
+     uint32 nbytes         the number of bytes that follow in this frame.  0 ends the stream, which is followed by
+                           the usual OK line.
+     uint64 first_scan     the number of the page's first scan, counting from the start of the acquisition
+     uint64 dropped_scans  total scans this client lost so far
+     uint32 nchans
+     uint32 nscans
+     int16  data[nscans][nchans]  the channel subset of every downsample'th scan of the page, counting from the
+                                  acquisition's scan 0, so that the phase doesn't depend on which pages were dropped
+   Each page is sent as soon as it is committed to the samples buffer.  A client whose socket has max_queued_frames
+   frames' worth of data waiting to go out has the next pages dropped (and counted) instead of queued, so a slow
+   client never holds up anything but itself.  0 means never drop them.  Pages the samples buffer overwrote before we
+   got to them count as dropped, too. */
+void CommandConnection::streamScans(const QBitArray & channelSubset, unsigned downsample, unsigned maxQueuedFrames)
+{
+    subMut.lock();
+    const unsigned ss = subReader ? subReader->scanSizeSamps() : 0, spp = subReader ? subReader->scansPerPage() : 0;
+    subMut.unlock();
+    std::vector<int> chans;
+    for (int i = 0, n = qMin(channelSubset.size(), int(ss)); i < n; ++i)
+        if (channelSubset.testBit(i)) chans.push_back(i);
+    const ScanGather g(ss, chans);
+    const unsigned nOn = unsigned(chans.size());
+
+    if (!SockUtil::send(*sock, QString().sprintf("SUBSCRIBED %u %u %u\n", nOn, spp, downsample), timeout, &errMsg, true))
+        return;
+
+    // wake up at least this often to notice the client or the acquisition ending
+    const double srate = mainApp()->configureDialogController()->acceptedParams.srate;
+    int waitms = srate > 0. ? int((spp/srate) * 1e3) : 50;
+    if (waitms < 1) waitms = 1;
+    if (waitms > 50) waitms = 50;
+
+    static const size_t hdrBytes = 4 + 8 + 8 + 4 + 4;
+    const size_t maxFrameBytes = hdrBytes + size_t(spp)*nOn*sizeof(int16);
+    std::vector<char> frame(maxFrameBytes);
+    u64 nDropped = 0, nFrames = 0;
+
+    while (!stop && sock->isValid() && sock->state() == QAbstractSocket::ConnectedState) {
+        if (sock->canReadLine() || (sock->waitForReadyRead(0) && sock->canReadLine())) {
+            sock->readLine(); // the client had enough
+            break;
+        }
+        QMutexLocker l(&subMut);
+        if (!subReader) break; // the acquisition stopped
+        int skips = 0;
+        unsigned nScans = 0;
+        const int16 *scans = subReader->waitNext(waitms, &skips, 0, &nScans);
+        if (!scans) continue;
+        nDropped += u64(skips) * spp;
+        if (maxQueuedFrames && u64(sock->bytesToWrite()) >= u64(maxQueuedFrames) * maxFrameBytes) {
+            nDropped += nScans; // backpressure: the client isn't keeping up
+            continue;
+        }
+        const u64 first = u64(subReader->latestPageRead() - 1) * spp;
+        const unsigned k0 = unsigned((downsample - first % downsample) % downsample);
+        const unsigned nOut = k0 < nScans ? (nScans - k0 + downsample - 1) / downsample : 0;
+        int16 *out = reinterpret_cast<int16 *>(&frame[hdrBytes]);
+        if (downsample == 1)
+            g.apply(scans, out, nScans);
+        else
+            for (unsigned k = k0; k < nScans; k += downsample, out += nOn)
+                g.apply(scans + size_t(k)*ss, out, 1);
+        l.unlock();
+
+        const unsigned nbytes = unsigned(hdrBytes - 4 + size_t(nOut)*nOn*sizeof(int16));
+        char *h = &frame[0];
+        memcpy(h, &nbytes, 4);
+        memcpy(h + 4, &first, 8);
+        memcpy(h + 12, &nDropped, 8);
+        memcpy(h + 20, &nOn, 4);
+        memcpy(h + 24, &nOut, 4);
+        sock->write(h, qint64(nbytes) + 4);
+        sock->flush(); // doesn't block
+        ++nFrames;
+    }
+
+    const unsigned endOfStream = 0;
+    sock->write(reinterpret_cast<const char *>(&endOfStream), 4);
+    if (sock->bytesToWrite()) sock->waitForBytesWritten(timeout);
+    Log() << SockUtil::contextName() << ": streamed " << nFrames << " pages, dropped " << nDropped << " scans";
+}
+
 void CommandConnection::postEventToAppAndWaitForReply(QEvent *e) {
     int evtType = (int)e->type();
     resp = QString::null;    
@@ -508,9 +752,6 @@ void CommandConnection::postEventToAppAndWaitForReply(QEvent *e) {
     
     if (gotResponse && evtResponse.isValid()) {
         switch(evtType) {
-            case E_IsConsoleHidden:
-                resp = QString().sprintf("%d\n",evtResponse.toInt());
-                break;
             case E_GetParams:
                 resp = evtResponse.toString();
                 break;
@@ -520,14 +761,8 @@ void CommandConnection::postEventToAppAndWaitForReply(QEvent *e) {
             case E_StartACQ:
                 errMsg = evtResponse.toString();
                 break;
-            case E_IsSaving:
-                resp = QString().sprintf("%d\n",evtResponse.toInt());
-                break;
-            case E_GetScanCount:
-                resp = QString().sprintf("%d\n",evtResponse.toInt());
-                break;
-            case E_GetChannelSubset:
-                resp = evtResponse.toString();
+            case E_Subscribe:
+                errMsg = evtResponse.toString();
                 break;
         }
     }
@@ -580,10 +815,6 @@ void MainApp::customEvent(QEvent *e) { ///< yes, we are implementing part of thi
     }
     
     switch((int)e->type()) {
-        case E_IsConsoleHidden:
-            conn->setResponseAndWake(isConsoleHidden());
-            e->accept();
-            break;            
         case E_ConsoleHide:
             if (!isConsoleHidden()) hideUnhideConsole();
             conn->setResponseAndWake();
@@ -599,7 +830,11 @@ void MainApp::customEvent(QEvent *e) { ///< yes, we are implementing part of thi
             e->accept();
             break;
         case E_SetParams:
-            conn->setResponseAndWake(configCtl ? configCtl->acqParamsFromString(((CustomEvt *)e)->param.toString()) : QString::null);
+            {
+                const QString err = configCtl ? configCtl->acqParamsFromString(((CustomEvt *)e)->param.toString()) : QString::null;
+                publishQueryState(); // the channel subset may have changed
+                conn->setResponseAndWake(err);
+            }
             e->accept();
             break;
         case E_StartACQ:
@@ -660,10 +895,6 @@ void MainApp::customEvent(QEvent *e) { ///< yes, we are implementing part of thi
             }
             e->accept();
             break;
-        case E_IsSaving:
-            conn->setResponseAndWake(isSaving());
-            e->accept();
-            break;
         case E_SetSaving:
             toggleSave(static_cast<CustomEvt *>(e)->param.toBool());
             conn->setResponseAndWake();
@@ -682,12 +913,20 @@ void MainApp::customEvent(QEvent *e) { ///< yes, we are implementing part of thi
             }
             e->accept();
             break;
-        case E_GetScanCount:
-            conn->setResponseAndWake(tempDataFile().getScanCount());
+        case E_Subscribe:
+            if (!task || !reader)
+                conn->setResponseAndWake(QString("Not acquiring."));
+            else {
+                conn->beginSubscription(*reader, "Subscriber " + static_cast<CustomEvt *>(e)->param.toString());
+                subscribedConns.insert(conn);
+                conn->setResponseAndWake(QString(""));
+            }
             e->accept();
             break;
-        case E_GetChannelSubset:
-            conn->setResponseAndWake(tempDataFile().getChannelSubset());
+        case E_Unsubscribe:
+            subscribedConns.remove(conn);
+            conn->endSubscription();
+            conn->setResponseAndWake();
             e->accept();
             break;
         default:
@@ -697,6 +936,13 @@ void MainApp::customEvent(QEvent *e) { ///< yes, we are implementing part of thi
     }
 }
 
+void MainApp::endScanSubscriptions() { ///< also implemented here, since only this file knows CommandConnection
+    // their threads notice, end their streams, and tell us again with E_Unsubscribe, which is then harmless
+    for (QSet<CommandConnection *>::iterator it = subscribedConns.begin(); it != subscribedConns.end(); ++it)
+        (*it)->endSubscription();
+    subscribedConns.clear();
+}
+
 void MainApp::par2WinForCommandConnectionEnded() {
     Par2Window * win = (Par2Window *)sender();
     CommandConnection *conn = par2WinConnMap[win];
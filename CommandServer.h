@@ -11,6 +11,7 @@
 
 #define DEFAULT_COMMAND_PORT 4142 /**< the port of the 'command' server */
 #define DEFAULT_COMMAND_TIMEOUT_MS 10000
+#define SUBSCRIBE_DEFAULT_MAX_QUEUED_FRAMES 4 /**< a SUBSCRIBE client that falls this many pages behind loses pages */
 
 #include <QObject>
 #include <QTcpServer>
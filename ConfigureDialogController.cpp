@@ -233,6 +233,9 @@ void ConfigureDialogController::resetFromParams(DAQ::Params *p_in)
 	dualDevModeChkd();
 
 	dialog->autoRetryOnAIOverrunsChk->setChecked(p.autoRetryOnAIOverrun);
+	dialog->compressDataFileChk->setChecked(p.compressDataFile);
+	dialog->spikeDetectChk->setChecked(p.spikeDetect);
+	dialog->spikeDetectSigmasSB->setValue(p.spikeDetectSigmas);
 
     dialog->graphsPerTabCB->clear();
     dialog->graphsPerTabCB->addItem("Default");
@@ -930,6 +933,9 @@ ConfigureDialogController::ValidationResult ConfigureDialogController::validateF
 
 	p.resumeGraphSettings = resumeGraphSettings;
 	p.autoRetryOnAIOverrun = dialog->autoRetryOnAIOverrunsChk->isChecked();
+	p.compressDataFile = dialog->compressDataFileChk->isChecked();
+	p.spikeDetect = dialog->spikeDetectChk->isChecked();
+	p.spikeDetectSigmas = dialog->spikeDetectSigmasSB->value();
     p.overrideGraphsPerTab = dialog->graphsPerTabCB->currentText().toUInt();
 	
 	for (unsigned num = 0; num < p.nVAIChans; ++num) {
@@ -1152,6 +1158,10 @@ void ConfigureDialogController::paramsFromSettingsObject(DAQ::Params & p, const
 	p.secondDevIsAuxOnly = settings.value("secondDevIsAuxOnly", false).toBool();
 	p.resumeGraphSettings = settings.value("resumeGraphSettings", true).toBool();
 	p.autoRetryOnAIOverrun = settings.value("autoRetryOnAIOverrun", true).toBool();
+	p.compressDataFile = settings.value("compressDataFile", false).toBool();
+	p.spikeDetect = settings.value("spikeDetect", false).toBool();
+	p.spikeDetectSigmas = settings.value("spikeDetectSigmas", 4.5).toDouble();
+	if (p.spikeDetectSigmas <= 0.) p.spikeDetectSigmas = 4.5;
     p.overrideGraphsPerTab = settings.value("overrideGraphsPerTab", 0).toUInt();
     p.graphUpdateRate = settings.value("graphUpdateRate", DEF_TASK_READ_FREQ_HZ).toInt();
     p.spatialVisUpdateRate = settings.value("spatialVisUpdateRate", DEF_TASK_READ_FREQ_HZ).toInt();
@@ -1267,6 +1277,9 @@ void ConfigureDialogController::saveSettings(int sc) const
         settings.setValue("pdOnSecondDev", p.pdOnSecondDev);
         settings.setValue("resumeGraphSettings", p.resumeGraphSettings);
         settings.setValue("autoRetryOnAIOverrun", p.autoRetryOnAIOverrun);
+        settings.setValue("compressDataFile", p.compressDataFile);
+        settings.setValue("spikeDetect", p.spikeDetect);
+        settings.setValue("spikeDetectSigmas", p.spikeDetectSigmas);
         settings.setValue("overrideGraphsPerTab", p.overrideGraphsPerTab);
         settings.setValue("graphUpdateRate", p.graphUpdateRate);
         settings.setValue("spatialVisUpdateRate", p.spatialVisUpdateRate);
@@ -316,6 +316,12 @@ namespace DAQ
           clockSource(0), error(0), callStr(0)
     {
         errBuff[0] = 0;
+        const Params & p (acqParams);
+        if (!p.doPreJuly2011IntanDemux && p.mode != DAQ::AIRegular) {
+            demux.reset(p.nVAIChans, DAQ::ModeNumChansPerIntan[p.mode], DAQ::ModeNumIntans[p.mode]*(p.dualDevMode && !p.secondDevIsAuxOnly ? 2 : 1));
+            Debug() << "Intan demux: " << demux.nIntans() << " INTANs x " << demux.nChansPerIntan() << " chans using " << (demux.usesSIMD() ? "SSE2" : "scalar") << " kernel";
+        } else
+            demux.reset(p.nVAIChans, 0, 0);
         setDO(false); // assert DO is low when stopped...
     }
 	
@@ -616,6 +622,21 @@ namespace DAQ
         const int intan = c/DAQ::ModeNumChansPerIntan[m], chan = c % DAQ::ModeNumChansPerIntan[m];
         return chan*(DAQ::ModeNumIntans[m] * (dualDevMode ? 2 : 1)) + intan;
     }
+
+    /// Sample `ix' of the merged dual dev data, without merging it.  Merged scans are laid out as
+    /// [dev1 MUXed chans][dev2 MUXed chans][dev1 extra chans][dev2 extra chans].
+    static inline int16 mergedDualDevSample(const std::vector<int16> & data, const std::vector<int16> & data2,
+                                            int NCHANS1, int NCHANS2, int nExtraChans1, int nExtraChans2, int ix)
+    {
+        const int nMx = NCHANS1-nExtraChans1, nMx2 = NCHANS2-nExtraChans2, scan = ix / (NCHANS1+NCHANS2);
+        int c = ix % (NCHANS1+NCHANS2), i = -1, j = -1;
+        if (c < nMx) i = scan*NCHANS1 + c;
+        else if ((c -= nMx) < nMx2) j = scan*NCHANS2 + c;
+        else if ((c -= nMx2) < nExtraChans1) i = scan*NCHANS1 + nMx + c;
+        else j = scan*NCHANS2 + nMx2 + (c - nExtraChans1);
+        if (i >= 0) return i < int(data.size()) ? data[i] : 0;
+        return j < int(data2.size()) ? data2[j] : 0;
+    }
     
     bool NITask::createAITasks() 
     {
@@ -1032,18 +1053,12 @@ namespace DAQ
                 }
             }
             
-            if (p.dualDevMode) {
-                std::vector<int16> out;
-                mergeDualDevData(out, data, data2, NCHANS1, NCHANS2, nExtraChans1, nExtraChans2);
-                data.swap(out);
-            }
-
             totalReadMut.lock();
             totalRead += static_cast<u64>(nRead) + static_cast<u64>(nRead2);
             totalReadMut.unlock();
 
-            // note that from this point forward, the 'data' buffer is the only valid buffer
-            // and it contains the MERGED data from both devices if in dual dev mode.
+            // note that in dual dev mode, 'data' and 'data2' are not merged here: doFinalDemuxAndEnqueue() merges
+            // them as it demuxes into the page.  Channel indices below are into the MERGED scans.
             
             // now, do optional AO output .. done in another thread to save on latency...
             if (aoWriteThr) {  
@@ -1071,7 +1086,7 @@ namespace DAQ
                         aoWriteThr->start();
                     }
                 }
-                const int dsize = int(data.size());
+                const int dsize = int(data.size()) + (p.dualDevMode ? int(data2.size()) : 0);
                 aoData.reserve(aoData.size()+dsize);
                 for (int i = 0; i < dsize; i += NCHANS1+NCHANS2) { // for each scan..
                     for (QVector<QPair<int,int> >::const_iterator it = aoAITab.begin(); it != aoAITab.end(); ++it) { // take ao channels
@@ -1079,7 +1094,7 @@ namespace DAQ
                         const int aiChIdx = ( (p.doPreJuly2011IntanDemux || !muxMode || ((*it).second) >= FIRSTAUX) ? ((*it).second) : mapNewChanIdToPreJuly2011ChanId((*it).second, p.mode, p.dualDevMode && !p.secondDevIsAuxOnly) );
                         const int dix = i+aiChIdx;
                         if (dix < dsize)
-                            aoData.push_back(data[dix]);
+                            aoData.push_back(p.dualDevMode ? mergedDualDevSample(data, data2, NCHANS1, NCHANS2, nExtraChans1, nExtraChans2, dix) : data[dix]);
                         else {
                             static int errct = 0;
                             aoData.push_back(0);
@@ -1093,7 +1108,7 @@ namespace DAQ
                 aoSampCount += sz;
             }
             
-            doFinalDemuxAndEnqueue(data);
+            doFinalDemuxAndEnqueue(data, p.dualDevMode ? &data2 : 0);
             lastEnq = lastReadTime;
 
             // fast settle...
@@ -1142,26 +1157,6 @@ namespace DAQ
         
     }
     
-    /*static*/
-    inline void NITask::mergeDualDevData(std::vector<int16> & out,
-                                const std::vector<int16> & data, const std::vector<int16> & data2, 
-                                int NCHANS1, int NCHANS2, 
-                                int nExtraChans1, int nExtraChans2)
-    {
-        const int nMx = NCHANS1-nExtraChans1, nMx2 = NCHANS2-nExtraChans2, s1 = int(data.size()), s2 = int(data2.size());
-        out.clear();
-        out.reserve(s1+s2);
-        int i,j;
-        for (i = 0, j = 0; i < s1 && j < s2; i+=NCHANS1, j+=NCHANS2) {
-            if (nMx > 0) out.insert(out.end(), data.begin()+i, data.begin()+i+nMx);
-            if (nMx2 > 0) out.insert(out.end(), data2.begin()+j, data2.begin()+j+nMx2);
-            out.insert(out.end(), data.begin()+i+nMx, data.begin()+i+NCHANS1);
-            out.insert(out.end(), data2.begin()+j+nMx2, data2.begin()+j+NCHANS2);
-        }
-        if (i < s1 || j < s2) 
-            Error() << "INTERNAL ERROR IN FUNCTION `mergeDualDevData()'!  The two device buffers data and data2 have differing numbers of scans! FIXME!  Aieeeee!!\n";
-    }        
-
     void NITask::setDO(bool onoff)
     {
         const char *callStr = "";
@@ -1250,35 +1245,44 @@ namespace DAQ
 #endif // ! FAKEDAQ
 
 
-    static inline void ApplyNewIntanDemuxToScan(int16 *begin, const unsigned nchans_per_intan, const unsigned num_intans) {
-        int narr = nchans_per_intan*num_intans;
-        int16 tmparr[NUM_MUX_CHANS_MAX]; // hopefully 512 channels is freakin' enough..
-        if (narr > NUM_MUX_CHANS_MAX) {
-            Error() << "INTERNAL ERROR: Scan size too large for compiled-in limits (too many INTANs?!).  Please fix the sourcecode at DAQ::ApplyJFRCIntanXXDemuxToScan!";
-            return;
-        }
-        int i,j,k;
-        for (k = 0; k < int(num_intans); ++k) {
-            const int jlimit = (k+1)*int(nchans_per_intan);
-            for (i = k, j = k*int(nchans_per_intan); j < jlimit; i+=num_intans,++j) {
-                tmparr[j] = begin[i];
-            }
-        }
-        memcpy(begin, tmparr, narr*sizeof(int16));
-    }
-
-    void NITask::doFinalDemuxAndEnqueue(std::vector<int16> & data)
+    void NITask::doFinalDemuxAndEnqueue(std::vector<int16> & data, std::vector<int16> *data2)
     {
         const DAQ::Params & p (params);
-        if (!p.doPreJuly2011IntanDemux && p.mode != DAQ::AIRegular) {
-            for (int i = 0; i < (int)data.size(); i += p.nVAIChans) {
-                ApplyNewIntanDemuxToScan(&data[i], DAQ::ModeNumChansPerIntan[p.mode], DAQ::ModeNumIntans[p.mode]*(p.dualDevMode && !p.secondDevIsAuxOnly ? 2 : 1));
+        const unsigned ss1 = data2 ? p.nVAIChans1 : p.nVAIChans, ss2 = data2 ? p.nVAIChans2 : 0;
+        unsigned nScans = ss1 ? unsigned(data.size())/ss1 : 0;
+        if (data2) {
+            const unsigned nScans2 = ss2 ? unsigned(data2->size())/ss2 : 0;
+            if (nScans2 != nScans) {
+                Error() << "INTERNAL ERROR IN FUNCTION `doFinalDemuxAndEnqueue()'!  The two device buffers data and data2 have differing numbers of scans! FIXME!  Aieeeee!!\n";
+                nScans = qMin(nScans, nScans2);
             }
         }
-        if (!writer.write(&data[0],unsigned(data.size())/p.nVAIChans)) {
-            Error() << "NITask::daqThr writer.write() returned false! FIXME!";
+        if (!data2 && demux.isIdentity()) {
+            if (!writer.write(&data[0],nScans)) {
+                Error() << "NITask::daqThr writer.write() returned false! FIXME!";
+            }
+        } else {
+            // (merge and) demux straight into the page, a page (or what's left of one) at a time
+            const int16 *src = data.empty() ? 0 : &data[0], *src2 = (!data2 || data2->empty()) ? 0 : &(*data2)[0];
+            for (unsigned left = nScans; left; ) {
+                const unsigned n = qMin(left, writer.scansFreeInPage());
+                int16 *dst = writer.writeDirectBegin(n);
+                if (!dst) {
+                    Error() << "NITask::daqThr writer.writeDirectBegin() returned NULL! FIXME!";
+                    break;
+                }
+                if (data2) demux.applyDual(src, ss1, ss1 - p.nExtraChans1, src2, ss2 - p.nExtraChans2, dst, n);
+                else demux.apply(src, dst, n);
+                if (!writer.writeDirectEnd(n)) {
+                    Error() << "NITask::daqThr writer.writeDirectEnd() returned false! FIXME!";
+                    break;
+                }
+                src += size_t(n)*ss1, left -= n;
+                if (src2) src2 += size_t(n)*ss2;
+            }
         }
         data.clear();
+        if (data2) data2->clear();
     }
 
 
@@ -1585,8 +1589,18 @@ namespace DAQ
     BugTask::BugTask(DAQ::Params & p, QObject *parent, const PagedScanReader & psr)
         : SubprocessTask(p, parent, "Bug3", "bug3_spikegl.exe", psr), req_shm_pg_sz(requiredShmPageSize(p.nVAIChans)), aoWriteThread(0), aoSampCount(0), aireader(0)
 	{
-		state = 0; nblocks = 0; nlines = 0;
+		nblocks = 0;
 		debugTTLStart = 0;
+		binaryBlocks = false; nTextBlocks = nBinaryBlocks = 0;
+		capture = 0;
+		if (!qgetenv("SPIKEGL_BUG3_CAPTURE").isEmpty()) {
+			capture = new QFile(QString::fromLocal8Bit(qgetenv("SPIKEGL_BUG3_CAPTURE")));
+			if (!capture->open(QIODevice::WriteOnly|QIODevice::Append)) {
+				Warning() << "Bug3: could not open capture file " << capture->fileName();
+				delete capture; capture = 0;
+			} else
+				Log() << "Bug3: capturing subprocess output to " << capture->fileName();
+		}
         if (writer.pageSize() != req_shm_pg_sz)
             Error() << "INTERNAL ERROR: BugTask needs a shm with page size == requiredShmPageSize()!  FIXME!!";
 	}
@@ -1599,8 +1613,9 @@ namespace DAQ
         if (aoWriteThread) delete aoWriteThread; aoWriteThread=0;
 #endif
         if (aireader) delete aireader, aireader=0;
+        if (capture) delete capture, capture=0;
         if (numChans() > 0)
-            Debug() << "Bug Task `" << objectName() << "' deleted after processing " << totalRead/u64(numChans()) << " scans.";
+            Debug() << "Bug Task `" << objectName() << "' deleted after processing " << totalRead/u64(numChans()) << " scans (" << nBinaryBlocks << " binary blocks, " << nTextBlocks << " text blocks).";
     }
 
     unsigned BugTask::requiredShmPageSize() const { return req_shm_pg_sz; }
@@ -1649,6 +1664,8 @@ namespace DAQ
 		env.insert("BUG3_ERR_TOLERANCE", QString::number(params.bug.errTol));
 		if (params.bug.hpf > 0) env.insert("BUG3_HIGHPASS_FILTER_CUTOFF", QString::number(params.bug.hpf));
 		if (params.bug.snf) env.insert("BUG3_60HZ_NOTCH_FILTER", "yes");		
+		// ask for the binary block format, unless the user's environment says otherwise.  See Bug3Protocol.h
+		if (!env.contains("BUG3_BLOCK_FORMAT")) env.insert("BUG3_BLOCK_FORMAT", "binary");
 	}
 		
 	void BugTask::sendExitCommand(QProcess & p) const 
@@ -1670,362 +1687,111 @@ namespace DAQ
 	unsigned BugTask::gotInput(const QByteArray & data, unsigned lastReadNBytes, QProcess & p) 
 	{
 		(void) p;
-		unsigned consumed = 0;
-		for (int i = (data.size()-lastReadNBytes), l = 0; i < data.size(); ++i) {
-			if (data[i] == '\n') {
-				QString line = data.mid(l, i-l+1);
-				l = consumed = i+1;
-				processLine(line, block, nblocks, state, nlines); 
-				if (state > nstates) {
-					processBlock(block, nblocks++);
-					block.clear();
-					state = 0;
-				}
+		if (capture) capture->write(data.constData()+(data.size()-lastReadNBytes), lastReadNBytes);
+
+		unsigned pos = 0;
+		for (;;) {
+			const Bug3::StreamParser::Item item = parser.next(data.constData(), unsigned(data.size()), pos);
+			if (item == Bug3::StreamParser::NeedMore) break;
+			switch (item) {
+			case Bug3::StreamParser::Line: processLine(parser.line()); break;
+			case Bug3::StreamParser::TextBlock: if (!binaryBlocks) processTextBlock(parser.textBlock()); break;
+			case Bug3::StreamParser::BinaryBlock: processBinaryBlock(parser.rawBlock()); break;
+			default: break;
 			}
 		}
-		return consumed;
+		return pos;
 	}
 			
-	void BugTask::processLine(const QString & lineUntrimmed, QMap<QString, QString> & block, const quint64 & nblocks, int & state, quint64 & nlines)
+	void BugTask::processLine(const QString & line)
 	{
-		QString line = lineUntrimmed.trimmed();
-#if 0
-		if (excessiveDebug) {
-			QString linecpy = line;
-			if (line.length() > 75) linecpy = line.left(65) + "..." + line.right(10);
-			if (linecpy.length() > 3) { Debug() << "Bug3: " << linecpy; }
-		}
-#endif
-		if (line.startsWith("---> Console")) { 
-			++nlines;
-			state=1; 
-			if (excessiveDebug) Debug() << "Bug3: New block, current nblocks=" << nblocks; 
-		} else if (state) {
-			++nlines;
-            static QRegExp blkSepRE("[}{]"); ///< made static here to compile the RE only once.. performance optimization
-			// we are in parsing mode..
-            QStringList nv = line.split(blkSepRE, QString::SkipEmptyParts);
-			if (nv.count() == 2) {
-				//Debug() << "Bug3: Got name=" << nv.first() << " v=" << nv.last().left(5) << "..." << nv.last().right(5);
-				block[nv.first()] = nv.last();
-				++state;
-            }
-            else if (excessiveDebug)  Debug() << "Bug3: line: '" << line << "' had nv.count()=" << nv.count();
-		} else if (!state && line.startsWith("USRMSG:")) {
+		if (line.startsWith("USRMSG:")) {
             emit(taskWarning(line.mid(7).trimmed()));
-        } else if (!state && line.startsWith("WARNMSG:")) {
+        } else if (line.startsWith("WARNMSG:")) {
             Warning() << "Bug3: " << line.mid(8).trimmed();
-        } else if (!state && line.startsWith("LOGMSG:")) {
+        } else if (line.startsWith("LOGMSG:")) {
             Log() << "Bug3: " << line.mid(7).trimmed();
+        } else if (line.startsWith("BLOCKFORMAT:")) {
+            // the subprocess acknowledging BUG3_BLOCK_FORMAT, see setupEnv()
+            QStringList f = line.mid(12).trimmed().split(" ", QString::SkipEmptyParts);
+            if (f.count() == 2 && (f.first() == "binary" || f.first() == "both") && f.last().toInt() == Bug3::BinaryVersion) {
+                binaryBlocks = true;
+                Log() << "Bug3: subprocess will send binary blocks (format " << f.join(" ") << ")";
+            } else
+                Log() << "Bug3: subprocess will send text blocks (`" << line << "')";
         }
 	}
-	
-	void BugTask::processBlock(const QMap<QString, QString> & blk, quint64 blockNum)
+
+	int16 *BugTask::beginBlock()
+	{
+		const unsigned nsamps = numChans() * SpikeGLScansPerBlock;
+		int16 *samps = writer.writeDirectBegin(SpikeGLScansPerBlock);
+		if (!samps) {
+			if (blockBuf.size() != nsamps) blockBuf.resize(nsamps);
+			samps = &blockBuf[0];
+		}
+		memset(samps, 0, nsamps*sizeof(int16));
+		return samps;
+	}
+
+	void BugTask::processTextBlock(const QMap<QString, QString> & blk)
 	{
+		if (excessiveDebug) Debug() << "Bug3: New text block, current nblocks=" << nblocks;
 		BlockMetaData meta;
-		meta.blockNum = blockNum;
-		const int nchans (numChans());
-		std::vector<int16> samps;
-        samps.resize(nchans * NeuralSamplesPerFrame * FramesPerBlock, 0); // todo: fix to come from params?
-		
-		// todo implement..
-		for (QMap<QString,QString>::const_iterator it = blk.begin(); it != blk.end(); ++it) {
-			const QString & k = it.key(), & v(it.value());
-#if 0
-            if (excessiveDebug) Debug() << "Bug3: " << "Got key: '" << k << "'";
-#endif
-			if (k.startsWith("NEU_")) {
-				QStringList knv = k.split("_");
-				int neur_chan = 0;
-				bool ok = false;
-				if (knv.count() == 2) {
-					neur_chan = knv.last().toInt(&ok);
-					if (neur_chan < 0 || neur_chan >= TotalNeuralChans) { neur_chan = 0; ok = false; }
-				} 
-				if (!ok) 
-					Warning() << "Bug3: Internal problem -- parse error on NEU_ key.";
-
-				QStringList nums = v.split(",");
-                //if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " neural samples for NEU chan " << neur_chan << "..";
-				bool warned = false;
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					for (int neurix = 0; neurix < NeuralSamplesPerFrame; ++neurix) {
-						QString num = nums.empty() ? "0" : nums.front();
-						if (nums.empty()) { 
-							if (!warned) Warning() << "Bug3: Internal problem -- ran out of neural samples in frame `" << v << "'";
-							warned = true;
-						} else nums.pop_front();
-						ok = false;
-						int samp = num.toUShort(&ok);
-						if (!ok) Error() << "Bug3: Internal error -- parse error while reading neuronal sample `" << num << "'";
-						// todo.. fix this.  wtf? can't think straight now...
-						samp = samp-ADCOffset; // incoming data is such that 0v = (int16)1023, this is because incoming samples are 11-bit. normalize so that 0v = 0
-						samp = samp * int16(32); // promote to 16-bit
-						samps[ frame*(NeuralSamplesPerFrame*nchans) + neurix*nchans + neur_chan ] = samp;
-					}
-				}
-			} else if (k.startsWith("EMG_")) {
-				QStringList knv = k.split("_");
-				int emg_chan = 0;
-				bool ok = false;
-				if (knv.count() == 2) {
-					emg_chan = knv.last().toInt(&ok);
-					if (emg_chan < 0 || emg_chan >= TotalEMGChans) { emg_chan = 0; ok = false; }
-				} 
-				if (!ok) Warning() << "Bug3: Internal problem -- parse error on EMG_ key.";
-
-				QStringList nums = v.split(",");
-                //if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " EMG samples..";
-				bool warned = false;
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of EMG samples in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					int samp = num.toUShort(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading emg sample `" << num << "'";
-					samp = samp-ADCOffset; // normalize since incoming data is weird 11 bit
-					samp = samp * int16(32); // promote to 16-bit
-					for (int emgix = 0; emgix < NeuralSamplesPerFrame; ++emgix) { // need to produce 16 samples for each 1 emg sample read in order to match neuronal rate!						
-						samps[ frame*(NeuralSamplesPerFrame*nchans) + emgix*nchans + (TotalNeuralChans+emg_chan) ] = samp;
-					}
+		meta.blockNum = nblocks++;
+		int16 *samps = beginBlock();
+		QStringList warnings;
+		Bug3::Decoder(int(numChans()), params.bug.whichTTLs).decodeText(blk, samps, meta, &warnings);
+		for (int i = 0; i < warnings.size(); ++i)
+			Warning() << warnings[i];
+		++nTextBlocks;
+		endBlock(samps, meta);
+	}
 
-				}
-			} else if (k.startsWith("AUX_")) {
-				QStringList knv = k.split("_");
-				int aux_chan = 0;
-				bool ok = false;
-				if (knv.count() == 2) {
-					aux_chan = knv.last().toInt(&ok);
-					if (aux_chan < 0 || aux_chan >= TotalAuxChans) { aux_chan = 0; ok = false; }
-				} 
-				if (!ok) Warning() << "Bug3: Internal problem -- parse error on AUX_ key.";
-				bool warned = false;
-				QStringList nums = v.split(",");
-                //if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " AUX samples..";
-				double avgVunreg = 0.0;
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of AUX samples in frame `" << v << "'";
-						warned = true;
-                    }
-					else nums.pop_front();
-					bool ok = false;
-					int samp = num.toUShort(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading emg sample `" << num << "'";
-					samp = samp-ADCOffset; // normalize since incoming data is 11-bit
-					if (aux_chan == 1)  avgVunreg += ADCStep * double(samp);
-					samp = samp * int16(32); // promote to 16-bit					
-					for (int auxix = 0; auxix < NeuralSamplesPerFrame; ++auxix) { // need to produce 16 samples for each 1 emg sample read in order to match neuronal rate!	
-						samps[ frame*(NeuralSamplesPerFrame*nchans) + auxix*nchans + (TotalNeuralChans+TotalEMGChans+aux_chan) ] = samp;
-					}
-				}
-				if (aux_chan == 1) {
-					avgVunreg = avgVunreg / (double)FramesPerBlock;
-					if (avgVunreg < 0.0) avgVunreg = 0.0;
-					if (avgVunreg > 6.0) avgVunreg = 6.0;
-					meta.avgVunreg = avgVunreg;
-				}
-			} else if (k.startsWith("TTL_")) {
-				// don't grab all ttl chans here, since we only really support a subset of them
-				QStringList knv = k.split("_");
-				int ttl_chan = 0;
-				bool ok = false;
-				if (knv.count() == 2) {
-					ttl_chan = knv.last().toInt(&ok);
-					if (ttl_chan < 0 || ttl_chan >= TotalTTLChans) { ttl_chan = 0; ok = false; }
-				} 
-				if (!ok) Warning() << "Bug3: Internal problem -- parse error on TTL_ key.";
-				if (params.bug.whichTTLs & (0x1<<ttl_chan)) {
-                    int ttl_chan_translated = ttl_chan;
-                    for (int i = 0; i < TotalTTLChans && i < ttl_chan; ++i)
-                        // make the TTL line number -> our_channelid
-                        // (because TTL10 from bug3 may not always be our TTL10 if say the ttl chans we have on are like 0,1,3,5,10,
-                        // then TTL 10 is really 4 for us!
-                        if (!(params.bug.whichTTLs & (0x1<<i)))
-                            --ttl_chan_translated;
-					bool warned = false;
-					QStringList nums = v.split(",");
-                    //if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " TTL samples..";
-					for (int frame = 0; frame < FramesPerBlock; ++frame) {
-						QString num = nums.empty() ? "0" : nums.front();
-						if (nums.empty()) { 
-							if (!warned) Warning() << "Bug3: Internal problem -- ran out of TTL samples in frame `" << v << "'";
-							warned = true;
-						}
-						else nums.pop_front();
-						bool ok = false;
-						int samp = num.toUShort(&ok);
-						if (!ok) Error() << "Bug3: Internal error -- parse error while reading emg sample `" << num << "'";
-#if 0 // BUG3_TTL_TESTING
-						// TODO HACK BUG FIXME TESTING XXX
-						///*
-						if (ttl_chan_translated == 0) {
-							qint64 scan = qint64(blockNum)*qint64(SpikeGLScansPerBlock) + qint64(frame*NeuralSamplesPerFrame);
-							const qint64 sr = params.srate;
-							static const qint64 ttlWSamps = 640*2;
-							static const qint64 everyNSecs = 2;
-							
-							if (scan>sr*everyNSecs) {
-								if (scan>(debugTTLStart+sr*everyNSecs)) 
-									debugTTLStart = scan;
-							
-								if (scan<debugTTLStart+ttlWSamps)
-									samp = 1;
-								else samp = 0;
-							}
-						}
-						//*/
-#endif
-						if (samp) samp = 32767; // normalize high to maxV
-						for (int ix = 0; ix < NeuralSamplesPerFrame; ++ix) { // need to produce 16 samples for each 1 emg sample read in order to match neuronal rate!						
-                            samps[ frame*(NeuralSamplesPerFrame*nchans) + ix*nchans + (TotalNeuralChans+TotalEMGChans+TotalAuxChans+ttl_chan_translated) ] = samp;
-						}						
-					}				
-				}
-			} else if (k.startsWith("CHIPID")) {
-				QStringList nums = v.split(",");
-				bool warned = false;
-				//if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " chipIDs..";
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of chipID data in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					quint16 chipid = num.toUShort(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading chipID `" << num << "'";
-					meta.chipID[frame] = chipid;
-				}
-			} else if (k.startsWith("CHIP_FC")) {
-				QStringList nums = v.split(",");
-				bool warned = false;
-				//if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " chip_fcs..";
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of chip_fc data in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					int chipfc = num.toInt(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading chip_fc `" << num << "'";
-					meta.chipFrameCounter[frame] = chipfc;
-				}
-			} else if (k.startsWith("FRAME_MARKER_COR")) {
-				QStringList nums = v.split(",");
-				bool warned = false;
-				//if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " FMCorr..";
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of framemarker_corr data in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					quint16 fmc  = num.toUShort(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading fmcorr `" << num << "'";
-					meta.frameMarkerCorrelation[frame] = fmc;
-				}
-			} else if (k.startsWith("BOARD_FC")) {
-				QStringList nums = v.split(",");
-				bool warned = false;
-				//if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " board_fc..";
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of board_fc data in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					int bfc  = num.toInt(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading board_fc `" << num << "'";
-					meta.boardFrameCounter[frame] = bfc;
-				}
-			} else if (k.startsWith("BOARD_FRAME_TIMER")) {
-				QStringList nums = v.split(",");
-				bool warned = false;
-				//if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " board_frame_timer..";
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of board_ftimer data in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					int bft  = num.toInt(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading board_ftimer `" << num << "'";
-					meta.boardFrameTimer[frame] = bft;
-				}
-			} else if (k.startsWith("BER")) {
-				bool ok = false;
-				double n = v.toDouble(&ok);
-				if (!ok) Warning() << "Bug3: Internal problem -- error parsing BER `" << v << "'";
-				meta.BER = n;
-			} else if (k.startsWith("WER")) {
-				bool ok = false;
-				double n = v.toDouble(&ok);
-				if (!ok) Warning() << "Bug3: Internal problem -- error parsing WER `" << v << "'";
-				meta.WER = n;				
-			} else if (k.startsWith("MISSING_FC")) {
-				bool ok = false;
-				int n = v.toInt(&ok);
-				if (!ok) Warning() << "Bug3: Internal problem -- error parsing MISSING_FC `" << v << "'";
-				// TESTING HACK XXX TODO FIXME!
-//				if (Util::random() < .3 && totalRead < 10000000ULL) n = int(Util::random(0.,16.)) % 6;
-                meta.missingFrameCount = n;
-            } else if (k.startsWith("COMM_ABSTIMENS")) {
-                bool ok = false;
-                u64 abs = v.toULongLong(&ok);
-                if (!ok) Warning() << "Bug3: Internal problem -- error parsing COMM_ABSTIMENS `" << v << "'";
-                meta.comm_absTimeNS = abs;
-            } else if (k.startsWith("CREATION_ABSTIMENS")) {
-                bool ok = false;
-                u64 abs = v.toULongLong(&ok);
-                if (!ok) Warning() << "Bug3: Internal problem -- error parsing CREATION_ABSTIMENS `" << v << "'";
-                meta.creation_absTimeNS = abs;
-            } else if (k.startsWith("FALSE_FC")) {
-				bool ok = false;
-				int n = v.toInt(&ok);
-				if (!ok) Warning() << "Bug3: Internal problem -- error parsing FALSE_FC `" << v << "'";
-				// TESTING HACK XXX TODO FIXME!
-//				if (Util::random() < .3 && totalRead < 10000000ULL) n = int(Util::random(0.,16.)) % 6;
-				meta.falseFrameCount = n;								
-			}
+	void BugTask::processBinaryBlock(const char *rawBlock)
+	{
+		if (!binaryBlocks) {
+			binaryBlocks = true; // should have been announced with a BLOCKFORMAT line, but whatever
+			Log() << "Bug3: subprocess switched to binary blocks";
 		}
+		BlockMetaData meta;
+		meta.blockNum = nblocks++;
+		int16 *samps = beginBlock();
+		Bug3::Decoder(int(numChans()), params.bug.whichTTLs).decodeBinary(rawBlock, samps, meta);
+		++nBinaryBlocks;
+		endBlock(samps, meta);
+	}
+
+	void BugTask::endBlock(int16 *samps, BlockMetaData & meta)
+	{
+		const int nchans (numChans());
+		const int nsamps = nchans * SpikeGLScansPerBlock;
 		totalReadMut.lock();
 		quint64 oldTotalRead = totalRead;
-		totalRead += (quint64)samps.size(); 
+		totalRead += (quint64)nsamps; 
 		totalReadMut.unlock();
 
-        handleAI(samps);
-        handleBadDataGraph(samps, meta);
-        handleAOPassthru(samps);
+        handleAI(samps, nsamps);
+        handleBadDataGraph(samps, nsamps, meta);
+        handleAOPassthru(samps, nsamps);
 
-		//Debug() << "Enq: " << samps.size() << " samps, firstSamp: " << oldTotalRead;
-        if (!writer.write(&samps[0],unsigned(samps.size())/nchans,&meta)) {
+		//Debug() << "Enq: " << nsamps << " samps, firstSamp: " << oldTotalRead;
+		const bool ok = blockBuf.size() && samps == &blockBuf[0]
+		                ? writer.write(samps, SpikeGLScansPerBlock, &meta)
+		                : writer.writeDirectEnd(SpikeGLScansPerBlock, &meta);
+        if (!ok) {
             Error() << "Bug3: INTERNAL PROBLEM, writer.write() returned false!";
         }
 		if (!oldTotalRead) emit(gotFirstScan());
 	}
 
-    void BugTask::handleBadDataGraph(std::vector<int16> &samps, const BugTask::BlockMetaData & meta)
+    void BugTask::handleBadDataGraph(int16 *samps, int nsamps, const BugTask::BlockMetaData & meta)
     {
        const DAQ::Params & p(params);
        if (!p.bug.graphBadData) return;
        const int nchans = int(numChans());
        if (!nchans) return;
-       const int nscans = int(samps.size())/nchans;
+       const int nscans = nsamps/nchans;
 
        const double & BER(meta.BER);
        double logBER;
@@ -2051,7 +1817,7 @@ namespace DAQ
        }
     }
 
-    void BugTask::handleAI(std::vector<int16> & samps) {
+    void BugTask::handleAI(int16 *samps, int nsamps) {
         if (!aireader && !params.bug.aiChans.isEmpty()) {
             aireader = new MultiChanAIReader(0);
             Connect(aireader, SIGNAL(error(const QString &)), this, SIGNAL(taskError(const QString &)));
@@ -2099,7 +1865,7 @@ namespace DAQ
         if (ais.size()) {
             const int nchans = int(numChans());
             const int mfc = params.bug.graphBadData ? 1 : 0;
-            const int nscans = int(samps.size())/(nchans>0?nchans:1);
+            const int nscans = nsamps/(nchans>0?nchans:1);
             const int aisz = int(ais.size());
             const int aiscans = aisz/nCh;
             const int off = aiscans-nscans;
@@ -2121,13 +1887,14 @@ namespace DAQ
         }
     }
 		
-    void BugTask::handleAOPassthru(const std::vector<int16> &samps)
+    void BugTask::handleAOPassthru(const int16 *samps, int nsamps)
     {
 #ifdef FAKEDAQ
+        (void)samps;
         if (!params.aoPassthru) return;
         if (!aoSampCount)
             Error() << "AOWriteThread unsupported on this platform -- not a real NI platform!  AOWrites will be disabled...";
-        aoSampCount += samps.size() / params.nVAIChans;
+        aoSampCount += nsamps / params.nVAIChans;
 #else
         if (params.aoPassthru) {
             params.mutex.lock();
@@ -2145,7 +1912,7 @@ namespace DAQ
             }
         }
         if (aoWriteThread) {
-            const int dsize = int(samps.size());
+            const int dsize = nsamps;
             std::vector<int16> aoData;
             aoData.reserve(dsize);
             const int NCHANS = params.nVAIChans;
@@ -2171,10 +1938,6 @@ namespace DAQ
 #endif
     }
 
-	BugTask::BlockMetaData::BlockMetaData() { ::memset(this, 0, sizeof(*this)); /*zero out all data.. yay!*/ }
-	BugTask::BlockMetaData::BlockMetaData(const BlockMetaData &o) { *this = o; }
-	BugTask::BlockMetaData & BugTask::BlockMetaData::operator=(const BlockMetaData & o) { ::memcpy(this, &o, sizeof(o)); return *this; }
-	
 	void BugTask::setNotchFilter(bool enabled)
 	{
 		pushCmd(QString("SNF=%1\r\n").arg(enabled ? "1" : "0").toUtf8());
@@ -2500,38 +2263,44 @@ channel #2 & #34   64‐bit           8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8
 channel #3 & #35   64‐bit           8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit
 channel #32 & #64  64‐bit           8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8‐bit
 */
-            // setup SpikeGL-native chanmap
+            // setup SpikeGL-native chanmap, in the order FG_SpikeGL.exe writes the scans: it remaps each frame so that
+            // channel i of a scan is electrode i, which it reads from raw frame channel mapping[i] (see frameMapping())
             static const int N_INTANS = 36, N_CHANS_PER_INTAN = 64;
             const int n_chans = which ? 2048 : 2304 ;
-            int *revmap = (int *)calloc(sizeof(int),n_chans);
-            for (int i = 0; i < n_chans; ++i) {
-                int j = mapping[i];
-                if (j < 0 || j >= n_chans) { Warning() << "setupCMFromArray: mapping array has invalid values!"; j = 0; return false; }
-                revmap[j] = i;
-            }
             ChanMap & cm(*cm_out);  cm.resize(n_chans);
-            for (int i = 0, chinc = -1, even = 1; i < n_chans; ++i, even = !even) {
-                if (!(i%(N_INTANS*2))) ++chinc;
-                const int intan = (i/2) % N_INTANS, intan_chan = even ? chinc : chinc+(N_CHANS_PER_INTAN/2);
-                int electrode = revmap[i];
-                if (electrode < 0 || electrode >= n_chans) {
-                    Warning() << "setupCMFromArray: electrode is out of range!";
-                    electrode = 0;
-                    return false;
-                }
+            for (int i = 0; i < n_chans; ++i) {
+                const int j = mapping[i];
+                if (j < 0 || j >= n_chans) { Warning() << "setupCMFromArray: mapping array has invalid values!"; return false; }
+                // raw frame channel j: every 72 frame channels are 1 channel of each of the 36 intans, low and high half alternating
+                const int chinc = j/(N_INTANS*2), intan = (j/2) % N_INTANS, intan_chan = (j%2) ? chinc+(N_CHANS_PER_INTAN/2) : chinc;
                 if (intan_chan >= N_CHANS_PER_INTAN || intan_chan < 0) {
                     Warning() << "setupCMFromArray: intan_chan is out of range!";
                     return false;
                 }
                 ChanMapDesc & d(cm[i]);
-                d.electrodeId = electrode;
+                d.electrodeId = i;
                 d.intan = intan;
                 d.intanCh = intan_chan;
             }
-            free(revmap);
             return true;
     }
 
+    /* static */
+    std::vector<int> FGTask::frameMapping(const ChanMap & cm, unsigned nChans)
+    {
+        // the inverse of the raw frame layout in setupCMFromArray().  The extra AI channels (past the intans') stay put.
+        static const int N_INTANS = 36, N_CHANS_PER_INTAN = 64;
+        std::vector<int> m(nChans);
+        for (unsigned i = 0; i < nChans; ++i) {
+            m[i] = int(i);
+            if (int(i) >= NumChans || i >= unsigned(cm.size())) continue;
+            const ChanMapDesc & d(cm[i]);
+            const int j = int(d.intanCh % (N_CHANS_PER_INTAN/2))*(N_INTANS*2) + int(d.intan)*2 + (d.intanCh >= unsigned(N_CHANS_PER_INTAN/2) ? 1 : 0);
+            if (int(d.intan) < N_INTANS && int(d.intanCh) < N_CHANS_PER_INTAN && j < NumChans) m[i] = j;
+        }
+        return m;
+    }
+
 
 
     /* static */
@@ -2693,9 +2462,10 @@ channel #32 & #64  64‐bit           8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8
 
 
 
-        // grab frames.. does stuff with Sapera API in the slave process
+        // grab frames.. does stuff with Sapera API in the slave process, which remaps each scan to electrode order (params.chanMap's order)
+        const std::vector<int> mapping(frameMapping(params.chanMap, params.nVAIChans));
         XtCmdGrabFrames x;
-        x.init(mainApp()->qsmNativeKey().toUtf8().constData(), writer.totalSize(), writer.pageSize(), writer.metaDataSizeBytes(), "J_2000+_Electrode_8tap_8bit.ccf", 144, 32, params.nVAIChans, 0/*getDefaultMapping(0)*/, params.nExtraChans1+params.nExtraChans2>0 ? true : false);
+        x.init(mainApp()->qsmNativeKey().toUtf8().constData(), writer.totalSize(), writer.pageSize(), writer.metaDataSizeBytes(), "J_2000+_Electrode_8tap_8bit.ccf", 144, 32, params.nVAIChans, mapping.size() ? &mapping[0] : 0, params.nExtraChans1+params.nExtraChans2>0 ? true : false);
         pushCmd(x);
     }
 
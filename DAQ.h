@@ -27,8 +27,11 @@
 #include <list>
 #include "ui_FG_Controls.h"
 #include "PagedRingBuffer.h"
+#include "Bug3Protocol.h"
+#include "IntanDemux.h"
 
 struct XtCmd;
+class QFile;
 
 namespace DAQ
 {
@@ -146,6 +149,10 @@ namespace DAQ
 		
 		bool resumeGraphSettings;
 
+		bool compressDataFile; ///< if true, the data file is losslessly compressed as it's saved (see DataFile::writeScans())
+		bool spikeDetect; ///< if true, run online spike detection during the acquisition, writing the spikes to a sidecar file
+		double spikeDetectSigmas; ///< spike detection threshold, in multiples of each channel's estimated noise level
+
 		bool autoRetryOnAIOverrun; ///< if true, auto-restart the acquisition every time there is a buffer overrun error from the NI DAQ drivers. Note that if we get more than 2 failures in a 1s period, the acquisition is aborted anyway.
         int overrideGraphsPerTab; ///< if nonzero, the number of graphs per tab to display, 0 implies use mode-specific limits
         int graphUpdateRate, spatialVisUpdateRate; ///< if nonzero, update the graphs this many times per second.  if <=0, will use DEF_TASK_READ_FREQ_HZ from SpikeGL.h
@@ -312,11 +319,10 @@ namespace DAQ
         friend struct DAQPvt;
 
         static int computeTaskReadFreq(double srate);
-		
-		static void mergeDualDevData(std::vector<int16> & output, const std::vector<int16> & data, const std::vector<int16> & data2, int NCHANS1, int NCHANS2, int nExtraChans, int nExtraChans2);
 
-        // used on all platforms
-        void doFinalDemuxAndEnqueue(std::vector<int16> & data);
+        // used on all platforms.  In dual dev mode data2 is the 2nd device's scans, merged with data's in the same pass as the demux.
+        void doFinalDemuxAndEnqueue(std::vector<int16> & data, std::vector<int16> *data2 = 0);
+        IntanDemux demux; ///< set up once from params by the c'tor.  A plain copy for AIRegular and pre-July 2011 demux modes.
 
         AOWriteThread *aoWriteThr;
         QVector<QPair<int,int> > aoAITab;
@@ -452,23 +458,7 @@ namespace DAQ
 
         Params::Bug & bugParams() { return params.bug; }
 
-		struct BlockMetaData {
-			quint64 blockNum; ///< sequential number. incremented for each new block
-			int boardFrameCounter[FramesPerBlock];
-			int boardFrameTimer[FramesPerBlock];
-			int chipFrameCounter[FramesPerBlock];
-			quint16 chipID[FramesPerBlock];
-			quint16 frameMarkerCorrelation[FramesPerBlock];
-			int missingFrameCount;
-			int falseFrameCount;
-			double BER, WER; ///< bit error rate and word error rate
-			double avgVunreg; ///< computed value derived from the "AUX" voltage channel.  Avg of all frames.  To save time we compute it on-the-fly as well.
-            u64 comm_absTimeNS, creation_absTimeNS; ///< timestamp ultimately coming off the CPU TSC that went with the block when it was created (creation_) and when it was sent down the pipe to SpikeGL (comm_)
-			
-			BlockMetaData();
-			BlockMetaData(const BlockMetaData &o);
-			BlockMetaData & operator=(const BlockMetaData & o);
-		};
+		typedef Bug3::BlockMetaData BlockMetaData; ///< see Bug3Protocol.h
 				
 		void setNotchFilter(bool enabled);
 		void setHPFilter(int val); ///<   <=0 == off, >0 = freq in Hz to high-pass filter
@@ -494,11 +484,13 @@ namespace DAQ
 	private:
         unsigned req_shm_pg_sz;
 
-		int state;
-        static const int nstates = 38;
-		quint64 nblocks, nlines;
+		quint64 nblocks;
 		qint64 debugTTLStart;
-		QMap<QString, QString> block;
+		Bug3::StreamParser parser;
+		bool binaryBlocks; ///< true once the subprocess said it will send binary blocks.  Any text blocks are then duplicates and are ignored.
+		quint64 nTextBlocks, nBinaryBlocks;
+		QFile *capture; ///< if SPIKEGL_BUG3_CAPTURE is set in the environment, all subprocess output is appended to that file (for bug3replay)
+		std::vector<int16> blockBuf; ///< used if a block doesn't fit in the current page of the shm, which it always should
 
         AOWriteThread *aoWriteThread;
         u64 aoSampCount;
@@ -509,11 +501,14 @@ namespace DAQ
         MultiChanAIReader *aireader;
         std::vector<int16> ais; ///< persistent ai buffer
 		
-		void processLine(const QString & lineUntrimmed, QMap<QString, QString> & block, const quint64 & nblocks, int & state, quint64 & nlines);
-		void processBlock(const QMap<QString, QString> &, quint64 blockNum);		
-        void handleAOPassthru(const std::vector<int16> & samps);
-        void handleAI(std::vector<int16> & samps);
-        void handleBadDataGraph(std::vector<int16> & samps, const BlockMetaData & meta);
+		void processLine(const QString & line); ///< text that isn't part of a block
+		void processTextBlock(const QMap<QString, QString> &);
+		void processBinaryBlock(const char *rawBlock);
+		int16 *beginBlock(); ///< returns zeroed space for the next block's samples, directly in the shm page if possible
+		void endBlock(int16 *samps, BlockMetaData & meta); ///< finishes up the block and commits it to the shm
+        void handleAOPassthru(const int16 *samps, int nsamps);
+        void handleAI(int16 *samps, int nsamps);
+        void handleBadDataGraph(int16 *samps, int nsamps, const BlockMetaData & meta);
 	};
 	
 
@@ -535,7 +530,10 @@ namespace DAQ
         ~FGTask();
 		
         static const int *getDefaultMapping(int which /* 1=calin 0=janelia*/, ChanMap *cm_out = 0);
+        /// mapping[i] is the raw frame channel of electrode i.  cm_out gets the channels in electrode order, which is how they arrive.
         static bool setupCMFromArray(const int *mapping, int which /* 1=calin 0=janelia */, ChanMap *cm_out);
+        /// The reverse of setupCMFromArray(): for each of nChans channels, the raw frame channel FG_SpikeGL.exe should put there.
+        static std::vector<int> frameMapping(const ChanMap & cm, unsigned nChans);
 
         unsigned numChans() const;
         unsigned samplingRate() const;
@@ -0,0 +1,240 @@
+#include "DataExporter.h"
+#include "EnvelopeIndex.h"
+#include "Util.h"
+#include <QThread>
+#include <QFile>
+#include <QFileInfo>
+#include <limits.h>
+#include <string.h>
+
+class DataExporterThread : public QThread
+{
+public:
+    DataExporterThread(DataExporter *e, bool reader) : e(e), reader(reader) {}
+protected:
+    void run() { if (reader) e->readLoop(); else e->formatLoop(); }
+private:
+    DataExporter *e;
+    bool reader;
+};
+
+DataExporter::DataExporter(const QString & inputBinFile, const ExportParams & p)
+    : auxGain(1.0), nThreads(0), pleaseStop(false), bytesIn(0), bytesOut(0), secs(0.), p(p),
+      chunkScans(1), nChunks(0), maxInFlight(0), inFlight(0), readerDone(false), stop(false)
+{
+    if (in.openForRead(inputBinFile)) auxGain = in.auxGain();
+    gains.fill(auxGain, in.numChans());
+    nThreads = unsigned(QThread::idealThreadCount());
+    if (nThreads < 1 || nThreads > 64) nThreads = 1;
+    if (nThreads > 8) nThreads = 8;
+}
+
+DataExporter::~DataExporter()
+{
+    for (std::deque<Chunk *>::iterator it = rawQ.begin(); it != rawQ.end(); ++it) delete *it;
+    for (std::map<u64, Chunk *>::iterator it = doneQ.begin(); it != doneQ.end(); ++it) delete it->second;
+}
+
+void DataExporter::fail(const QString & err)
+{
+    QMutexLocker l(&mut);
+    if (extendedError.isNull()) extendedError = err;
+    stop = true;
+    canRead.wakeAll(); haveRaw.wakeAll(); haveDone.wakeAll();
+}
+
+void DataExporter::readLoop()
+{
+    const bool csv = p.format == ExportParams::Csv;
+    for (u64 seq = 0; seq < nChunks; ++seq) {
+        {
+            QMutexLocker l(&mut);
+            while (!stop && inFlight >= maxInFlight) canRead.wait(&mut);
+            if (stop) return;
+            ++inFlight;
+        }
+        Chunk *c = new Chunk;
+        c->seq = seq;
+        c->pos = u64(p.from) + seq*chunkScans;
+        const u64 n = qMin(chunkScans, u64(p.to) + 1 - c->pos);
+        const i64 nr = in.readScans(c->scans, c->pos, n, p.chanSubset);
+        if (nr != i64(n)) {
+            fail(QString("Error reading scans %1-%2 of the input file.").arg(c->pos).arg(c->pos+n-1));
+            delete c;
+            return;
+        }
+        c->nScans = unsigned(n);
+        QMutexLocker l(&mut);
+        if (csv) rawQ.push_back(c), haveRaw.wakeOne();
+        else doneQ[seq] = c, haveDone.wakeOne();
+    }
+    QMutexLocker l(&mut);
+    readerDone = true;
+    haveRaw.wakeAll();
+}
+
+void DataExporter::formatLoop()
+{
+    for (;;) {
+        Chunk *c = 0;
+        {
+            QMutexLocker l(&mut);
+            while (!stop && rawQ.empty() && !readerDone) haveRaw.wait(&mut);
+            if (stop || rawQ.empty()) return;
+            c = rawQ.front();
+            rawQ.pop_front();
+        }
+        formatCSV(c);
+        QMutexLocker l(&mut);
+        doneQ[c->seq] = c;
+        haveDone.wakeOne(); // the writer is the only one waiting on this
+    }
+}
+
+static inline char *appendInt(char *o, int v)
+{
+    char tmp[12];
+    int n = 0;
+    unsigned u = v < 0 ? unsigned(-v) : unsigned(v);
+    do { tmp[n++] = char('0' + u % 10); u /= 10; } while (u);
+    if (v < 0) *o++ = '-';
+    while (n) *o++ = tmp[--n];
+    return o;
+}
+
+void DataExporter::formatCSV(Chunk *c) const
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    const int scansz = int(chansOn.size());
+    const double smin = double(SHRT_MIN), usmax = double(USHRT_MAX);
+    c->text.resize(int(c->nScans) * scansz * 24 + int(c->nScans)); // worst case is Real: 6 significant digits in 'g' format is at most 13 chars, plus a comma
+    char *o = c->text.data();
+    const int16 *s = c->scans.size() ? &c->scans[0] : 0;
+    for (unsigned i = 0; i < c->nScans; ++i, s += scansz) {
+        for (int j = 0; j < scansz; ++j) {
+            if (p.csvSubFormat == ExportParams::Real) {
+                // NB: the range is looked up by position in the subset, not by channel -- this is what exports have always done
+                const double minR = in.rangeMin(j), maxR = in.rangeMax(j);
+                double sampl = ( ((double(s[j]) + (-smin))/(usmax+1.)) * (maxR-minR) ) + minR;
+                sampl /= gains[chansOn[j]];
+                const QByteArray num = QByteArray::number(sampl, 'g', 6); // same as QTextStream's default, and not affected by the C locale like printf
+                memcpy(o, num.constData(), size_t(num.size()));
+                o += num.size();
+            } else if (p.csvSubFormat == ExportParams::DecInt16) {
+                o = appendInt(o, s[j]);
+            } else { // HexUInt16
+                const unsigned short u = static_cast<unsigned short>(s[j]);
+                *o++ = '0'; *o++ = 'x';
+                *o++ = hexDigits[(u>>12)&0xf]; *o++ = hexDigits[(u>>8)&0xf]; *o++ = hexDigits[(u>>4)&0xf]; *o++ = hexDigits[u&0xf];
+            }
+            if (j+1 < scansz) *o++ = ',';
+        }
+        *o++ = '\n';
+    }
+    c->text.resize(int(o - c->text.data()));
+    std::vector<int16>().swap(c->scans); // done with these, free them early
+}
+
+DataExporter::Result DataExporter::exportData()
+{
+    const double t0 = getTime();
+    const bool csv = p.format == ExportParams::Csv;
+    if (!in.isOpenForRead()) {
+        extendedError = "Could not open the input file.";
+        return Failure;
+    }
+    chansOn.clear();
+    for (int i = 0; i < (int)p.chanSubset.size(); ++i)
+        if (p.chanSubset.testBit(i)) chansOn.push_back(i);
+    const u64 nscans = p.to >= p.from ? u64(p.to - p.from) + 1 : 0;
+    if (chansOn.empty() || !nscans || u64(p.to) >= in.scanCount()) {
+        extendedError = "Invalid channel subset or scan range for export.";
+        return Failure;
+    }
+    chunkScans = qMax(u64(ChunkBytes / (chansOn.size()*sizeof(int16))), u64(1));
+    nChunks = (nscans + chunkScans - 1) / chunkScans;
+    if (!csv) nThreads = 0;
+    maxInFlight = 2*nThreads + 2;
+
+    // open output
+    DataFile binOut;
+    QFile csvOut(p.filename);
+    if (csv) {
+        if (!csvOut.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+            extendedError = "Could not open export file for write.";
+            return Failure;
+        }
+    } else {
+        QVector<unsigned> chanNumSubset;
+        for (unsigned i = 0; i < chansOn.size(); ++i) chanNumSubset.push_back(unsigned(chansOn[i]));
+        if (!binOut.openForReWrite(in, p.filename, chanNumSubset)) {
+            extendedError = "Could not open export file for write.";
+            return Failure;
+        }
+        // override the auxGain parameter from the input file with out custom gain setting
+        binOut.setParam("auxGain", auxGain);
+    }
+
+    std::vector<DataExporterThread *> threads;
+    threads.push_back(new DataExporterThread(this, true));
+    for (unsigned i = 0; i < nThreads; ++i) threads.push_back(new DataExporterThread(this, false));
+    for (unsigned i = 0; i < threads.size(); ++i) threads[i]->start();
+
+    // we are the writer
+    int prevPct = -1;
+    for (u64 seq = 0; seq < nChunks; ++seq) {
+        Chunk *c = 0;
+        {
+            QMutexLocker l(&mut);
+            std::map<u64, Chunk *>::iterator it;
+            while (!stop && !pleaseStop && (it = doneQ.find(seq)) == doneQ.end()) haveDone.wait(&mut, 100);
+            if (stop || pleaseStop) break;
+            c = it->second;
+            doneQ.erase(it);
+        }
+        bool ok;
+        if (csv) {
+            ok = csvOut.write(c->text) == qint64(c->text.size());
+            bytesOut += u64(c->text.size());
+        } else {
+            ok = binOut.writeScans(&c->scans[0], c->nScans, true);
+            bytesOut += u64(c->scans.size()*sizeof(int16));
+        }
+        bytesIn += u64(c->nScans)*chansOn.size()*sizeof(int16);
+        delete c;
+        if (!ok) { fail("Error writing to export file."); break; }
+        {
+            QMutexLocker l(&mut);
+            --inFlight;
+            canRead.wakeOne();
+        }
+        const int pct = int(((seq+1)*100ULL)/nChunks);
+        if (pct > prevPct) progress(prevPct = pct);
+    }
+
+    {
+        QMutexLocker l(&mut);
+        stop = true;
+        canRead.wakeAll(); haveRaw.wakeAll(); haveDone.wakeAll();
+    }
+    for (unsigned i = 0; i < threads.size(); ++i) { threads[i]->wait(); delete threads[i]; }
+
+    Result r = !extendedError.isNull() ? Failure : (pleaseStop ? Canceled : Success);
+    if (csv) {
+        csvOut.close();
+        if (r != Success) csvOut.remove();
+    } else {
+        const QString f = binOut.fileName(), m = binOut.metaFileName();
+        binOut.closeAndFinalize();
+        if (r != Success) {
+            QFile::remove(f);
+            QFile::remove(m);
+            QFile::remove(EnvelopeIndex::fileNameFor(f));
+        }
+    }
+    secs = getTime() - t0;
+    if (r == Success)
+        Log() << "Exported " << nscans << " scans x " << chansOn.size() << " chans to " << QFileInfo(p.filename).fileName() << " in "
+              << secs << " s: " << mbPerSecIn() << " MB/s in, " << mbPerSecOut() << " MB/s out (" << nThreads << " formatter threads)";
+    return r;
+}
@@ -0,0 +1,75 @@
+#ifndef DataExporter_H
+#define DataExporter_H
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+#include <deque>
+#include <map>
+#include <vector>
+#include "TypeDefs.h"
+#include "ExportDialogController.h"
+#include "DataFile.h"
+
+/** Exports a range of scans and a subset of channels of a .bin file to a new .bin file or to a CSV
+    file, as specified by an ExportParams.  The input is opened separately from any DataFile the caller
+    may already have open on it, so the caller may keep using theirs while the export runs.
+
+    Works as a pipeline: a reader thread pulls chunks of about ChunkBytes out of the input file,
+    nThreads formatter threads turn the chunks into CSV text in parallel (.bin exports skip this
+    stage), and the thread that called exportData() writes the chunks out in order, calling
+    progress() as it goes.  Does no GUI of its own, so it is used both by the FileViewerWindow
+    and by the CommandServer's EXPORTFILE command. */
+struct DataExporter {
+    enum Result { Success, Failure, Canceled };
+    enum { ChunkBytes = 2*1024*1024 };
+
+    DataExporter(const QString & inputBinFile, const ExportParams & p); ///< c'tor opens the input file and initializes values.  `p' must outlive this instance
+    virtual ~DataExporter();
+
+    QVector<double> gains; ///< per input channel, divides the volts in CSV Real exports.  Defaults to the input's auxGain() for all
+    double auxGain; ///< saved in the meta file of .bin exports.  Defaults to the input's auxGain()
+    unsigned nThreads; ///< number of formatter threads.  Defaults to the number of CPUs, at most 8
+    volatile bool pleaseStop;
+    QString extendedError; ///< set if exportData() returns Failure
+
+    virtual void progress(int) {} /**< no-op, reimplemented in subclasses.  pct 0-100, called from the thread calling exportData() */
+
+    Result exportData(); ///< does the whole export, blocking the calling thread until it's done
+
+    /// stats, valid after exportData()
+    u64 bytesIn, bytesOut;
+    double secs;
+    double mbPerSecIn() const { return secs > 0. ? bytesIn / secs / (1024.*1024.) : 0.; }
+    double mbPerSecOut() const { return secs > 0. ? bytesOut / secs / (1024.*1024.) : 0.; }
+
+private:
+    struct Chunk {
+        u64 seq, pos;
+        unsigned nScans;
+        std::vector<int16> scans;
+        QByteArray text; ///< the CSV lines, for CSV exports
+    };
+    friend class DataExporterThread;
+
+    void readLoop(); ///< reader thread
+    void formatLoop(); ///< formatter threads
+    void formatCSV(Chunk *c) const;
+    void fail(const QString & err);
+
+    DataFile in;
+    const ExportParams & p;
+    std::vector<int> chansOn;
+    u64 chunkScans, nChunks;
+    unsigned maxInFlight;
+
+    QMutex mut; ///< protects everything below
+    QWaitCondition canRead, haveRaw, haveDone;
+    std::deque<Chunk *> rawQ; ///< read, waiting for a formatter
+    std::map<u64, Chunk *> doneQ; ///< ready to be written, by seq
+    unsigned inFlight; ///< chunks read but not yet written
+    bool readerDone, stop;
+};
+
+#endif
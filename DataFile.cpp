@@ -1,31 +1,179 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for O_DIRECT */
+#endif
 #include "DataFile.h"
 #include "Util.h"
 #include "SpikeGL.h"
 #include "MainApp.h"
 #include <QFileInfo.h>
 #include <memory>
+#include <deque>
 #include "ConfigureDialogController.h"
 #include "ChanMappingController.h"
+#include "ScanGather.h"
+#include "SampleCodec.h"
+#include "Sha1Tree.h"
+#include "Sha1VerifyTask.h"
 #include <QThread>
-#include "SampleBufQ.h"
+#include <QWaitCondition>
+#include <QDir>
 #include <QMessageBox>
 #include <QTextStream>
 #include <QMutexLocker>
+#include <string.h>
+#include <limits.h>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#endif
 
-class DFWriteThread : public QThread, public SampleBufQ
+/** The asynchronous writer stage for DataFile.  The producer (normally the DataSavingThread) copies
+    scans into page-aligned blocks taken from a fixed pool, and full blocks are handed off to this thread,
+    which writes them to disk with unbuffered I/O so that a slow disk never stalls the caller as long as
+    there is a free block in the pool.  With the minimum pool size of 2 this is plain double-buffering.
+    Optionally, written blocks then go to a second thread that hashes them (each block is one leaf of a
+    Sha1Tree) before they are reused, which keeps the SHA1 off both the producer and the disk writes. */
+class DFWriteThread : public QThread
 {
-	DataFile *d;
-	volatile bool stopflg;
-
 public:
-    DFWriteThread(DataFile *df, unsigned q_size);
+    DFWriteThread(DataFile *df, unsigned nBlocks, unsigned blockSizeBytes);
 	~DFWriteThread();
+
+    /// opens our own unbuffered handle to the already-created data file.  Call once before start().
+    bool openOutput(const QString & fileName);
+    /// called by the producer: copies data into the current block, handing full blocks off to the writer thread.  May block if the pool is exhausted.
+    bool put(const void *data, unsigned nBytes);
+    /// hands off the last partial block, waits for all writes to complete, closes our handle and trims the file to its real size.
+    bool finish();
+    /// starts the hashing thread.  Call once, before the first put().
+    void startHashing();
+    /// the Sha1Tree hash of everything put(), with leaves of hashBlockSize() bytes.  Empty until finish(), or if not hashing or a write failed.
+    QString hashResult() const { return hashStr; }
+    unsigned hashBlockSize() const { return blockSize; }
+
+    unsigned queueDepth() const { QMutexLocker l(&qmut); return unsigned(fullQ.size()); }
+    unsigned queueMaxDepth() const { return nBlocks; }
+    u64 bytesPut() const { return nBytesPut; }
+    QVector<unsigned> stallHistogram() const { QMutexLocker l(&qmut); return stalls; }
+    QVector<unsigned> latencyHistogram() const { QMutexLocker l(&qmut); return latencies; }
+    bool waitForEmpty(int ms) const;
+
+    static QString histogramToString(const QVector<unsigned> & h);
+
 protected:
 	void run(); ///< from QThread
-	
-	bool write(const std::vector<int16> & scans);
+
+private:
+    struct Block { char *mem; unsigned len, dataLen; u64 seq; }; ///< dataLen is len without the padding of the last block
+    struct HashThread : public QThread {
+        DFWriteThread *w;
+        HashThread(DFWriteThread *wt) : QThread(0), w(wt) {}
+    protected:
+        void run() { w->hashLoop(); }
+    };
+
+    bool writeBlock(const Block & b);
+    void closeOutput();
+    static void histoAdd(QVector<unsigned> & h, double secs);
+    static char *allocAligned(unsigned sz);
+    static void freeAligned(char *p);
+    void hashLoop(); ///< the hashing thread's loop
+
+    DataFile *d;
+    const unsigned nBlocks, blockSize;
+    std::vector<Block> blocks;
+    std::deque<Block *> freeQ, fullQ; ///< fullQ includes the block currently being written
+    Block *cur; ///< owned by the producer, not in either queue
+    mutable QMutex qmut;
+    mutable QWaitCondition freeCond, fullCond, emptyCond;
+    volatile bool stopflg, errflg;
+    bool finished, unbuffered;
+    QString fname;
+    u64 nBytesPut;
+    QVector<unsigned> stalls, latencies; ///< locked by qmut
+    HashThread *hasher;
+    std::deque<Block *> hashQ; ///< written blocks waiting to be hashed, then they go back to freeQ
+    mutable QWaitCondition hashCond;
+    bool hashStop;
+    u64 nextSeq;
+    Sha1Tree tree; ///< only touched by the hashing thread until it's done
+    QString hashStr;
+#ifdef Q_OS_WIN
+    HANDLE h;
+#else
+    int fd;
+#endif
+};
+
+/** The compression stage for compressed data files (DAQ::Params::compressDataFile), between the producer and the
+    DFWriteThread.  The producer's scans are cut into chunks of chunkScans scans (DF_COMPRESS_CHUNK_BYTES
+    worth), each chunk is compressed with SampleCodec by one of a pool of worker threads, and the
+    compressed chunks are handed to the DFWriteThread in order.
+
+    The file is a ZHeader, then the chunks, each a ZChunk followed by its data, then the chunk index (the
+    file offset of each ZChunk, 8 bytes each) and a ZFooter.  Every chunk but the last has chunkScans scans,
+    so scan s is in chunk s / chunkScans, and chunks decode independently of each other: that's what makes
+    random access by readScans() cheap.  A chunk that doesn't compress is stored as is.  Little endian, no
+    padding.  The .meta file has compression = sglz1 for the benefit of other readers. */
+class DFCompressor
+{
+public:
+    DFCompressor(DataFile *df, DFWriteThread *out, unsigned nChans, unsigned chunkScans, unsigned nThreads);
+    ~DFCompressor();
+
+    /// writes the file header and starts the workers.  Call once, before any put().
+    bool start();
+    /// called by the producer: copies the scans into the current chunk, queueing full chunks for compression.  May block if all chunks are busy.
+    bool put(const int16 *scans, unsigned nScans);
+    /// queues the last partial chunk, waits for everything to be written, then writes the chunk index.
+    bool finish();
+
+    u64 bytesIn() const { QMutexLocker l(&qmut); return nIn; }
+    u64 bytesOut() const { QMutexLocker l(&qmut); return nOut; }
+    double busySecs() const { QMutexLocker l(&qmut); return busy; } ///< summed over the workers
+    unsigned numThreads() const { return unsigned(workers.size()); }
+
+    struct ZHeader { char magic[8]; quint32 version, nChans, chunkScans, reserved[3]; };
+    struct ZChunk { char magic[4]; quint32 nScans, nBytes, flags; };
+    struct ZFooter { quint64 indexOffset, nChunks, nScans; char magic[8]; };
+    enum { Version = 1, ChunkStored = 1 /* ZChunk flag: not compressed */ };
+
+private:
+    struct Job { std::vector<int16> raw; unsigned nScans; u64 seq; std::vector<uchar> enc; };
+    struct Worker : public QThread {
+        DFCompressor *c;
+        Worker(DFCompressor *comp) : QThread(0), c(comp) {}
+    protected:
+        void run() { c->work(); }
+    };
+
+    void work(); ///< a worker's loop
+    void submit(); ///< queues cur, called with qmut locked
+
+    DataFile *d;
+    DFWriteThread *out;
+    const unsigned nChans, chunkScans;
+    std::vector<Job> jobs;
+    std::vector<Worker *> workers;
+    std::deque<Job *> freeQ, todoQ;
+    Job *cur; ///< owned by the producer, not in either queue
+    mutable QMutex qmut;
+    QWaitCondition freeCond, todoCond, outCond;
+    u64 nextSeq, nextOut; ///< locked by qmut.  Chunks are written in seq order.
+    volatile bool stopflg, errflg;
+    bool started, finished;
+    u64 nScans, nIn, nOut;
+    double busy;
+    std::vector<u64> offsets; ///< the chunk index
 };
 
+static const char zHeaderMagic[8] = "SGLZBIN", zChunkMagic[4] = {'S','G','L','C'}, zFooterMagic[8] = "SGLZIDX";
+
 
 static QString metaFileForFileName(const QString &fname)
 {
@@ -34,35 +182,28 @@ static QString metaFileForFileName(const QString &fname)
 
 /* static */ bool DataFile::verifySHA1(const QString & filename)
 {
-    SHA1 sha;
     Params p;
 
     if (!p.fromFile(metaFileForFileName(filename))) { 
         Error() << "verifySHA1 could not read/parse/find meta file for " << filename;
         return false;
     }
-    
-    if (!sha.HashFile(filename.toLatin1().constData())) {
-        Error() << "verifySHA1 could not read file: " << filename;
-        return false;
-    }
-    QString hash = sha.ReportHash().c_str();
-    QString hashSaved = p["sha1"].toString().trimmed();
-    if (hashSaved.length() != 40) {
-        Error() << "Meta file hash is not existant or not of the correct format `" << hashSaved << "'!";
-        return false;
-    }
-    hash = hash.trimmed();
-    return hash.compare(hashSaved, Qt::CaseInsensitive) == 0;
- }
+    Sha1Verifier v(filename, metaFileForFileName(filename), p);
+    const Sha1Verifier::Result r = v.verify();
+    if (r != Sha1Verifier::Success && !v.extendedError.isEmpty()) Error() << "verifySHA1: " << v.extendedError;
+    return r == Sha1Verifier::Success;
+}
  
 DataFile::DataFile()
-    : mut(QMutex::Recursive), mode(Undefined), scanCt(0), nChans(0), sRate(0), writeRateAvg_for_ui(0), writeRateAvg(0.), nWritesAvg(0), nWritesAvgMax(1), dfwt(0)
+    : mut(QMutex::Recursive), mode(Undefined), scanCt(0), nChans(0), sRate(0), writeRateAvg_for_ui(0), writeRateAvg(0.), nWritesAvg(0), nWritesAvgMax(1), dfwt(0), dfc(0), compress(false), compressRatio(1.), mapPtr(0), mapOff(0), mapLen(0), mapOk(false),
+      compressed(false), zChunkScans(0), zChunkNum(-1), zChunkLen(0)
 {
 }
 
 DataFile::~DataFile() {
+	if (dfc) delete dfc, dfc = 0;
 	if (dfwt) delete dfwt, dfwt = 0;
+	unmapWindow();
 }
 
 bool DataFile::closeAndFinalize() 
@@ -71,18 +212,46 @@ bool DataFile::closeAndFinalize()
 
     if (!isOpen()) return false;
 	if (mode == Input) {
+		unmapWindow();
 		dataFile.close();
 		metaFile.close();
 		nChans = scanCt = sRate = 0;
+		compressed = false;
+		zChunkOffsets.clear(); zChunkNum = -1;
+		zChunk.clear(); zBuf.clear();
 		mode = Undefined;
 		return true;
 	} else if (mode == Output) {
-		if (dfwt) delete dfwt, dfwt = 0;
 		// Output mode...
-		sha.Final();
-        params["sha1"] = /*sha.ReportHash().c_str()*/ "0";
+        qint64 fileSize = dataFile.size();
+        QString hash;
+        unsigned hashBlockSize = 0;
+		if (dfc) {
+            const bool ok = dfc->finish();
+            const double mbIn = dfc->bytesIn()/1024.0/1024.0, mbOut = dfc->bytesOut()/1024.0/1024.0;
+            if (!ok) Error() << fileName() << ": error finishing the compressed file, it may be unreadable!";
+            Debug() << fileName() << " compressed " << mbIn << " MB to " << mbOut << " MB (ratio " << (mbOut > 0. ? mbIn/mbOut : 0.) << ") at "
+                    << (dfc->busySecs() > 0. ? mbIn/dfc->busySecs() : 0.) << " MB/s per core on " << dfc->numThreads() << " threads";
+            params["compression"] = "sglz1";
+            params["uncompressedSizeBytes"] = qint64(scanCt)*qint64(nChans)*qint64(sizeof(int16));
+            delete dfc, dfc = 0;
+        }
+		if (dfwt) {
+            dfwt->finish();
+            fileSize = qint64(dfwt->bytesPut());
+            hash = dfwt->hashResult(), hashBlockSize = dfwt->hashBlockSize();
+            Debug() << fileName() << " asynch writer stall histogram (ms bins): " << DFWriteThread::histogramToString(dfwt->stallHistogram())
+                    << ", write latency histogram (ms bins): " << DFWriteThread::histogramToString(dfwt->latencyHistogram());
+            delete dfwt, dfwt = 0;
+        }
+		if (envb.isActive()) envb.finish(u64(fileSize));
+        // only asynch writes get (tree) hashed, by the DFWriteThread.  The plain sha1 is never computed while
+        // recording, so it's 0 as always, and Verify SHA1 can fill it in later.
+        params["sha1"] = QString("0");
+        if (hash.length()) params["sha1Tree"] = hashBlockSize, params["sha1TreeHash"] = hash;
+        else params.remove("sha1Tree"), params.remove("sha1TreeHash");
 		params["fileTimeSecs"] = fileTimeSecs();
-		params["fileSizeBytes"] = dataFile.size();
+		params["fileSizeBytes"] = fileSize;
 		params["createdBy"] = QString("%1").arg(VERSION_STR);
         if (badData.count()) {
             QString bdString;
@@ -101,30 +270,74 @@ bool DataFile::closeAndFinalize()
 		metaFile.close(); // close it.. we mostly reserved it in the FS.. however we did write to it if writeCommentToMetaFile() as called, otherwise we just reserved it on the FS    
         writeRateAvg_for_ui = writeRateAvg = 0.;
 		nWritesAvg = nWritesAvgMax = 0;
+		compressRatio = 1.;
 		mode = Undefined;
 		return params.toFile(mf,true /* append since we may have written comments to metafile!*/);
 	} 
 	return false; // not normally reached...
 }
 
-bool DataFile::writeScans(const int16 *scans, unsigned nScans)
+bool DataFile::reopenForFirstWrite()
+{
+    // special case -- Leonardo lab requested that timestamp on data files be the timestamp of when first scan arrived
+    // so, to fudge this we need to close the data file, delete it, and quickly reopen it
+    // the reason we had it open in the first place was to 'reserve' that spot on the disk ;)
+    QString fileName(dataFile.fileName());
+
+    dataFile.remove(); /// remove the 0-byte file
+    dataFile.setFileName(fileName);
+    if (!dataFile.open(QIODevice::WriteOnly|QIODevice::Truncate)) { // reopen it to reset the timestamp
+        Error() << "Failed to open data file " << fileName << " for write!";
+        return false;
+    }
+    return true;
+}
+
+bool DataFile::startAsynchWriter(unsigned queueSize)
+{
+    if (queueSize < 2) queueSize = DF_ASYNCH_QUEUE_SIZE;
+    dfwt = new DFWriteThread(this, queueSize, DF_ASYNCH_BLOCK_SIZE);
+    if (!dfwt->openOutput(dataFile.fileName())) {
+        delete dfwt, dfwt = 0;
+        return false;
+    }
+    if (qgetenv("SPIKEGL_SHA1") != "0") dfwt->startHashing();
+    dfwt->start(QThread::HighPriority);
+    if (compress) {
+        unsigned nThreads = unsigned(QThread::idealThreadCount() > 3 ? QThread::idealThreadCount()/2 : 1);
+        if (nThreads > 8) nThreads = 8;
+        unsigned chunkScans = unsigned(DF_COMPRESS_CHUNK_BYTES / (nChans*sizeof(int16)));
+        if (chunkScans < unsigned(SampleCodec::PartitionSize)) chunkScans = SampleCodec::PartitionSize;
+        dfc = new DFCompressor(this, dfwt, unsigned(nChans), chunkScans, nThreads);
+        if (!dfc->start()) {
+            Error() << "DataFile: could not start compressing " << dataFile.fileName();
+            delete dfc, dfc = 0;
+            delete dfwt, dfwt = 0;
+            return false;
+        }
+        Debug() << "DataFile: compressing " << dataFile.fileName() << " in chunks of " << chunkScans << " scans on " << nThreads << " threads";
+    }
+    return true;
+}
+
+bool DataFile::writeScans(const int16 *scans, unsigned nScans, bool asynch, unsigned asynch_queue_size)
 {
     QMutexLocker ml(&mut);
 
     if (!isOpen()) return false;
     if (!nScans) return true; // for now, we allow empty writes!
-    if (scanCt == 0) {
-        // special case -- Leonardo lab requested that timestamp on data files be the timestamp of when first scan arrived
-        // so, to fudge this we need to close the data file, delete it, and quickly reopen it
-        // the reason we had it open in the first place was to 'reserve' that spot on the disk ;)
-        QString fileName(dataFile.fileName());
-
-        dataFile.remove(); /// remove the 0-byte file
-        dataFile.setFileName(fileName);
-        if (!dataFile.open(QIODevice::WriteOnly|QIODevice::Truncate)) { // reopen it to reset the timestamp
-            Error() << "Failed to open data file " << fileName << " for write!";
-            return false;
-        }
+    if (scanCt == 0 && !dfwt && !reopenForFirstWrite()) return false;
+
+    if (envb.isActive()) envb.add(scans, nScans);
+
+    if (asynch) {
+        if (!dfwt && !startAsynchWriter(asynch_queue_size)) return false;
+        scanCt += nScans;
+        if (dfc) return dfc->put(scans, nScans);
+        return dfwt->put(scans, unsigned(nScans*nChans*sizeof(int16)));
+    } else if (dfwt) {
+        Error() << "INTERNAL: Previous call to DataFile::writeScans() was asynch, now we are synch! This is unsupported! FIXME!";
+        return false;
     }
 
     scanCt += nScans;
@@ -141,43 +354,7 @@ bool DataFile::writeScans(const std::vector<int16> & scans, bool asynch, unsigne
         Error() << "writeScan: Scan needs to be of size a multiple of " << nChans << " chans long (dataFile: " << QFileInfo(dataFile.fileName()).baseName() << ")";
         return false;
     }
-	if (scanCt == 0) {
-		// special case -- Leonardo lab requested that timestamp on data files be the timestamp of when first scan arrived
-		// so, to fudge this we need to close the data file, delete it, and quickly reopen it
-		// the reason we had it open in the first place was to 'reserve' that spot on the disk ;)
-		QString fileName(dataFile.fileName());
-		
-		dataFile.remove(); /// remove the 0-byte file
-		dataFile.setFileName(fileName);
-		if (!dataFile.open(QIODevice::WriteOnly|QIODevice::Truncate)) { // reopen it to reset the timestamp
-			Error() << "Failed to open data file " << fileName << " for write!";
-			return false;				
-		}
-	}
-	
-	scanCt += scans.size()/nChans;
-
-    if (asynch) {
-        (void)threaded_queueSize;
-        Error() << "INTERNAL ERROR: DataFile `asynch'' writeScans mode is no longer supported! Fix the caller!";
-        return false;
-        /*if (!dfwt) {
-            if (threaded_queueSize == 0) threaded_queueSize = SAMPLE_BUF_Q_SIZE;
-            dfwt = new DFWriteThread(this, threaded_queueSize);
-			dfwt->start();
-		}
-		std::vector<int16> scansCopy;
-		scansCopy.reserve(scans.size());
-		scansCopy.insert(scansCopy.begin(), scans.begin(), scans.end());
-		dfwt->enqueueBuffer(scansCopy, 0);
-        return dfwt->dataQueueSize() < dfwt->dataQueueMaxSize;*/
-	} else if (dfwt) { // !asynch but we have a dfwt!! wtf?!
-		Error() << "INTERNAL: Previous call to DataFile::writeScans() was asynch, now we are synch! This is unsupported! FIXME!";
-		delete dfwt;
-		dfwt = 0;
-	}
-	// else .. synch..
-	return doFileWrite(scans);
+    return writeScans(&scans[0], unsigned(scans.size()/nChans), asynch, threaded_queueSize);
 }
 
 void DataFile::writeCommentToMetaFile(const QString & cmt, bool prepend)
@@ -211,10 +388,9 @@ bool DataFile::doFileWrite(const int16 *scans, unsigned nScans)
     //qDebug("Wrote %d bytes in %f ms",n2Write,tWrite*1e3);
 
     // Sha1 Realtime has update disabled as of 2/9/2016 -- this was causing massive slowdowns on
-    // file saving of large data files.  Will revisit this later.  But noone was using the sha1
-    // hash's anyway.  Right now the Sha1 Verify... popup will warn if the sha1 hash is 0,
-    // and offer the user the opportunity to recompute the hash.s
-    //sha.UpdateHash((const uint8_t *)&scans[0], n2Write);
+    // file saving of large data files.  Asynch writes are now hashed on the DFWriteThread's hashing
+    // thread instead (see Sha1Tree); synchronous ones still get sha1 = 0, and the Sha1 Verify...
+    // popup offers to compute it later.
 
 	// update write speed..
 	writeRateAvg = (writeRateAvg*nWritesAvg+(n2Write/tWrite))/double(nWritesAvg+1);
@@ -262,7 +438,6 @@ bool DataFile::openForReWrite(const DataFile & other, const QString & filename,
     params.remove("badData"); // rebuild this as we write!
 	scanCt = 0;
 	nChans = nOnChans;
-	sha.Reset();
 	sRate = other.sRate;
 	range = other.range;
     writeRateAvg = 0.;
@@ -293,6 +468,11 @@ bool DataFile::openForReWrite(const DataFile & other, const QString & filename,
 	if (params.contains("chanDisplayNames")) params["chanDisplayNames"] = cdnStr;
 	if (params.contains("customRanges")) params["customRanges"] = crStr;
 	pd_chanId = other.pd_chanId;
+	if (qgetenv("SPIKEGL_ENVELOPE") != "0") envb.begin(outputFile, nChans);
+	compress = params.value("compressDataFile", false).toBool();
+	compressRatio = 1.;
+	params.remove("compression"); // closeAndFinalize() puts these back if this file ends up compressed too
+	params.remove("uncompressedSizeBytes");
 	
 	return true;
 }
@@ -325,7 +505,6 @@ bool DataFile::openForWrite(const DAQ::Params & dp, const QString & filename_ove
         Error() << "Failed to open either one or both of the data and meta files for " << outputFile;
         return false;
     }
-    sha.Reset();
     params = Params();
     badData.clear();
     scanCt = 0;
@@ -392,6 +571,9 @@ bool DataFile::openForWrite(const DAQ::Params & dp, const QString & filename_ove
         params["bug_dataRate"] = dp.bug.rate;
     }
     params["acqStartEndMode"] = DAQ::AcqStartEndModeToString(dp.acqStartEndMode);
+    params["compressDataFile"] = dp.compressDataFile;
+    params["spikeDetect"] = dp.spikeDetect;
+    if (dp.spikeDetect) params["spikeDetectSigmas"] = dp.spikeDetectSigmas;
     if (dp.demuxedBitMap.count(false)) {
         params["saveChannelSubset"] = dp.subsetString;
     } else 
@@ -412,6 +594,9 @@ bool DataFile::openForWrite(const DAQ::Params & dp, const QString & filename_ove
 		}
 		params["chanDisplayNames"] = str;
 	}
+	if (qgetenv("SPIKEGL_ENVELOPE") != "0") envb.begin(outputFile, nChans);
+	compress = dp.compressDataFile;
+	compressRatio = 1.;
 	
     return true;
 }
@@ -488,6 +673,7 @@ bool DataFile::openForRead(const QString & file_in)
 		Error() << "Cannot open data file: " << error;
 		return false;
 	}
+	unmapWindow();
 	dataFile.close();  metaFile.close();
 	dataFile.setFileName(file);
     metaFile.setFileName(metaFileForFileName(file));	
@@ -505,6 +691,10 @@ bool DataFile::openForRead(const QString & file_in)
 	nChans = params["nChans"].toUInt();
 	sRate = params["sRateHz"].toDouble();
 	scanCt = (fsize / (qint64)sizeof(int16)) / static_cast<qint64>(nChans);
+	if (!openCompressed()) {
+		dataFile.close(); metaFile.close();
+		return false;
+	}
 	range.min = params["rangeMin"].toDouble();
 	range.max = params["rangeMax"].toDouble();
 	customRanges.clear();
@@ -562,7 +752,8 @@ bool DataFile::openForRead(const QString & file_in)
             }
         }
     }
-	Debug() << "Opened " << QFileInfo(file).fileName() << " " << nChans << " chans @" << sRate << " Hz, " << scanCt << " scans total.";
+	mapOk = !compressed && qgetenv("SPIKEGL_DATAFILE_MMAP") != "0";
+	Debug() << "Opened " << QFileInfo(file).fileName() << " " << nChans << " chans @" << sRate << " Hz, " << scanCt << " scans total" << (compressed ? " (compressed)." : ".");
 	mode = Input;
 	return true;
 }
@@ -587,6 +778,65 @@ i64 DataFile::readScans(std::vector<int16> & scans_out, u64 pos, u64 num2read, c
 	
 	u64 cur = pos;
 	i64 nout = 0;
+
+	if (compressed) {
+		// decode a chunk at a time, then copy out of that like the mapped case below
+		if (!nChansOn) return i64((num2read + downSampleFactor - 1) / downSampleFactor);
+		std::vector<int> onChans;
+		for (int i = 0; i < nChans; ++i)
+			if (chset.testBit(i)) onChans.push_back(i);
+		ScanGather g(nChans, onChans);
+		while (cur < pos + num2read) {
+			if (!loadChunk(cur / zChunkScans)) {
+				Error() << "Corrupt compressed data in dataFile::readScans()!";
+				scans_out.clear();
+				return -1;
+			}
+			const u64 first = u64(zChunkNum) * zChunkScans, end = qMin(first + zChunkLen, pos + num2read);
+			if (cur >= end) break; // scanCt says there's more than the chunks hold
+			if (downSampleFactor == 1) {
+				g.apply(&zChunk[(cur - first) * nChans], &scans_out[nout * nChansOn], unsigned(end - cur));
+				nout += i64(end - cur);
+				cur = end;
+			} else {
+				for ( ; cur < end; cur += downSampleFactor, ++nout) {
+					const int16 *s = &zChunk[(cur - first) * nChans];
+					int16 *out = &scans_out[nout * nChansOn];
+					for (unsigned j = 0; j < nChansOn; ++j) out[j] = s[onChans[j]];
+				}
+			}
+		}
+		scans_out.resize(size_t(nout) * nChansOn);
+		return nout;
+	}
+
+	if (mapOk && nChansOn) {
+		// copy straight out of the mapped file, a window at a time
+		ScanView v;
+		ScanGather g;
+		while (cur < pos + num2read) {
+			const i64 n = mapScans(v, cur, pos + num2read - cur, chset, downSampleFactor);
+			if (n <= 0) break;
+			int16 *out = &scans_out[nout * nChansOn];
+			if (downSampleFactor == 1) {
+				if (g.inScanSize() != unsigned(nChans)) g.setIndices(nChans, v.chans);
+				g.apply(v.base, out, unsigned(n));
+			} else {
+				for (i64 i = 0; i < n; ++i, out += nChansOn)
+					v.copyScan(i, out);
+			}
+			nout += n;
+			cur += u64(n) * downSampleFactor;
+		}
+		if (cur >= pos + num2read) return nout;
+		if (nout) {
+			Error() << "Mapping failed part way through dataFile::readScans()!";
+			scans_out.clear();
+			return -1;
+		}
+		// otherwise mapping just got disabled, fall through to reading it..
+	}
+
 	std::vector<int> onChans;
 	onChans.reserve(chset.size());
 	for (int i = 0, n = chset.size(); i < n; ++i) 
@@ -642,6 +892,139 @@ i64 DataFile::readScans(std::vector<int16> & scans_out, u64 pos, u64 num2read, c
 	return nout;
 }
 
+i64 DataFile::mapScans(ScanView & v, u64 pos, u64 num2read, const QBitArray & channelSubset, unsigned downSampleFactor)
+{
+	v = ScanView();
+	if (!mapOk || mode != Input || nChans <= 0) return -1;
+	if (pos > scanCt) return -1;
+	if (num2read + pos > scanCt) num2read = scanCt - pos;
+	if (downSampleFactor <= 0) downSampleFactor = 1;
+	v.stride = unsigned(nChans) * downSampleFactor;
+	if (channelSubset.size() == nChans) {
+		for (int i = 0; i < nChans; ++i)
+			if (channelSubset.testBit(i)) v.chans.push_back(i);
+	} else {
+		v.chans.resize(nChans);
+		for (int i = 0; i < nChans; ++i) v.chans[i] = i;
+	}
+	if (!num2read) return 0;
+
+	const qint64 scanBytes = qint64(nChans) * qint64(sizeof(int16));
+	u64 nout = (num2read + downSampleFactor - 1) / downSampleFactor;
+	const qint64 begin = qint64(pos) * scanBytes;
+	// if the whole range won't fit in one window, only map as many scans as will
+	const qint64 maxBytes = qint64(DF_MAP_WINDOW_SIZE) - DF_MAP_ALIGN;
+	const qint64 strideBytes = qint64(v.stride) * qint64(sizeof(int16));
+	if (qint64(nout - 1) * strideBytes + scanBytes > maxBytes)
+		nout = u64((maxBytes - scanBytes) / strideBytes) + 1;
+	const qint64 end = begin + qint64(nout - 1) * strideBytes + scanBytes;
+
+	if (!mapWindow(begin, end)) return -1;
+	v.base = reinterpret_cast<const int16 *>(mapPtr + (begin - mapOff));
+	v.nScans = nout;
+	return i64(nout);
+}
+
+bool DataFile::mapWindow(qint64 begin, qint64 end)
+{
+	if (mapPtr && begin >= mapOff && end <= mapOff + mapLen) return true;
+	unmapWindow();
+	const qint64 fsize = dataFile.size();
+	if (end > fsize) end = fsize;
+	// center the window on the requested range, so that scrolling back and forth in the file viewer stays in it
+	qint64 len = qint64(DF_MAP_WINDOW_SIZE), slack = len - (end - begin) - DF_MAP_ALIGN;
+	if (slack < 0) slack = 0;
+	qint64 off = begin - slack / 2;
+	if (off + len > fsize) off = fsize - len;
+	if (off < 0) off = 0;
+	off -= off % DF_MAP_ALIGN;
+	if (len < end - off) len = end - off; // only ever grows by less than DF_MAP_ALIGN
+	if (len > fsize - off) len = fsize - off;
+	if (end > off + len) { Error() << "INTERNAL ERROR: DataFile::mapWindow() range does not fit in the map window!"; return false; }
+	mapPtr = dataFile.map(off, len);
+	if (!mapPtr) {
+		Warning() << "Could not memory-map " << QFileInfo(dataFile.fileName()).fileName() << " (" << dataFile.errorString() << "), reading it instead.";
+		mapOk = false;
+		return false;
+	}
+	mapOff = off, mapLen = len;
+	if (excessiveDebug) Debug() << "DataFile: mapped bytes " << off << "-" << (off+len) << " of " << QFileInfo(dataFile.fileName()).fileName();
+	return true;
+}
+
+void DataFile::unmapWindow()
+{
+	if (mapPtr) dataFile.unmap(mapPtr);
+	mapPtr = 0, mapOff = mapLen = 0;
+}
+
+bool DataFile::openCompressed()
+{
+	compressed = false;
+	zChunkOffsets.clear();
+	zChunkNum = -1, zChunkLen = 0;
+	DFCompressor::ZHeader h;
+	if (dataFile.peek(reinterpret_cast<char *>(&h), sizeof(h)) != qint64(sizeof(h)) || memcmp(h.magic, zHeaderMagic, sizeof(h.magic)))
+		return true; // a plain .bin
+	if (h.version != DFCompressor::Version || h.nChans != quint32(nChans) || !h.chunkScans) {
+		Error() << QFileInfo(dataFile.fileName()).fileName() << " is a compressed data file of an unsupported version, or doesn't match its .meta file.";
+		return false;
+	}
+	compressed = true;
+	zChunkScans = h.chunkScans;
+	const qint64 fsize = dataFile.size();
+	DFCompressor::ZFooter f;
+	bool ok = fsize >= qint64(sizeof(h) + sizeof(f)) && dataFile.seek(fsize - qint64(sizeof(f)))
+	          && dataFile.read(reinterpret_cast<char *>(&f), sizeof(f)) == qint64(sizeof(f)) && !memcmp(f.magic, zFooterMagic, sizeof(f.magic))
+	          && f.indexOffset + f.nChunks*sizeof(u64) + sizeof(f) == u64(fsize)
+	          && f.nScans <= f.nChunks*zChunkScans && f.nScans + zChunkScans > f.nChunks*zChunkScans
+	          && dataFile.seek(qint64(f.indexOffset));
+	if (ok) {
+		zChunkOffsets.resize(int(f.nChunks));
+		ok = !f.nChunks || dataFile.read(reinterpret_cast<char *>(zChunkOffsets.data()), qint64(f.nChunks*sizeof(u64))) == qint64(f.nChunks*sizeof(u64));
+		scanCt = f.nScans;
+	}
+	if (!ok) {
+		// the recording never got to write the index, so find the chunks by walking them
+		Warning() << QFileInfo(dataFile.fileName()).fileName() << " has no chunk index (was the recording cut short?), rebuilding it.";
+		zChunkOffsets.clear();
+		u64 n = 0;
+		qint64 off = sizeof(h);
+		DFCompressor::ZChunk c;
+		while (dataFile.seek(off) && dataFile.read(reinterpret_cast<char *>(&c), sizeof(c)) == qint64(sizeof(c))
+			   && !memcmp(c.magic, zChunkMagic, sizeof(c.magic)) && c.nScans && c.nScans <= zChunkScans
+			   && off + qint64(sizeof(c) + c.nBytes) <= fsize) {
+			zChunkOffsets.push_back(u64(off));
+			n += c.nScans;
+			off += qint64(sizeof(c) + c.nBytes);
+			if (c.nScans < zChunkScans) break; // only the last chunk is short
+		}
+		scanCt = n;
+	}
+	return true;
+}
+
+bool DataFile::loadChunk(u64 i)
+{
+	if (zChunkNum >= 0 && u64(zChunkNum) == i) return true;
+	zChunkNum = -1;
+	if (i >= u64(zChunkOffsets.size())) return false;
+	DFCompressor::ZChunk c;
+	if (!dataFile.seek(qint64(zChunkOffsets[int(i)])) || dataFile.read(reinterpret_cast<char *>(&c), sizeof(c)) != qint64(sizeof(c))
+		|| memcmp(c.magic, zChunkMagic, sizeof(c.magic)) || !c.nScans || c.nScans > zChunkScans)
+		return false;
+	zBuf.resize(c.nBytes ? c.nBytes : 1);
+	if (dataFile.read(reinterpret_cast<char *>(&zBuf[0]), qint64(c.nBytes)) != qint64(c.nBytes)) return false;
+	zChunk.resize(size_t(c.nScans)*nChans);
+	if (c.flags & DFCompressor::ChunkStored) {
+		if (c.nBytes != zChunk.size()*sizeof(int16)) return false;
+		memcpy(&zChunk[0], &zBuf[0], c.nBytes);
+	} else if (!SampleCodec::decode(&zBuf[0], c.nBytes, c.nScans, unsigned(nChans), &zChunk[0]))
+		return false;
+	zChunkNum = i64(i), zChunkLen = c.nScans;
+	return true;
+}
+
 double DataFile::auxGain() const 
 {
 	if (params.contains("auxGain")) {
@@ -698,68 +1081,426 @@ bool DataFile::secondDevIsAuxOnly() const
 	return false;
 }
 
-DFWriteThread::DFWriteThread(DataFile *df, unsigned q_size) : QThread(0), SampleBufQ("Data Write Queue", q_size), d(df), stopflg(false)
-{}
+DFWriteThread::DFWriteThread(DataFile *df, unsigned nb, unsigned bs)
+    : QThread(0), d(df), nBlocks(nb < 2 ? 2 : nb), blockSize(bs), cur(0), stopflg(false), errflg(false), finished(false), unbuffered(false), nBytesPut(0),
+      stalls(DataFile::NumWriteHistoBins, 0), latencies(DataFile::NumWriteHistoBins, 0), hasher(0), hashStop(false), nextSeq(0), tree(bs)
+{
+#ifdef Q_OS_WIN
+    h = INVALID_HANDLE_VALUE;
+#else
+    fd = -1;
+#endif
+    blocks.resize(nBlocks);
+    for (unsigned i = 0; i < nBlocks; ++i) {
+        blocks[i].mem = allocAligned(blockSize);
+        blocks[i].len = blocks[i].dataLen = 0;
+        blocks[i].seq = 0;
+        if (blocks[i].mem) freeQ.push_back(&blocks[i]);
+    }
+}
 
 DFWriteThread::~DFWriteThread()
 {
-	stopflg = true;
-	if (isRunning()) {
-		//Error() << "INTERNAL ERROR: Waiting for data file writer thread to finish!";
-		//qApp->processEvents(QEventLoop::ExcludeUserInputEvents);
-	//	wait();
-	//}
-///*
-		if (!wait(100) && isRunning()) {
-			QMessageBox *mb = new QMessageBox(0);
-			mb->setWindowModality(Qt::ApplicationModal);
-			mb->setStandardButtons(QMessageBox::NoButton);
-			mb->setText("Waiting for data file writer thread, please be patient... ");
-			mb->show();
-			qApp->processEvents(QEventLoop::ExcludeUserInputEvents);
-//			waitForEmpty();
-//			dataQCond.wakeAll();
-			if (isRunning()) wait();
-			delete mb;
-		}
-	}
-//*/
+    finish();
+    if (hasher) delete hasher, hasher = 0;
+    for (unsigned i = 0; i < blocks.size(); ++i)
+        freeAligned(blocks[i].mem), blocks[i].mem = 0;
+}
+
+/* static */ char *DFWriteThread::allocAligned(unsigned sz)
+{
+#ifdef Q_OS_WIN
+    return reinterpret_cast<char *>(_aligned_malloc(sz, DF_DIRECT_IO_ALIGN));
+#else
+    void *p = 0;
+    if (posix_memalign(&p, DF_DIRECT_IO_ALIGN, sz)) return 0;
+    return reinterpret_cast<char *>(p);
+#endif
+}
+
+/* static */ void DFWriteThread::freeAligned(char *p)
+{
+    if (!p) return;
+#ifdef Q_OS_WIN
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+bool DFWriteThread::openOutput(const QString & fn)
+{
+    if (freeQ.size() < 2) {
+        Error() << "DFWriteThread: could not allocate " << nBlocks << " aligned write blocks of " << blockSize << " bytes!";
+        return false;
+    }
+#ifdef Q_OS_WIN
+    h = CreateFileW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(fn).utf16()), GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE, 0,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL|FILE_FLAG_NO_BUFFERING|FILE_FLAG_WRITE_THROUGH, 0);
+    unbuffered = h != INVALID_HANDLE_VALUE;
+    if (!unbuffered) {
+        Warning() << "DFWriteThread: unbuffered open of " << fn << " failed, falling back to buffered writes.";
+        h = CreateFileW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(fn).utf16()), GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE, 0,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    }
+    if (h == INVALID_HANDLE_VALUE) {
+        Error() << "DFWriteThread: could not open " << fn << " for write!";
+        return false;
+    }
+#else
+    const QByteArray path = QFile::encodeName(fn);
+#  ifdef O_DIRECT
+    fd = ::open(path.constData(), O_WRONLY|O_DIRECT);
+    unbuffered = fd > -1;
+#  endif
+    if (fd < 0) fd = ::open(path.constData(), O_WRONLY); // not all filesystems support O_DIRECT (tmpfs, some network FS's)
+    if (fd < 0) {
+        Error() << "DFWriteThread: could not open " << fn << " for write: " << strerror(errno);
+        return false;
+    }
+#  ifdef F_NOCACHE
+    unbuffered = fcntl(fd, F_NOCACHE, 1) == 0; // OSX equivalent of O_DIRECT
+#  endif
+    if (!unbuffered) Warning() << "DFWriteThread: unbuffered I/O unavailable for " << fn << ", falling back to buffered writes.";
+#endif
+    fname = fn; // only set on success, since finish() trims this file
+    Debug() << "DFWriteThread: opened " << fn << (unbuffered ? " (unbuffered)" : " (buffered)") << " with " << nBlocks << " blocks of " << (blockSize/1024) << " KB";
+    return true;
+}
+
+void DFWriteThread::closeOutput()
+{
+#ifdef Q_OS_WIN
+    if (h != INVALID_HANDLE_VALUE) CloseHandle(h), h = INVALID_HANDLE_VALUE;
+#else
+    if (fd > -1) ::close(fd), fd = -1;
+#endif
+}
+
+bool DFWriteThread::writeBlock(const Block & b)
+{
+#ifdef Q_OS_WIN
+    DWORD nw = 0;
+    return WriteFile(h, b.mem, b.len, &nw, 0) && nw == b.len;
+#else
+    unsigned off = 0;
+    while (off < b.len) {
+        ssize_t nw = ::write(fd, b.mem + off, b.len - off);
+        if (nw < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        off += unsigned(nw);
+    }
+    return true;
+#endif
+}
+
+/* static */ void DFWriteThread::histoAdd(QVector<unsigned> & hist, double secs)
+{
+    int bin = 0;
+    for (double ms = secs*1e3; ms >= 1.0 && bin < hist.size()-1; ms /= 2.0) ++bin;
+    ++hist[bin];
+}
+
+/* static */ QString DFWriteThread::histogramToString(const QVector<unsigned> & hist)
+{
+    QString ret;
+    for (int i = 0; i < hist.size(); ++i) {
+        if (!hist[i]) continue;
+        if (ret.length()) ret.append(" ");
+        ret.append(QString("%1:%2").arg(i ? QString("<%1").arg(1<<i) : QString("<1")).arg(hist[i]));
+    }
+    return ret.length() ? ret : QString("(none)");
+}
+
+bool DFWriteThread::put(const void *data, unsigned nBytes)
+{
+    const char *src = reinterpret_cast<const char *>(data);
+    while (nBytes) {
+        if (!cur) {
+            QMutexLocker l(&qmut);
+            if (freeQ.empty()) {
+                const double t0 = getTime();
+                while (freeQ.empty() && !errflg) freeCond.wait(&qmut);
+                histoAdd(stalls, getTime()-t0);
+            }
+            if (errflg) return false;
+            cur = freeQ.front(); freeQ.pop_front();
+            cur->len = 0;
+        }
+        const unsigned n = MIN(nBytes, blockSize - cur->len);
+        memcpy(cur->mem + cur->len, src, n);
+        cur->len += n; src += n; nBytes -= n; nBytesPut += n;
+        if (cur->len == blockSize) {
+            QMutexLocker l(&qmut);
+            cur->dataLen = cur->len; cur->seq = nextSeq++;
+            fullQ.push_back(cur); cur = 0;
+            fullCond.wakeOne();
+        }
+    }
+    return !errflg;
+}
+
+bool DFWriteThread::finish()
+{
+    if (finished) return !errflg;
+    finished = true;
+    {
+        QMutexLocker l(&qmut);
+        if (cur && cur->len) {
+            cur->dataLen = cur->len; cur->seq = nextSeq++;
+            // unbuffered writes need to be a multiple of the sector size, so pad the tail and trim the file afterwards
+            const unsigned padded = ((cur->len + DF_DIRECT_IO_ALIGN - 1) / DF_DIRECT_IO_ALIGN) * DF_DIRECT_IO_ALIGN;
+            memset(cur->mem + cur->len, 0, padded - cur->len);
+            cur->len = padded;
+            fullQ.push_back(cur);
+        } else if (cur)
+            freeQ.push_back(cur);
+        cur = 0;
+        stopflg = true;
+        fullCond.wakeAll();
+    }
+    if (isRunning()) wait();
+    if (hasher) {
+        {
+            QMutexLocker l(&qmut);
+            hashStop = true;
+            hashCond.wakeAll();
+        }
+        hasher->wait();
+        if (!errflg) hashStr = QString::fromLatin1(tree.result(nBytesPut).c_str());
+    }
+    closeOutput();
+    if (!fname.isEmpty() && !QFile::resize(fname, qint64(nBytesPut))) {
+        Error() << "DFWriteThread: could not trim " << fname << " to " << nBytesPut << " bytes!";
+        errflg = true;
+    }
+    return !errflg;
+}
+
+bool DFWriteThread::waitForEmpty(int ms) const
+{
+    QMutexLocker l(&qmut);
+    if (fullQ.empty()) return true;
+    return emptyCond.wait(&qmut, ms < 0 ? ULONG_MAX : static_cast<unsigned long>(ms)) && fullQ.empty();
 }
 
 void DFWriteThread::run()
 {
-    Error() << "DFWriteThread is no longer supported, but was created in SpikeGL!  FIXME!";
-    return;
-/*
-    unsigned bufct = 0, noDataCt = 0;
-	u64 bytect = 0;
-    Debug() << "DFWriteThread started for " << d->fileName() << "  with queueSize " << dataQueueMaxSize << "...";
-	std::vector<int16> buf;
-	u64 scount = 0;
-	while (!stopflg) {
-		while (dequeueBuffer(buf, scount, false, false)) {
-			++bufct;
-			bytect += buf.size() * sizeof(int16);
-			write(buf);
-            noDataCt = 0;
-		}
-        if (++noDataCt > 10000) msleep(1);
-	}
-	Debug() << "DFWriteThread stopped after writing " << bufct << " buffers (" << bytect << " bytes in " << d->scanCount() << " scans).";
-*/
+    Debug() << "DFWriteThread started for " << fname << "...";
+    unsigned bufct = 0;
+    u64 bytect = 0;
+    for (;;) {
+        Block *b = 0;
+        {
+            QMutexLocker l(&qmut);
+            while (fullQ.empty() && !stopflg) fullCond.wait(&qmut);
+            if (fullQ.empty()) break;
+            b = fullQ.front(); // leave it in the queue while it is being written so that queueDepth() counts it
+        }
+        const double t0 = getTime();
+        const bool ok = errflg || writeBlock(*b);
+        const double tWrite = getTime() - t0;
+        if (!ok && !errflg) Error() << "DFWriteThread: write of " << b->len << " bytes to " << fname << " failed!";
+        if (ok && !errflg && tWrite > 0.) {
+            // update write speed..
+            d->writeRateAvg = (d->writeRateAvg*d->nWritesAvg+(b->len/tWrite))/double(d->nWritesAvg+1);
+            if (++d->nWritesAvg > d->nWritesAvgMax) d->nWritesAvg = d->nWritesAvgMax;
+            d->writeRateAvg_for_ui = qRound(d->writeRateAvg);
+        }
+        ++bufct; bytect += b->len;
+        {
+            QMutexLocker l(&qmut);
+            if (!ok) errflg = true;
+            histoAdd(latencies, tWrite);
+            fullQ.pop_front();
+            if (hasher && ok) {
+                hashQ.push_back(b);
+                hashCond.wakeOne();
+            } else {
+                freeQ.push_back(b);
+                freeCond.wakeAll();
+            }
+            if (fullQ.empty()) emptyCond.wakeAll();
+        }
+    }
+	Debug() << "DFWriteThread stopped after writing " << bufct << " blocks (" << bytect << " bytes) to " << fname << ".";
+}
+
+DFCompressor::DFCompressor(DataFile *df, DFWriteThread *o, unsigned nc, unsigned cs, unsigned nThreads)
+    : d(df), out(o), nChans(nc), chunkScans(cs ? cs : 1), cur(0), nextSeq(0), nextOut(0), stopflg(false), errflg(false),
+      started(false), finished(false), nScans(0), nIn(0), nOut(0), busy(0.)
+{
+    if (nThreads < 1) nThreads = 1;
+    jobs.resize(2*nThreads + 1); // enough for every worker to have one in hand and one waiting, plus the producer's
+    for (unsigned i = 0; i < jobs.size(); ++i) {
+        jobs[i].raw.resize(size_t(chunkScans)*nChans);
+        jobs[i].nScans = 0; jobs[i].seq = 0;
+        freeQ.push_back(&jobs[i]);
+    }
+    for (unsigned i = 0; i < nThreads; ++i) workers.push_back(new Worker(this));
+}
+
+DFCompressor::~DFCompressor()
+{
+    finish();
+    for (unsigned i = 0; i < workers.size(); ++i) delete workers[i];
+    workers.clear();
 }
 
-bool DFWriteThread::write(const std::vector<int16> & scans)
+bool DFCompressor::start()
 {
-	if (!d || ! d->dataFile.isWritable() ) return false;
-	return d->doFileWrite(scans);
+    ZHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, zHeaderMagic, sizeof(h.magic));
+    h.version = Version;
+    h.nChans = nChans;
+    h.chunkScans = chunkScans;
+    if (!out->put(&h, sizeof(h))) return false;
+    for (unsigned i = 0; i < workers.size(); ++i) workers[i]->start(QThread::HighPriority);
+    started = true;
+    return true;
+}
+
+void DFCompressor::submit()
+{
+    cur->seq = nextSeq++;
+    todoQ.push_back(cur); cur = 0;
+    todoCond.wakeOne();
+}
+
+bool DFCompressor::put(const int16 *scans, unsigned n)
+{
+    while (n) {
+        if (!cur) {
+            QMutexLocker l(&qmut);
+            while (freeQ.empty() && !errflg) freeCond.wait(&qmut);
+            if (errflg) return false;
+            cur = freeQ.front(); freeQ.pop_front();
+            cur->nScans = 0;
+        }
+        const unsigned k = MIN(n, chunkScans - cur->nScans);
+        memcpy(&cur->raw[size_t(cur->nScans)*nChans], scans, size_t(k)*nChans*sizeof(int16));
+        cur->nScans += k; scans += size_t(k)*nChans; n -= k; nScans += k;
+        if (cur->nScans == chunkScans) {
+            QMutexLocker l(&qmut);
+            submit();
+        }
+    }
+    return !errflg;
+}
+
+void DFCompressor::work()
+{
+    for (;;) {
+        Job *j = 0;
+        {
+            QMutexLocker l(&qmut);
+            while (todoQ.empty() && !stopflg) todoCond.wait(&qmut);
+            if (todoQ.empty()) break;
+            j = todoQ.front(); todoQ.pop_front();
+        }
+        const double t0 = getTime();
+        const size_t rawBytes = size_t(j->nScans)*nChans*sizeof(int16);
+        j->enc.resize(sizeof(ZChunk) + SampleCodec::maxEncodedBytes(j->nScans, nChans));
+        ZChunk *zc = reinterpret_cast<ZChunk *>(&j->enc[0]);
+        memcpy(zc->magic, zChunkMagic, sizeof(zc->magic));
+        zc->nScans = j->nScans;
+        zc->flags = 0;
+        size_t n = SampleCodec::encode(&j->raw[0], j->nScans, nChans, &j->enc[sizeof(ZChunk)]);
+        if (n >= rawBytes) {
+            // noise, or something else that doesn't compress: store it
+            memcpy(&j->enc[sizeof(ZChunk)], &j->raw[0], rawBytes);
+            n = rawBytes;
+            zc->flags = ChunkStored;
+        }
+        zc->nBytes = quint32(n);
+        const double tEnc = getTime() - t0;
+        {
+            // hand the chunks to the writer in order.  Workers take chunks in order, so the one holding nextOut isn't waiting here.
+            QMutexLocker l(&qmut);
+            while (j->seq != nextOut) outCond.wait(&qmut);
+        }
+        const u64 off = out->bytesPut();
+        const bool ok = !errflg && out->put(&j->enc[0], unsigned(sizeof(ZChunk) + n));
+        {
+            QMutexLocker l(&qmut);
+            if (!ok) errflg = true;
+            else offsets.push_back(off);
+            ++nextOut;
+            nIn += rawBytes; nOut += sizeof(ZChunk) + n; busy += tEnc;
+            if (nOut) d->compressRatio = double(nIn) / double(nOut);
+            freeQ.push_back(j);
+            outCond.wakeAll();
+            freeCond.wakeAll();
+        }
+    }
+}
+
+bool DFCompressor::finish()
+{
+    if (finished) return !errflg;
+    finished = true;
+    {
+        QMutexLocker l(&qmut);
+        if (cur && cur->nScans) submit();
+        else if (cur) freeQ.push_back(cur), cur = 0;
+        stopflg = true;
+        todoCond.wakeAll();
+    }
+    for (unsigned i = 0; i < workers.size(); ++i)
+        if (workers[i]->isRunning()) workers[i]->wait();
+    if (errflg || !started) return false;
+    ZFooter f;
+    memset(&f, 0, sizeof(f));
+    f.indexOffset = out->bytesPut();
+    f.nChunks = offsets.size();
+    f.nScans = nScans;
+    memcpy(f.magic, zFooterMagic, sizeof(f.magic));
+    if ((offsets.size() && !out->put(&offsets[0], unsigned(offsets.size()*sizeof(u64)))) || !out->put(&f, sizeof(f)))
+        errflg = true;
+    return !errflg;
+}
+
+void DFWriteThread::startHashing()
+{
+    if (hasher) return;
+    hasher = new HashThread(this);
+    hasher->start();
+}
+
+void DFWriteThread::hashLoop()
+{
+    const double t0 = getTime();
+    double busy = 0.;
+    for (;;) {
+        Block *b = 0;
+        {
+            QMutexLocker l(&qmut);
+            while (hashQ.empty() && !hashStop) hashCond.wait(&qmut);
+            if (hashQ.empty()) break;
+            b = hashQ.front(); hashQ.pop_front();
+        }
+        const double t1 = getTime();
+        uint8_t digest[20];
+        Sha1Tree::hashBlock(b->mem, b->dataLen, digest);
+        tree.setLeaf(b->seq, digest);
+        busy += getTime() - t1;
+        {
+            QMutexLocker l(&qmut);
+            freeQ.push_back(b);
+            freeCond.wakeAll();
+        }
+    }
+    Debug() << "DFWriteThread: hashed " << nBytesPut << " bytes of " << fname << ", busy " << (getTime() > t0 ? 100.*busy/(getTime()-t0) : 0.) << "% of the time";
 }
 
 /// Returns true iff we did an asynch write and we have writes that still haven't finished.  False otherwise.
 bool DataFile::hasPendingWrites() const
 {
 	if (mode == Output && dfwt) {
-		return dfwt->dataQueueSize() > 0;
+		return dfwt->queueDepth() > 0;
 	}
 	return false;
 }
@@ -773,7 +1514,26 @@ bool DataFile::waitForPendingWrites(int timeout_ms) const
 
 double DataFile::pendingWriteQFillPct() const
 {
-	if (dfwt) return (dfwt->dataQueueSize() / double(dfwt->dataQueueMaxSize)) * 100.;
+	if (dfwt) return (dfwt->queueDepth() / double(dfwt->queueMaxDepth())) * 100.;
 	return 0.;
 }
 
+unsigned DataFile::pendingWriteQDepth() const
+{
+    if (dfwt) return dfwt->queueDepth();
+    return 0;
+}
+
+QVector<unsigned> DataFile::writeStallHistogram() const
+{
+    QMutexLocker ml(&mut);
+    if (dfwt) return dfwt->stallHistogram();
+    return QVector<unsigned>();
+}
+
+QVector<unsigned> DataFile::writeLatencyHistogram() const
+{
+    QMutexLocker ml(&mut);
+    if (dfwt) return dfwt->latencyHistogram();
+    return QVector<unsigned>();
+}
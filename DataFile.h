@@ -13,12 +13,15 @@
 #include "sha1.h"
 #include "DAQ.h"
 #include "ChanMap.h"
+#include "EnvelopeIndex.h"
 
 class DFWriteThread;
+class DFCompressor;
 
 class DataFile
 {
 	friend class DFWriteThread;
+	friend class DFCompressor;
 	
 public:
     DataFile();
@@ -68,15 +71,24 @@ public:
     /** Write complete scans to the file.  File must have been opened for write 
 		using openForWrite().
         Must be vector of length a multiple of  numChans() otherwise it will 
-	    fail unconditionally */
+	    fail unconditionally.
+        If asynch is true, the data is copied into a page-aligned block and handed off to a 
+        dedicated writer thread which writes whole blocks to disk using unbuffered I/O 
+        (O_DIRECT, F_NOCACHE, or FILE_FLAG_NO_BUFFERING depending on platform).  
+        asynch_queue_size is the number of DF_ASYNCH_BLOCK_SIZE blocks in the writer's pool
+        (0 means DF_ASYNCH_QUEUE_SIZE).  Once a file has been written asynchronously, all 
+        subsequent writes to it must also be asynch.
+        If compressDataFile was set in the params the file was opened with, asynch writes are
+        losslessly compressed by a pool of worker threads before they go to the writer thread (see
+        DFCompressor for the file format).  readScans() reads such files transparently. */
     bool writeScans(const std::vector<int16> & scan, bool asynch = false, unsigned asynch_queue_size = 0);
 	
 
-    /// *synchronous* write of a scan to a file.  File must have been opened for write
+    /// Write of a scan to a file.  File must have been opened for write
     /// using openForWrite()
     /// A scan is defined as a unit of numChans() samples.  Pass the scanCt to tell this function how many scans
-    /// are in `scans'.
-    bool writeScans(const int16 *scans, unsigned scanCt);
+    /// are in `scans'.  See the above function for the meaning of asynch and asynch_queue_size.
+    bool writeScans(const int16 *scans, unsigned scanCt, bool asynch = false, unsigned asynch_queue_size = 0);
 
 	/// Returns true iff we did an asynch write and we have writes that still haven't finished.  False otherwise.
 	bool hasPendingWrites() const;
@@ -86,6 +98,17 @@ public:
 	
 	/// If using asynch writes, returns the pending write queue fill percent, otherwise 0.
 	double pendingWriteQFillPct() const;
+
+    /// If using asynch writes, returns the number of full blocks waiting to be written (or being written), otherwise 0.
+    unsigned pendingWriteQDepth() const;
+
+    enum { NumWriteHistoBins = 12 };
+    /** If using asynch writes, returns a histogram of the times writeScans() blocked waiting for the writer thread
+        to free up a block.  Bin 0 counts stalls shorter than 1 ms, bin i counts stalls in [2^(i-1), 2^i) ms, and
+        the last bin counts everything longer.  Returns an empty vector if not using asynch writes. */
+    QVector<unsigned> writeStallHistogram() const;
+    /// Same binning as writeStallHistogram(), but for the duration of each block write done by the writer thread.
+    QVector<unsigned> writeLatencyHistogram() const;
 	
 	/** Read scans from the file.  File must have been opened for read
 	    using openForRead().  Returns number of scans actually read or -1 on failure.  
@@ -93,8 +116,38 @@ public:
 	    NB 2: Short reads are supported -- that is, if pos + num2read is past 
 	    the end of file, the number of scans available is read instead.  
         The return value will reflect this.
+        The scans are copied out of the memory-mapped file (see mapScans()) when possible, or read the
+        old-fashioned way otherwise.
         Note: this function is not threadsafe as it was never intended to be called by threaded code. */
 	i64 readScans(std::vector<int16> & scans_out, u64 pos, u64 num2read, const QBitArray & channelSubset = QBitArray(), unsigned downSampleFactor = 1);
+
+    /** A read-only, strided view of some scans of a file opened for read, pointing straight into the memory-mapped
+        file (see mapScans()).  View scan i is file scan pos + i*downSampleFactor, and view channel j is file
+        channel chans[j]. */
+    struct ScanView {
+        const int16 *base; ///< the first (full) scan in the view
+        u64 nScans; ///< number of scans in the view
+        unsigned stride; ///< distance in samples between consecutive view scans, that is numChans() * downSampleFactor
+        std::vector<int> chans; ///< the file channel for each view channel
+
+        ScanView() : base(0), nScans(0), stride(0) {}
+        unsigned numChans() const { return unsigned(chans.size()); }
+        /// all of the file's channels for view scan i
+        const int16 *scan(u64 i) const { return base + i*stride; }
+        int16 at(u64 i, unsigned j) const { return base[i*stride + chans[j]]; }
+        /// copies the numChans() channels of view scan i, packed, to out
+        void copyScan(u64 i, int16 *out) const { const int16 *s = scan(i); for (unsigned j = 0; j < chans.size(); ++j) out[j] = s[chans[j]]; }
+    };
+
+    /** Like readScans(), but doesn't read or copy anything: view is pointed at the requested scans in a window
+        of the memory-mapped file.  The window slides along (it is DF_MAP_WINDOW_SIZE bytes, unless the file is
+        smaller), so the view is only valid until the next call to mapScans() or readScans(), or until the file
+        is closed.  Short reads are possible both at the end of the file and when the requested range does not
+        fit in one window, so check the return value, which is the number of scans in the view.
+        Returns -1 if the file can't be mapped (or mapping was disabled by setting the environment variable
+        SPIKEGL_DATAFILE_MMAP=0), in which case use readScans().
+        Note: this function is not threadsafe as it was never intended to be called by threaded code. */
+    i64 mapScans(ScanView & view, u64 pos, u64 num2read, const QBitArray & channelSubset = QBitArray(), unsigned downSampleFactor = 1);
 	
     // all below functions are not threadsafe.. they are not called by anything other than the main thread typically, or if they are.
     // they use volatile ints and such or return 'non-critical' data...
@@ -118,8 +171,10 @@ public:
 
     /// the average speed in bytes/sec for writes
     double writeSpeedBytesSec() const { return writeRateAvg_for_ui; }
-    /// the minimal write speed required in bytes/sec, based on sample rate
-    double minimalWriteSpeedRequired() const { return nChans*sizeof(int16)*double(sRate); }
+    /// the minimal write speed required in bytes/sec, based on sample rate (and the compression ratio so far, if compressing)
+    double minimalWriteSpeedRequired() const { return nChans*sizeof(int16)*double(sRate) / compressRatio; }
+    /// true if the file opened for read is a compressed one (see writeScans()).  mapScans() always fails on those.
+    bool isCompressed() const { return compressed; }
 
 	/// Add a comment to the meta file.  Comments will appear BEFORE all the name = value pairs in the file.
 	/// This was added on 2/5/2015 in order to support 'meta' data coming in from the bug3/telemetry USB-based
@@ -135,6 +190,12 @@ public:
 protected:
 	bool doFileWrite(const std::vector<int16> & scans);
     bool doFileWrite(const int16 *scans, unsigned nScans);
+    bool reopenForFirstWrite(); ///< resets the file timestamp to that of the first scan (see writeScans())
+    bool startAsynchWriter(unsigned queueSize);
+    bool mapWindow(qint64 begin, qint64 end); ///< makes sure file bytes [begin,end) are mapped, sliding the window if need be
+    void unmapWindow();
+    bool openCompressed(); ///< reads the header and chunk index of a compressed file opened for read
+    bool loadChunk(u64 chunk); ///< decodes chunk number `chunk' of a compressed file into zChunk, unless it's already there
 
     mutable QMutex mut;
 
@@ -160,10 +221,27 @@ private:
 	int pd_chanId;
 	
 	/// member vars used for Output mode only
-    SHA1 sha;
     volatile unsigned writeRateAvg_for_ui; ///< in bytes/sec
     double writeRateAvg; ///< in bytes/sec
     unsigned nWritesAvg, nWritesAvgMax; ///< the number of writes in the average, tops off at sRate/10
 	DFWriteThread *dfwt;
+	DFCompressor *dfc; ///< only if compressing, see writeScans()
+	bool compress; ///< params compressDataFile at open time
+	volatile double compressRatio; ///< uncompressed/compressed bytes so far, 1 if not compressing
+	EnvelopeIndex::Builder envb; ///< writes the .env sidecar as we go, see EnvelopeIndex
+
+	/// member vars used for memory-mapped reads (Input mode)
+	uchar *mapPtr;
+	qint64 mapOff, mapLen;
+	bool mapOk; ///< false if mapping is disabled or failed once for this file
+
+	/// member vars used for reading compressed files (Input mode)
+	bool compressed;
+	unsigned zChunkScans; ///< chunk i holds scans [i*zChunkScans, (i+1)*zChunkScans)
+	QVector<u64> zChunkOffsets;
+	i64 zChunkNum; ///< the chunk in zChunk, or -1
+	unsigned zChunkLen; ///< in scans
+	std::vector<int16> zChunk;
+	std::vector<uchar> zBuf;
 };
 #endif
@@ -0,0 +1,270 @@
+#include "EnvelopeIndex.h"
+#include "DataFile.h"
+#include "Util.h"
+#include <QFileInfo>
+#include <string.h>
+
+static const char envMagic[8] = "SGLENV1";
+
+EnvelopeIndex::EnvelopeIndex()
+    : nChans(0)
+{}
+
+/* static */ QString EnvelopeIndex::fileNameFor(const QString & binFileName)
+{
+    QFileInfo fi(binFileName);
+    return fi.path() + "/" + fi.completeBaseName() + ".env";
+}
+
+bool EnvelopeIndex::open(const QString & binFileName, unsigned nchans, u64 scanCt)
+{
+    close();
+    f.setFileName(fileNameFor(binFileName));
+    if (!f.exists() || !f.open(QIODevice::ReadOnly)) return false;
+    Header h;
+    if (f.read(reinterpret_cast<char *>(&h), sizeof(h)) != qint64(sizeof(h))
+        || memcmp(h.magic, envMagic, sizeof(envMagic)) || h.version != Version
+        || h.baseDecimation != BaseDecimation || h.chunkBuckets != ChunkBuckets
+        || h.nChans != nchans || h.scanCt != scanCt || h.binFileSize != u64(QFileInfo(binFileName).size())
+        || !h.footerOffset || !f.seek(qint64(h.footerOffset))) {
+        Debug() << "Envelope index " << f.fileName() << " is incomplete or stale, ignoring it.";
+        close();
+        return false;
+    }
+    nChans = nchans;
+    levels.resize(h.nLevels);
+    for (unsigned l = 0; l < h.nLevels; ++l) {
+        quint64 nb = 0; quint32 nc = 0;
+        if (f.read(reinterpret_cast<char *>(&nb), sizeof(nb)) != qint64(sizeof(nb))
+            || f.read(reinterpret_cast<char *>(&nc), sizeof(nc)) != qint64(sizeof(nc))
+            || (nb + ChunkBuckets - 1) / ChunkBuckets != nc) {
+            Error() << "Envelope index " << f.fileName() << " has a corrupt footer.";
+            close();
+            return false;
+        }
+        levels[l].nBuckets = nb;
+        levels[l].chunkOffsets.resize(nc);
+        if (nc && f.read(reinterpret_cast<char *>(&levels[l].chunkOffsets[0]), qint64(nc*sizeof(u64))) != qint64(nc*sizeof(u64))) {
+            Error() << "Envelope index " << f.fileName() << " has a truncated footer.";
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void EnvelopeIndex::close()
+{
+    f.close();
+    levels.clear();
+    nChans = 0;
+}
+
+int EnvelopeIndex::levelFor(u64 maxDecimation) const
+{
+    int ret = -1;
+    for (unsigned l = 0; l < levels.size() && decimation(l) <= maxDecimation; ++l) ret = int(l);
+    return ret;
+}
+
+i64 EnvelopeIndex::read(unsigned level, u64 first, u64 n, const std::vector<int> & chans, std::vector<int16> & out)
+{
+    if (!isOpen() || level >= levels.size()) return -1;
+    const Level & L(levels[level]);
+    if (first > L.nBuckets) return -1;
+    if (first + n > L.nBuckets) n = L.nBuckets - first;
+    const unsigned nOut = unsigned(chans.size()), bucketSize = nChans*2;
+    out.resize(n * nOut * 2);
+    u64 b = first;
+    int16 *o = n ? &out[0] : 0;
+    while (b < first + n) {
+        const u64 chunk = b / ChunkBuckets, inChunk = b % ChunkBuckets;
+        u64 cnt = ChunkBuckets - inChunk;
+        if (cnt > first + n - b) cnt = first + n - b;
+        buf.resize(cnt * bucketSize);
+        const qint64 nbytes = qint64(buf.size() * sizeof(int16));
+        if (!f.seek(qint64(L.chunkOffsets[chunk] + inChunk*bucketSize*sizeof(int16)))
+            || f.read(reinterpret_cast<char *>(&buf[0]), nbytes) != nbytes) {
+            Error() << "Error reading envelope index " << f.fileName();
+            return -1;
+        }
+        for (u64 i = 0; i < cnt; ++i) {
+            const int16 *mm = &buf[i*bucketSize];
+            for (unsigned j = 0; j < nOut; ++j, o += 2)
+                o[0] = mm[chans[j]*2], o[1] = mm[chans[j]*2+1];
+        }
+        b += cnt;
+    }
+    return i64(n);
+}
+
+EnvelopeIndex::Builder::Builder()
+    : nChans(0), nScans(0), err(false)
+{}
+
+EnvelopeIndex::Builder::~Builder()
+{
+    if (f.isOpen()) {
+        f.close();
+        f.remove();
+    }
+}
+
+bool EnvelopeIndex::Builder::begin(const QString & binFileName, unsigned nchans)
+{
+    if (f.isOpen()) { f.close(); f.remove(); }
+    nChans = nchans;
+    nScans = 0;
+    err = false;
+    levels.clear();
+    levels.reserve(64); // never reallocated: closeBucket() holds on to a Level while pushing to the next one
+    f.setFileName(fileNameFor(binFileName));
+    if (!nChans || !f.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+        Warning() << "Could not create envelope index " << f.fileName();
+        return false;
+    }
+    Header h;
+    memset(&h, 0, sizeof(h)); // an all-zero header marks the index as incomplete
+    if (f.write(reinterpret_cast<const char *>(&h), sizeof(h)) != qint64(sizeof(h))) {
+        Warning() << "Could not write envelope index " << f.fileName();
+        f.close(); f.remove();
+        return false;
+    }
+    levels.push_back(Level());
+    levels[0].partial.resize(nChans*2);
+    return true;
+}
+
+void EnvelopeIndex::Builder::add(const int16 *scans, unsigned n)
+{
+    if (!f.isOpen() || err) return;
+    Level & L0(levels[0]);
+    int16 * const mm = &L0.partial[0];
+    for (unsigned s = 0; s < n; ++s, scans += nChans) {
+        if (!L0.nPartial) {
+            for (unsigned c = 0; c < nChans; ++c) mm[c*2] = mm[c*2+1] = scans[c];
+        } else {
+            for (unsigned c = 0; c < nChans; ++c) {
+                const int16 v = scans[c];
+                if (v < mm[c*2]) mm[c*2] = v;
+                if (v > mm[c*2+1]) mm[c*2+1] = v;
+            }
+        }
+        if (++L0.nPartial == BaseDecimation) closeBucket(0);
+    }
+    nScans += n;
+}
+
+void EnvelopeIndex::Builder::pushBucket(unsigned level, const int16 *src)
+{
+    if (level >= levels.size()) {
+        if (levels.size() == levels.capacity()) return; // 2^64 scans.. not going to happen
+        levels.push_back(Level());
+        levels.back().partial.resize(nChans*2);
+    }
+    Level & L(levels[level]);
+    int16 * const mm = &L.partial[0];
+    if (!L.nPartial) {
+        memcpy(mm, src, nChans*2*sizeof(int16));
+    } else {
+        for (unsigned c = 0; c < nChans; ++c) {
+            if (src[c*2] < mm[c*2]) mm[c*2] = src[c*2];
+            if (src[c*2+1] > mm[c*2+1]) mm[c*2+1] = src[c*2+1];
+        }
+    }
+    if (++L.nPartial == 2) closeBucket(level);
+}
+
+void EnvelopeIndex::Builder::closeBucket(unsigned level)
+{
+    Level & L(levels[level]);
+    L.chunk.insert(L.chunk.end(), L.partial.begin(), L.partial.end());
+    ++L.nBuckets;
+    L.nPartial = 0;
+    if (L.chunk.size() >= size_t(ChunkBuckets)*nChans*2) writeChunk(level);
+    pushBucket(level+1, &L.partial[0]);
+}
+
+bool EnvelopeIndex::Builder::writeChunk(unsigned level)
+{
+    Level & L(levels[level]);
+    if (L.chunk.empty()) return true;
+    const qint64 nbytes = qint64(L.chunk.size()*sizeof(int16));
+    L.chunkOffsets.push_back(u64(f.pos()));
+    if (f.write(reinterpret_cast<const char *>(&L.chunk[0]), nbytes) != nbytes) {
+        if (!err) Warning() << "Error writing envelope index " << f.fileName() << ", it will not be used.";
+        err = true;
+        return false;
+    }
+    L.chunk.clear();
+    return true;
+}
+
+bool EnvelopeIndex::Builder::finish(u64 binFileSize)
+{
+    if (!f.isOpen()) return false;
+    // close out the partial buckets on each level, stopping at the first level that has just 1 bucket
+    unsigned nLevels = 0;
+    for (unsigned l = 0; l < levels.size() && !err; ++l) {
+        if (levels[l].nPartial) closeBucket(l);
+        if (!levels[l].nBuckets) break;
+        nLevels = l+1;
+        if (levels[l].nBuckets == 1) break;
+    }
+    for (unsigned l = 0; l < nLevels && !err; ++l) writeChunk(l);
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, envMagic, sizeof(envMagic));
+    h.version = Version;
+    h.nChans = nChans;
+    h.baseDecimation = BaseDecimation;
+    h.chunkBuckets = ChunkBuckets;
+    h.nLevels = nLevels;
+    h.scanCt = nScans;
+    h.binFileSize = binFileSize;
+    h.footerOffset = u64(f.pos());
+    for (unsigned l = 0; l < nLevels && !err; ++l) {
+        const quint64 nb = levels[l].nBuckets;
+        const quint32 nc = quint32(levels[l].chunkOffsets.size());
+        err = f.write(reinterpret_cast<const char *>(&nb), sizeof(nb)) != qint64(sizeof(nb))
+              || f.write(reinterpret_cast<const char *>(&nc), sizeof(nc)) != qint64(sizeof(nc))
+              || f.write(reinterpret_cast<const char *>(&levels[l].chunkOffsets[0]), qint64(nc*sizeof(u64))) != qint64(nc*sizeof(u64));
+    }
+    if (!err) err = !f.seek(0) || f.write(reinterpret_cast<const char *>(&h), sizeof(h)) != qint64(sizeof(h));
+    levels.clear();
+    if (err) {
+        Warning() << "Error finishing envelope index " << f.fileName() << ", removing it.";
+        f.close(); f.remove();
+        return false;
+    }
+    f.close();
+    return true;
+}
+
+/* static */ bool EnvelopeIndex::build(const QString & binFileName, volatile bool *cancel)
+{
+    DataFile df;
+    if (!df.openForRead(binFileName)) return false;
+    Builder b;
+    if (!b.begin(binFileName, df.numChans())) return false;
+    const double t0 = getTime();
+    const u64 nScans = df.scanCount(), chunkScans = u64(4*1024*1024) / (df.numChans()*sizeof(int16)) + 1;
+    DataFile::ScanView v;
+    std::vector<int16> data;
+    for (u64 pos = 0; pos < nScans; ) {
+        if (cancel && *cancel) return false; // b's destructor removes the partial index
+        i64 n = df.mapScans(v, pos, chunkScans);
+        const int16 *scans = v.base;
+        if (n < 0) {
+            n = df.readScans(data, pos, chunkScans);
+            if (n <= 0) return false;
+            scans = &data[0];
+        }
+        if (!n) break;
+        b.add(scans, unsigned(n));
+        pos += u64(n);
+    }
+    const bool ok = b.finish(u64(QFileInfo(binFileName).size()));
+    Debug() << "Built envelope index for " << QFileInfo(binFileName).fileName() << " in " << (getTime()-t0) << " secs";
+    return ok;
+}
@@ -0,0 +1,108 @@
+#ifndef EnvelopeIndex_H
+#define EnvelopeIndex_H
+
+#include <QString>
+#include <QFile>
+#include <vector>
+#include "TypeDefs.h"
+
+/** A min/max envelope "pyramid" for a .bin data file, kept in a sidecar file
+    next to it (foo.bin -> foo.env).
+
+    Level 0 holds, for every BaseDecimation scans (a "bucket") and every channel,
+    the min and max sample.  Each level above it merges pairs of buckets of the
+    level below, so level L has a decimation of BaseDecimation << L, all the way
+    up to a level with just 1 bucket.  The whole thing is about 1/16th the size of
+    the .bin file.  This lets the FileViewerWindow draw any zoom span by reading
+    about as many buckets as there are pixels, without losing narrow spikes the
+    way plain decimation does.
+
+    The sidecar is written front to back as the data comes in (see Builder), so
+    it can be built by DataFile while acquiring:
+
+        Header        -- written last, all zeroes until the index is complete
+        chunks...     -- ChunkBuckets buckets of some level: [bucket][chan][min,max] int16
+        footer        -- per level: u64 nBuckets, u32 nChunks, u64 chunkOffset[nChunks]
+
+    Chunks of different levels are interleaved in the order they filled up. */
+class EnvelopeIndex
+{
+public:
+    enum { BaseDecimation = 64, ChunkBuckets = 4096, Version = 1 };
+
+    EnvelopeIndex();
+
+    static QString fileNameFor(const QString & binFileName);
+
+    /// Opens the sidecar for binFileName.  Fails if it doesn't exist, is incomplete, or is stale (was made for a different nChans/scanCt).
+    bool open(const QString & binFileName, unsigned nChans, u64 scanCt);
+    void close();
+    bool isOpen() const { return f.isOpen(); }
+
+    unsigned numLevels() const { return unsigned(levels.size()); }
+    u64 decimation(unsigned level) const { return u64(BaseDecimation) << level; }
+    u64 numBuckets(unsigned level) const { return level < levels.size() ? levels[level].nBuckets : 0; }
+    /// the coarsest level with decimation() <= maxDecimation, or -1 if even level 0 is coarser than that
+    int levelFor(u64 maxDecimation) const;
+
+    /** Reads buckets [first, first+n) of `level' for the channels in chans.  out gets n * chans.size() * 2
+        samples: for each bucket, the min and max of each channel.  Returns the number of buckets read
+        (fewer than n at the end of the level) or -1 on error. */
+    i64 read(unsigned level, u64 first, u64 n, const std::vector<int> & chans, std::vector<int16> & out);
+
+    /// Writes a sidecar incrementally, as scans are appended to a .bin file.
+    class Builder
+    {
+    public:
+        Builder();
+        ~Builder(); ///< an unfinished sidecar is deleted
+
+        bool begin(const QString & binFileName, unsigned nChans);
+        /// feed it every scan, in order
+        void add(const int16 *scans, unsigned nScans);
+        /// flushes everything and writes the header.  binFileSize is recorded so a stale sidecar can be detected.
+        bool finish(u64 binFileSize);
+        bool isActive() const { return f.isOpen(); }
+
+    private:
+        struct Level {
+            std::vector<int16> partial; ///< min,max per channel of the bucket being accumulated
+            unsigned nPartial; ///< number of scans (level 0) or buckets (higher levels) in partial
+            std::vector<int16> chunk; ///< finished buckets not yet written
+            u64 nBuckets;
+            std::vector<u64> chunkOffsets;
+            Level() : nPartial(0), nBuckets(0) {}
+        };
+
+        void pushBucket(unsigned level, const int16 *minmax);
+        void closeBucket(unsigned level);
+        bool writeChunk(unsigned level);
+
+        QFile f;
+        unsigned nChans;
+        u64 nScans;
+        std::vector<Level> levels;
+        bool err;
+    };
+
+    /// Builds the sidecar for an existing .bin file by reading all of it.  Returns false on error or if *cancel got set.
+    static bool build(const QString & binFileName, volatile bool *cancel = 0);
+
+    struct Header {
+        char magic[8]; ///< "SGLENV1"
+        quint32 version, nChans, baseDecimation, chunkBuckets, nLevels, reserved;
+        quint64 scanCt, binFileSize, footerOffset;
+    };
+
+private:
+    struct Level {
+        u64 nBuckets;
+        std::vector<u64> chunkOffsets;
+    };
+    QFile f;
+    unsigned nChans;
+    std::vector<Level> levels;
+    std::vector<int16> buf;
+};
+
+#endif
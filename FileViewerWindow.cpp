@@ -33,6 +33,7 @@
 #include <QAction>
 #include <QMenu>
 #include "ExportDialogController.h"
+#include "DataExporter.h"
 #include <QProgressDialog>
 #include <QTextStream>
 #include <QMessageBox>
@@ -47,6 +48,8 @@
 #include <QComboBox>
 #include <stdio.h>
 #include "ui_FVW_Readme.h"
+#include <QThread>
+#include <algorithm>
 
 
 const QString FileViewerWindow::viewModeNames[] = {
@@ -68,8 +71,20 @@ private:
 	mutable void *tagPtr;
 };
 
+/// Builds a missing envelope index in the background so that opening a big file doesn't block.  See viewFile().
+class EnvelopeBuildThread : public QThread
+{
+public:
+	EnvelopeBuildThread(const QString & f) : file(f), stop(false), ok(false) {}
+	const QString file;
+	volatile bool stop;
+	bool ok;
+protected:
+	void run() { ok = EnvelopeIndex::build(file, &stop); }
+};
+
 FileViewerWindow::FileViewerWindow()
-: QMainWindow(0), pscale(1), mouseOverT(-1.), mouseOverV(0), mouseOverGNum(-1), mouseButtonIsDown(false), dontKillSelection(false), hpfilter(0), arrowKeyFactor(.1), pgKeyFactor(.5), n_graphs_pg(8), curr_graph_page(0), showReadme(true)
+: QMainWindow(0), pscale(1), mouseOverT(-1.), mouseOverV(0), mouseOverGNum(-1), mouseButtonIsDown(false), dontKillSelection(false), hpfilter(0), arrowKeyFactor(.1), pgKeyFactor(.5), n_graphs_pg(8), curr_graph_page(0), showReadme(true), envThread(0)
 {	
     readmeDlg = 0; readme=0;
 
@@ -271,6 +286,7 @@ FileViewerWindow::FileViewerWindow()
 FileViewerWindow::~FileViewerWindow()
 {	
 	/// scrollArea and graphParent automatically deleted here because they are children of us.
+	stopEnvelopeBuild();
 	delete hpfilter;
     // these aren't children, so delete them
     delete readmeDlg, readmeDlg = 0;
@@ -293,6 +309,16 @@ bool FileViewerWindow::viewFile(const QString & fname, QString *errMsg /* = 0 */
 		Error() << err;
 		return false; // file is empty
 	}
+
+	// use the file's envelope index when zoomed out, building it first if it's missing (older file, or made by an older SpikeGL)
+	stopEnvelopeBuild();
+	if (!envelope.open(dataFile.fileName(), dataFile.numChans(), dataFile.scanCount())
+		&& dataFile.scanCount() >= u64(EnvelopeIndex::BaseDecimation)*EnvelopeIndex::ChunkBuckets) {
+		Log() << "Building envelope index for " << fname_no_path << " in the background...";
+		envThread = new EnvelopeBuildThread(dataFile.fileName());
+		Connect(envThread, SIGNAL(finished()), this, SLOT(envelopeBuilt()));
+		envThread->start(QThread::LowPriority);
+	}
 	
 	setWindowTitle(QString(APPNAME) + QString(" File Viewer - ") + QFileInfo(fname_no_path).fileName() + " " 
 				   + QString::number(dataFile.numChans()) + " channels @ " 
@@ -386,6 +412,28 @@ bool FileViewerWindow::viewFile(const QString & fname, QString *errMsg /* = 0 */
 	return true;
 }
 
+void FileViewerWindow::stopEnvelopeBuild()
+{
+	if (envThread) {
+		envThread->disconnect(this);
+		envThread->stop = true;
+		envThread->wait();
+		delete envThread, envThread = 0;
+	}
+	envelope.close();
+}
+
+void FileViewerWindow::envelopeBuilt()
+{
+	if (!envThread) return;
+	if (envThread->ok && envThread->file == dataFile.fileName()
+		&& envelope.open(dataFile.fileName(), dataFile.numChans(), dataFile.scanCount())) {
+		Log() << "Envelope index for " << QFileInfo(dataFile.fileName()).fileName() << " ready.";
+		updateData();
+	}
+	envThread->deleteLater(), envThread = 0;
+}
+
 bool FileViewerWindow::queryCloseOK() 
 {
 	// for now, always ok..
@@ -625,10 +673,63 @@ void FileViewerWindow::updateData()
 	
     //double t0r = getTime();
 
+	DataFile::ScanView view;
 	std::vector<int16> data;
-	i64 nread = dataFile.readScans(data, pos, num, channelSubset, downsample);	
+	const i64 nfit = pos < (i64)dataFile.scanCount() ? qMin(num, i64(dataFile.scanCount()) - pos) : 0;
+	i64 nread = -1;
+	bool viewData = false; // if true, view gets pointed at `data'
+
+	// zoomed way out: draw the min/max envelope from the index, which costs I/O proportional to the graph width
+	// rather than the zoom span, and doesn't decimate spikes away.  Can't highpass filter an envelope though.
+	const bool anyFiltered = std::find(chansToFilter.begin(), chansToFilter.end(), true) != chansToFilter.end();
+	const int envLevel = envelope.isOpen() && !anyFiltered && nfit > 0 ? envelope.levelFor(u64(downsample)*2) : -1;
+	if (envLevel >= 0) {
+		const u64 D = envelope.decimation(envLevel), first = u64(pos) / D, nb = (u64(pos + nfit) + D - 1) / D - first;
+		std::vector<int> chans(chanIdsOn.begin(), chanIdsOn.end());
+		std::vector<int16> mm;
+		const i64 got = envelope.read(envLevel, first, nb, chans, mm);
+		if (got > 0) {
+			// each bucket becomes 2 scans: its mins, then its maxes
+			data.resize(size_t(got)*2*nChansOn);
+			for (i64 b = 0; b < got; ++b)
+				for (int j = 0; j < nChansOn; ++j) {
+					data[(b*2)*nChansOn + j] = mm[(b*nChansOn + j)*2];
+					data[(b*2+1)*nChansOn + j] = mm[(b*nChansOn + j)*2 + 1];
+				}
+			nread = got*2;
+			downsample = int(D/2);
+			viewData = true;
+		}
+	}
+	if (nread < 0) {
+		// look at the scans right where they sit in the mapped file, rather than copying them all out first
+		nread = dataFile.mapScans(view, pos, num, channelSubset, downsample);
+		if (nread < 0 || nread < (nfit + downsample - 1) / downsample) {
+			// can't map or too big for one map window, so fall back to the copy
+			nread = dataFile.readScans(data, pos, num, channelSubset, downsample);
+			viewData = true;
+		}
+	}
+	if (anyFiltered && nread > 0 && !viewData) {
+		// never filter in place in the mapped file!  Take a packed copy of the view instead
+		data.resize(size_t(nread)*nChansOn);
+		for (i64 i = 0; i < nread; ++i) view.copyScan(u64(i), &data[size_t(i)*nChansOn]);
+		viewData = true;
+	}
+	if (viewData) {
+		view = DataFile::ScanView();
+		view.base = data.size() ? &data[0] : 0;
+		view.nScans = nread > 0 ? nread : 0;
+		view.stride = nChansOn;
+		for (int i = 0; i < nChansOn; ++i) view.chans.push_back(i);
+	}
+	if (anyFiltered && nread > 0) {
+		const float dt = 1.0f / (srate / float(downsample));
+		filter.setChannelMask(chansToFilter);
+		filter.applyBlock(&data[0], unsigned(nread), unsigned(nChansOn), dt);
+	}
 	
-    //Debug() << "dataFile.readScans() took " << ((getTime()-t0r)*1e3) << " msec";
+    //Debug() << "reading data took " << ((getTime()-t0r)*1e3) << " msec";
 
 	if (nread < 0) {
 		Error() << "Error reading data from input file!";
@@ -648,19 +749,17 @@ void FileViewerWindow::updateData()
 		}
 
         const float smin(SHRT_MIN), usmax(USHRT_MAX);
-        const float dt = 1.0f / (srate / float(downsample));
         std::vector<float> avgs(nChansOn, 0.f);
         const float avgfactor = 1.0f/float(nread);
         QVector<QVector<Vec2f> > & vecs (scratchVecs);
         if (vecs.size() < nChansOn) vecs.resize(nChansOn);
 		for (int i = 0; i < nread; ++i) {
-			filter.apply(&data[i * nChansOn], dt, chansToFilter);
 			for (int j = 0; j < nChansOn; ++j) {                
                 const int chanId = chanIdsOn[j];
                 const int g = i2g(chanId);
                 if (g >= 0 && g < nGraphs) {
                     if (vecs[j].size() < nread) vecs[j].resize(nread);
-                    int16 & rawsampl = data[i * nChansOn + j];
+                    const int16 rawsampl = view.at(u64(i), unsigned(j));
                     const float sampl = ( ((float(rawsampl) + (-smin))/(usmax)) * (2.0f) ) - 1.0f;
                     Vec2f & vec(vecs[j][i]);
                     vec.x = float(i)/float(nread);
@@ -1305,6 +1404,14 @@ void FileViewerWindow::exportSlot()
 	
 }
 
+/// feeds DataExporter's progress to the export progress dialog
+struct FVWExporter : public DataExporter
+{
+	QProgressDialog & prog;
+	FVWExporter(const QString & f, const ExportParams & p, QProgressDialog & prog) : DataExporter(f, p), prog(prog) {}
+	void progress(int pct) { prog.setValue(pct); if (prog.wasCanceled()) pleaseStop = true; }
+};
+
 void FileViewerWindow::doExport(const ExportParams & p)
 {
 	qint64 nscans = (p.to - p.from) + 1;
@@ -1312,102 +1419,16 @@ void FileViewerWindow::doExport(const ExportParams & p)
 	QProgressDialog progress(QString("Exporting ") + QString::number(nscans) + " scans...", "Abort Export", 0, 100, this);
 	progress.setWindowModality(Qt::WindowModal);
 	progress.setMinimumDuration(0);
-	
 
-	if (p.format == ExportParams::Bin) {
-	
-		DataFile out;
-		QVector<unsigned> chanNumSubset;
-		for (int i = 0; i < (int)p.chanSubset.size(); ++i) if (p.chanSubset.testBit(i)) chanNumSubset.push_back(i);
-		if (!out.openForReWrite(dataFile, p.filename, chanNumSubset)) {
-			Error() << "Could not open export file for write.";
-			return;
-		}
-		
-		// override the auxGain parameter from the input file with out custom gain setting
-		out.setParam("auxGain", defaultGain);
-		
-		int prevVal = -1;
-		std::vector<int16> scan;
-		scan.resize(chanNumSubset.size());
-		
-		for (qint64 i = 0; i < nscans; ++i) {
-			
-			dataFile.readScans(scan, p.from+i, 1, p.chanSubset);
-			out.writeScans(scan);
-			int val = int((i*100LL)/nscans);
-			if (val > prevVal) progress.setValue(prevVal = val);		
-			if (progress.wasCanceled()) {
-				QString f = out.fileName(), m = out.metaFileName();
-				out.closeAndFinalize();
-				QFile::remove(f);
-				QFile::remove(m);
-				return;
-			}
-		}
-		out.closeAndFinalize();
-		progress.setValue(100);
-			
-	} else if (p.format == ExportParams::Csv) {
-		
-		QFile out(p.filename);
-		if (!out.open(QIODevice::WriteOnly|QIODevice::Truncate)) {			
-			Error() << "Could not open export file for write.";
-			return;
-		}
+	FVWExporter x(dataFile.fileName(), p, progress);
+	x.auxGain = defaultGain; // override the auxGain parameter from the input file with our custom gain setting
+	for (int i = 0; i < graphParams.size() && i < x.gains.size(); ++i) x.gains[i] = graphParams[i].gain;
+	const DataExporter::Result r = x.exportData();
+	if (r == DataExporter::Failure) Error() << "Export failed: " << x.extendedError;
+	if (r != DataExporter::Success) return;
+	progress.setValue(100);
 
-		QTextStream outs(&out);
-		
-		int prevVal = -1;
-		std::vector<int16> scan, chansOn;
-		const int scansz = p.chanSubset.count(true);
-		chansOn.reserve(scansz);
-		for (int i = 0; i < (int)p.chanSubset.size(); ++i) 
-			if (p.chanSubset.testBit(i)) chansOn.push_back(i);		
-		scan.resize(scansz);
-		
-		for (qint64 i = 0; i < nscans; ++i) {
-			
-			dataFile.readScans(scan, p.from+i, 1, p.chanSubset);
-            if (p.csvSubFormat == ExportParams::Real) {
-                const double smin = double(SHRT_MIN), usmax = double(USHRT_MAX);
-                for (int j = 0; j < scansz; ++j) {
-                    const double minR = dataFile.rangeMin(j), maxR = dataFile.rangeMax(j);
-                    double sampl = ( ((double(scan[j]) + (-smin))/(usmax+1.)) * (maxR-minR) ) + minR;
-                    sampl /= graphParams[chansOn[j]].gain;
-                    outs << sampl << ( j+1 < scansz ? "," : "");
-                }
-                outs << "\n";
-            } else if (p.csvSubFormat == ExportParams::DecInt16) {
-                for (int j = 0; j < scansz; ++j)
-                    outs << scan[j] << ( j+1 < scansz ? "," : "");
-                outs << "\n";
-            } else if (p.csvSubFormat == ExportParams::HexUInt16) {
-                char buf[64];
-                for (int j = 0; j < scansz; ++j) {
-#ifdef Q_OS_WINDOWS
-                    _snprintf_s
-#else
-                    snprintf
-#endif
-                        (buf,sizeof(buf),"0x%04hx",(unsigned short)scan[j]);
-                    outs << buf << (j+1 < scansz ? "," : "");
-                }
-                outs << "\n";
-            }
-			int val = int((i*100LL)/nscans);
-			if (val > prevVal) progress.setValue(prevVal = val);		
-			if (progress.wasCanceled()) {
-				out.close();
-				out.remove();
-				return;
-			}
-		}
-		
-		progress.setValue(100);				
-	}
-	
-	QMessageBox::information(this, "Export Complete", "Export completed successfully.");	
+	QMessageBox::information(this, "Export Complete", QString("Export completed successfully (%1 MB/s).").arg(x.mbPerSecIn(), 0, 'f', 1));
 }
 
 void FileViewerWindow::selectGraph(int num)
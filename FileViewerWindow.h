@@ -10,6 +10,7 @@
 #define FileViewerWindow_H
 #include <QMainWindow>
 #include "DataFile.h"
+#include "EnvelopeIndex.h"
 #include "VecWrapBuffer.h"
 #include <QPair>
 #include "ChanMap.h"
@@ -35,6 +36,7 @@ class QEvent;
 class TaggableLabel;
 class QComboBox;
 class Ui_FVW_Readme;
+class EnvelopeBuildThread;
 
 /// The class that handles the window you get when opening files.
 class FileViewerWindow : public QMainWindow
@@ -68,6 +70,7 @@ private slots:
 	void colorSchemeMenuSlot();
 	void setAuxGain(double);
 	void mouseOverGraph(double,double);
+	void envelopeBuilt();
 	void mouseOverGraphInWindowCoords(int,int);
 	void clickedGraphInWindowCoords(int,int);
     void toggleMaximize(); // maximize/minimize
@@ -112,6 +115,7 @@ private:
 	void mouseOverGraphInWindowCoords(GLGraph *, int,int);
 	void setFilePos64(qint64 pos, bool noupdate = false);
 	void printStatusMessage();
+	void stopEnvelopeBuild(); ///< also closes the envelope index
 	void doExport(const ExportParams &);
     int graphsPerPage() const { return n_graphs_pg; }
     int currentGraphsPage() const { return curr_graph_page; }
@@ -206,6 +210,9 @@ private:
 
     bool showReadme;
     QDialog *readmeDlg; Ui_FVW_Readme *readme;
+
+    EnvelopeIndex envelope; ///< min/max pyramid for dataFile, used by updateData() when zoomed out.  Not always open.
+    EnvelopeBuildThread *envThread; ///< non-null while the envelope index is being built
 };
 
 
@@ -5,6 +5,7 @@
 #include "XtCmd.h"
 #include "FPGA.h"
 #include "../../../PagedRingbuffer.h"
+#include "../../../SIMD.h"
 #include <varargs.h>
 
 SapAcquisition *acq = 0;
@@ -418,6 +419,10 @@ static bool setupAndStartAcq()
         writer->ErrFunc = &PSWErrFunc; writer->DbgFunc = &PSWDbgFunc;
         _snprintf_c(tmp, sizeof(tmp), "Connected to shared memory \"%s\" size: %u  pagesize: %u metadatasize: %u", shmName.c_str(), shmSize, shmPageSize, shmMetaSize);
         spikeGL->pushConsoleDebug(tmp);
+        if (writer->remapsChannels()) {
+            _snprintf_c(tmp, sizeof(tmp), "Remapping %u channels at each page commit (%s gather)", writer->scanSizeSamps(), writer->channelRemap().usesSIMD() ? "SSSE3" : "scalar");
+            spikeGL->pushConsoleDebug(tmp);
+        }
     }
 
     if (serverIndex < 0) serverIndex = 1;
@@ -739,6 +744,7 @@ int main(int argc, const char* argv[])
     // NB: it's vital these two objects get constructed before any other calls.. since other code assumes they are valid and may call these objects' methods
     spikeGL = new SpikeGLOutThread;
     spikeGLIn = new SpikeGLInputThread;
+    SIMD::level(); // detect the CPU's instruction sets now, before the threads that use ScanGather are started
 
     killAllOtherInstances();
 
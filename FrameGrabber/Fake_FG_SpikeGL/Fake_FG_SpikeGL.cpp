@@ -3,6 +3,7 @@
 #include "GlowBalls.h"
 #include "../FG_SpikeGL/FG_SpikeGL/XtCmd.h"
 #include "../../PagedRingbuffer.h"
+#include "../../SIMD.h"
 #include <QTimer>
 #include <QDateTime>
 #include <QSharedMemory>
@@ -356,6 +357,10 @@ static bool setupAndStartAcq()
         writer->ErrFunc = &PSWErrFunc; writer->DbgFunc = &PSWDbgFunc;
         _snprintf_c(tmp, sizeof(tmp), "Connected to shared memory \"%s\" size: %u  pagesize: %u metadatasize: %u", shmName.c_str(), shmSize, shmPageSize, shmMetaSize);
         spikeGL->pushConsoleDebug(tmp);
+        if (writer->remapsChannels()) {
+            _snprintf_c(tmp, sizeof(tmp), "Remapping %u channels at each page commit (%s gather)", writer->scanSizeSamps(), writer->channelRemap().usesSIMD() ? "SSSE3" : "scalar");
+            spikeGL->pushConsoleDebug(tmp);
+        }
     }
     xfer = new XferEmu(qApp);
     xfer->start(QThread::HighPriority);
@@ -542,6 +547,7 @@ MyApp::~MyApp()
 
 int main(int argc, char **argv)
 {
+    SIMD::level(); // detect the CPU's instruction sets now, before the threads that use ScanGather exist
     MyApp app(argc,argv);
 
     return app.exec();
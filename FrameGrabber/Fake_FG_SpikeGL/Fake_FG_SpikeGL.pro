@@ -14,4 +14,4 @@ macx {
 
 # Input
 HEADERS += GlowBalls.h SpikeGLHandlerThread.h
-SOURCES += Fake_FG_SpikeGL.cpp SpikeGLHandlerThread.cpp ../../PagedRingBuffer.cpp
+SOURCES += Fake_FG_SpikeGL.cpp SpikeGLHandlerThread.cpp ../../PagedRingBuffer.cpp ../../ScanGather.cpp
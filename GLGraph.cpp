@@ -16,6 +16,7 @@
 #include <QMouseEvent>
 #include "Util.h"
 #include <QVarLengthArray.h>
+#include <QGLBuffer>
 
 void GLGraph::reset(QMutex *mut)
 {
@@ -36,6 +37,7 @@ void GLGraph::reset(QMutex *mut)
 
     yscale = 1.;
     pointsWB = 0;
+    vboMirror.invalidate();
     auto_update = false;
     setNumHGridLines(4);
     setNumVGridLines(4);
@@ -74,7 +76,7 @@ void GLGraph::reset(QMutex *mut)
 */
 
 GLGraph::GLGraph(QWidget *parent, QMutex *mut)
-    : QGLWidget(parent, Util::sharedGLWidget()), ptsMut(mut)
+    : QGLWidget(parent, Util::sharedGLWidget()), ptsMut(mut), vbo(0), vboCap(0)
 {
     reset(mut);
 
@@ -82,6 +84,10 @@ GLGraph::GLGraph(QWidget *parent, QMutex *mut)
 }
 
 GLGraph::~GLGraph() {
+    if (vbo) {
+        makeCurrent();
+        delete vbo, vbo = 0;
+    }
     Util::sharedGLWidgetDtorCB(this);
 }
 
@@ -132,7 +138,7 @@ void GLGraph::paintGL()
         if (fabs(max_x-min_x) > 0.) {
             glScaled(1./(max_x-min_x), yscale, 1.);
         }
-        drawPoints();
+        if (!drawPointsVBO()) drawPoints();
         glPopMatrix();
     }
 
@@ -224,6 +230,105 @@ void GLGraph::drawPoints() const
     glLineWidth(savedWidth);
 }
 
+/// Vertex x's in a GLGraphVBOMirror are relative to its x0.  Once the newest point is this many graph widths past x0,
+/// x0 is moved up (re-uploading everything), so the x's keep their float precision no matter how long acquisition runs.
+#define VBO_REBASE_SPANS 16.
+
+void GLGraphVBOMirror::sync(QGLBuffer *vbo, unsigned base, const Vec2fWrapBuffer *wb, double span, std::vector<Vec2f> & tmp)
+{
+    const unsigned c = wb->capacity(), len = wb->size(), head = wb->headIndex();
+    const unsigned long long nNew = wb->totalPut() - put;
+    if (src != wb || gen != wb->generation() || cap != c || nNew >= c
+        || (len && double(wb->last().x) - x0 > VBO_REBASE_SPANS*span)) {
+        // upload all of it
+        x0 = len ? wb->first().x : 0.;
+        src = wb;
+        upload(vbo, base, 0, c, tmp);
+    } else if (nNew) {
+        // just the new points, which end right before head+len, possibly wrapping around the end of the buffer
+        const unsigned first = (head + len - unsigned(nNew)) % c, n1 = qMin(unsigned(nNew), c - first);
+        upload(vbo, base, first, n1, tmp);
+        if (n1 < nNew) upload(vbo, base, 0, unsigned(nNew) - n1, tmp);
+    }
+    gen = wb->generation();
+    cap = c;
+    put = wb->totalPut();
+}
+
+/// copies slots [first, first+n) of src's raw storage to the vbo, making their x's relative to x0
+void GLGraphVBOMirror::upload(QGLBuffer *vbo, unsigned base, unsigned first, unsigned n, std::vector<Vec2f> & tmp) const
+{
+    if (!n) return;
+    const Vec2f *p = src->rawData() + first;
+    if (tmp.size() < n) tmp.resize(n);
+    for (unsigned i = 0; i < n; ++i) {
+        tmp[i].x = float(double(p[i].x) - x0);
+        tmp[i].y = p[i].y;
+    }
+    vbo->write(int((base+first)*sizeof(Vec2f)), &tmp[0], int(n*sizeof(Vec2f)));
+}
+
+void GLGraphVBOMirror::draw(unsigned base, double min_x) const
+{
+    const unsigned len = src->size(), head = src->headIndex();
+    glTranslated(x0 - min_x, 0., 0.);
+    glVertexPointer(2, GL_FLOAT, 0, 0); // offset 0 in the bound vbo
+    // the mirror has the wrap buffer's layout, so the points are in 1 or 2 pieces
+    const unsigned n1 = qMin(len, cap - head);
+    glDrawArrays(GL_LINE_STRIP, GLint(base + head), GLsizei(n1));
+    if (len > n1) {
+        const GLuint joint[2] = { base+cap-1, base };
+        glDrawElements(GL_LINES, 2, GL_UNSIGNED_INT, joint);
+        glDrawArrays(GL_LINE_STRIP, GLint(base), GLsizei(len - n1));
+    }
+}
+
+/// Like drawPoints(), but from a vertex buffer object that only gets sent the points that are new since the
+/// previous paint.  Instead of subtracting min_x from every point, the translation to min_x is done by the
+/// modelview matrix -- it's at most VBO_REBASE_SPANS graph widths, so it doesn't have the precision problem
+/// described in drawPoints().  Returns false if VBOs can't be used, in which case the caller should use drawPoints().
+bool GLGraph::drawPointsVBO()
+{
+    static bool disabled = qgetenv("SPIKEGL_GRAPH_VBO") == "0";
+    if (disabled) return false;
+    if (!vbo) {
+        vbo = new QGLBuffer(QGLBuffer::VertexBuffer);
+        vbo->setUsagePattern(QGLBuffer::DynamicDraw);
+        if (!vbo->create()) {
+            Warning() << "GLGraph: vertex buffer objects not supported, drawing graphs from client memory.";
+            delete vbo, vbo = 0;
+            disabled = true;
+            return false;
+        }
+        vboCap = 0;
+    }
+    const unsigned cap = pointsWB->capacity();
+
+    vbo->bind();
+    if (vboCap != cap) {
+        vbo->allocate(int(cap*sizeof(Vec2f)));
+        vboCap = cap;
+        vboMirror.invalidate();
+    }
+    vboMirror.sync(vbo, 0, pointsWB, fabs(max_x-min_x) > 0. ? fabs(max_x-min_x) : 1., vboTmp);
+
+    GLfloat savedColor[4];
+    GLfloat savedWidth;
+    // save some values
+    glGetFloatv(GL_CURRENT_COLOR, savedColor);
+    glGetFloatv(GL_LINE_WIDTH, &savedWidth);
+    glLineWidth(1.0f);
+    glColor4f(graph_Color.redF(), graph_Color.greenF(), graph_Color.blueF(), graph_Color.alphaF());
+
+    vboMirror.draw(0, min_x);
+    vbo->release();
+
+    // restore saved values
+    glColor4f(savedColor[0], savedColor[1], savedColor[2], savedColor[3]);
+    glLineWidth(savedWidth);
+    return true;
+}
+
 void GLGraph::drawSelection() const
 {
 	if (!isSelectionVisible()) return;
@@ -287,6 +392,7 @@ void GLGraph::setNumVGridLines(unsigned n)
 
 void GLGraph::setPoints(const Vec2fWrapBuffer *va)
 {
+    if (va != pointsWB) vboMirror.invalidate(); // upload everything at the next paint
     pointsWB = va;
     if (auto_update) updateGL();
     else need_update = true;
@@ -331,13 +437,18 @@ void GLGraph::mouseDoubleClickEvent(QMouseEvent *evt)
 }
 
 Vec2f GLGraph::pos2Vec(const QPoint & pos)
+{
+    return pos2Vec(pos, width(), height());
+}
+
+Vec2f GLGraph::pos2Vec(const QPoint & pos, int w, int h) const
 {
     Vec2f ret;
-    ret.x = double(pos.x())/width();
+    ret.x = double(pos.x())/w;
     // invert Y
-    int y = height()-pos.y();
-    ret.y = (double(y)/height()*2.-1.)/yscale;
-    ret.x = (ret.x * (maxx()-minx()))+minx();
+    int y = h-pos.y();
+    ret.y = (double(y)/h*2.-1.)/yscale;
+    ret.x = (ret.x * (max_x-min_x))+min_x;
     return ret;
 }
 
@@ -400,6 +511,7 @@ void GLGraph::setState(const GLGraphState & s)
 	max_x = s.max_x;
 	yscale = s.yscale;
 	gridLineStipplePattern = s.gridLineStipplePattern;
+	if (s.pointsWB != pointsWB) vboMirror.invalidate();
 	pointsWB = s.pointsWB;
 	tagData = s.tagData;
 	selectionBegin = s.selectionBegin;
@@ -6,9 +6,34 @@
 #include <vector>
 #include <QVariant>
 class QMutex;
+class QGLBuffer;
 
 #include "VecWrapBuffer.h"
 
+/// Mirrors a Vec2fWrapBuffer's raw storage, slot for slot, in a range of a GL vertex buffer object, so that each
+/// paint only has to upload the points put into it since the previous one.  GLGraph has a vbo of its own to put
+/// this in, GLGraphCanvas packs the mirrors of all of its graphs into 1 vbo.
+struct GLGraphVBOMirror
+{
+    const Vec2fWrapBuffer *src; ///< what's mirrored.  0 if nothing yet
+    unsigned gen, cap;
+    unsigned long long put;
+    double x0; ///< vertex x's are relative to this
+
+    GLGraphVBOMirror() : src(0), gen(0), cap(0), put(0), x0(0.) {}
+
+    /// forces a full upload at the next sync()
+    void invalidate() { src = 0; }
+    /// Brings the mirror at vertex offset base of vbo (which must be bound, and hold base + wb->capacity() vertices)
+    /// up to date with wb.  span is the width of the graph, in x units.  tmp is scratch space.
+    void sync(QGLBuffer *vbo, unsigned base, const Vec2fWrapBuffer *wb, double span, std::vector<Vec2f> & tmp);
+    /// Draws the points as a line strip from the bound vbo, with the modelview matrix translated by x0 - min_x.
+    void draw(unsigned base, double min_x) const;
+
+private:
+    void upload(QGLBuffer *vbo, unsigned base, unsigned first, unsigned n, std::vector<Vec2f> & tmp) const;
+};
+
 
 struct GLGraphState
 {
@@ -46,6 +71,10 @@ public:
     QVariant tag() const { return tagData; }
     void setTag(const QVariant & v) { tagData = v; }
 
+    /// The graph draws pointsBuf as is at each paint.  By default it mirrors it in a GL vertex buffer object, uploading
+    /// only the points put into it since the previous paint, so points must only be modified via putData(), reserve()
+    /// or clear() -- or call setPoints() again with a different buffer (or 0) first.  Set the environment variable
+    /// SPIKEGL_GRAPH_VBO=0 to draw from client memory instead.
     void setPoints(const Vec2fWrapBuffer *pointsBuf);
 
     QColor & bgColor() { return bg_Color; }
@@ -96,11 +125,13 @@ signals:
     void doubleClicked(double x, double y); ///< this only emitted on Left dbl-click
 
 protected:
+    friend class GLGraphCanvas; ///< draws graphs in its own context, and emits their signals
     void initializeGL();
     void resizeGL(int w, int h);
     void paintGL();
 
     Vec2f pos2Vec(const QPoint & pos);
+    Vec2f pos2Vec(const QPoint & pos, int w, int h) const; ///< pos in a w x h area
     void mouseMoveEvent(QMouseEvent *evt);
     void mousePressEvent(QMouseEvent *evt);
     void mouseReleaseEvent(QMouseEvent *evt);
@@ -109,6 +140,7 @@ protected:
 private:
     void drawGrid() const;
     void drawPoints() const;
+    bool drawPointsVBO();
 	void drawSelection() const;
 
     QMutex *ptsMut;
@@ -118,6 +150,10 @@ private:
     unsigned short gridLineStipplePattern;
     const Vec2fWrapBuffer *pointsWB;
     mutable QVector<Vec2f> pointsDisplayBuf;
+    QGLBuffer *vbo; ///< holds vboMirror.  0 if not created yet
+    unsigned vboCap; ///< vertices allocated in vbo
+    GLGraphVBOMirror vboMirror;
+    std::vector<Vec2f> vboTmp;
     std::vector<Vec2f> gridVs, gridHs;
     bool auto_update, need_update;
     QVariant tagData;
@@ -0,0 +1,338 @@
+#include "GLGraphCanvas.h"
+#if defined(Q_WS_MACX) || defined(Q_OS_DARWIN)
+#include <gl.h>
+#else
+#include <GL/gl.h>
+#endif
+#include <math.h>
+#include <algorithm>
+#include <QMutex>
+#include <QMouseEvent>
+#include <QGLBuffer>
+#include <QCheckBox>
+#include <QFontMetrics>
+#include "Util.h"
+
+GLGraphCanvas::GLGraphCanvas(QWidget *parent)
+    : QGLWidget(parent, Util::sharedGLWidget()), nRows(0), nCols(0), selected(0), maxed(0), vbo(0), vboCap(0),
+      noVBO(qgetenv("SPIKEGL_GRAPH_VBO") == "0")
+{
+    setAutoBufferSwap(true);
+    setMouseTracking(true);
+    setCursor(Qt::CrossCursor);
+    Util::sharedGLWidgetCtorCB(this);
+}
+
+GLGraphCanvas::~GLGraphCanvas()
+{
+    if (vbo) {
+        makeCurrent();
+        delete vbo, vbo = 0;
+    }
+    Util::sharedGLWidgetDtorCB(this);
+}
+
+void GLGraphCanvas::setGraphs(const QVector<GLGraph *> & graphs, const QVector<QCheckBox *> & saveChks, int nr, int nc)
+{
+    std::vector<QCheckBox *> cs(graphs.size(), (QCheckBox *)0);
+    for (int i = 0; i < saveChks.size() && i < graphs.size(); ++i) cs[i] = saveChks[i];
+    if (cs != chks) chks.swap(cs), update();
+    if (nr == nRows && nc == nCols && int(cells.size()) == graphs.size() && std::equal(cells.begin(), cells.end(), graphs.begin()))
+        return; // keep the mirrors
+    cells.assign(graphs.begin(), graphs.end());
+    nRows = nr, nCols = nc;
+    mirrors.assign(cells.size(), GLGraphVBOMirror());
+    bases.assign(cells.size(), 0);
+    if (selected && std::find(cells.begin(), cells.end(), selected) == cells.end()) selected = 0;
+    if (maxed && std::find(cells.begin(), cells.end(), maxed) == cells.end()) maxed = 0;
+    update();
+}
+
+void GLGraphCanvas::setSelectedGraph(GLGraph *g)
+{
+    if (g == selected) return;
+    selected = g;
+    update();
+}
+
+void GLGraphCanvas::setMaximizedGraph(GLGraph *g)
+{
+    if (g == maxed) return;
+    maxed = g;
+    update();
+}
+
+bool GLGraphCanvas::needsUpdateGL() const
+{
+    for (size_t i = 0; i < cells.size(); ++i)
+        if (cells[i] && cells[i]->needsUpdateGL()) return true;
+    return false;
+}
+
+int GLGraphCanvas::nGraphsShown() const
+{
+    if (maxed) return 1;
+    return int(cells.size() - std::count(cells.begin(), cells.end(), (GLGraph *)0));
+}
+
+QRect GLGraphCanvas::frameArea(int idx) const
+{
+    QRect r;
+    if (maxed) {
+        if (cells[idx] == maxed) r = rect();
+    } else if (nRows > 0 && nCols > 0 && idx < nRows*nCols) {
+        // same as the 1 pixel spaced QGridLayout that holds the graphs when they are their own widgets
+        const int row = idx / nCols, col = idx % nCols, W = width() + 1, H = height() + 1;
+        const int x0 = col*W/nCols, y0 = row*H/nRows;
+        r = QRect(x0, y0, (col+1)*W/nCols - 1 - x0, (row+1)*H/nRows - 1 - y0);
+    }
+    // leave room for the frame drawn around the selected graph
+    return r.isValid() ? r.adjusted(2, 2, -2, -2) : QRect();
+}
+
+QRect GLGraphCanvas::chkArea(int idx) const
+{
+    const QCheckBox *c = idx < int(chks.size()) ? chks[idx] : 0;
+    if (!c || c->isHidden()) return QRect();
+    const QRect f = frameArea(idx);
+    if (!f.isValid()) return QRect();
+    // the checkbox sits above the graph, as in the frame that holds a graph when it's its own widget
+    return QRect(f.x(), f.y(), f.width(), std::min(c->sizeHint().height(), f.height()/2));
+}
+
+QRect GLGraphCanvas::cellArea(int idx) const
+{
+    QRect r = frameArea(idx);
+    const QRect c = chkArea(idx);
+    if (c.isValid()) r.setTop(c.bottom() + 1);
+    return r.isValid() ? r : QRect();
+}
+
+GLGraph *GLGraphCanvas::graphAt(const QPoint & pos, QRect *area) const
+{
+    for (int i = 0; i < int(cells.size()); ++i) {
+        if (!cells[i]) continue;
+        const QRect a = cellArea(i);
+        if (a.isValid() && a.contains(pos)) {
+            if (area) *area = a;
+            return cells[i];
+        }
+    }
+    return 0;
+}
+
+void GLGraphCanvas::initializeGL()
+{
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glDisable(GL_TEXTURE_2D);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    Util::setVSyncMode(false);
+}
+
+void GLGraphCanvas::resizeGL(int w, int h)
+{
+    glViewport(0, 0, w, h);
+}
+
+/// Creates the vbo if need be, and lays the cells' mirrors out in it, back to back.  Returns false if VBOs can't be
+/// used.  On success vbo is left bound.
+bool GLGraphCanvas::syncVBO()
+{
+    if (noVBO) return false;
+    if (!vbo) {
+        vbo = new QGLBuffer(QGLBuffer::VertexBuffer);
+        vbo->setUsagePattern(QGLBuffer::DynamicDraw);
+        if (!vbo->create()) {
+            Warning() << "GLGraphCanvas: vertex buffer objects not supported, drawing graphs from client memory.";
+            delete vbo, vbo = 0;
+            noVBO = true;
+            return false;
+        }
+        vboCap = 0;
+    }
+    unsigned total = 0;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        // a cell whose offset moved has to be re-uploaded
+        if (bases[i] != total) mirrors[i].invalidate(), bases[i] = total;
+        const GLGraph *g = cells[i];
+        if (!g) continue;
+        if (g->ptsMut) g->ptsMut->lock();
+        if (g->pointsWB) total += g->pointsWB->capacity();
+        if (g->ptsMut) g->ptsMut->unlock();
+    }
+    vbo->bind();
+    if (total > vboCap) {
+        vbo->allocate(int(total*sizeof(Vec2f)));
+        vboCap = total;
+        for (size_t i = 0; i < mirrors.size(); ++i) mirrors[i].invalidate();
+    }
+    return true;
+}
+
+void GLGraphCanvas::paintGL()
+{
+    if (!isVisible()) return;
+    const int W = width(), H = height();
+    const QColor bg = palette().color(QPalette::Window);
+
+    glViewport(0, 0, W, H);
+    glClearColor(bg.redF(), bg.greenF(), bg.blueF(), 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glLineWidth(1.f);
+
+    // every cell is drawn in the same coordinates a GLGraph uses for itself, only with a different viewport
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0., 1., -1., 1., -1., 1.);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    const bool useVBO = syncVBO();
+    glEnable(GL_SCISSOR_TEST);
+    for (int i = 0; i < int(cells.size()); ++i) {
+        GLGraph *g = cells[i];
+        if (!g) continue;
+        const QRect a = cellArea(i);
+        if (!a.isValid()) continue;
+        const int y = H - a.y() - a.height(); // GL's y goes up
+        glViewport(a.x(), y, a.width(), a.height());
+        glScissor(a.x(), y, a.width(), a.height());
+
+        const QColor & c = g->highlighted ? g->highlight_Color : g->bg_Color;
+        glClearColor(c.redF(), c.greenF(), c.blueF(), c.alphaF());
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        g->drawGrid();
+
+        if (g->ptsMut) g->ptsMut->lock();
+        if (g->pointsWB && g->pointsWB->size()) {
+            const double span = fabs(g->max_x-g->min_x);
+            glPushMatrix();
+            if (span > 0.) glScaled(1./span, g->yscale, 1.);
+            if (useVBO) {
+                const QColor & gc = g->graph_Color;
+                mirrors[i].sync(vbo, bases[i], g->pointsWB, span > 0. ? span : 1., vboTmp);
+                glColor4f(gc.redF(), gc.greenF(), gc.blueF(), gc.alphaF());
+                mirrors[i].draw(bases[i], g->min_x);
+            } else
+                g->drawPoints();
+            glPopMatrix();
+        }
+        if (g->ptsMut) g->ptsMut->unlock();
+
+        g->drawSelection();
+        g->need_update = false;
+    }
+    glDisable(GL_SCISSOR_TEST);
+    if (useVBO) vbo->release();
+
+    for (int i = 0; i < int(cells.size()); ++i) {
+        const QRect c = cells[i] ? chkArea(i) : QRect();
+        if (c.isValid()) drawSaveChk(c, chks[i]);
+    }
+    if (selected && !maxed) {
+        for (int i = 0; i < int(cells.size()); ++i)
+            if (cells[i] == selected) { drawFrame(frameArea(i)); break; }
+    }
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+/// draws a 2 pixel wide box just outside of r, like the QFrame::Box the graph's frame gets when it's selected
+void GLGraphCanvas::drawFrame(const QRect & r) const
+{
+    if (!r.isValid()) return;
+    const QColor fg = palette().color(QPalette::WindowText);
+    glViewport(0, 0, width(), height());
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0., width(), height(), 0., -1., 1.); // in widget coords
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    const float x0 = r.left() - 1.f, y0 = r.top() - 1.f, x1 = r.left() + r.width() + 1.f, y1 = r.top() + r.height() + 1.f;
+    const GLfloat v[] = { x0, y0,  x1, y0,  x1, y1,  x0, y1 };
+    glLineWidth(2.f);
+    glColor4f(fg.redF(), fg.greenF(), fg.blueF(), 1.f);
+    glVertexPointer(2, GL_FLOAT, 0, v);
+    glDrawArrays(GL_LINE_LOOP, 0, 4);
+    glLineWidth(1.f);
+}
+
+/// draws chk's box and label in r: a box, crossed when checked, greyed out along with the label when disabled
+void GLGraphCanvas::drawSaveChk(const QRect & r, const QCheckBox *chk)
+{
+    const QColor fg = palette().color(chk->isEnabled() ? QPalette::Active : QPalette::Disabled, QPalette::WindowText);
+    glViewport(0, 0, width(), height());
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0., width(), height(), 0., -1., 1.); // in widget coords
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    const int sz = std::min(11, r.height() - 2);
+    const float x0 = r.left() + 3.5f, y0 = r.top() + (r.height() - sz)/2 + .5f, x1 = x0 + sz, y1 = y0 + sz;
+    const GLfloat box[] = { x0, y0,  x1, y0,  x1, y1,  x0, y1 }, cross[] = { x0+2.f, y0+2.f,  x1-2.f, y1-2.f,  x1-2.f, y0+2.f,  x0+2.f, y1-2.f };
+    glColor4f(fg.redF(), fg.greenF(), fg.blueF(), 1.f);
+    glVertexPointer(2, GL_FLOAT, 0, box);
+    glDrawArrays(GL_LINE_LOOP, 0, 4);
+    if (chk->isChecked()) {
+        glLineWidth(2.f);
+        glVertexPointer(2, GL_FLOAT, 0, cross);
+        glDrawArrays(GL_LINES, 0, 4);
+        glLineWidth(1.f);
+    }
+    const QFontMetrics fm(font());
+    renderText(r.left() + sz + 8, r.top() + (r.height() + fm.ascent() - fm.descent())/2, chk->text(), font());
+}
+
+void GLGraphCanvas::mouseMoveEvent(QMouseEvent *evt)
+{
+    QRect a;
+    GLGraph *g = graphAt(evt->pos(), &a);
+    if (!g) return;
+    const QPoint p (evt->pos() - a.topLeft());
+    emit(g->cursorOverWindowCoords(p.x(), p.y()));
+    Vec2f v(g->pos2Vec(p, a.width(), a.height()));
+    emit(g->cursorOver(v.x,v.y));
+}
+
+void GLGraphCanvas::mousePressEvent(QMouseEvent *evt)
+{
+    if (!(evt->buttons() & Qt::LeftButton)) return;
+    for (int i = 0; i < int(cells.size()); ++i) {
+        if (cells[i] && chkArea(i).contains(evt->pos())) {
+            // its toggled() signal does the rest, just as if it had been clicked in its frame
+            if (chks[i]->isEnabled()) chks[i]->toggle(), update();
+            return;
+        }
+    }
+    QRect a;
+    GLGraph *g = graphAt(evt->pos(), &a);
+    if (!g) return;
+    const QPoint p (evt->pos() - a.topLeft());
+    emit(g->clickedWindowCoords(p.x(), p.y()));
+    Vec2f v(g->pos2Vec(p, a.width(), a.height()));
+    emit(g->clicked(v.x,v.y));
+}
+
+void GLGraphCanvas::mouseReleaseEvent(QMouseEvent *evt)
+{
+    if (evt->buttons() & Qt::LeftButton) return;
+    QRect a;
+    GLGraph *g = graphAt(evt->pos(), &a);
+    if (!g) return;
+    const QPoint p (evt->pos() - a.topLeft());
+    emit(g->clickReleasedWindowCoords(p.x(), p.y()));
+    Vec2f v(g->pos2Vec(p, a.width(), a.height()));
+    emit(g->clickReleased(v.x,v.y));
+}
+
+void GLGraphCanvas::mouseDoubleClickEvent(QMouseEvent *evt)
+{
+    if (!(evt->buttons() & Qt::LeftButton)) return;
+    QRect a;
+    GLGraph *g = graphAt(evt->pos(), &a);
+    if (!g) return;
+    Vec2f v(g->pos2Vec(evt->pos() - a.topLeft(), a.width(), a.height()));
+    emit(g->doubleClicked(v.x,v.y));
+}
@@ -0,0 +1,78 @@
+#ifndef GLGraphCanvas_H
+#define GLGraphCanvas_H
+
+#include <QGLWidget>
+#include <QVector>
+#include <vector>
+#include "GLGraph.h"
+class QGLBuffer;
+class QCheckBox;
+
+/** Draws a whole grid of GLGraphs in 1 GL widget, in 1 pass.
+
+    Normally each GLGraph is its own QGLWidget, so repainting a tab of graphs means making each
+    graph's context current, painting it and swapping its buffers, one graph after the other.  The
+    canvas instead paints each graph into its cell of a single widget (with glViewport/glScissor),
+    and keeps the points of all of them in 1 vertex buffer object, each graph's mirror at its own
+    offset.
+
+    The GLGraphs themselves are not shown: they just hold the per-graph state (colors, x range,
+    y scale, points, selection, highlight) as usual, so the code driving them doesn't change.  Mouse
+    events over a cell are re-emitted as that graph's own signals, so sender() is the graph.
+
+    Likewise the graphs' "Save" checkboxes stay in their hidden frames: the canvas draws each one
+    in a strip at the top of its cell while it isn't hidden, and a click there toggles it. */
+class GLGraphCanvas : public QGLWidget
+{
+    Q_OBJECT
+public:
+    GLGraphCanvas(QWidget *parent = 0);
+    ~GLGraphCanvas();
+
+    /// The graphs to draw, row-major in an nRows x nCols grid, and their save checkboxes (same size, or empty for none).
+    /// Null entries leave their cell empty.
+    void setGraphs(const QVector<GLGraph *> & graphs, const QVector<QCheckBox *> & saveChks, int nRows, int nCols);
+    /// The graph to draw with a frame around it, or 0 for none
+    void setSelectedGraph(GLGraph *g);
+    /// If not 0, only this graph is drawn, over the whole canvas
+    void setMaximizedGraph(GLGraph *g);
+
+    /// true if any of the graphs need a repaint.  Painting the canvas clears this for all of them.
+    bool needsUpdateGL() const;
+
+    /// the graph under pos (in widget coords), and the rect of its drawing area.  0 if none.
+    GLGraph *graphAt(const QPoint & pos, QRect *area = 0) const;
+    /// the number of graphs drawn
+    int nGraphsShown() const;
+
+protected:
+    void initializeGL();
+    void resizeGL(int w, int h);
+    void paintGL();
+
+    void mouseMoveEvent(QMouseEvent *evt);
+    void mousePressEvent(QMouseEvent *evt);
+    void mouseReleaseEvent(QMouseEvent *evt);
+    void mouseDoubleClickEvent(QMouseEvent *evt);
+
+private:
+    QRect frameArea(int idx) const; ///< all of cells[idx]'s cell, inside the frame drawn when it's selected
+    QRect chkArea(int idx) const; ///< the strip at the top of frameArea() where its save checkbox goes, if shown
+    QRect cellArea(int idx) const; ///< where cells[idx] is drawn, in widget coords: frameArea() less chkArea()
+    bool syncVBO();
+    void drawFrame(const QRect & r) const;
+    void drawSaveChk(const QRect & r, const QCheckBox *chk);
+
+    std::vector<GLGraph *> cells;
+    std::vector<QCheckBox *> chks; ///< per cell, may be 0
+    int nRows, nCols;
+    GLGraph *selected, *maxed;
+    QGLBuffer *vbo; ///< holds all the cells' mirrors.  0 if not created yet
+    unsigned vboCap; ///< vertices allocated in vbo
+    std::vector<GLGraphVBOMirror> mirrors; ///< per cell
+    std::vector<unsigned> bases; ///< per cell: the vertex offset of its mirror in vbo
+    std::vector<Vec2f> vboTmp;
+    bool noVBO;
+};
+
+#endif
@@ -35,6 +35,7 @@
 #include <string.h>
 #include "MainApp.h"
 #include "HPFilter.h"
+#include "GLGraphCanvas.h"
 #include "QLed.h"
 #include "ConfigureDialogController.h"
 #include "play.xpm"
@@ -80,7 +81,7 @@ static void initIcons()
 }
 
 GraphsWindow::GraphsWindow(DAQ::Params & p, QWidget *parent, bool isSaving, bool useTabs, int graphUpdateRateHz)
-    : QMainWindow(parent), threadsafe_is_visible(false), params(p), useTabs(useTabs), downsampleRatio(1.), dsLeftOver(0), dsMaxNPts(-1), tNow(0.), tLast(0.), tAvg(0.), tNum(0.), filter(0), modeCaresAboutSGL(false), modeCaresAboutPD(false), suppressRecursive(false), graphsMut(QMutex::Recursive)
+    : QMainWindow(parent), threadsafe_is_visible(false), params(p), useTabs(useTabs), downsampleRatio(1.), dsMaxNPts(-1), tNow(0.), tLast(0.), tAvg(0.), tNum(0.), filter(0), modeCaresAboutSGL(false), modeCaresAboutPD(false), suppressRecursive(false), ingestT(0.), ingestTMax(0.), ingestLastLog(0.), ingestN(0), paintT(0.), paintTMax(0.), paintLastLog(0.), paintN(0), graphsMut(QMutex::Recursive)
 {
     sharedCtor(p, isSaving, graphUpdateRateHz);
 }
@@ -298,6 +299,7 @@ void GraphsWindow::sharedCtor(DAQ::Params & p, bool isSaving, int graphUpdateRat
     pausedGraphs.resize(graphs.size());
     graphTimesSecs.resize(graphs.size());
     points.resize(graphs.size());
+    rings.resize(graphs.size());
     graphStats.resize(graphs.size());
 	graphStates.resize(graphs.size());
     
@@ -309,12 +311,18 @@ void GraphsWindow::sharedCtor(DAQ::Params & p, bool isSaving, int graphUpdateRat
     nRowsGraphTab = nColsGraphTab = -1;
     if (useTabs) {
         int num = 0;
+        if (qgetenv("SPIKEGL_GRAPH_CANVAS") == "1") canvases.fill(0, nGraphTabs);
         for (int i = 0; i < nGraphTabs && num < (int)graphs.size(); ++i) {
             QWidget *graphsWidget = new QWidget(0);
             graphTabs[i] = graphsWidget;
             QGridLayout *l = new QGridLayout(graphsWidget);
             l->setHorizontalSpacing(1);
             l->setVerticalSpacing(1);
+            if (canvases.size()) {
+                // the graph frames still get parented to the tab, but stay hidden: the canvas draws the graphs
+                canvases[i] = new GLGraphCanvas(graphsWidget);
+                l->addWidget(canvases[i], 0, 0);
+            }
 
             int numThisPage = (nGraphTabs - i > 1) ? NUM_GRAPHS_PER_GRAPH_TAB : (graphs.size() % NUM_GRAPHS_PER_GRAPH_TAB);
             if (!numThisPage) numThisPage = NUM_GRAPHS_PER_GRAPH_TAB;
@@ -367,7 +375,8 @@ void GraphsWindow::sharedCtor(DAQ::Params & p, bool isSaving, int graphUpdateRat
                     f->setFrameStyle(QFrame::StyledPanel|QFrame::Plain); // only enable frame when it's selected!
                     setupGraph(num, firstExtraChan);
                     Connect(chks[num], SIGNAL(toggled(bool)), this, SLOT(saveGraphChecked(bool)));
-                    l->addWidget(f, r, c);
+                    if (canvases.size()) f->hide();
+                    else l->addWidget(f, r, c);
                     ///
                     //QCheckBox *chk = new QCheckBox(graphsWidget);
                     //l->addWidget(chk, r, c);
@@ -387,6 +396,12 @@ void GraphsWindow::sharedCtor(DAQ::Params & p, bool isSaving, int graphUpdateRat
         QGridLayout *l = new QGridLayout(nonTabWidget);
         l->setHorizontalSpacing(1);
         l->setVerticalSpacing(1);
+        if (qgetenv("SPIKEGL_GRAPH_CANVAS") == "1") {
+            // 1 canvas for whichever graphs openCustomChanset() puts on screen
+            canvases.fill(0, 1);
+            canvases[0] = new GLGraphCanvas(nonTabWidget);
+            l->addWidget(canvases[0], 0, 0);
+        }
 
         int nrows = int(sqrtf(NUM_GRAPHS_PER_GRAPH_TAB)), ncols = 0;
         if (NUM_GRAPHS_PER_GRAPH_TAB == 32)
@@ -546,6 +561,8 @@ void GraphsWindow::hideUnhideSaveChannelCBs()
 {
 	for (int num = 0; num < (int)chks.size(); ++num)
 		chks[num]->setHidden(!mainApp()->isSaveCBEnabled());
+    for (int i = 0; i < canvases.size(); ++i)
+        if (canvases[i]) canvases[i]->update(); // they draw the checkboxes
 }
 
 void GraphsWindow::installEventFilter(QObject *obj)
@@ -568,8 +585,14 @@ void GraphsWindow::setGraphTimeSecs(int num, double t)
 
     if (num < 0 || num >= (int)graphs.size() || t < 0.0) return;
     graphTimesSecs[num] = t;
-    const i64 npts = ( graphs[num] ? i64(qCeil(t*(params.srate/qRound(downsampleRatio)))) : 0); // if the graph is not on-screen, make it use 0 points in the points WB to save memory for high-channel-counts
+    const int dsr = qRound(downsampleRatio);
+    const i64 npts = ( graphs[num] ? i64(qCeil(t*(params.srate/dsr))) * (dsr > 1 ? 2 : 1) : 0); // if the graph is not on-screen, make it use 0 points in the points WB to save memory for high-channel-counts.  when downsampling, putScans() makes 2 points (min and max) per dsr scans
     points[num].reserve(npts);
+    {
+        QMutexLocker il(&ingestMut);
+        rings[num].reset(unsigned(npts));
+        dsMaxNPts = -1; // signal to recompute this value next call to putScans()
+    }
     double s = t;
     int nlines = 1;
     // try to figure out how many lines to draw based on nsecs..
@@ -585,124 +608,78 @@ void GraphsWindow::setGraphTimeSecs(int num, double t)
 	graphStates[num].max_x = graphStates[num].min_x+t;
     graphStats[num].clear();
 
-    dsMaxNPts = -1; // signal to recompute this value next call to putScans()
-
     // notify potential listener such as spatial vis window which may care about how many points are visible
     emit graphTimeSecsChanged(num,t);
 }
 
 void GraphsWindow::putScans(const int16 * data, unsigned DSIZE, u64 firstSamp)
 {
-    QMutexLocker l(&graphsMut);
+    // NB: this is called from the data thread.  It doesn't lock graphsMut or touch anything it protects, so it never
+    // waits for the GUI thread to finish painting.  It just appends the points to each graph's PointRing, and
+    // updateGraphs() moves them over to the graphs.
+    QMutexLocker l(&ingestMut);
 
-        //const double t0 = getTime(); /// XXX debug
-        const int SCANSIZE (graphs.size());
+        const double t0 = getTime();
+        const int SCANSIZE (rings.size());
         const int dsr = qRound(downsampleRatio);
         const int DOWNSAMPLE_RATIO(dsr<1?1:dsr);
         const double SRATE (params.srate > 0. ? params.srate : 0.01);
         const int DSCANS = int(DSIZE/unsigned(SCANSIZE));
-        const int DSCANS_DS = DSCANS/DOWNSAMPLE_RATIO;
-        // avoid some operator[] and others..
-        const int16 * DPTR = &data[0];
-        const bool * const pgraphs = &pausedGraphs[0];
-        Vec2fWrapBuffer * const pts = &points[0];
-        int startpt = 0 + (dsLeftOver*SCANSIZE);
-        u64 sidx = u64(firstSamp + u64(startpt));
-
-        double t = double(sidx / double(SCANSIZE)) / double(SRATE);
-        const double deltaT =  1.0/SRATE * DOWNSAMPLE_RATIO;
-        // now, push new points to back of each graph, downsampling if need be
-        Vec2f v;
-        int idx = 0, scannum = dsLeftOver, scannum_ds = scannum/DOWNSAMPLE_RATIO;
-        const int maximizedIdx = (maximized ? parseGraphNum(maximized) : -1);
+
+        if (int(decimator.scanSize()) != SCANSIZE || int(decimator.ratio()) != DOWNSAMPLE_RATIO)
+            decimator.reset(unsigned(SCANSIZE), unsigned(DOWNSAMPLE_RATIO));
 
         if (dsMaxNPts < 0) {
-            for (int i = 0; i < SCANSIZE; ++i)
-                if (int(pts[i].capacity()) > dsMaxNPts)
-                    dsMaxNPts = int(pts[i].capacity());
+            ringsOn.clear();
+            for (int i = 0; i < SCANSIZE; ++i) {
+                if (!rings[i].isOn()) continue; // graph isn't on-screen
+                ringsOn.push_back(i);
+                if (int(rings[i].capacity()) > dsMaxNPts)
+                    dsMaxNPts = int(rings[i].capacity());
+            }
         }
 
-        /*int NPTS_RCVD = DSCANS/DOWNSAMPLE_RATIO;
-        if (dsMaxNPts < NPTS_RCVD) {
-            Warning() << "dsMaxNPts=" << dsMaxNPts << ", NPTS_RCVD=" << NPTS_RCVD;
-        }*/
-
-        bool needFilter = filter;
-        if (needFilter) scanTmp.resize(SCANSIZE);
-        dsLeftOver -= DSCANS;
-        if (dsLeftOver < 0) dsLeftOver = 0;
-        for (int i = startpt; i < (int)DSIZE; ++i) {
-            if (needFilter) {
-                memcpy(&scanTmp[0], &data[i], SCANSIZE*sizeof(int16));
-                filter->apply(&scanTmp[0], deltaT);
-                DPTR = (&scanTmp[0])-i;//fudge DPTR.. dangerous but below code always accesses it as DPTR[i], so it's ok
-                needFilter = false;
-            }
-            if (dsMaxNPts >= DSCANS_DS-scannum_ds) {
-                if ( graphs[idx] && !pgraphs[idx] && (maximizedIdx < 0 || maximizedIdx == idx)) {
-                    v.x = t;
-                    v.y = DPTR[i] / 32768.0; // hardcoded range of data
-                    Vec2fWrapBuffer & pbuf = pts[idx];
-                    GraphStats & gs = graphStats[idx];
-                    if (!pbuf.unusedCapacity()) {
-                        const double val = pbuf.first().y;
-                        gs.s1 -= val; // un-tally sum of values
-                        gs.s2 -= val*val; // un-tally sum of squares of values
-                        --gs.num;
-                    }
-                    pbuf.putData(&v, 1);
-                    gs.s1 += v.y; // tally sum of values
-                    gs.s2 += v.y*v.y; // tally sum of squares of values
-                    ++gs.num;
-                }
-            }
-            if (!(++idx % SCANSIZE)) { // new scan
-                idx = 0;
-                t += deltaT;
-                i = int((i-SCANSIZE) + DOWNSAMPLE_RATIO*SCANSIZE);
-                scannum += DOWNSAMPLE_RATIO;
-                ++scannum_ds;
-                if (scannum >= DSCANS)
-                    dsLeftOver = (scannum - DSCANS)%DOWNSAMPLE_RATIO;
-                else
-                    dsLeftOver = 0;
-                if ((i+1) % SCANSIZE) {
-                    Warning() << "i+1 mod SCANSIZE is nonzero!";
-                    i -= (i+1) % SCANSIZE;
-                }
-                DPTR = &data[0];
-                needFilter = filter;
-            }
+        // highpass filter the whole page in one go, before decimating, so the filter sees every scan
+        const int16 *src = data;
+        if (filter && DSCANS) {
+            scanTmp.resize(size_t(DSCANS)*SCANSIZE); // only ever grows the capacity, so no allocation in the steady state
+            memcpy(&scanTmp[0], data, size_t(DSCANS)*SCANSIZE*sizeof(int16));
+            filter->applyBlock(&scanTmp[0], unsigned(DSCANS), unsigned(SCANSIZE), 1.0/SRATE);
+            src = &scanTmp[0];
         }
 
-        for (int i = 0; i < SCANSIZE; ++i) {
-            if (pgraphs[i] || !graphs[i]) continue;
-            // now, copy in temp data
-            if (graphs[i] && pts[i].size() >= 2) {
-#if 0
-                // the below code always draws new data from left of graph, then scrolls.. this is kind of broken though
-
-                // now, readjust x axis begin,end
-                graphStates[i].min_x = pts[i].first().x;
-                graphs[i]->minx() = graphStates[i].min_x;
-				graphStates[i].max_x = graphStates[i].min_x + graphTimesSecs[i];
-                graphs[i]->maxx() = graphStates[i].max_x;
-                // XXX hack uncomment below 2 line if the empty gap at the end of the downsampled graph annoys you, or comment them out to remove this 'feature'
-                //if (!points[i].unusedCapacity())
-                //    graphs[i]->maxx() = points[i].last().x;
-#else
-                // the below code always draws new data at right of graph, then scrolls
-                // now, readjust x axis begin,end
-                graphStates[i].max_x = pts[i].last().x;
-                graphs[i]->maxx() = graphStates[i].max_x;
-                graphStates[i].min_x = graphStates[i].max_x - graphTimesSecs[i];
-                graphs[i]->minx() = graphStates[i].min_x;
-#endif
-            } 
-            // and, notify graph of new points
-            graphs[i]->setPoints(&pts[i]);
+        // The rows we plot, evenly spaced dx apart starting at time tFirst.  Without downsampling, that's every scan.
+        // With it, each bucket of DOWNSAMPLE_RATIO scans becomes 2 rows, its per-channel minimum and maximum, so spikes
+        // narrower than a bucket still show at their full height.
+        const int16 *rows = src;
+        int nPlot = DSCANS;
+        double tFirst = double(firstSamp / u64(SCANSIZE)) / SRATE, dx = 1.0/SRATE;
+        if (DOWNSAMPLE_RATIO > 1) {
+            tFirst = double(firstSamp / u64(SCANSIZE) - decimator.pending()) / SRATE; // the first bucket began in a previous page
+            dx = DOWNSAMPLE_RATIO / SRATE / 2.0;
+            nPlot = 2*int(decimator.bucketsFor(unsigned(DSCANS)));
+            decimTmp.resize(size_t(nPlot)*SCANSIZE + 1);
+            decimator.apply(src, unsigned(DSCANS), unsigned(SCANSIZE), &decimTmp[0]);
+            rows = &decimTmp[0];
         }
-        
+        // don't bother with the points that would scroll right off of even the widest graph
+        const int skip = nPlot > dsMaxNPts ? nPlot - dsMaxNPts : 0, nPut = nPlot - skip;
+
+        // now, push new points to back of each graph's ring
+        const int nOn = int(ringsOn.size());
+        const int * const on = nOn ? &ringsOn[0] : 0;
+        PointRing * const rp = &rings[0];
+        if (nPut > 0) {
+            for (int j = 0; j < nOn; ++j) rp[on[j]].beginWrite(unsigned(nPut));
+            for (int k = skip; k < nPlot; ++k) {
+                const int16 * const scan = rows + size_t(k)*SCANSIZE;
+                const float x = float(tFirst + k*dx);
+                for (int j = 0; j < nOn; ++j)
+                    rp[on[j]].put(unsigned(k-skip), Vec2f(x, scan[on[j]] / 32768.0f)); // hardcoded range of data
+            }
+            for (int j = 0; j < nOn; ++j) rp[on[j]].endWrite(unsigned(nPut));
+        }
+
         tNow = getTime();
 
         const double tDelta = tNow - tLast;
@@ -713,20 +690,124 @@ void GraphsWindow::putScans(const int16 * data, unsigned DSIZE, u64 firstSamp)
             tAvg /= ++tNum;
         } 
 
-        // debug fixme XXX TODO
-        //if (mainApp()->isDebugMode()) qDebug("GraphsWindow::putScans took %f ms (avg time between calls=%f ms)", (tNow-t0)*1e3, tAvg*1e3);
+        if (excessiveDebug) {
+            const double el = tNow - t0;
+            ingestT += el, ++ingestN;
+            if (el > ingestTMax) ingestTMax = el;
+            if (tNow - ingestLastLog >= 5.0) {
+                Debug() << "GraphsWindow::putScans took " << (ingestT/ingestN*1e3) << " ms avg, " << (ingestTMax*1e3) << " ms max per page of "
+                        << DSCANS << " scans x " << SCANSIZE << " chans (" << nPut << " points to each of " << nOn << " graphs), "
+                        << (tAvg*1e3) << " ms avg between pages";
+                ingestT = ingestTMax = 0., ingestN = 0, ingestLastLog = tNow;
+            }
+        }
 
         tLast = tNow;
 }
 
+/// appends n points to graph num's display buffer, keeping its stats up to date, and scrolls the graph to show them
+void GraphsWindow::appendPoints(int num, const Vec2f *v, unsigned n)
+{
+    Vec2fWrapBuffer & pbuf = points[num];
+    GraphStats & gs = graphStats[num];
+    const unsigned cap = pbuf.capacity();
+    if (!cap || !n) return;
+    if (n > cap) v += n - cap, n = cap; // the rest would just get clobbered
+    const unsigned nClobbered = pbuf.size() + n > cap ? pbuf.size() + n - cap : 0;
+    for (unsigned i = 0; i < nClobbered; ++i) {
+        const double val = pbuf.at(int(i)).y;
+        gs.s1 -= val; // un-tally sum of values
+        gs.s2 -= val*val; // un-tally sum of squares of values
+        --gs.num;
+    }
+    pbuf.putData(v, n);
+    for (unsigned i = 0; i < n; ++i) {
+        gs.s1 += v[i].y; // tally sum of values
+        gs.s2 += v[i].y*v[i].y; // tally sum of squares of values
+        ++gs.num;
+    }
+    if (!graphs[num]) return;
+    if (pbuf.size() >= 2) {
+        // always draw new data at right of graph, then scroll
+        // now, readjust x axis begin,end
+        graphStates[num].max_x = pbuf.last().x;
+        graphs[num]->maxx() = graphStates[num].max_x;
+        graphStates[num].min_x = graphStates[num].max_x - graphTimesSecs[num];
+        graphs[num]->minx() = graphStates[num].min_x;
+    }
+    // and, notify graph of new points
+    graphs[num]->setPoints(&pbuf);
+}
+
 void GraphsWindow::updateGraphs()
 {
     QMutexLocker l(&graphsMut);
 
+    // take the points putScans() left for us
+    const int maximizedIdx = (maximized ? parseGraphNum(maximized) : -1);
+    for (int i = 0; i < (int)graphs.size(); ++i) {
+        const bool want = graphs[i] && !pausedGraphs[i] && (maximizedIdx < 0 || maximizedIdx == i);
+        ringTmp.clear();
+        if (rings[i].take(want ? &ringTmp : 0))
+            appendPoints(i, &ringTmp[0], unsigned(ringTmp.size()));
+    }
+
     // repaint all graphs..
-    for (int i = 0; i < (int)graphs.size(); ++i)
-        if (graphs[i] && graphs[i]->needsUpdateGL())
-            graphs[i]->updateGL();
+    const double t0 = getTime();
+    int nPainted = 0;
+    if (canvases.size()) {
+        for (int i = 0; i < canvases.size(); ++i)
+            if (canvases[i] && canvases[i]->isVisible() && canvases[i]->needsUpdateGL())
+                canvases[i]->updateGL(), ++nPainted;
+    } else {
+        for (int i = 0; i < (int)graphs.size(); ++i)
+            if (graphs[i] && graphs[i]->needsUpdateGL())
+                graphs[i]->updateGL(), ++nPainted;
+    }
+    if (excessiveDebug && nPainted) {
+        const double t1 = getTime(), el = t1 - t0;
+        paintT += el, ++paintN;
+        if (el > paintTMax) paintTMax = el;
+        if (t1 - paintLastLog >= 5.0) {
+            int nOn = 0;
+            if (canvases.size()) { for (int i = 0; i < canvases.size(); ++i) if (canvases[i] && canvases[i]->isVisible()) nOn += canvases[i]->nGraphsShown(); }
+            else for (int i = 0; i < (int)graphs.size(); ++i) if (graphs[i] && graphs[i]->isVisible()) ++nOn;
+            Debug() << "GraphsWindow::updateGraphs repaint of " << nOn << " graphs (" << (canvases.size() ? "1 GLGraphCanvas" : "1 GLGraph each")
+                    << ") took " << (paintT/paintN*1e3) << " ms avg, " << (paintTMax*1e3) << " ms max";
+            paintT = paintTMax = 0., paintN = 0, paintLastLog = t1;
+        }
+    }
+}
+
+/// Tells the canvases (if any) which graphs to draw after tabChange(), retileGraphsAccordingToSorting() or
+/// openCustomChanset() moved them around, and which of them is selected or maximized.  Only the current tab's canvas
+/// gets graphs.
+void GraphsWindow::updateCanvases()
+{
+    QMutexLocker l(&graphsMut);
+
+    if (canvases.isEmpty() || sorting.size() != graphs.size()) return;
+    const int t = tabWidget ? tabWidget->currentIndex() : (stackedWidget ? stackedWidget->currentIndex() : 0);
+    for (int i = 0; i < canvases.size(); ++i) {
+        if (!canvases[i]) continue;
+        QVector<GLGraph *> gs;
+        QVector<QCheckBox *> cs;
+        if (!useTabs) {
+            // in the order openCustomChanset() lays them out in
+            for (int k = 0; k < lastCustomChanset.size(); ++k) {
+                const int id = int(lastCustomChanset[k]) < graphs.size() ? sorting[lastCustomChanset[k]] : -1;
+                gs.push_back(id < 0 ? 0 : graphs[id]);
+                cs.push_back(id < 0 ? 0 : chks[id]);
+            }
+        }
+        for (int k = 0; useTabs && i == t && k < NUM_GRAPHS_PER_GRAPH_TAB && t*NUM_GRAPHS_PER_GRAPH_TAB+k < graphs.size(); ++k) {
+            gs.push_back(graphs[sorting[t*NUM_GRAPHS_PER_GRAPH_TAB+k]]);
+            cs.push_back(chks[sorting[t*NUM_GRAPHS_PER_GRAPH_TAB+k]]);
+        }
+        canvases[i]->setGraphs(gs, cs, nRowsGraphTab, nColsGraphTab);
+        canvases[i]->setSelectedGraph(graphs[selectedGraph]);
+        canvases[i]->setMaximizedGraph(maximized);
+    }
 }
 
 void GraphsWindow::setDownsampling(bool checked)
@@ -736,21 +817,23 @@ void GraphsWindow::setDownsampling(bool checked)
     {
         QMutexLocker l(&graphsMut);
 
-        dsLeftOver = 0;
-
         if (checked?1:0 != downsampleChk->isChecked()?1:0) {
             downsampleChk->blockSignals(true);
             downsampleChk->setChecked(checked);
             downsampleChk->blockSignals(false);
         }
 
-        double hz = downsamplekHz->value() * 1000.0;
+        double hz = downsamplekHz->value() * 1000.0, ratio = 1.;
         if (checked) {
             if (hz <= 0.0) hz = 1.0;
-            downsampleRatio = params.srate/hz;
-            if (downsampleRatio < 1.) downsampleRatio = 1.;
-        } else
-            downsampleRatio = 1.;
+            ratio = params.srate/hz;
+            if (ratio < 1.) ratio = 1.;
+        }
+        {
+            QMutexLocker il(&ingestMut); // putScans() uses these
+            decimator.reset(unsigned(rings.size()), unsigned(qRound(ratio)));
+            downsampleRatio = ratio;
+        }
         double khz = params.srate/downsampleRatio / 1000.0;
         if (checked) {
             // now update double spinbox with real value we are using.. useful
@@ -831,6 +914,7 @@ void GraphsWindow::selectGraph(int num)
 		chanLbl->setText(QString("Ch %1").arg(num));        
 	}
     graphFrames[num]->setFrameStyle(QFrame::Box|QFrame::Plain);
+    updateCanvases();
 
     updateGraphCtls();
 }
@@ -958,7 +1042,7 @@ void GraphsWindow::updateMouseOver()
 
     QWidget *w = QApplication::widgetAt(QCursor::pos());
     bool isNowOver = true;
-    if (!w || !dynamic_cast<GLGraph *>(w)) isNowOver = false;
+    if (!w || !(dynamic_cast<GLGraph *>(w) || dynamic_cast<GLGraphCanvas *>(w))) isNowOver = false;
     const int & num = lastMouseOverGraph;
     if (num < 0 || num >= (int)graphs.size()) {
         statusBar()->clearMessage();
@@ -994,13 +1078,13 @@ void GraphsWindow::toggleMaximize()
             // non-tabbed mode just involves hiding everything but the maximized graph.. so unhide everything that was hidden by maximize
             for (int i = 0; i < (int)graphs.size(); ++i) {
                 // unhide everything that was on our page (that has a valid GLGraph * pointer)
-                if (graphs[i]) graphFrames[i]->setHidden(false);
+                if (graphs[i] && canvases.isEmpty()) graphFrames[i]->setHidden(false);
             }
         } else { // tabber mode is a little more complex
             // un-maximize
             for (int i = 0; i < (int)graphs.size(); ++i) {
                 if (graphs[i] == maximized) continue;
-                graphFrames[i]->setHidden(false);
+                if (canvases.isEmpty()) graphFrames[i]->setHidden(false);
                 clearGraph(i); // clear previously-paused graph
             }
             if (tabWidget || stackedCombo) {
@@ -1023,7 +1107,7 @@ void GraphsWindow::toggleMaximize()
         tabber->setHidden(true); // if we don't hide the parent, the below operation is slow and jerky
         for (int i = 0; i < (int)graphs.size(); ++i) {
             if (num == i) continue;
-            graphFrames[i]->setHidden(true);
+            if (canvases.isEmpty()) graphFrames[i]->setHidden(true);
         }
         maximized = graphs[num];
         if (tabWidget || stackedCombo) {
@@ -1041,6 +1125,7 @@ void GraphsWindow::toggleMaximize()
         tabber->setHidden(false);
         tabber->show(); // now show parent
     }
+    updateCanvases();
     updateGraphCtls();
 }
 
@@ -1052,12 +1137,14 @@ void GraphsWindow::clearGraph(int which)
     if (which < 0 || which > graphs.size()) {
         // clear all..
         for (int i = 0; i < (int)points.size(); ++i) {
+            rings[i].take(0); // and drop whatever putScans() left for us
             points[i].clear();
             if (graphs[i]) graphs[i]->setPoints(&points[i]);
 			graphStates[i].pointsWB = &points[i];
             graphStats[i].clear();
         }
     } else {
+        rings[which].take(0);
         points[which].clear();
         if (graphs[which]) graphs[which]->setPoints(&points[which]);
 		graphStates[which].pointsWB = &points[which];		
@@ -1110,9 +1197,10 @@ void GraphsWindow::hpfChk(bool b)
 {
     QMutexLocker l(&graphsMut);
 
-    if (filter) delete filter, filter = 0;
-    if (b) {
-        filter = new HPFilter(graphs.size(), 300.0);
+    {
+        QMutexLocker il(&ingestMut);
+        if (filter) delete filter, filter = 0;
+        if (b) filter = new HPFilter(graphs.size(), 300.0);
     }
     QSettings settings(SETTINGS_DOMAIN, SETTINGS_APP);
 	settings.beginGroup("GraphsWindow");
@@ -1182,6 +1270,8 @@ void GraphsWindow::toggleSaveChecked(bool b)
 	const int n = chks.size();
 	for (int i = 0; i < n; ++i)
         chks[i]->setDisabled(b);
+    for (int i = 0; i < canvases.size(); ++i)
+        if (canvases[i]) canvases[i]->update();
 }
 
 void GraphsWindow::setToggleSaveChkBox(bool b)
@@ -1268,13 +1358,15 @@ void GraphsWindow::retileGraphsAccordingToSorting() {
                     const int graphId = sorting[num], namId = naming[num];
                     QFrame * & f = graphFrames[graphId];
                     f->setParent(graphsWidget);
-                    l->addWidget(f, r, c);
+                    if (canvases.size()) f->hide();
+                    else l->addWidget(f, r, c);
 
                     if (first_graph_num == (int)0xdeadbeef) first_graph_num = namId;
                     last_graph_num = namId;
 
                 }
             }
+            if (i < canvases.size() && canvases[i]) l->addWidget(canvases[i], 0, 0);
             QString tabText = QString("%3 %1-%2").arg(first_graph_num).arg(last_graph_num).arg(params.bug.enabled ? "Chan." : "Elec.");
             if (tabWidget)
                 tabWidget->setTabText(i, tabText);
@@ -1407,7 +1499,7 @@ void GraphsWindow::openCustomChanset(const QVector<unsigned> & ids)
             }
         }
         QGridLayout *grid = dynamic_cast<QGridLayout *>(nonTabWidget->layout());
-        if (grid) {
+        if (grid && canvases.isEmpty()) {
             int r = i / nColsGraphTab, c = i % nColsGraphTab;
             grid->removeWidget(f);
             grid->addWidget(f,r,c);
@@ -1417,6 +1509,7 @@ void GraphsWindow::openCustomChanset(const QVector<unsigned> & ids)
         setGraphTimeSecs(graphId, graphTimesSecs[graphId]);
     }
     for (int i = 0; i < N_G; ++i) if (graphs[i]) graphs[i]->setUpdatesEnabled(true);
+    updateCanvases();
     nonTabWidget->show();
     setUpdatesEnabled(true);
     if (selectedGraph < firstGraph || selectedGraph >= firstGraph+NUM_GRAPHS_PER_GRAPH_TAB)
@@ -1478,6 +1571,7 @@ void GraphsWindow::tabChange(int t)
 	setUpdatesEnabled(true);
 	if (selectedGraph < firstGraph || selectedGraph >= firstGraph+NUM_GRAPHS_PER_GRAPH_TAB)
 		selectGraph(firstGraph); // force first graph to be selected!
+	updateCanvases();
 	//retileGraphsAccordingToSorting();
 	emit tabChanged(t);
 }
@@ -1666,9 +1760,10 @@ unsigned GraphsWindow::grabAllScansFromDisplayBuffers(std::vector<int16> & scans
         }
     }
     const int dsr_i = qRound(dsr);
-    if (dsr_i != 1) {
+    if (dsr_i > 2) {
+        // when downsampling, the graphs have 2 points (a min and a max) for each dsr_i scans
         scans_out_resampled.clear();
-        Util::Resampler::resample(scans_out, scans_out_resampled, double(dsr_i), scansz, Util::Resampler::SincMedium, true);
+        Util::Resampler::resample(scans_out, scans_out_resampled, double(dsr_i)/2.0, scansz, Util::Resampler::SincMedium, true);
     } else {
         // no resampling since graph data wasn't originally downsampled...
         scans_out_resampled.swap(scans_out);
@@ -6,6 +6,8 @@
 #include "GLGraph.h"
 #include "TypeDefs.h"
 #include "VecWrapBuffer.h"
+#include "PointRing.h"
+#include "MinMaxDecimator.h"
 #include <QVector>
 #include <vector>
 #include "ChanMappingController.h"
@@ -28,6 +30,7 @@ class QTabWidget;
 class QTimer;
 class QStackedWidget;
 class QComboBox;
+class GLGraphCanvas;
 
 class GraphsWindow : public QMainWindow, public GenericGrapher
 {
@@ -144,6 +147,8 @@ private:
     void setGraphTimeSecs(int graphnum, double t); // note you should call update_nPtsAllGs after this!  (Not auto-called in this function just in case of batch setGraphTimeSecs() in which case 1 call at end to update_nPtsAllGs() suffices.)
     
     void updateGraphCtls();
+    void appendPoints(int graphnum, const Vec2f *pts, unsigned n);
+    void updateCanvases();
     void doPauseUnpause(int num, bool updateCtls = true);
     void computeGraphMouseOverVars(unsigned num, double & y,
                                    double & mean, double & stdev, double & rms,
@@ -204,7 +209,7 @@ private:
     QVector<GraphStats> graphStats; ///< mean/stddev stuff
 	QVector<GLGraphState> graphStates; ///< used to maintain internal glgraph state for graph re-use...
     volatile double downsampleRatio;
-    int dsLeftOver, dsMaxNPts;
+    int dsMaxNPts;
     double tNow, tLast, tAvg, tNum;
     int pdChan, firstExtraChan;
     QAction *pauseAct, *maxAct, *applyAllAct;
@@ -220,10 +225,21 @@ private:
 	QVector <int> sorting, naming;
 	QSet<GLGraph *> extraGraphs;
     std::vector<int16> scanTmp;
+    MinMaxDecimator decimator; ///< what putScans() downsamples with
+    std::vector<int16> decimTmp;
     QVector<unsigned> lastCustomChanset;
     QDoubleSpinBox *downsamplekHz;
+    std::vector<PointRing> rings; ///< per graph: points from putScans() (data thread) waiting for updateGraphs() (GUI thread) to take them
+    std::vector<Vec2f> ringTmp;
+    std::vector<int> ringsOn; ///< the graphs whose ring is on, for putScans()
+    double ingestT, ingestTMax, ingestLastLog; ///< putScans() timing, logged in excessiveDebug mode
+    unsigned ingestN;
+    QVector<GLGraphCanvas *> canvases; ///< per tab (just 1 when not using tabs), when its graphs are drawn by 1 GLGraphCanvas instead of each being its own widget (SPIKEGL_GRAPH_CANVAS=1).  empty otherwise
+    double paintT, paintTMax, paintLastLog; ///< updateGraphs() repaint timing, logged in excessiveDebug mode
+    unsigned paintN;
 
     mutable QMutex graphsMut; ///< recursive mutex.  locked whenever this class accesses graph data.  used because we are transitioning over to a threaded graphing data reader model as of Feb. 2016
+    QMutex ingestMut; ///< protects what putScans() uses: the rings' capacities, dsMaxNPts, downsampleRatio, decimator and filter.  never held while painting, so the data thread never waits on the GUI
 };
 
 
@@ -1,9 +1,11 @@
 #include "HPFilter.h"
+#include "SIMD.h"
 #include <math.h>
 #ifndef M_PI
 # define M_PI           3.14159265358979323846
 #endif
 HPFilter::HPFilter(unsigned ssize, double coff)
+    : cutoffHz(0.), lastDt(0.), A(0.f), B(1.f), virgin(true)
 {
     setScanSize(ssize);
     setCutoffFreqHz(coff);
@@ -12,8 +14,13 @@ HPFilter::HPFilter(unsigned ssize, double coff)
 void HPFilter::setScanSize(unsigned ss)
 {
     state.clear();
-    state.resize(ss, 0.);
-    lastDt = 0.;    
+    state.resize(ss, 0.f);
+    mask.clear();
+    mask.resize(ss, -1);
+    allOn = mask;
+    maskBools.clear();
+    maskBools.resize(ss, true);
+    lastDt = 0.;
     virgin = true;
 }
 
@@ -25,37 +32,165 @@ void HPFilter::setCutoffFreqHz(double f)
     virgin = true; // force a recompute of coeffs on next call to apply()
 }
 
+void HPFilter::setChannelMask(const std::vector<bool> & chans)
+{
+    const unsigned ss = scanSize();
+    if (chans.size() < ss) return;
+    for (unsigned i = 0; i < ss; ++i) {
+        mask[i] = chans[i] ? -1 : 0;
+        maskBools[i] = chans[i];
+    }
+}
+
+void HPFilter::setupCoeffs(double dt)
+{
+    if (lastDt != dt || virgin) {
+        lastDt = dt;
+        const double a = exp(-2.0 * M_PI * cutoffHz * lastDt);
+        A = float(a);
+        B = float(1.0 - a);
+    }
+    virgin = false;
+}
+
 void HPFilter::apply(short *scan, double dt)
 {
-	std::vector<bool> v;
-	v.resize(scanSize(), true);
-	apply(scan, dt, v);
+    if (dt <= 0. || allOn.empty()) return; // error!
+    setupCoeffs(dt);
+    run(scan, 1, scanSize(), &allOn[0]);
 }
 
 void HPFilter::apply(short *scan, double dt, const std::vector<bool> & chans)
 {
 	if (chans.size() < scanSize()) return;
-    if (dt <= 0.) return; // error!
-    if (lastDt != dt || virgin) {
-        lastDt = dt;
-        recomputeCoeffs();
+    if (dt <= 0. || mask.empty()) return; // error!
+    if (chans.size() != maskBools.size() || chans != maskBools) setChannelMask(chans);
+    setupCoeffs(dt);
+    run(scan, 1, scanSize(), &mask[0]);
+}
+
+/// A channel that sits at exactly 0 for a while decays its state into the denormals, which are
+/// many times slower to compute with.  So flush them to zero while filtering.
+struct DenormalsOff {
+#ifdef SIMD_X86
+    unsigned csr;
+    DenormalsOff() : csr(_mm_getcsr()) { _mm_setcsr(csr | 0x8040); } // FTZ | DAZ
+    ~DenormalsOff() { _mm_setcsr(csr); }
+#endif
+};
+
+void HPFilter::applyBlock(short *scans, unsigned nScans, unsigned stride, double dt)
+{
+    if (dt <= 0. || mask.empty() || stride < scanSize()) return; // error!
+    setupCoeffs(dt);
+    run(scans, nScans, stride, &mask[0]);
+}
+
+void HPFilter::applyBlockScalar(short *scans, unsigned nScans, unsigned stride, double dt)
+{
+    if (dt <= 0. || mask.empty() || stride < scanSize()) return; // error!
+    setupCoeffs(dt);
+    DenormalsOff d;
+    runScalar(scans, nScans, stride, &mask[0]);
+}
+
+void HPFilter::run(short *scans, unsigned nScans, unsigned stride, const short *maskp)
+{
+    DenormalsOff d;
+    const SIMD::Level l = SIMD::level();
+    if (l >= SIMD::AVX2) runAVX2(scans, nScans, stride, maskp);
+    else if (l >= SIMD::SSE2) runSSE2(scans, nScans, stride, maskp);
+    else runScalar(scans, nScans, stride, maskp);
+}
+
+/* All the kernels do the same float math, in the same order, so they produce identical output.
+   The state is kept in sample units (ie. scaled by 32768) which saves a multiply per sample:
+
+       state = B*in + A*state,  out = clamp(in - state, +/-32768) * 32767/32768
+
+   The SIMD kernels do 8 channels at a time and leave the last ss % 8 channels of each scan to
+   filterTail(). */
+
+static const float outScale = 32767.f/32768.f;
+
+static inline void filterTail(short *scan, float *st, const short *maskp, unsigned from, unsigned ss, float A, float B)
+{
+    for (unsigned i = from; i < ss; ++i) {
+        const float in = float(scan[i]);
+        st[i] = B * in + A * st[i];
+        float out = in - st[i];
+        if (out > 32768.f) out = 32768.f;
+        else if (out < -32768.f) out = -32768.f;
+        if (maskp[i])
+            scan[i] = static_cast<short>(out * outScale);
+    }
+}
+
+void HPFilter::runScalar(short *scans, unsigned nScans, unsigned stride, const short *maskp)
+{
+    const unsigned ss = scanSize();
+    float * const st = &state[0];
+    for (unsigned s = 0; s < nScans; ++s, scans += stride)
+        filterTail(scans, st, maskp, 0, ss, A, B);
+}
+
+#ifdef SIMD_X86
+void HPFilter::runSSE2(short *scans, unsigned nScans, unsigned stride, const short *maskp)
+{
+    const unsigned ss = scanSize(), nVec = ss & ~7U;
+    float * const st = &state[0];
+    const __m128 a = _mm_set1_ps(A), b = _mm_set1_ps(B), sc = _mm_set1_ps(outScale);
+    const __m128 hi = _mm_set1_ps(32768.f), lo = _mm_set1_ps(-32768.f);
+    for (unsigned s = 0; s < nScans; ++s, scans += stride) {
+        for (unsigned i = 0; i < nVec; i += 8) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(scans + i));
+            const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(maskp + i));
+            // sign-extend the 8 samples to 2 x 4 int32, then to float
+            const __m128 in0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+            const __m128 in1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+            const __m128 s0 = _mm_add_ps(_mm_mul_ps(b, in0), _mm_mul_ps(a, _mm_loadu_ps(st + i)));
+            const __m128 s1 = _mm_add_ps(_mm_mul_ps(b, in1), _mm_mul_ps(a, _mm_loadu_ps(st + i + 4)));
+            _mm_storeu_ps(st + i, s0);
+            _mm_storeu_ps(st + i + 4, s1);
+            const __m128 o0 = _mm_mul_ps(_mm_max_ps(_mm_min_ps(_mm_sub_ps(in0, s0), hi), lo), sc);
+            const __m128 o1 = _mm_mul_ps(_mm_max_ps(_mm_min_ps(_mm_sub_ps(in1, s1), hi), lo), sc);
+            const __m128i o = _mm_packs_epi32(_mm_cvttps_epi32(o0), _mm_cvttps_epi32(o1));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(scans + i), _mm_or_si128(_mm_and_si128(m, o), _mm_andnot_si128(m, v)));
+        }
+        filterTail(scans, st, maskp, nVec, ss, A, B);
     }
+}
 
-    const int ss = scanSize();
-    for (int i = 0; i < ss; ++i) {
-		const double in = static_cast<double>(scan[i])/32768.;
-		state[i] = B * in + A * state[i];            
-		double out =  in - state[i];            
-		if (out > 1.0) out = 1.0;
-		else if (out < -1.0) out = -1.0;
-		if (chans[i])
-            scan[i] = static_cast<short>(out*32767.);
+SIMD_TARGET("avx2")
+void HPFilter::runAVX2(short *scans, unsigned nScans, unsigned stride, const short *maskp)
+{
+    const unsigned ss = scanSize(), nVec = ss & ~7U;
+    float * const st = &state[0];
+    const __m256 a = _mm256_set1_ps(A), b = _mm256_set1_ps(B), sc = _mm256_set1_ps(outScale);
+    const __m256 hi = _mm256_set1_ps(32768.f), lo = _mm256_set1_ps(-32768.f);
+    for (unsigned s = 0; s < nScans; ++s, scans += stride) {
+        for (unsigned i = 0; i < nVec; i += 8) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(scans + i));
+            const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(maskp + i));
+            const __m256 in = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v));
+            // no FMA here: it would round differently from the other kernels
+            const __m256 s0 = _mm256_add_ps(_mm256_mul_ps(b, in), _mm256_mul_ps(a, _mm256_loadu_ps(st + i)));
+            _mm256_storeu_ps(st + i, s0);
+            const __m256i o32 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_max_ps(_mm256_min_ps(_mm256_sub_ps(in, s0), hi), lo), sc));
+            const __m128i o = _mm_packs_epi32(_mm256_castsi256_si128(o32), _mm256_extracti128_si256(o32, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(scans + i), _mm_blendv_epi8(v, o, m));
+        }
+        filterTail(scans, st, maskp, nVec, ss, A, B);
     }
-    virgin = false;
+}
+#else
+void HPFilter::runSSE2(short *scans, unsigned nScans, unsigned stride, const short *maskp)
+{
+    runScalar(scans, nScans, stride, maskp);
 }
 
-void HPFilter::recomputeCoeffs()
+void HPFilter::runAVX2(short *scans, unsigned nScans, unsigned stride, const short *maskp)
 {
-    A = exp(-2.0 * M_PI * cutoffHz * lastDt);
-    B = 1.0 - A;
+    runScalar(scans, nScans, stride, maskp);
 }
+#endif
@@ -3,35 +3,54 @@
 
 #include <vector>
 
-/// A high-pass filter.  Feed it a scan at a time and have it 
-/// high-pass filter based on the cutoff freq.
-/// This is basically a biquad filter.
+/// A high-pass filter.  Feed it a scan at a time, or better yet a block of scans
+/// at a time, and have it high-pass filter based on the cutoff freq.
+/// This is basically a single-pole IIR filter, run independently on each channel.
+/// The filter state is kept in single precision floats so that applyBlock() can
+/// process 4 (SSE2) or 8 (AVX2) channels at once; see SIMD.h.
 class HPFilter
 {
 public:
     HPFilter(unsigned scanSize, double cutoffHz);
     void setCutoffFreqHz(double fHz);
     double cutoffFreqHz() const { return cutoffHz; }
-    
-    void setScanSize(unsigned);
+
+    void setScanSize(unsigned); ///< also resets the channel mask to all channels
     unsigned scanSize() const { return unsigned(state.size()); }
 
-    /// Convolves the scan in-place using the filter
+    /// Which channels applyBlock() writes filtered values back to (which_chans[i] == true -> filter).
+    /// Should have at least scanSize() entries, otherwise this is ignored.  The default is all channels.
+    /// (NB: filter state is always updated for each chan even if filtering isn't applied)
+    void setChannelMask(const std::vector<bool> & which_chans);
+
+    /// Filters nScans scans in-place.  Scan i starts at scans + i*stride, and stride must be >= scanSize().
+    /// Only the channels in the channel mask are modified.  Does not allocate.
+    void applyBlock(short *scans, unsigned nScans, unsigned stride, double dt);
+
+    /// Convolves the scan in-place using the filter.  All channels are filtered, regardless of the channel mask.
     void apply(short *scan, double dt);
 
 	/// Same as above, but supports convolving only a subset of channels in the scan.
-	/// Note that which_chans should be the same size as scanSize().  It specifies
-	/// which channels in the scan array to filter (which_chans[i] == true -> filter).
-	/// (NB: filter state is always updated for each chan even if filtering isn't applied)
+	/// Equivalent to setChannelMask(which_chans) followed by applyBlock(scan, 1, scanSize(), dt).
 	void apply(short *scan, double dt, const std::vector<bool> & which_chans);
 
+    /// Same as applyBlock() but never uses the SIMD kernels.  Gives the same results; here for benchmarking.
+    void applyBlockScalar(short *scans, unsigned nScans, unsigned stride, double dt);
+
 private:
-    void recomputeCoeffs();
+    void setupCoeffs(double dt);
+    void run(short *scans, unsigned nScans, unsigned stride, const short *maskp);
+    void runScalar(short *scans, unsigned nScans, unsigned stride, const short *maskp);
+    void runSSE2(short *scans, unsigned nScans, unsigned stride, const short *maskp);
+    void runAVX2(short *scans, unsigned nScans, unsigned stride, const short *maskp);
 
-    double cutoffHz, lastDt, A, B;
-    std::vector<double> state;
+    double cutoffHz, lastDt;
+    float A, B;
+    std::vector<float> state;
+    std::vector<short> mask, allOn; ///< per channel: -1 to write the filtered value back, 0 to leave it alone
+    std::vector<bool> maskBools; ///< what mask was made from, so apply(scan,dt,which) only rebuilds it when which changes
     bool virgin;
-    
+
 };
 
 #endif
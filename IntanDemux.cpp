@@ -0,0 +1,185 @@
+#include "IntanDemux.h"
+#include "SIMD.h"
+#include <string.h>
+
+void IntanDemux::reset(unsigned scanSize, unsigned nChansPerIntan, unsigned nIntans)
+{
+    ss = scanSize;
+    npi = nChansPerIntan;
+    nI = nIntans;
+    if (size_t(npi)*nI > ss) npi = nI = 0; // bad params, don't demux
+    perm.resize(size_t(npi)*nI);
+    // INTAN k's channel c is input sample c*nIntans + k, and goes to output sample k*nChansPerIntan + c
+    for (unsigned k = 0; k < nI; ++k)
+        for (unsigned c = 0; c < npi; ++c)
+            perm[k*npi + c] = c*nI + k;
+}
+
+bool IntanDemux::usesSIMD() const
+{
+#ifdef SIMD_X86
+    return !isIdentity() && npi >= 8 && !(nI & 1) && SIMD::level() >= SIMD::SSE2;
+#else
+    return false;
+#endif
+}
+
+void IntanDemux::apply(const short *in, short *out, unsigned nScans) const
+{
+    if (isIdentity()) { memcpy(out, in, size_t(nScans)*ss*sizeof(short)); return; }
+    if (!usesSIMD()) { applyScalar(in, out, nScans); return; }
+    const unsigned nmux = npi*nI;
+    std::vector<const short *> rows(npi);
+    for (unsigned s = 0; s < nScans; ++s, in += ss, out += ss) {
+        for (unsigned c = 0; c < npi; ++c) rows[c] = in + c*nI;
+        applySSE2(&rows[0], out);
+        if (ss > nmux) memcpy(out + nmux, in + nmux, (ss-nmux)*sizeof(short));
+    }
+}
+
+void IntanDemux::applyScalar(const short *in, short *out, unsigned nScans) const
+{
+    const unsigned nmux = unsigned(perm.size());
+    const unsigned *p = perm.empty() ? 0 : &perm[0];
+    for (unsigned s = 0; s < nScans; ++s, in += ss, out += ss) {
+        for (unsigned i = 0; i < nmux; ++i) out[i] = in[p[i]];
+        if (ss > nmux) memcpy(out + nmux, in + nmux, (ss-nmux)*sizeof(short));
+    }
+}
+
+namespace {
+    /// A merged dual device scan, without the merge: where its 4 segments are in the 2 input scans, in merged order.
+    struct MergedScan {
+        const short *seg[4];
+        unsigned off[5]; ///< seg[i] is merged samples [off[i], off[i+1])
+        unsigned ss1, ss2;
+
+        MergedScan(const short *in, unsigned scanSize1, unsigned nMux, const short *in2, unsigned scanSize2, unsigned nMux2)
+            : ss1(scanSize1), ss2(scanSize2)
+        {
+            seg[0] = in; seg[1] = in2; seg[2] = in + nMux; seg[3] = in2 + nMux2;
+            off[0] = 0; off[1] = nMux; off[2] = nMux + nMux2; off[3] = off[2] + (ss1-nMux); off[4] = ss1 + ss2;
+        }
+        void next() { seg[0] += ss1; seg[1] += ss2; seg[2] += ss1; seg[3] += ss2; }
+        /// which segment merged samples [from, from+n) are in, or -1 if they span more than 1
+        int segOf(unsigned from, unsigned n) const {
+            for (int i = 0; i < 4; ++i)
+                if (from >= off[i] && from + n <= off[i+1]) return i;
+            return -1;
+        }
+        /// copies merged samples [from, to) to out, 1 block copy per segment
+        void copy(unsigned from, unsigned to, short *out) const {
+            for (int i = 0; i < 4 && from < to; ++i) {
+                if (from >= off[i+1]) continue;
+                const unsigned end = to < off[i+1] ? to : off[i+1];
+                memcpy(out, seg[i] + (from-off[i]), (end-from)*sizeof(short));
+                out += end-from; from = end;
+            }
+        }
+    };
+}
+
+void IntanDemux::applyDual(const short *in, unsigned scanSize1, unsigned nMux, const short *in2, unsigned nMux2, short *out, unsigned nScans) const
+{
+    if (scanSize1 > ss) scanSize1 = ss;
+    if (nMux > scanSize1) nMux = scanSize1;
+    if (nMux2 > ss-scanSize1) nMux2 = ss-scanSize1;
+    MergedScan m(in, scanSize1, nMux, in2, ss-scanSize1, nMux2);
+    if (isIdentity()) { // just the merge
+        for (unsigned s = 0; s < nScans; ++s, m.next(), out += ss) m.copy(0, ss, out);
+        return;
+    }
+    if (!usesSIMD()) { applyDualScalar(in, scanSize1, nMux, in2, nMux2, out, nScans); return; }
+
+    // The MUXed part is npi rows of nI samples: find which segment each row is in, once.  A row that
+    // straddles 2 segments (nMux not a multiple of nI) is copied to `split' for each scan instead.
+    const unsigned nmux = npi*nI;
+    std::vector<int> rowSeg(npi);
+    std::vector<const short *> rows(npi);
+    std::vector<short> split;
+    for (unsigned c = 0; c < npi; ++c)
+        if ((rowSeg[c] = m.segOf(c*nI, nI)) < 0) split.resize(nmux);
+    for (unsigned s = 0; s < nScans; ++s, m.next(), out += ss) {
+        for (unsigned c = 0; c < npi; ++c) {
+            const int i = rowSeg[c];
+            if (i >= 0) rows[c] = m.seg[i] + (c*nI - m.off[i]);
+            else { m.copy(c*nI, c*nI + nI, &split[c*nI]); rows[c] = &split[c*nI]; }
+        }
+        applySSE2(&rows[0], out);
+        if (ss > nmux) m.copy(nmux, ss, out + nmux);
+    }
+}
+
+void IntanDemux::applyDualScalar(const short *in, unsigned scanSize1, unsigned nMux, const short *in2, unsigned nMux2, short *out, unsigned nScans) const
+{
+    if (scanSize1 > ss) scanSize1 = ss;
+    if (nMux > scanSize1) nMux = scanSize1;
+    if (nMux2 > ss-scanSize1) nMux2 = ss-scanSize1;
+    if (!ss) return;
+    MergedScan m(in, scanSize1, nMux, in2, ss-scanSize1, nMux2);
+    std::vector<short> merged(ss);
+    for (unsigned s = 0; s < nScans; ++s, m.next(), out += ss) {
+        m.copy(0, ss, &merged[0]);
+        applyScalar(&merged[0], out, 1);
+    }
+}
+
+#ifdef SIMD_X86
+/* Each MUXed part is nChansPerIntan rows of nIntans samples.  The kernel takes 8 rows at a time
+   (the last 8 overlap the previous ones when nChansPerIntan isn't a multiple of 8; being out of
+   place, writing some outputs twice is harmless), and transposes them 4 columns (INTANs) at a
+   time, then 2 if nIntans is 2 mod 4.  Each column comes out as 8 consecutive channels of one
+   INTAN, so each is 1 store.  Rows are passed as pointers so that in dual device mode they can
+   be read from either device's buffer. */
+
+static inline void transpose8x4(const short * const *row, unsigned k, short *out, unsigned npi)
+{
+    const __m128i a0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row[0] + k));
+    const __m128i a1 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row[1] + k));
+    const __m128i a2 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row[2] + k));
+    const __m128i a3 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row[3] + k));
+    const __m128i a4 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row[4] + k));
+    const __m128i a5 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row[5] + k));
+    const __m128i a6 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row[6] + k));
+    const __m128i a7 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row[7] + k));
+    const __m128i t0 = _mm_unpacklo_epi16(a0, a1), t1 = _mm_unpacklo_epi16(a2, a3); // rows 0-3, columns interleaved
+    const __m128i t2 = _mm_unpacklo_epi16(a4, a5), t3 = _mm_unpacklo_epi16(a6, a7); // rows 4-7
+    const __m128i u0 = _mm_unpacklo_epi32(t0, t1), u1 = _mm_unpackhi_epi32(t0, t1); // columns 0,1 and 2,3 of rows 0-3
+    const __m128i u2 = _mm_unpacklo_epi32(t2, t3), u3 = _mm_unpackhi_epi32(t2, t3); // same, rows 4-7
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi64(u0, u2));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + npi), _mm_unpackhi_epi64(u0, u2));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2*npi), _mm_unpacklo_epi64(u1, u3));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3*npi), _mm_unpackhi_epi64(u1, u3));
+}
+
+static inline __m128i load2(const short *p) { int v; memcpy(&v, p, sizeof(v)); return _mm_cvtsi32_si128(v); }
+
+static inline void transpose8x2(const short * const *row, unsigned k, short *out, unsigned npi)
+{
+    const __m128i t0 = _mm_unpacklo_epi16(load2(row[0] + k), load2(row[1] + k));
+    const __m128i t1 = _mm_unpacklo_epi16(load2(row[2] + k), load2(row[3] + k));
+    const __m128i t2 = _mm_unpacklo_epi16(load2(row[4] + k), load2(row[5] + k));
+    const __m128i t3 = _mm_unpacklo_epi16(load2(row[6] + k), load2(row[7] + k));
+    const __m128i u0 = _mm_unpacklo_epi32(t0, t1), u2 = _mm_unpacklo_epi32(t2, t3);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi64(u0, u2));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + npi), _mm_unpackhi_epi64(u0, u2));
+}
+
+/// the MUXed part of 1 scan, whose npi rows are at rows[0..npi-1]
+void IntanDemux::applySSE2(const short * const *rows, short *out) const
+{
+    const unsigned n4 = nI & ~3U;
+    for (unsigned r = 0; ; r += 8) {
+        if (r + 8 > npi) r = npi - 8;
+        unsigned k = 0;
+        for ( ; k < n4; k += 4) transpose8x4(rows + r, k, out + k*npi + r, npi);
+        if (k < nI) transpose8x2(rows + r, k, out + k*npi + r, npi);
+        if (r + 8 >= npi) break;
+    }
+}
+#else
+void IntanDemux::applySSE2(const short * const *rows, short *out) const
+{
+    (void)rows; (void)out; // not reached: usesSIMD() is false
+}
+#endif
@@ -0,0 +1,55 @@
+#ifndef IntanDemux_H
+#define IntanDemux_H
+
+#include <vector>
+
+/** The Intan demux of the NI MUX modes, for whole blocks of scans at a time.
+
+    In a MUXed scan the first nChansPerIntan*nIntans samples are interleaved: sample i is channel
+    i / nIntans of INTAN i % nIntans.  Demuxing groups them by INTAN, so each INTAN's channels
+    end up contiguous, in order.  The samples after those (the extra channels: PD, etc) stay put.
+    That is a transpose of an nChansPerIntan x nIntans matrix of samples, which apply() does
+    8 channels by 4 (or 2) INTANs at a time, with SSE2 unpacks.
+
+    The permutation is built once by reset(), rather than for each scan.  Out of place, so that
+    the demuxed scans can go straight into the PagedScanWriter's page.  In dual device mode,
+    applyDual() does the merge of the 2 devices' scans in the same pass. */
+class IntanDemux
+{
+public:
+    IntanDemux() : ss(0), npi(0), nI(0) {}
+    IntanDemux(unsigned scanSize, unsigned nChansPerIntan, unsigned nIntans) : ss(0), npi(0), nI(0) { reset(scanSize, nChansPerIntan, nIntans); }
+
+    /// Sets up for scans of scanSize samples.  If the MUXed part doesn't fit in the scan, or there's nothing
+    /// to demux, apply() just copies.
+    void reset(unsigned scanSize, unsigned nChansPerIntan, unsigned nIntans);
+
+    unsigned scanSize() const { return ss; }
+    unsigned nChansPerIntan() const { return npi; }
+    unsigned nIntans() const { return nI; }
+    /// true if apply() is just a memcpy
+    bool isIdentity() const { return nI < 2 || npi < 2; }
+    /// true if apply() will use the vectorized kernel on this machine
+    bool usesSIMD() const;
+
+    /// Demuxes nScans scans from `in' to `out', which must not overlap.
+    void apply(const short *in, short *out, unsigned nScans) const;
+    /// Same result as apply(), using the precomputed permutation only.  Here for benchmarking.
+    void applyScalar(const short *in, short *out, unsigned nScans) const;
+
+    /// Dual device mode: merges and demuxes in 1 pass.  Same result as apply() on the merged scans, which are laid
+    /// out as [in's 1st nMux samples][in2's 1st nMux2 samples][in's remaining samples][in2's remaining samples].
+    /// in has scanSize1 samples per scan, in2 has scanSize() - scanSize1.  Contiguous runs go to `out' as block
+    /// copies, and the MUXed part is read in place from both buffers.
+    void applyDual(const short *in, unsigned scanSize1, unsigned nMux, const short *in2, unsigned nMux2, short *out, unsigned nScans) const;
+    /// Same result as applyDual(): merges each scan, then applyScalar()'s it.  Here for benchmarking.
+    void applyDualScalar(const short *in, unsigned scanSize1, unsigned nMux, const short *in2, unsigned nMux2, short *out, unsigned nScans) const;
+
+private:
+    void applySSE2(const short * const *rows, short *out) const;
+
+    unsigned ss, npi, nI;
+    std::vector<unsigned> perm; ///< output sample i of a scan is input sample perm[i], for the MUXed part
+};
+
+#endif
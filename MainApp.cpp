@@ -49,6 +49,7 @@
 #include "Bug_Popout.h"
 #include "FG_ConfigDialog.h"
 #include "ui_SampleBuf_Dialog.h"
+#include "SIMD.h"
 
 Q_DECLARE_METATYPE(unsigned);
 
@@ -88,11 +89,13 @@ namespace {
 MainApp * MainApp::singleton = 0;
 
 MainApp::MainApp(int & argc, char ** argv)
-    : QApplication(argc, argv, true), mut(QMutex::Recursive), consoleWindow(0), debug(false), initializing(true), sysTray(0), nLinesInLog(0), nLinesInLogMax(1000), task(0), graphsWindow(0), spatialWindow(0), bugWindow(0), fgWindow(0), notifyServer(0), commandServer(0), fastSettleRunning(false), helpWindow(0), noHotKeys(false), pdWaitingForStimGL(false), precreateDialog(0), pregraphDummyParent(0), maxPreGraphs(/*MAX_NUM_GRAPHS_PER_GRAPH_TAB*/4), tPerGraph(0.), acqStartingDialog(0), doBugAcqInstead(false)
+    : QApplication(argc, argv, true), mut(QMutex::Recursive), consoleWindow(0), debug(false), initializing(true), sysTray(0), nLinesInLog(0), nLinesInLogMax(1000), task(0), graphsWindow(0), spatialWindow(0), bugWindow(0), fgWindow(0), notifyServer(0), commandServer(0), fastSettleRunning(false), helpWindow(0), preBufSamps(0), noHotKeys(false), pdWaitingForStimGL(false), precreateDialog(0), pregraphDummyParent(0), maxPreGraphs(/*MAX_NUM_GRAPHS_PER_GRAPH_TAB*/4), tPerGraph(0.), acqStartingDialog(0), doBugAcqInstead(false)
 {
     got_sgl_ended = got_sgl_save = got_sgl_started = false;
+    qsAcquiring = qsSaving = qsConsoleHidden = 0;
     reader = 0;
     gthread1 = gthread2 = 0;
+    spikeThread = 0;
     dthread = 0;
     samplesBuffer = 0;
     need2FreeSamplesBuffer = false;
@@ -132,6 +135,7 @@ MainApp::MainApp(int & argc, char ** argv)
 	
     Connect(this, SIGNAL(do_updateWindowTitles()), this, SLOT(updateWindowTitles()));
     Connect(this, SIGNAL(do_stopTask()), this, SLOT(stopTask()));
+    Connect(this, SIGNAL(do_taskError(const QString &)), this, SLOT(gotTaskError(const QString &)));
 
     defaultLogColor = consoleWindow->textEdit()->textColor();
     consoleWindow->setAttribute(Qt::WA_DeleteOnClose, false);
@@ -168,6 +172,7 @@ MainApp::MainApp(int & argc, char ** argv)
     consoleWindow->show();
 
     setupStimGLIntegration();
+    publishQueryState();
     setupCommandServer();
 
     QTimer *timer = new QTimer(this);
@@ -650,6 +655,7 @@ void MainApp::hideUnhideConsole()
             if (graphsWindow && hadfocus) graphsWindow->setFocus(Qt::OtherFocusReason);
         }
     }
+    publishQueryState();
 }
 
 void MainApp::hideUnhideGraphs()
@@ -805,7 +811,9 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
     if (sizeof(void *) <= 4 && shmSizeMB > 2047) shmSizeMB = 2047;
     const long shmSizeBytes = long(shmSizeMB)*1024L*1024L;
 
-    if (doFGAcqInstead) {
+    // FG_SpikeGL.exe writes to the buffer from its own process.  Otherwise it only needs to be shared for readers in
+    // other processes (see ShmClient/), which is opt-in.
+    if (doFGAcqInstead || qgetenv("SPIKEGL_SHARED_SAMPLES") == "1") {
         if (!shm.isAttached()) {
             shm.setKey(SAMPLES_SHM_NAME);
 
@@ -867,8 +875,7 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
     acqStartingDialog->open();
     // end acq starting dialog block
     
-    preBuf.clear();
-    preBuf.reserve(0);
+    preBufSamps = 0;
     if (params.usePD && (params.acqStartEndMode == DAQ::PDStart || params.acqStartEndMode == DAQ::PDStartEnd
 						 || params.acqStartEndMode == DAQ::AITriggered || params.acqStartEndMode == DAQ::Bug3TTLTriggered)) {
         const double sil = params.silenceBeforePD > 0. ? params.silenceBeforePD : DEFAULT_PD_SILENCE;
@@ -877,11 +884,7 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
         if (szSamps <= 0) szSamps = params.nVAIChans;
         if (szSamps % params.nVAIChans) 
             szSamps += params.nVAIChans - szSamps%params.nVAIChans;
-        preBuf.reserve(szSamps*sizeof(int16));
-		char *mem = new char[preBuf.capacity()];
-		memset(mem, 0, preBuf.capacity());
-		preBuf.putData(mem, preBuf.capacity());
-		delete [] mem;
+        preBufSamps = unsigned(szSamps);
     }
     
     if (doFGAcqInstead) {
@@ -1015,12 +1018,34 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
         fgWindow = fgtask->dialogW;
     }
     Debug() << "SamplesSHM Page Size: " << reader->pageSize() << " bytes (" << reader->scansPerPage() << " scans per page), " << reader->nPages() << " total pages";
+    if (preBufSamps && reader->scansPerPage()) {
+        // the pre-trigger window is looked back at in the sample buffer, so it has to fit in there with room to spare for the writer
+        const unsigned preBufPages = (preBufSamps/params.nVAIChans + reader->scansPerPage() - 1) / reader->scansPerPage();
+        if (preBufPages + 1 > reader->nPages()/2)
+            Warning() << "Pre-trigger window of " << (preBufSamps/params.nVAIChans) << " scans needs " << preBufPages << " of the sample buffer's " << reader->nPages() << " pages -- it may get cut short.  Increase the sample buffer size?";
+    }
+    if (shm.isAttached()) {
+        // describe the scans for readers in other processes
+        const unsigned n = params.nVAIChans;
+        std::vector<unsigned short> ids(n);
+        std::vector<unsigned char> flags(n);
+        for (unsigned i = 0; i < n; ++i) {
+            ids[i] = static_cast<unsigned short>(i < unsigned(params.chanMap.size()) ? params.chanMap[i].electrodeId : i);
+            flags[i] = static_cast<unsigned char>((params.isAuxChan(i) ? PAGED_RINGBUFFER_CHAN_AUX : 0)
+                                                  | (int(i) < params.demuxedBitMap.size() && params.demuxedBitMap.testBit(i) ? PAGED_RINGBUFFER_CHAN_SAVED : 0));
+        }
+        reader->publishLayout(params.srate, n ? &ids[0] : 0, n ? &flags[0] : 0);
+        Log() << "Sample buffer shared as `" << shm.nativeKey() << "'";
+    }
 
     if (gthread1) delete gthread1, gthread1 = 0;
     if (gthread2) delete gthread2, gthread2 = 0;
     if (dthread) delete dthread, dthread = 0;
     gthread1 = new GraphingThread(graphsWindow, *reader, params);
     gthread2 = new GraphingThread(spatialWindow, *reader, params);
+    if (spikeThread) delete spikeThread, spikeThread = 0;
+    if (params.spikeDetect)
+        spikeThread = new SpikeDetectThread(this, *reader, params, getNewSpikeFileName());
 
 	doBugAcqInstead = false;
 	doFGAcqInstead = false;
@@ -1060,6 +1085,7 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
     Connect(task, SIGNAL(gotFirstScan()), this, SLOT(gotFirstScan()));
     if (gthread1) gthread1->start(QThread::LowPriority);
     if (gthread2) gthread2->start(QThread::LowestPriority);
+    if (spikeThread) spikeThread->start(QThread::LowPriority);
     dthread = new DataSavingThread(this);
     dthread->start(QThread::HighPriority);
     task->start();
@@ -1177,6 +1203,8 @@ void MainApp::stopTask()
     if (task->isRunning()) task->stop();
     if (gthread1) delete gthread1, gthread1 = 0;
     if (gthread2) delete gthread2, gthread2 = 0;
+    if (spikeThread) delete spikeThread, spikeThread = 0;
+    endScanSubscriptions();
     if (dthread) {
         QMessageBox *mb = 0;
         if ((reader->latest() - reader->latestPageRead()) * SAMPLES_SHM_DESIRED_PAGETIME_MS > 500) {
@@ -1224,6 +1252,7 @@ void MainApp::stopTask()
     updateWindowTitles();
 	if (acqStartingDialog) delete acqStartingDialog, acqStartingDialog = 0;
     unsigned long bufSize = reader ? reader->totalSize() : 0;
+    if (reader && shm.isAttached()) reader->retractLayout(); // tells readers in other processes to detach
     if (reader) delete reader, reader = 0;
     if (need2FreeSamplesBuffer && samplesBuffer) {
         free(samplesBuffer);
@@ -1269,32 +1298,24 @@ void MainApp::gotTaskWarning(const QString & e)
 }
 
 
-/* static */
-void MainApp::prependPrebufToScans(const WrapBuffer & preBuf, std::vector<int16> & scans, int & num, int skip)
+unsigned MainApp::lookBackPrebuf(std::vector<int16> & scans, unsigned nSamps) const
 {
-    if (scans.capacity() < (preBuf.size()/sizeof(int16))) scans.reserve(preBuf.size()/sizeof(int16));
-    void *ptr=0;
-    unsigned lenBytes=0, lenElems = 0;
-    preBuf.dataPtr1(ptr, lenBytes);
-	lenElems = lenBytes / sizeof(int16);
-	num = 0;
-    if (ptr && skip < (int)lenElems) {
-        scans.insert(scans.begin(), reinterpret_cast<int16 *>(ptr) + skip, reinterpret_cast<int16 *>(ptr)+skip+(lenElems-skip));
-		num += lenElems - skip;
-    }
-	skip -= lenElems;
-	if (skip < 0) skip = 0;
-    preBuf.dataPtr2(ptr, lenBytes);
-	lenElems = lenBytes / sizeof(int16);
-    if (ptr && skip < (int)lenElems) {
-        scans.insert(scans.begin()+num, reinterpret_cast<int16 *>(ptr) + skip, reinterpret_cast<int16 *>(ptr)+skip+(lenElems-skip));
-		num += lenElems - skip;
+    scans.resize(nSamps);
+    const unsigned pageSamps = reader->scansPerPage()*reader->scanSizeSamps(), cur = reader->latestPageRead();
+    unsigned end = nSamps, back = 1; // scans[end, nSamps) are filled in
+    for ( ; end && pageSamps && back < cur; ++back) {
+        const int16 *page = reinterpret_cast<const int16 *>(reader->lookBackPage(cur - back));
+        if (!page) break;
+        const unsigned n = end < pageSamps ? end : pageSamps;
+        memcpy(&scans[end-n], page + (pageSamps-n), n*sizeof(int16));
+        if (!reader->pageStillValid(cur - back)) break; // the writer got to it while we were copying
+        end -= n;
     }
-	skip -= lenElems;
+    // what's left is from before the acquisition started, or was overwritten already.  Either way it's saved as silence.
+    if (end) memset(&scans[0], 0, end*sizeof(int16));
+    return back < cur ? end : 0;
 }
 
-
-
 void MainApp::putRestarts(const DAQ::Params & p, u64 firstSamp, u64 restartNumScans) const
 {
     const u64 dfScanNr = dataFile.isOpen() ? dataFile.scanCount() : 0;
@@ -1361,14 +1382,16 @@ void MainApp::GraphingThread::run()
     if (sleepms < 1) sleepms = 1;
     if (sleepms > 200) sleepms = 200;
 
+    if (!reader.registerReader(g->grapherName(), PagedRingBuffer::DropPages))
+        Warning() << "GraphingThread '" << g->grapherName() << "' could not register with the sample buffer, its lag will not be reported";
+
     Debug() << "Graphing thread '" << g->grapherName() << "' started, sleeptime_ms=" << sleepms << ", priority=" << int(priority());
 
     while (!pleaseStop) {
         int skips = 0;
-        const int16 *scans = reader.next(&skips);
-        if (!scans) {
-            msleep(sleepms);
-        } else {
+        // sleeps until the writer commits a page (or sleepms elapses so that pleaseStop gets noticed)
+        const int16 *scans = reader.waitNext(sleepms, &skips);
+        if (scans) {
             if (skips) {
                 if (g->caresAboutSkippedScans()) Warning() << "GraphingThread '" << g->grapherName() << "' -- dropped " << (skips*nScansPerPage) << " scans! Graphs too slow for acquisition?";
                 // TODO FIXME -- report dropped scans in UI permanently in taskbar or something here..
@@ -1385,7 +1408,94 @@ void MainApp::GraphingThread::run()
         }
     }
 
-    Debug() << "GraphingThread '" << g->grapherName() << "' ending after processing " << (sampCount/nChansPerScan) << " scans.";
+    reader.unregisterReader();
+    const PagedRingBuffer::WakeupStats ws = reader.wakeupStats();
+    Debug() << "GraphingThread '" << g->grapherName() << "' ending after processing " << (sampCount/nChansPerScan) << " scans.  Page commit to wakeup latency: avg " << ws.avgLatencyUs << "us, max " << ws.maxLatencyUs << "us over " << ws.nWakeups << " wakeups.";
+}
+
+MainApp::SpikeDetectThread::SpikeDetectThread(QObject *parent, const PagedScanReader & psr, const DAQ::Params &p, const QString & fn)
+    : QThread(parent), reader(psr), fileName(fn), pleaseStop(false)
+{
+    const double ms = p.srate / 1e3;
+    // snippets from 0.4 ms before the threshold crossing to 0.8 ms after it, and 1 ms refractory period
+    det.reset(reader.scanSizeSamps(), p.srate, p.spikeDetectSigmas, 300., unsigned(0.4*ms + 0.5), unsigned(0.8*ms + 0.5), unsigned(ms + 0.5));
+    std::vector<bool> chans(reader.scanSizeSamps());
+    for (unsigned i = 0; i < unsigned(chans.size()); ++i) chans[i] = !p.isAuxChan(i);
+    det.setChannelMask(chans);
+    reader.resetToBeginning();
+}
+
+MainApp::SpikeDetectThread::~SpikeDetectThread() {
+    pleaseStop = true;
+    if (isRunning()) wait();
+}
+
+void MainApp::SpikeDetectThread::run()
+{
+    const unsigned nChansPerScan = reader.scanSizeSamps(), nScansPerPage = reader.scansPerPage(), len = det.snippetLength();
+    int sleepms = int(((nScansPerPage/det.srate()) * 1e3)/2);
+    if (sleepms < 1) sleepms = 1;
+    if (sleepms > 200) sleepms = 200;
+
+    QFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+        Error() << "SpikeDetectThread could not open `" << fileName << "' for writing, no spike detection for this acquisition";
+        return;
+    }
+    SpikeFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "SGLSPIKE", sizeof(h.magic));
+    h.version = SPIKE_FILE_VERSION;
+    h.nChans = nChansPerScan;
+    h.srate = det.srate();
+    h.snippetPre = det.snippetPre();
+    h.snippetPost = det.snippetPost();
+    h.thresholdSigmas = float(det.thresholdSigmas());
+    h.hpfCutoffHz = 300.f;
+    f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+
+    if (!reader.registerReader("SpikeDetector", PagedRingBuffer::DropPages))
+        Warning() << "SpikeDetectThread could not register with the sample buffer, its lag will not be reported";
+    Debug() << "Spike detection thread started, " << det.thresholdSigmas() << " sigma threshold, writing to `" << fileName << "'";
+
+    const int recSize = 8 + 4 + 2*int(len);
+    QByteArray recs;
+    u64 nSpikes = 0, nDropped = 0;
+    while (!pleaseStop) {
+        int skips = 0;
+        unsigned n = 0;
+        const int16 *scans = reader.waitNext(sleepms, &skips, 0, &n);
+        if (!scans) continue;
+        if (!n) n = nScansPerPage;
+        if (skips) {
+            if (!nDropped) Warning() << "SpikeDetectThread -- dropped " << (skips*nScansPerPage) << " scans! Spike detection too slow for acquisition?";
+            nDropped += u64(skips)*nScansPerPage;
+        }
+        const unsigned ns = det.apply(scans, n, nChansPerScan, reader.scansReadVirtual() - n);
+        if (!ns) continue;
+        recs.resize(int(ns)*recSize);
+        char *o = recs.data();
+        for (unsigned i = 0; i < ns; ++i, o += recSize) {
+            const SpikeDetector::Spike & sp (det.spikes()[i]);
+            const quint64 scan = sp.scan;
+            const quint32 chan = sp.chan;
+            memcpy(o, &scan, 8);
+            memcpy(o + 8, &chan, 4);
+            memcpy(o + 12, &det.snippets()[size_t(i)*len], 2*len);
+        }
+        if (f.write(recs) != recs.size()) {
+            Error() << "SpikeDetectThread: error writing to `" << fileName << "', stopping spike detection";
+            break;
+        }
+        nSpikes += ns;
+    }
+
+    reader.unregisterReader();
+    f.close();
+    double noise = 0.;
+    for (unsigned i = 0; i < nChansPerScan; ++i) noise += det.noise(i);
+    Debug() << "SpikeDetectThread ending after " << nSpikes << " spikes (mean noise " << (nChansPerScan ? noise/nChansPerScan : 0.) << " counts, "
+            << nDropped << " scans dropped, " << det.nLost() << " spikes lost to gaps), written to `" << fileName << "'";
 }
 
 MainApp::DataSavingThread::DataSavingThread(MainApp *mainApp)
@@ -1404,16 +1514,36 @@ void MainApp::DataSavingThread::run()
 {
     unsigned sleeptime_ms = qRound( (((double(app->reader->scansPerPage()) / app->configCtl->acceptedParams.srate) * 1000.0)) / DEF_TASK_READ_FREQ_HZ);
     if (!sleeptime_ms) sleeptime_ms = 1;
+    // the data saver must be lossless, so it makes the writer wait for it rather than lose pages
+    if (!app->reader->registerReader("Data Saver", PagedRingBuffer::BlockWriter))
+        Warning() << "MainApp::DataSavingThread could not register with the sample buffer, data saving may drop pages under load";
     Debug() << "MainApp::DataSavingThread started, sleeptime_ms=" << sleeptime_ms << ", priority=" << int(priority());
 
     while (!pleaseStop) {
+        // taskReadFunc() drains all available pages, then we sleep until the writer commits the next one.
+        // The timeout keeps taskReadFunc()'s periodic housekeeping (status bar, timed stops) going even if no data arrives.
         if (app->taskReadFunc())
-            msleep(sleeptime_ms);
+            app->reader->waitForNextPage(qMin(sleeptime_ms*DEF_TASK_READ_FREQ_HZ, 100U));
         else
             pleaseStop = true;
     }
 
-    Debug() << "MainApp::DataSavingThread ended after processing " << app->scanCount() << " scans.";
+    app->reader->unregisterReader();
+    const PagedRingBuffer::WakeupStats ws = app->reader->wakeupStats();
+    Debug() << "MainApp::DataSavingThread ended after processing " << app->scanCount() << " scans.  Writer waited on readers for " << app->reader->nWriterBlocks() << " pages.";
+    Debug() << "MainApp::DataSavingThread page commit to wakeup latency: avg " << ws.avgLatencyUs << "us, max " << ws.maxLatencyUs << "us over " << ws.nWakeups << " wakeups.";
+}
+
+/// CAREFUL with this function -- it's called from within the DataSavingThread
+void MainApp::setupSaveGather(const DAQ::Params & p)
+{
+    std::vector<bool> keep(p.nVAIChans, false);
+    for (unsigned i = 0; i < p.nVAIChans; ++i)
+        keep[i] = int(i) < p.demuxedBitMap.size() && p.demuxedBitMap.testBit(i);
+    saveGather.setSubset(keep);
+    saveGatherMap = p.demuxedBitMap;
+    Debug() << "Save channel subset: " << saveGather.inScanSize() << " -> " << saveGather.outScanSize() << " chans using "
+            << (saveGather.usesSIMD() ? SIMD::levelName(SIMD::level()) : "scalar") << " gather";
 }
 
 ///< called from a thread!  BE CAREFUL! ALL CODE HERE SHOULD BE THREADSAFE!
@@ -1438,7 +1568,14 @@ bool MainApp::taskReadFunc()
         scans = reader->next(&skips,&metaPtr,&scans_ret);
         gotSomething = !!scans;
 
-        if (!gotSomething) { break; }
+        if (!gotSomething) {
+            if (reader->writerMismatch()) {
+                // pages are arriving, but not where we look for them.  Without this the acquisition would just sit there, saving nothing
+                emit do_taskError("The program writing the sample buffer (for framegrabber acquisitions, FG_SpikeGL.exe) was built with a different sample buffer layout than this SpikeGL, so its data can't be read.\n\nRebuild it from this source tree.");
+                return false;
+            }
+            break;
+        }
         if (scans_ret != reader->scansPerPage()) {
             Error() << "MainApp::taskReadFunc INTERNAL ERROR: scans_ret != scansPerPage -- FIXME!";
         }
@@ -1472,7 +1609,6 @@ bool MainApp::taskReadFunc()
         lastScanSz = reader->scansPerPage()*reader->scanSizeSamps();
         scanCt = firstSamp/u64(p.nVAIChans) + u64(reader->scansPerPage());
         i32 triggerOffset = -1;
-        int prebufCopied = 0;
 
         if (taskWaitingForTrigger) { // task has been triggered , so save data, and graph it..
             if (!taskHasManualTrigOverride) {
@@ -1541,39 +1677,42 @@ bool MainApp::taskReadFunc()
                     Debug() << "Bug3 Mode: Manual trigger workaround: Grabbed " << ndispscans << " scans from display buffers and prepended to file...";
                 } else {
                     // otherwise, do the normal prebuf prepend stuff here
-                    if (triggerOffset >= 0 && preBuf.size()) {
-                        prependPrebufToScans(preBuf, prebuf_scans, prebufCopied, triggerOffset);
+                    if (triggerOffset >= 0 && preBufSamps > unsigned(triggerOffset)) {
+                        // the pre-trigger window ends triggerOffset samples into this page, which is written in full below
+                        const unsigned missing = lookBackPrebuf(prebuf_scans, preBufSamps - unsigned(triggerOffset));
+                        if (missing)
+                            Warning() << "Pre-trigger window: " << (missing/p.nVAIChans) << " scans were no longer in the sample buffer and were saved as 0.";
                     }
                 }
+                if (dataFile.scanCount() == 0) {
+                    // where this file starts in the acquisition, which is what the scan numbers in the .spikes file count from
+                    const u64 pbScans = prebuf_scans.size()/p.nVAIChans, scan0 = firstSamp/p.nVAIChans;
+                    dataFile.setParam("acqFirstScan", qulonglong(scan0 > pbScans ? scan0 - pbScans : 0));
+                    if (spikeThread) dataFile.setParam("spikeFile", QFileInfo(spikeThread->fileName).fileName());
+                }
                 if (wasFakeData) {
                     // indicate bad data in output file..
                     dataFile.pushBadData(dataFile.scanCount(), fakeDataSz/p.nVAIChans);
                 }
                 if (dataFile.numChans() != p.nVAIChans) {
-                    //double ts = getTime();
-                    // need to subset the chans in-place here.  a bit costly performance-wise.. we can optimize this further if need be by doing it on multiple cores at once using QConcurrent or somesuch mechanism
-                    const int pbs = (int)prebuf_scans.size();
-                    const double ratio = dataFile.numChans() / double(p.nVAIChans ? p.nVAIChans : 1.);
-                    save_subset.resize(0);
-                    save_subset.reserve(qRound((pbs + n) * ratio) + 256);
-                    for (int i = 0; i < int(n+pbs); ++i) {
-                        const int rel = i % p.nVAIChans;
-                        if (p.demuxedBitMap.testBit(rel)) {
-                            if (i < pbs)
-                                save_subset.push_back(prebuf_scans[i]);
-                            else
-                                save_subset.push_back(scans[i-pbs]);
-                        }
-                    }
-                    //Debug() << "subsetting took: " << ((getTime()-ts)*1e3) << " ms";
-                    dataFile.writeScans(save_subset);
+                    // need to subset the chans here.  the gather table is built once per channel subset, and the
+                    // subsetting itself is done a page at a time by the (vectorized) ScanGather kernel
+                    if (saveGatherMap != p.demuxedBitMap || saveGather.inScanSize() != p.nVAIChans)
+                        setupSaveGather(p);
+                    const unsigned nOut = saveGather.outScanSize(),
+                                   pbScans = unsigned(prebuf_scans.size()/p.nVAIChans),
+                                   nScans = unsigned(n/p.nVAIChans);
+                    save_subset.resize((pbScans + nScans) * nOut);
+                    if (pbScans) saveGather.apply(&prebuf_scans[0], &save_subset[0], pbScans);
+                    if (nScans) saveGather.apply(scans, &save_subset[pbScans*nOut], nScans);
+                    dataFile.writeScans(save_subset, true);
                     if (bugWindow && bugMeta) {
                         bugWindow->writeMetaToBug3File(dataFile, *bugMeta); // bugMetaFudge explanation: in order to make sure scan numbers in file line up with scan numbers in data file, make sure to writeScans() to the data file *before* calling this!
                     }
                 } else {
-                    dataFile.writeScans(prebuf_scans);
+                    dataFile.writeScans(prebuf_scans, true);
                     //if (prebuf_scans.size()) Debug() << "prebuf: wrote " << prebuf_scans.size()/p.nVAIChans << " prebuf scans";
-                    dataFile.writeScans(scans, n/p.nVAIChans);
+                    dataFile.writeScans(scans, unsigned(n/p.nVAIChans), true);
                     //if (n != i64(scanSz)) Debug() << "writeScans: n=,scanSz=" << n << "," << scanSz << " difference is " << ((scanSz-n)/p.nVAIChans) << " scans.." << (n%p.nVAIChans ? "NOT ALIGNED" : "ALIGNED") ;
                     if (bugWindow && bugMeta)
                         bugWindow->writeMetaToBug3File(dataFile, *bugMeta); // bugMetaFudge explanation: in order to make sure scan numbers in file line up with scan numbers in data file, make sure to writeScans() to the data file *before* calling this!
@@ -1603,10 +1742,16 @@ bool MainApp::taskReadFunc()
                 }
 
                 QString dfScanStr = "";
-                if (dataFile.isOpen()) dfScanStr = QString(" - ") + QString::number(dataFile.scanCount()) + " scans saved";
+                if (dataFile.isOpen()) {
+                    dfScanStr = QString(" - ") + QString::number(dataFile.scanCount()) + " scans saved";
+                    if (dataFile.pendingWriteQDepth()) dfScanStr += QString(" (") + QString::number(dataFile.pendingWriteQFillPct(),'f',0) + "% write q.)";
+                }
 
                 double bufferFill = (double(reader->latest() - reader->latestPageRead()) / reader->nPages()) * 1e2;
                 QString bufStr = QString(" - ") + QString::number(bufferFill,'f',2) + "% buf. lag ";
+                PagedRingBuffer::ReaderStatus slowest;
+                if (reader->slowestReader(&slowest) > -1 && slowest.lag > reader->latest() - reader->latestPageRead())
+                    bufStr += QString("(") + QString::fromUtf8(slowest.name) + ": " + QString::number((double(slowest.lag) / reader->nPages()) * 1e2,'f',2) + "%) ";
 
                 QString droppedScanStr = "";
                 if (scanSkipCt) {
@@ -1625,9 +1770,8 @@ bool MainApp::taskReadFunc()
             SampleBufQ *buf = *it;
             Warning() << "The buffer: `" << (*it)->name << "' is " << double((buf->dataQueueSize()/double(buf->dataQueueMaxSize))*100.) << "% full! System too slow for the specified acquisition?";
         }
-
-        // normally *always* pre-buffer the scans since we may need them at any time on a re-trigger event
-        preBuf.putData(&scans[0], unsigned(lastScanSz*sizeof(scans[0])));
+        if (dataFile.pendingWriteQFillPct() > 90.0)
+            Warning() << "The data file write queue is " << dataFile.pendingWriteQFillPct() << "% full! Disk too slow for the specified acquisition?";
 
         firstSamp += reader->scansPerPage()*reader->scanSizeSamps();
     }
@@ -1758,7 +1902,7 @@ bool MainApp::detectStopTask(const int16 * scans, unsigned sz, u64 firstSamp, in
         }
         if (firstSamp+u64(sz) - lastSeenPD > pdOffTimeSamps) { // timeout PD after X scans..
 			if (dataFile.isOpen()) {
-                stopRecordAtSamp = lastSeenPD + MAX((preBuf.capacity()/sizeof(int16)),pdOffTimeSamps) /**< NB: preBuf.capacity() is the amount of silence time before/after PD, scan-aligned! */;
+                stopRecordAtSamp = lastSeenPD + MAX(u64(preBufSamps),pdOffTimeSamps) /**< NB: preBufSamps is the amount of silence time before/after PD, scan-aligned! */;
                 if (isBugAlt) stopRecordAtSamp = lastSeenPD + pdOffTimeSamps;
 				taskWaitingForStop = false;
 			} else {
@@ -1820,6 +1964,7 @@ void MainApp::triggerTask()
 
 void MainApp::updateWindowTitles()
 {
+    publishQueryState(); // everything that changes the save or acquisition state ends up here, too
     const bool isOpen = dataFile.isOpen();
     QString stat = "";
     QString fname = isOpen ? dataFile.fileName() : "(no outfile)";
@@ -2238,6 +2383,21 @@ QString MainApp::getNewDataFileName(const QString & suf) const
 	return p.outputFileOrig;  // should never be reached unless we have 2^31 file collisions!
 }
 
+QString MainApp::getNewSpikeFileName() const
+{
+	const DAQ::Params & p (configCtl->acceptedParams);
+	QFileInfo fi(p.outputFileOrig);
+	if (!fi.isAbsolute()) {
+		fi.setFile(outputDirectory() + "/" + p.outputFileOrig);
+	}
+	QString prefix = fi.filePath();
+	if (fi.completeSuffix().length()) prefix.chop(fi.completeSuffix().length()+1);
+	QString fn = prefix + ".spikes";
+	for (int i = 1; i > 0 && QFile::exists(fn); ++i)
+		fn = prefix + "_" + QString::number(i) + ".spikes";
+	return fn;
+}
+
 // called from data save thread
 void MainApp::trf_stimGL_Process()
 {
@@ -2419,6 +2579,28 @@ bool MainApp::isSaving() const {
     return dataFile.isOpen();
 }
 
+MainApp::QueryState MainApp::queryState() const
+{
+    QueryState s;
+    s.acquiring = qsAcquiring, s.saving = qsSaving, s.consoleHidden = qsConsoleHidden;
+    QMutexLocker l(&qsMut);
+    s.currentSaveFile = qsSaveFile;
+    s.channelSubset = qsChanSubset;
+    return s;
+}
+
+void MainApp::publishQueryState()
+{
+    // GUI thread only: isConsoleHidden() and the channel subset (configCtl->acceptedParams) belong to it
+    QMutexLocker l(&qsMut);
+    qsAcquiring = task ? 1 : 0;
+    qsSaving = dataFile.isOpen() ? 1 : 0;
+    qsConsoleHidden = isConsoleHidden() ? 1 : 0;
+    qsSaveFile = qsSaving ? dataFile.fileName() : QString::null;
+    if (qsSaveFile.isEmpty()) qsSaveFile = QString::null;
+    qsChanSubset = configCtl ? tmpDataFile.getChannelSubset() : QString("\n");
+}
+
 void MainApp::toggleSave(bool s)
 {
     mut.lock();
@@ -47,9 +47,10 @@ class GenericGrapher;
 #include "DAQ.h"
 #include "DataFile.h"
 #include "TempDataFile.h"
-#include "WrapBuffer.h"
 #include "StimGL_SpikeGL_Integration.h"
 #include "CommandServer.h"
+#include "ScanGather.h"
+#include "SpikeDetector.h"
 
 #ifdef Q_OS_WIN
 #include <windows.h>
@@ -124,6 +125,16 @@ public:
     QString outputFile() const;
 	/// Query the absolute path of the current save file.  Returns QString::null if not saving.  This is the actual file we are currently saving to. Note this is reentrant and threadsafe, unlike the above functions
 	QString getCurrentSaveFile() const;
+
+    /// What the command server's read-only queries report
+    struct QueryState {
+        bool acquiring, saving, consoleHidden;
+        QString currentSaveFile; ///< null if not saving
+        QString channelSubset; ///< formatted as by TempDataFile::getChannelSubset()
+    };
+    /// Thread-safe, and never waits on the main thread: the state as of the last publishQueryState().  This is so
+    /// CommandConnection threads can answer queries while the main thread is busy, say painting graphs.
+    QueryState queryState() const;
     
     /// Returns the directory under which all plugin data files are to be saved.
     QString outputDirectory() const { QMutexLocker l(&mut); return outDir; }
@@ -158,6 +169,8 @@ public:
     bool isShiftPressed();
 
     QString getNewDataFileName(const QString & stimglSuffix = "") const;
+    /// the sidecar file for this acquisition's detected spikes: the output file's name with a .spikes extension, made unique
+    QString getNewSpikeFileName() const;
 
     /** Attempts to pop a QFrame containing a pre-created GLGraph off the 
         internal precreate list.  If the internal list is empty, simply
@@ -313,7 +326,10 @@ private:
     bool detectStopTask(const int16 * scans, unsigned sz, u64 firstSamp,
                         int override_trigIndex = -1, int16 override_thresh = -1);
     /// CAREFUL with this function -- it's called from within the DataSavingThread and as such should be fairly thread-safe and not directly touch the GUI
-    static void prependPrebufToScans(const WrapBuffer & wb, std::vector<int16> & scans, int & numAdded, int skip);
+    /// Fills `scans' with the nSamps samples just before the reader's current page, looked up in the sample buffer.  Returns how many of them (from the start) had already been overwritten, and were filled with 0 instead.  Samples from before the acquisition started are 0 too, but aren't counted.
+    unsigned lookBackPrebuf(std::vector<int16> & scans, unsigned nSamps) const;
+    /// CAREFUL with this function -- it's called from within the DataSavingThread.  (Re)builds saveGather from p.demuxedBitMap
+    void setupSaveGather(const DAQ::Params & p);
     void precreateOneGraph(bool noGLGraph = false);
     bool startAcq(QString & errTitle, QString & errMsg);
 	void showPrecreateDialog();
@@ -336,6 +352,15 @@ private:
     QMap<QString, QVariant> queuedParams;  ///< for StimGL integration... this should also gets locked with mut
     QMap<Par2Window *, CommandConnection *> par2WinConnMap;
     QSet<CommandConnection *> fastSettleConns;  ///< connections waiting for fast settle...
+    QSet<CommandConnection *> subscribedConns;  ///< connections streaming scans to their client (SUBSCRIBE command)
+    void endScanSubscriptions(); ///< implemented in CommandServer.cpp.  Call before the samples buffer goes away.
+
+    /// Updates what queryState() returns.  GUI thread only -- DataSavingThread gets here by emitting
+    /// do_updateWindowTitles(), whose slot calls this.
+    void publishQueryState();
+    volatile int qsAcquiring, qsSaving, qsConsoleHidden; ///< read without locking
+    mutable QMutex qsMut; ///< only ever held to copy the strings below, or by publishQueryState()
+    QString qsSaveFile, qsChanSubset;
     
     mutable QMutex mut; ///< used to lock outDir for now
     ConfigureDialogController *configCtl;
@@ -395,7 +420,7 @@ private:
     bool fastSettleRunning;
     QDialog *helpWindow;
 
-    WrapBuffer preBuf;
+    unsigned preBufSamps; ///< size of the pre-trigger window, in samples (scan-aligned).  It is looked up in the sample buffer when the trigger fires, see lookBackPrebuf()
     bool noHotKeys, pdWaitingForStimGL;	
     bool dsFacilityEnabled;
     
@@ -436,6 +461,20 @@ private:
         void run();
     };
 
+    /// Online spike detection (DAQ::Params::spikeDetect): another reader of the sample buffer that runs a SpikeDetector
+    /// on each page and appends the spikes it finds to a sidecar file, see SpikeFileHeader.
+    struct SpikeDetectThread : public QThread {
+        PagedScanReader reader;
+        SpikeDetector det;
+        QString fileName;
+        volatile bool pleaseStop;
+
+        SpikeDetectThread(QObject *parent, const PagedScanReader & psr, const DAQ::Params &params, const QString & fileName);
+        ~SpikeDetectThread();
+    protected:
+        void run();
+    };
+
     friend class DataSavingThread;
 
     struct DataSavingThread : public QThread {
@@ -451,9 +490,12 @@ private:
     };
 
     GraphingThread *gthread1, *gthread2;
+    SpikeDetectThread *spikeThread;
     DataSavingThread *dthread;
 
     std::vector<int16> save_subset, prebuf_scans; ///< working vars used by taskReadFunc().. it may be faster to keep these around across calls to taskReadFunc()
+    ScanGather saveGather; ///< used by taskReadFunc() to compact scans down to the save channel subset.  Rebuilt whenever saveGatherMap != params.demuxedBitMap
+    QBitArray saveGatherMap;
 
 public:
 
@@ -473,6 +515,7 @@ public:
 signals:
     void do_updateWindowTitles(); ///< helper signal so that DataSavingThread can effect changes into GUI
     void do_stopTask(); ///< helper signal so that DataSavingThread can effect changes into GUI
+    void do_taskError(const QString &); ///< helper signal so that DataSavingThread can report errors that stop the task
     void do_setPDTrigLED(bool); ///< helper signal so that DataSavingThread can effect changes into GUI
     void do_setManualTrigEnabled(bool); ///< helper signal so that DataSavingThread can effect changes into GUI
     void do_setSGLTrig(bool); ///< helper signal so that DataSavingThread can effect changes into GUI
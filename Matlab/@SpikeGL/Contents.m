@@ -229,6 +229,15 @@
 %                The `res' return value is 1 if the verification passed,
 %                zero otherwise.
 %
+%    res = ExportFile(myobj, infile, outfile, format, channel_subset, from_scan, to_scan)
+%
+%                Exports (part of) a saved .bin data file to a new .bin
+%                file or to a CSV text file (format is one of 'BIN', 'CSV',
+%                'CSVINT16' or 'CSVHEX'), without using the File Viewer.
+%                Relative filenames are relative to the save dir.  Prints
+%                progress to the matlab console, and returns the export
+%                throughput in MB/s, or 0 if the export failed.
+%
 %    daqData = GetDAQData(myObj, start_scan, scan_ct, channel_subset, downsample_factor)
 %
 %                Obtain a MxN matrix of int16s where M corresponds to
@@ -0,0 +1,48 @@
+%    res = ExportFile(myobj, infile, outfile, format, channel_subset, from_scan, to_scan)
+%
+%                Exports (part of) a saved .bin data file to a new .bin
+%                file or to a CSV text file, without using the File Viewer.
+%                If infile or outfile are relative, they are interpreted as
+%                being relative to the save dir.  Filenames may not contain
+%                spaces.  format is one of 'BIN' (the default), 'CSV'
+%                (volts), 'CSVINT16' (raw samples) or 'CSVHEX' (raw
+%                samples as hex).  channel_subset is a vector of channel
+%                indices (not IDs) into the data file, default is all
+%                channels.  from_scan and to_scan default to the whole file.
+%                outfile (or, for BIN, its .meta file) may not be infile or
+%                the file currently being recorded.
+%                Since this is a long operation, this functions uses the
+%                `disp' command to print progress information to the
+%                matlab console.  The `res' return value is the export
+%                throughput in MB/s, or 0 if the export failed.
+function [res] = ExportFile(s, infile, outfile, varargin)
+
+    ChkConn(s);
+    format = 'BIN';
+    if (nargin >= 4), format = varargin{1}; end;
+    channel_subset = 'ALL';
+    if (nargin >= 5 & ~isempty(varargin{2})), channel_subset = sprintf('%d#', varargin{2}); end;
+    from_scan = 0;
+    if (nargin >= 6), from_scan = varargin{3}; end;
+    to_scan = -1;
+    if (nargin >= 7), to_scan = varargin{4}; end;
+    CalinsNetMex('sendString', s.handle, sprintf('EXPORTFILE %s %s %s %s %d %d\n', infile, outfile, format, channel_subset, from_scan, to_scan));
+    i = 0;
+    res = 0;
+    while ( 1 ),
+        line = CalinsNetMex('readLine', s.handle);
+        if (i == 0 & strfind(line, 'ERROR') == 1),
+            disp(sprintf('Export not ok: %s', line(7:length(line))));
+            return;
+        end;
+        if (isempty(line)), continue; end;
+        if (strcmp(line,'OK')),
+            break;
+        end;
+        if (strfind(line, 'EXPORTED') == 1),
+            res = sscanf(line(10:length(line)), '%d %f');
+            res = res(2);
+            continue;
+        end;
+        disp(sprintf('Export progress: %s%%',line));
+    end;
@@ -0,0 +1,123 @@
+#include "MinMaxDecimator.h"
+#include "SIMD.h"
+#include <string.h>
+
+MinMaxDecimator::MinMaxDecimator(unsigned ss, unsigned ratio)
+    : rat(1), nIn(0)
+{
+    reset(ss, ratio);
+}
+
+void MinMaxDecimator::reset(unsigned ss, unsigned ratio)
+{
+    lo.assign(ss, 0);
+    hi.assign(ss, 0);
+    rat = ratio ? ratio : 1;
+    nIn = 0;
+}
+
+unsigned MinMaxDecimator::apply(const short *scans, unsigned nScans, unsigned stride, short *out)
+{
+    return run(scans, nScans, stride, out, false);
+}
+
+unsigned MinMaxDecimator::applyScalar(const short *scans, unsigned nScans, unsigned stride, short *out)
+{
+    return run(scans, nScans, stride, out, true);
+}
+
+unsigned MinMaxDecimator::run(const short *scans, unsigned nScans, unsigned stride, short *out, bool scalar)
+{
+    const unsigned ss = scanSize();
+    if (!ss || stride < ss) return 0; // error!
+    unsigned nb = 0;
+    while (nScans) {
+        unsigned n = rat - nIn;
+        if (n > nScans) n = nScans;
+        if (!nIn) {
+            // first scan of a bucket: it is the min and max so far
+            memcpy(&lo[0], scans, ss*sizeof(short));
+            memcpy(&hi[0], scans, ss*sizeof(short));
+        }
+        fold(scans, n, stride, scalar);
+        nIn += n, nScans -= n, scans += size_t(n)*stride;
+        if (nIn == rat) {
+            memcpy(out, &lo[0], ss*sizeof(short));
+            memcpy(out + ss, &hi[0], ss*sizeof(short));
+            out += 2*ss, nIn = 0, ++nb;
+        }
+    }
+    return nb;
+}
+
+void MinMaxDecimator::fold(const short *scans, unsigned nScans, unsigned stride, bool scalar)
+{
+    const SIMD::Level l = scalar ? SIMD::Scalar : SIMD::level();
+    if (l >= SIMD::AVX2) foldAVX2(scans, nScans, stride);
+    else if (l >= SIMD::SSE2) foldSSE2(scans, nScans, stride, 0);
+    else foldScalar(scans, nScans, stride, 0);
+}
+
+/* The kernels keep a block of channels' min and max in registers while they walk down the
+   scans, so lo and hi are only loaded and stored once per block per call.  foldAVX2() leaves
+   the last ss % 16 channels to foldSSE2(), which leaves the last ss % 8 to foldScalar(). */
+
+void MinMaxDecimator::foldScalar(const short *scans, unsigned nScans, unsigned stride, unsigned from)
+{
+    const unsigned ss = scanSize();
+    for (unsigned s = 0; s < nScans; ++s, scans += stride)
+        for (unsigned i = from; i < ss; ++i) {
+            const short v = scans[i];
+            if (v < lo[i]) lo[i] = v;
+            if (v > hi[i]) hi[i] = v;
+        }
+}
+
+#ifdef SIMD_X86
+void MinMaxDecimator::foldSSE2(const short *scans, unsigned nScans, unsigned stride, unsigned from)
+{
+    const unsigned ss = scanSize(), nVec = ss & ~7U;
+    for (unsigned i = from; i < nVec; i += 8) {
+        __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&lo[i]));
+        __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&hi[i]));
+        const short *p = scans + i;
+        for (unsigned s = 0; s < nScans; ++s, p += stride) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            l = _mm_min_epi16(l, v);
+            h = _mm_max_epi16(h, v);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&lo[i]), l);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&hi[i]), h);
+    }
+    foldScalar(scans, nScans, stride, nVec);
+}
+
+SIMD_TARGET("avx2")
+void MinMaxDecimator::foldAVX2(const short *scans, unsigned nScans, unsigned stride)
+{
+    const unsigned ss = scanSize(), nVec = ss & ~15U;
+    for (unsigned i = 0; i < nVec; i += 16) {
+        __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&lo[i]));
+        __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&hi[i]));
+        const short *p = scans + i;
+        for (unsigned s = 0; s < nScans; ++s, p += stride) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            l = _mm256_min_epi16(l, v);
+            h = _mm256_max_epi16(h, v);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(&lo[i]), l);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(&hi[i]), h);
+    }
+    foldSSE2(scans, nScans, stride, nVec);
+}
+#else
+void MinMaxDecimator::foldSSE2(const short *scans, unsigned nScans, unsigned stride, unsigned from)
+{
+    foldScalar(scans, nScans, stride, from);
+}
+
+void MinMaxDecimator::foldAVX2(const short *scans, unsigned nScans, unsigned stride)
+{
+    foldScalar(scans, nScans, stride, 0);
+}
+#endif
@@ -0,0 +1,49 @@
+#ifndef MinMaxDecimator_H
+#define MinMaxDecimator_H
+
+#include <vector>
+
+/** Decimates a stream of scans by ratio() while keeping its envelope: each bucket of ratio()
+    consecutive scans becomes 2 scans, the per-channel minimum and the per-channel maximum over
+    the bucket.  Unlike keeping every ratio()'th scan, a spike shorter than the bucket still
+    shows up in the output at its full height.
+
+    Buckets may straddle calls to apply(): the scans of the last, partial bucket are folded into
+    the running min/max and the bucket is completed by the next call.
+
+    The channels are processed 8 (SSE2) or 16 (AVX2) at a time, see SIMD.h. */
+class MinMaxDecimator
+{
+public:
+    MinMaxDecimator(unsigned scanSize = 0, unsigned ratio = 1);
+
+    /// sets the scan size and decimation ratio, and discards the partial bucket
+    void reset(unsigned scanSize, unsigned ratio);
+    unsigned scanSize() const { return unsigned(lo.size()); }
+    unsigned ratio() const { return rat; }
+    /// how many scans of the current bucket were seen so far
+    unsigned pending() const { return nIn; }
+    /// how many buckets apply(scans, nScans, ...) will complete
+    unsigned bucketsFor(unsigned nScans) const { return (nIn + nScans) / rat; }
+
+    /// Feeds nScans scans.  Scan i starts at scans + i*stride, and stride must be >= scanSize().
+    /// For each bucket completed, writes 2 tightly packed scans to out: the minimum, then the maximum.
+    /// So out must have room for 2*bucketsFor(nScans)*scanSize() samples.  Returns the number of buckets
+    /// completed.  Does not allocate.
+    unsigned apply(const short *scans, unsigned nScans, unsigned stride, short *out);
+
+    /// Same as apply() but never uses the SIMD kernels.  Gives the same results; here for benchmarking.
+    unsigned applyScalar(const short *scans, unsigned nScans, unsigned stride, short *out);
+
+private:
+    unsigned run(const short *scans, unsigned nScans, unsigned stride, short *out, bool scalar);
+    void fold(const short *scans, unsigned nScans, unsigned stride, bool scalar);
+    void foldScalar(const short *scans, unsigned nScans, unsigned stride, unsigned from);
+    void foldSSE2(const short *scans, unsigned nScans, unsigned stride, unsigned from);
+    void foldAVX2(const short *scans, unsigned nScans, unsigned stride);
+
+    std::vector<short> lo, hi; ///< per channel: min and max of the current bucket so far
+    unsigned rat, nIn;
+};
+
+#endif
@@ -1,11 +1,88 @@
 #include "stdafx.h"
 #include "PagedRingBuffer.h"
 #include <string.h>
+#include <stdio.h>
+#include <stddef.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <unistd.h>
+#include <time.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <limits.h>
+#endif
+
+static inline unsigned atomicCAS(volatile unsigned *p, unsigned expected, unsigned desired)
+{
+#ifdef _MSC_VER
+    return static_cast<unsigned>(_InterlockedCompareExchange(reinterpret_cast<volatile long *>(p), long(desired), long(expected)));
+#else
+    return __sync_val_compare_and_swap(p, expected, desired);
+#endif
+}
+
+static inline unsigned atomicAdd(volatile unsigned *p, int delta)
+{
+#ifdef _MSC_VER
+    return static_cast<unsigned>(_InterlockedExchangeAdd(reinterpret_cast<volatile long *>(p), long(delta)));
+#else
+    return __sync_fetch_and_add(p, unsigned(delta));
+#endif
+}
+
+static inline void fullBarrier()
+{
+#ifdef _MSC_VER
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+static inline void sleepMs(unsigned ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep(ms*1000);
+#endif
+}
+
+/// monotonic and system-wide, so that timestamps written by FG_SpikeGL.exe are comparable with ours
+static inline unsigned long long nowUs()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq = { 0 };
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER ct;
+    QueryPerformanceCounter(&ct);
+    return static_cast<unsigned long long>(ct.QuadPart / freq.QuadPart) * 1000000ULL
+         + static_cast<unsigned long long>((ct.QuadPart % freq.QuadPart) * 1000000LL / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec)*1000000ULL + static_cast<unsigned long long>(ts.tv_nsec/1000);
+#endif
+}
+
+static inline unsigned long long nowMs() { return nowUs()/1000ULL; }
 
 PagedRingBuffer::PagedRingBuffer(void *m, unsigned long sz, unsigned long psz)
-    : memBuffer(m), mem(reinterpret_cast<char *>(m)+sizeof(unsigned int)), real_size_bytes(sz), avail_size_bytes(sz-sizeof(unsigned int)), page_size(psz)
+    : memBuffer(m), mem(reinterpret_cast<char *>(m)+sizeof(ShmHeader)), real_size_bytes(sz), avail_size_bytes(sz > sizeof(ShmHeader) ? sz-sizeof(ShmHeader) : 0), page_size(psz), readerSlot(-1), wakeHandle(0), wakeHandleId(0)
 {
     resetToBeginning();
+    resetWakeupStats();
+}
+
+PagedRingBuffer::~PagedRingBuffer()
+{
+    unregisterReader();
+    closeWakeHandle();
 }
 
 void PagedRingBuffer::resetToBeginning()
@@ -17,6 +94,17 @@ void PagedRingBuffer::resetToBeginning()
     }
 }
 
+void PagedRingBuffer::resetToLatest()
+{
+    resetToBeginning();
+    const unsigned p = latest();
+    if (!p || !npages) return;
+    // the writer puts page number p (they start at 1) at index (p-1) % npages
+    lastPageRead = p;
+    pageIdx = int((p-1) % npages);
+    if (readerSlot > -1) shmHdr->readers[readerSlot].lastPageRead = p;
+}
+
 void *PagedRingBuffer::getCurrentReadPage()
 {
     if (!mem || !npages || !avail_size_bytes) return 0;
@@ -27,6 +115,15 @@ void *PagedRingBuffer::getCurrentReadPage()
     return reinterpret_cast<char *>(h)+sizeof(Header);
 }
 
+bool PagedRingBuffer::nextPageReady() const
+{
+    if (!mem || !npages || !avail_size_bytes) return false;
+    int nxt = (pageIdx+1) % npages;
+    if (nxt < 0) nxt = 0;
+    const Header *h = reinterpret_cast<const Header *>(&mem[ (page_size+sizeof(Header)) * nxt ]);
+    return h->magic == unsigned(PAGED_RINGBUFFER_MAGIC) && h->pageNum >= lastPageRead+1U;
+}
+
 void *PagedRingBuffer::nextReadPage(int *nSkips)
 {
     if (!mem || !npages || !avail_size_bytes) return 0;
@@ -34,8 +131,13 @@ void *PagedRingBuffer::nextReadPage(int *nSkips)
     if (nxt < 0) nxt = 0;
     Header *h = reinterpret_cast<Header *>(&mem[ (page_size+sizeof(Header)) * nxt ]);
     Header hdr; memcpy(&hdr, h, sizeof(hdr)); // hopefully avoid some potential race conditions
-    if (hdr.magic == unsigned(PAGED_RINGBUFFER_MAGIC) && hdr.pageNum >= lastPageRead+1U) {
+    if (hdr.magic == unsigned(PAGED_RINGBUFFER_MAGIC) && hdr.pageNum >= lastPageRead+1U && !writerMismatch()) {
         if (nSkips) *nSkips = int(hdr.pageNum-(lastPageRead+1)); // record number of overflows/lost pages here!
+        if (readerSlot > -1) {
+            ReaderSlot & rs (shmHdr->readers[readerSlot]);
+            rs.nSkips += hdr.pageNum-(lastPageRead+1);
+            rs.lastPageRead = hdr.pageNum; // publish our cursor for the writer
+        }
         lastPageRead = hdr.pageNum;
         pageIdx = nxt;
         return reinterpret_cast<char *>(h)+sizeof(Header);
@@ -45,8 +147,183 @@ void *PagedRingBuffer::nextReadPage(int *nSkips)
     return 0;
 }
 
+const void *PagedRingBuffer::lookBackPage(unsigned pageNum) const
+{
+    if (!pageStillValid(pageNum)) return 0;
+    // the writer puts page number p (they start at 1) at index (p-1) % npages
+    return &mem[ (page_size+sizeof(Header)) * ((pageNum-1) % npages) + sizeof(Header) ];
+}
+
+bool PagedRingBuffer::pageStillValid(unsigned pageNum) const
+{
+    if (!mem || !npages || !avail_size_bytes || !pageNum || writerMismatch()) return false;
+    const Header *h = reinterpret_cast<const Header *>(&mem[ (page_size+sizeof(Header)) * ((pageNum-1) % npages) ]);
+    // The writer clears the header before it touches a page's data, so if the header still names pageNum after the
+    // caller's reads of the data (the barrier keeps them before ours), those reads all saw that page.
+    fullBarrier();
+    return h->magic == unsigned(PAGED_RINGBUFFER_MAGIC) && h->pageNum == pageNum;
+}
+
+static unsigned newWakeId(const void *salt)
+{
+    unsigned id = unsigned(reinterpret_cast<size_t>(salt)) ^ unsigned(nowUs());
+#ifdef _WIN32
+    id ^= unsigned(GetCurrentProcessId()) << 16;
+#else
+    id ^= unsigned(getpid()) << 16;
+#endif
+    return id ? id : 1;
+}
+
 void PagedRingBuffer::bzero() {
-    if (mem && avail_size_bytes) memset(mem, 0, avail_size_bytes);
+    if (mem && avail_size_bytes) {
+        memset(memBuffer, 0, sizeof(ShmHeader) + avail_size_bytes);
+        shmHdr->wakeId = newWakeId(this); // name a fresh wakeup object for this run, see openWakeHandle()
+    }
+    readerSlot = -1;
+}
+
+void *PagedRingBuffer::openWakeHandle()
+{
+#ifdef _WIN32
+    const unsigned id = mem ? shmHdr->wakeId : 0;
+    if (id != wakeHandleId) closeWakeHandle();
+    if (!wakeHandle && id) {
+        char name[64];
+        _snprintf(name, sizeof(name), "Local\\SpikeGL_PagedRingBuffer_%08x", id);
+        name[sizeof(name)-1] = 0;
+        wakeHandle = CreateSemaphoreA(NULL, 0, 0x7fffffff, name); // opens it if the other side created it first
+        wakeHandleId = id;
+    }
+#endif
+    return wakeHandle;
+}
+
+void PagedRingBuffer::closeWakeHandle()
+{
+#ifdef _WIN32
+    if (wakeHandle) CloseHandle(reinterpret_cast<HANDLE>(wakeHandle));
+#endif
+    wakeHandle = 0; wakeHandleId = 0;
+}
+
+bool PagedRingBuffer::waitForNextPage(unsigned timeout_ms)
+{
+    if (!mem || !npages || !avail_size_bytes) return false;
+    if (nextPageReady()) return true;
+    const unsigned long long t0 = nowUs(), tmo = static_cast<unsigned long long>(timeout_ms)*1000ULL;
+    for (;;) {
+        // Sample the sequence number (latestPNum) *before* re-checking, so a commit that lands in between makes the wait return at once.
+        const unsigned seq = shmHdr->latestPNum;
+        if (nextPageReady()) break;
+        const unsigned long long elapsed = nowUs() - t0;
+        if (elapsed >= tmo) { ++nWakeTimeouts; return false; }
+        const unsigned long long rem = tmo - elapsed;
+        atomicAdd(&shmHdr->nWaiters, 1); // full barrier: the writer either sees us waiting, or we see its new latestPNum
+#if defined(__linux__)
+        if (shmHdr->latestPNum == seq) {
+            struct timespec ts;
+            ts.tv_sec = time_t(rem / 1000000ULL);
+            ts.tv_nsec = long((rem % 1000000ULL) * 1000ULL);
+            // not FUTEX_PRIVATE_FLAG: the writer may live in another process
+            syscall(SYS_futex, &shmHdr->latestPNum, FUTEX_WAIT, seq, &ts, NULL, 0);
+        }
+#elif defined(_WIN32)
+        HANDLE h = reinterpret_cast<HANDLE>(openWakeHandle());
+        if (h && shmHdr->latestPNum == seq) WaitForSingleObject(h, DWORD((rem+999ULL)/1000ULL));
+        else if (!h) sleepMs(1);
+#else
+        if (shmHdr->latestPNum == seq) sleepMs(1);
+#endif
+        atomicAdd(&shmHdr->nWaiters, -1);
+    }
+    // we had to sleep, so the page that woke us was committed while we waited
+    const unsigned long long tc = shmHdr->lastCommitUs, tw = nowUs();
+    const double lat = tw > tc ? double(tw - tc) : 0.;
+    ++nWakeups;
+    wakeLatSumUs += lat;
+    if (lat > wakeLatMaxUs) wakeLatMaxUs = lat;
+    return true;
+}
+
+void *PagedRingBuffer::waitNextReadPage(unsigned timeout_ms, int *nSkips)
+{
+    void *ret = nextReadPage(nSkips);
+    if (!ret && waitForNextPage(timeout_ms)) ret = nextReadPage(nSkips);
+    return ret;
+}
+
+PagedRingBuffer::WakeupStats PagedRingBuffer::wakeupStats() const
+{
+    WakeupStats ret;
+    ret.nWakeups = nWakeups;
+    ret.nTimeouts = nWakeTimeouts;
+    ret.avgLatencyUs = nWakeups ? wakeLatSumUs / double(nWakeups) : 0.;
+    ret.maxLatencyUs = wakeLatMaxUs;
+    return ret;
+}
+
+void PagedRingBuffer::resetWakeupStats()
+{
+    nWakeups = nWakeTimeouts = 0;
+    wakeLatSumUs = wakeLatMaxUs = 0.;
+}
+
+bool PagedRingBuffer::registerReader(const char *name, ReaderPolicy policy)
+{
+    if (!mem || !npages) return false;
+    if (readerSlot > -1) unregisterReader();
+    for (int i = 0; i < PAGED_RINGBUFFER_MAX_READERS; ++i) {
+        ReaderSlot & rs (shmHdr->readers[i]);
+        if (atomicCAS(&rs.inUse, 0, unsigned(PAGED_RINGBUFFER_MAGIC)) == 0) {
+            // slot is ours
+            rs.lastPageRead = lastPageRead ? lastPageRead : latest();
+            rs.policy = unsigned(policy);
+            rs.nSkips = 0;
+            strncpy(rs.name, name ? name : "", sizeof(rs.name)-1);
+            rs.name[sizeof(rs.name)-1] = 0;
+            readerSlot = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PagedRingBuffer::unregisterReader()
+{
+    if (readerSlot < 0 || !shmHdr) return;
+    ReaderSlot & rs (shmHdr->readers[readerSlot]);
+    rs.policy = unsigned(DropPages); // make sure the writer never waits on a departed reader
+    rs.inUse = 0;
+    readerSlot = -1;
+}
+
+bool PagedRingBuffer::readerStatus(int slot, ReaderStatus & out) const
+{
+    if (!mem || !npages || slot < 0 || slot >= PAGED_RINGBUFFER_MAX_READERS) return false;
+    const ReaderSlot & rs (shmHdr->readers[slot]);
+    if (rs.inUse != unsigned(PAGED_RINGBUFFER_MAGIC)) return false;
+    memcpy(out.name, rs.name, sizeof(out.name));
+    out.name[sizeof(out.name)-1] = 0;
+    out.policy = ReaderPolicy(rs.policy);
+    const unsigned lpr = rs.lastPageRead, l = latest();
+    out.lag = l > lpr ? l - lpr : 0;
+    out.nSkips = rs.nSkips;
+    return true;
+}
+
+int PagedRingBuffer::slowestReader(ReaderStatus *status) const
+{
+    int ret = -1;
+    ReaderStatus st, worst;
+    for (int i = 0; i < PAGED_RINGBUFFER_MAX_READERS; ++i) {
+        if (readerStatus(i, st) && (ret < 0 || st.lag > worst.lag)) {
+            worst = st;
+            ret = i;
+        }
+    }
+    if (ret > -1 && status) *status = worst;
+    return ret;
 }
 
 PagedRingBufferWriter::PagedRingBufferWriter(void *mem, unsigned long sz, unsigned long psz)
@@ -54,6 +331,7 @@ PagedRingBufferWriter::PagedRingBufferWriter(void *mem, unsigned long sz, unsign
 {
     lastPageWritten = 0;
     nWritten = 0;
+    max_block_ms = 500;
 }
 
 PagedRingBufferWriter::~PagedRingBufferWriter() {}
@@ -72,11 +350,34 @@ void *PagedRingBufferWriter::grabNextPageForWrite()
     int nxt = (pageIdx+1) % npages;
     if (nxt < 0) nxt = 0;
     Header *h = reinterpret_cast<Header *>(&mem[ (page_size+sizeof(Header)) * nxt ]);
+    if (h->magic == unsigned(PAGED_RINGBUFFER_MAGIC)) waitForBlockingReaders(h->pageNum);
     h->magic = 0; h->pageNum = 0;
+    // The page's data stores (memcpy, SIMD, ..) aren't volatile, so without this the compiler or a weakly ordered CPU
+    // could let them land before the header is cleared, and lookBackPage()/pageStillValid() would miss the overwrite.
+    fullBarrier();
     pageIdx = nxt;
     return reinterpret_cast<char *>(h)+sizeof(Header);
 }
 
+void PagedRingBufferWriter::waitForBlockingReaders(unsigned victim)
+{
+    // A reader is done with page `victim' once it has moved on to a later page, since it may still be
+    // working on the last page nextReadPage() handed it.
+    unsigned long long t0 = 0;
+    for (int i = 0; i < PAGED_RINGBUFFER_MAX_READERS; ++i) {
+        ReaderSlot & rs (shmHdr->readers[i]);
+        while (rs.inUse == unsigned(PAGED_RINGBUFFER_MAGIC) && rs.policy == unsigned(BlockWriter)
+               && int(rs.lastPageRead - victim) <= 0) {
+            if (!t0) { t0 = nowMs(); ++shmHdr->nWriterBlocks; }
+            else if (nowMs() - t0 >= max_block_ms) {
+                rs.policy = unsigned(DropPages); // reader is hung or gone, stop waiting on it
+                break;
+            }
+            sleepMs(1);
+        }
+    }
+}
+
 bool PagedRingBufferWriter::commitCurrentWritePage()
 {
     if (!mem || !npages || !avail_size_bytes) return false;
@@ -84,9 +385,27 @@ bool PagedRingBufferWriter::commitCurrentWritePage()
     if (pg < 0) pg = 0;
     Header *h = reinterpret_cast<Header *>(&mem[ (page_size+sizeof(Header)) * pg ]);
     pageIdx = pg;
+    shmHdr->lastCommitUs = nowUs();
+    if (shmHdr->writerAbi != unsigned(PAGED_RINGBUFFER_WRITER_ABI)) {
+        shmHdr->writerAbi = PAGED_RINGBUFFER_WRITER_ABI; // after a bzero() by the reader, normally just once
+        fullBarrier(); // before latestPNum says there's a page, see writerMismatch()
+    }
     h->pageNum = *latestPNum = ++lastPageWritten;
     h->magic = (unsigned)PAGED_RINGBUFFER_MAGIC;
     ++nWritten;
+    // Wake readers sleeping in waitForNextPage().  The barrier orders our stores above against the load of nWaiters
+    // below, pairing with the reader's atomic increment; without it a reader could go to sleep on a page we just committed.
+    fullBarrier();
+    const unsigned nw = shmHdr->nWaiters;
+    if (nw) {
+#if defined(__linux__)
+        syscall(SYS_futex, &shmHdr->latestPNum, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#elif defined(_WIN32)
+        if (!shmHdr->wakeId) atomicCAS(&shmHdr->wakeId, 0, newWakeId(this)); // buffer was never bzero()'d
+        HANDLE hs = reinterpret_cast<HANDLE>(openWakeHandle());
+        if (hs) ReleaseSemaphore(hs, LONG(nw), NULL);
+#endif
+    }
     return true;
 }
 
@@ -118,6 +437,18 @@ const short *PagedScanReader::next(int *nSkips, void **metaPtr, unsigned *scans_
 {
     int sk = 0;
     const short *scans = (short *)nextReadPage(&sk);
+    return gotPage(scans, sk, nSkips, metaPtr, scans_returned);
+}
+
+const short *PagedScanReader::waitNext(unsigned timeout_ms, int *nSkips, void **metaPtr, unsigned *scans_returned)
+{
+    int sk = 0;
+    const short *scans = (short *)waitNextReadPage(timeout_ms, &sk);
+    return gotPage(scans, sk, nSkips, metaPtr, scans_returned);
+}
+
+const short *PagedScanReader::gotPage(const short *scans, int sk, int *nSkips, void **metaPtr, unsigned *scans_returned)
+{
     if (nSkips) *nSkips = sk;
     if (scans_returned) *scans_returned = 0;
     if (metaPtr) *metaPtr = 0;
@@ -131,10 +462,44 @@ const short *PagedScanReader::next(int *nSkips, void **metaPtr, unsigned *scans_
     return scans;
 }
 
+void PagedScanReader::publishLayout(double srate, const unsigned short *chanIds, const unsigned char *chanFlags)
+{
+    // C++03 static assert: the offset is part of the format that other processes read
+    typedef char layoutOffsetCheck[offsetof(ShmHeader, layout) == PAGED_RINGBUFFER_LAYOUT_OFFSET ? 1 : -1];
+    (void)sizeof(layoutOffsetCheck);
+    if (!mem || !npages) return;
+    Layout & l (shmHdr->layout);
+    l.magic = 0;
+    fullBarrier();
+    l.version = PAGED_RINGBUFFER_LAYOUT_VERSION;
+    l.headerBytes = unsigned(sizeof(ShmHeader));
+    l.pageHeaderBytes = unsigned(sizeof(Header));
+    l.pageSize = unsigned(page_size);
+    l.nPages = npages;
+    l.scanSizeSamps = scan_size_samps;
+    l.metaDataSizeBytes = meta_data_size_bytes;
+    l.scansPerPage = nScansPerPage;
+    l.nChans = scan_size_samps < PAGED_RINGBUFFER_LAYOUT_MAX_CHANS ? scan_size_samps : PAGED_RINGBUFFER_LAYOUT_MAX_CHANS;
+    l.srate = srate;
+    for (unsigned i = 0; i < l.nChans; ++i) {
+        l.chanIds[i] = chanIds ? chanIds[i] : static_cast<unsigned short>(i);
+        l.chanFlags[i] = chanFlags ? chanFlags[i] : 0;
+    }
+    fullBarrier(); // a reader that sees the magic sees all of the above
+    l.magic = unsigned(PAGED_RINGBUFFER_LAYOUT_MAGIC);
+}
+
+void PagedScanReader::retractLayout()
+{
+    if (!mem || !npages) return;
+    shmHdr->layout.magic = 0;
+    fullBarrier();
+}
+
 static int dummyErrFunc(const char *fmt, ...) { (void)fmt; return 0; }
 
 PagedScanWriter::PagedScanWriter(unsigned scan_size_samples, unsigned meta_data_size_bytes, void *mem, unsigned long size_bytes, unsigned long page_size, const std::vector<int> & cmap)
-    : PagedRingBufferWriter(mem, size_bytes, page_size), ErrFunc(&dummyErrFunc), scan_size_samps(scan_size_samples), scan_size_bytes(scan_size_samples*sizeof(short)), meta_data_size_bytes(meta_data_size_bytes), chan_mapping(cmap),  mapper(0)
+    : PagedRingBufferWriter(mem, size_bytes, page_size), ErrFunc(&dummyErrFunc), scan_size_samps(scan_size_samples), scan_size_bytes(scan_size_samples*sizeof(short)), meta_data_size_bytes(meta_data_size_bytes), remapping(false), shmPage(0)
 {
     if (meta_data_size_bytes > page_size) meta_data_size_bytes = page_size;
     nScansPerPage = scan_size_bytes ? ((page_size-meta_data_size_bytes)/scan_size_bytes) : 0;
@@ -143,11 +508,18 @@ PagedScanWriter::PagedScanWriter(unsigned scan_size_samples, unsigned meta_data_
     scanCt = 0;
     sampleCt = 0;
     currPage = 0;
+    if (cmap.size() && nScansPerPage) {
+        // output channel i of a scan is input channel cmap[i]; channels past the end of the map stay put
+        std::vector<int> idx(scan_size_samps);
+        for (unsigned i = 0; i < scan_size_samps; ++i) idx[i] = i < cmap.size() ? cmap[i] : int(i);
+        remap.setIndices(scan_size_samps, idx);
+        remapping = !remap.isIdentity();
+        if (remapping) staging.resize(pageSize()/sizeof(short) + 1);
+    }
 }
 
 PagedScanWriter::~PagedScanWriter()
 {
-    if (mapper) delete mapper; mapper = 0; // tell mapper to end and kill it
 }
 
 void PagedScanWriter::writePartialBegin()
@@ -207,18 +579,11 @@ bool PagedScanWriter::writePartial(const void *data, unsigned nbytes, const void
 
 void *PagedScanWriter::grabNextPageForWrite()
 {
-    if (mapper) delete mapper, mapper = 0;
     void *p = PagedRingBufferWriter::grabNextPageForWrite();
-    /* NOTE THAT CHANNEL MAPPING IS BROKEN FOR NOW.. or so it appears.  It lead to performance issues & hangs -- see 4/12/2016 email from Jim Chen.
-       So we disable it and just do the more kosher thing of having a correct channel mapping setup in SpikeGL GUI.
-       This means the data file will always have raw frame format.. but at least things work well.  
-    if (chan_mapping.size()) {
-        mapper = new ScanRemapper(reinterpret_cast<short *>(p), nScansPerPage, scan_size_samps, chan_mapping);
-        mapper->ErrFunc = ErrFunc; mapper->DbgFunc = DbgFunc;
-        if (!mapper->start()) {
-            ErrFunc("FATAL! Failed to start ScanRemapper thread in PagedScanWriter::grabNextPageForWrite()");
-        }
-    }*/
+    /* The old ScanRemapper thread (1 thread per page, remapping each scan in place behind the writer) lead to
+       performance issues & hangs -- see 4/12/2016 email from Jim Chen.  Now the writer fills a private staging
+       page and commit() gathers it into the real page in one pass, which keeps up with the FG easily. */
+    if (remapping) { shmPage = reinterpret_cast<short *>(p); return &staging[0]; }
     return p;
 }
 
@@ -254,54 +619,39 @@ bool PagedScanWriter::write(const short *scans, unsigned nScans, const void *met
     return true;
 }
 
-void PagedScanWriter::commit()
+short *PagedScanWriter::writeDirectBegin(unsigned nScans)
 {
-    if (currPage) {
-        /*if (mapper) { 
-            //DbgFunc("PagedScanWriter::commit() called, but mapper %d is still active. Releasing and waiting...", mapper->id());
-            mapper->release(nScansPerPage); 
-            mapper->wait(); 
-            delete mapper; mapper = 0;
-        } // wait for mapper to complete channel reordering..*/
-        commitCurrentWritePage();
-        currPage = 0; pageOffset = 0; partial_offset = 0;
-    }
+    if (!currPage) { currPage = (short *)grabNextPageForWrite(); pageOffset = 0; partial_offset = 0; }
+    if (!currPage || !nScans || pageOffset + nScans > nScansPerPage) return 0;
+    return currPage + (pageOffset*scan_size_samps);
 }
 
-PagedScanWriter::ScanRemapper::ScanRemapper(short *page, unsigned nScansPerPage, unsigned scanLen, const std::vector<int> & mapping)
-    : Semaphore(nScansPerPage), ErrFunc(&dummyErrFunc), pleaseStop(false), scans(page), nScansPerPage(nScansPerPage), scanLen(scanLen), map(mapping) 
-{}
-
-PagedScanWriter::ScanRemapper::~ScanRemapper()
+bool PagedScanWriter::writeDirectEnd(unsigned nScans, const void *meta)
 {
-    pleaseStop = true;
-    if (isRunning()) {
-        //DbgFunc("ScanMapper Thread %d delete called while still running, attempting to end thread gracefully...", id());
-        release(); 
-        Thread::wait(0xffffffff);
+    if (!currPage || pageOffset + nScans > nScansPerPage) return false;
+    pageOffset += nScans;
+    partial_offset = pageOffset * scan_size_bytes;
+    scanCt += static_cast<unsigned long long>(nScans);
+    sampleCt += static_cast<unsigned long long>(nScans*scan_size_samps);
+    if (pageOffset == nScansPerPage) {
+        if (meta_data_size_bytes) {
+            if (!meta) return false; // force caller to give us metadata when we are closing up a page!
+            memcpy(currPage + (pageOffset*scan_size_samps), meta, meta_data_size_bytes);
+        }
+        commit();
     }
+    return true;
 }
 
-void PagedScanWriter::ScanRemapper::threadFunc()
+void PagedScanWriter::commit()
 {
-    
-    //DbgFunc("ScanRemapper Thread %d started.", id());
-    short *scan = scans;
-    int ct = 0;
-    std::vector<short> tmpScan; tmpScan.resize(scanLen);
-    while (ct < (int)nScansPerPage) {
-        acquire();
-        if (pleaseStop) {
-            DbgFunc("ScanRemapper Thread %d received premature stop. Exiting...", id());
-            return;
+    if (currPage) {
+        if (remapping && shmPage) {
+            remap.apply(currPage, shmPage, nScansPerPage);
+            if (meta_data_size_bytes) memcpy(shmPage + (nScansPerPage*scan_size_samps), currPage + (nScansPerPage*scan_size_samps), meta_data_size_bytes);
+            shmPage = 0;
         }
-        for (int i = 0; i < int(scanLen); ++i)
-            tmpScan[i] = scan[map[i]];
-        memcpy(scan, &tmpScan[0], scanLen*sizeof(scan[0]));
-        scan += scanLen;
-        ++ct;
+        commitCurrentWritePage();
+        currPage = 0; pageOffset = 0; partial_offset = 0;
     }
-    //DbgFunc("ScanRemapper Thread %d completed successfully after processing %d scans.", id(), (int)nScansPerPage);
 }
-
-
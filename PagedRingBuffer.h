@@ -4,15 +4,26 @@
 #include <vector>
 
 #include "Thread_Compat.h"
+#include "ScanGather.h"
 
 #include <string.h>
 
 #define PAGED_RINGBUFFER_MAGIC 0x4a6ef00d
+#define PAGED_RINGBUFFER_MAX_READERS 16
+#define PAGED_RINGBUFFER_READER_NAME_LEN 32
+#define PAGED_RINGBUFFER_LAYOUT_MAGIC 0x53474c31 /* 'SGL1' */
+#define PAGED_RINGBUFFER_LAYOUT_VERSION 2 /* bump this whenever ShmHeader or Layout change.  ShmClient/SpikeGLShm.c mirrors them! */
+#define PAGED_RINGBUFFER_LAYOUT_OFFSET 800 /* where Layout sits in the shared header */
+#define PAGED_RINGBUFFER_WRITER_ABI (0x53475700U + PAGED_RINGBUFFER_LAYOUT_VERSION) /* 'SGW' + version: ShmHeader::writerAbi */
+#define PAGED_RINGBUFFER_LAYOUT_MAX_CHANS 4096
+#define PAGED_RINGBUFFER_CHAN_AUX 0x1 /* Layout::chanFlags: not an electrode (PD, trigger, etc) */
+#define PAGED_RINGBUFFER_CHAN_SAVED 0x2 /* Layout::chanFlags: in the channel subset that goes to the data file */
 
 class PagedRingBuffer
 {
 public:
     PagedRingBuffer(void *mem, unsigned long size_bytes, unsigned long page_size);
+    ~PagedRingBuffer(); ///< unregisters this reader, if it was registered
 
     unsigned long pageSize() const { return page_size; }
     unsigned long totalSize() const { return real_size_bytes; }
@@ -20,12 +31,15 @@ public:
     unsigned int nPages() const { return npages; }
 
     void resetToBeginning();
+    /// Moves the read cursor past the latest page committed, so that the next page read is the next one the writer
+    /// commits.  For readers that only want live data and that join while the writer is running.
+    void resetToLatest();
 
     void *getCurrentReadPage();
     /// returns NULL when a new read page isn't 'ready' yet.  nSkips is the number of pages dropped due to overflows.  Normally should be 0.
     void *nextReadPage(int *nSkips = 0);
 
-    /// clear the contents to 0.
+    /// clear the contents to 0, including the shared header (and thus all reader registrations).  Call this before any readers register.
     void bzero();
 
     void *rawData() const { return const_cast<void *>(memBuffer); }
@@ -36,15 +50,119 @@ public:
     /// Returns the last page this reader saw.  Compare it to latest() to get an idea of how far behind this reader is.
     unsigned int latestPageRead() const { return lastPageRead; }
 
+    /** true if the writer that committed this buffer's pages was built with a different shared header layout -- a stale
+        FG_SpikeGL.exe, say.  Its pages are at other offsets than ours, so they can't be read: nextReadPage() returns
+        NULL instead of garbage.  Only known once the writer has committed a page. */
+    bool writerMismatch() const { return mem && *latestPNum && shmHdr->writerAbi != unsigned(PAGED_RINGBUFFER_WRITER_ABI); }
+
+    /** Looks back at committed page number pageNum (as in latest()) without moving the read cursor.  Returns NULL if
+        that page was never written or has since been reused.  The writer never waits on look-backs, so the page can be
+        reused at any time: copy out what is needed, then check pageStillValid(pageNum) and discard the copy if false. */
+    const void *lookBackPage(unsigned pageNum) const;
+    /// true if page number pageNum is still in the buffer, and wasn't reused while it was being read.  See lookBackPage().
+    bool pageStillValid(unsigned pageNum) const;
+
+    /// What the writer should do when it is about to overwrite a page a registered reader hasn't consumed yet.
+    enum ReaderPolicy {
+        DropPages = 0, ///< the default: the writer never waits, and this reader (only) loses pages if it falls behind
+        BlockWriter    ///< the writer waits (up to its maxBlockMs()) for this reader to catch up.  Use for lossless consumers like the data saver.
+    };
+
+    /** Publishes this reader's read cursor in a slot in the shared header so that the writer (and anyone else
+        attached to the buffer) can see each consumer's lag.  Returns false if all PAGED_RINGBUFFER_MAX_READERS
+        slots are taken.  Registrations are not inherited by copies of this object. */
+    bool registerReader(const char *name, ReaderPolicy policy = DropPages);
+    void unregisterReader();
+    bool isRegisteredReader() const { return readerSlot > -1; }
+
+    struct ReaderStatus {
+        char name[PAGED_RINGBUFFER_READER_NAME_LEN];
+        ReaderPolicy policy;
+        unsigned lag; ///< in pages, relative to latest()
+        unsigned nSkips; ///< total pages this reader lost to overruns
+    };
+    /// Fills in `out' for registered reader slot number `slot' (0 to PAGED_RINGBUFFER_MAX_READERS-1).  Returns false if the slot is unused.
+    bool readerStatus(int slot, ReaderStatus & out) const;
+    /// Returns the slot number of the registered reader with the greatest lag (and optionally its status), or -1 if there are no registered readers.
+    int slowestReader(ReaderStatus *status = 0) const;
+    /// total number of pages for which the writer waited on a BlockWriter reader
+    unsigned nWriterBlocks() const { return mem ? shmHdr->nWriterBlocks : 0; }
+
+    /** Blocks until the page after the last one read is available (in which case nextReadPage() will succeed), or
+        until timeout_ms elapses.  Returns true if a page is ready.  The writer signals waiting readers from
+        commitCurrentWritePage() via a wakeup object associated with the shared header: a futex on Linux, a named
+        semaphore on Windows.  Elsewhere this degrades to polling every millisecond. */
+    bool waitForNextPage(unsigned timeout_ms);
+    /// Like nextReadPage(), but waits up to timeout_ms for the page to arrive.
+    void *waitNextReadPage(unsigned timeout_ms, int *nSkips = 0);
+
+    /// Commit-to-wakeup latency for the waits above that actually had to sleep, as seen by this reader.
+    struct WakeupStats {
+        unsigned nWakeups; ///< number of times a page arrived while we were sleeping on it
+        unsigned nTimeouts;
+        double avgLatencyUs, maxLatencyUs;
+    };
+    WakeupStats wakeupStats() const;
+    void resetWakeupStats();
+
 protected:
+    struct ReaderSlot {
+        volatile unsigned inUse; ///< 0 if free, PAGED_RINGBUFFER_MAGIC if taken
+        volatile unsigned lastPageRead;
+        volatile unsigned policy;
+        volatile unsigned nSkips;
+        char name[PAGED_RINGBUFFER_READER_NAME_LEN];
+    };
+
+    /** Describes the pages to readers in other processes, which have no other way of knowing the scan geometry.  See
+        PagedScanReader::publishLayout().  Fixed size types only, since it is read by C code built with other compilers. */
+    struct Layout {
+        volatile unsigned magic; ///< PAGED_RINGBUFFER_LAYOUT_MAGIC once published, else 0.  Stored last.
+        unsigned version; ///< PAGED_RINGBUFFER_LAYOUT_VERSION
+        unsigned headerBytes; ///< sizeof(ShmHeader): the first page's Header is this far into the buffer
+        unsigned pageHeaderBytes; ///< sizeof(Header)
+        unsigned pageSize, nPages;
+        unsigned scanSizeSamps, metaDataSizeBytes, scansPerPage;
+        unsigned nChans; ///< entries used in chanIds and chanFlags.  Same as scanSizeSamps, unless that's more than PAGED_RINGBUFFER_LAYOUT_MAX_CHANS.
+        double srate; ///< in scans per second
+        unsigned short chanIds[PAGED_RINGBUFFER_LAYOUT_MAX_CHANS]; ///< for each sample of a scan, the channel (electrode id, for mapped channels) it came from
+        unsigned char chanFlags[PAGED_RINGBUFFER_LAYOUT_MAX_CHANS]; ///< PAGED_RINGBUFFER_CHAN_AUX etc
+    };
+
+    /// lives at the very beginning of the shared memory, before the first page
+    struct ShmHeader {
+        volatile unsigned int latestPNum; ///< must be first -- see union below
+        /** PAGED_RINGBUFFER_WRITER_ABI, stored by the writer before it first sets latestPNum.  Stays at this offset in
+            every version (an old 4 byte header writer puts its first page's magic here), so that readers can tell when the
+            writer doesn't agree with them about the rest of this struct.  See writerMismatch(). */
+        volatile unsigned int writerAbi;
+        volatile unsigned int nWriterBlocks; ///< number of pages the writer had to wait on a BlockWriter reader for
+        volatile unsigned int nWaiters; ///< readers currently sleeping in waitForNextPage().  The writer only signals if nonzero.
+        volatile unsigned int wakeId; ///< set by bzero(), names the wakeup object on Windows
+        volatile unsigned long long lastCommitUs; ///< monotonic timestamp of the last commitCurrentWritePage(), for latency measurement
+        ReaderSlot readers[PAGED_RINGBUFFER_MAX_READERS];
+        Layout layout; ///< at PAGED_RINGBUFFER_LAYOUT_OFFSET
+    };
+
     union {
         void *memBuffer;
         volatile unsigned int *latestPNum;
+        ShmHeader *shmHdr;
     };
-    char *mem; // points one unsigned int past memBuffer
+    char *mem; // points one ShmHeader past memBuffer
     unsigned long real_size_bytes, avail_size_bytes, page_size;
     unsigned int npages, lastPageRead;
     int pageIdx;
+    int readerSlot; ///< index into shmHdr->readers, or -1 if not registered
+
+    void *wakeHandle; ///< Windows only: this side's handle to the named semaphore for wakeId
+    unsigned wakeHandleId;
+    void *openWakeHandle(); ///< (re)opens wakeHandle if shmHdr->wakeId changed.  Returns 0 if there is no wakeup object.
+    void closeWakeHandle();
+    bool nextPageReady() const;
+
+    unsigned nWakeups, nWakeTimeouts;
+    double wakeLatSumUs, wakeLatMaxUs;
 
     struct Header {
         volatile unsigned int magic;
@@ -66,6 +184,11 @@ public:
 
     unsigned long nPagesWritten() const { return nWritten; }
 
+    /// The longest the writer will wait, per page, for a BlockWriter reader to catch up.  If a reader makes the
+    /// writer time out, it is demoted to DropPages (it is presumably hung or dead).  Default is 500 ms.
+    unsigned maxBlockMs() const { return max_block_ms; }
+    void setMaxBlockMs(unsigned ms) { max_block_ms = ms; }
+
     /// grab the next write page.
     /// note that grabbing more than 1 page at a time will result in an error.
     /// Grab the page, write to it, then commit it sometime later before grabbing
@@ -79,10 +202,14 @@ public:
 
     void initializeForWriting(); ///< generally, call this before first writing to the buffer to clear it to 0
 
+protected:
+    /// called from grabNextPageForWrite() before a page is reused: waits on any BlockWriter readers that haven't consumed it yet
+    void waitForBlockingReaders(unsigned pageNumAboutToBeOverwritten);
+
 private:
     unsigned long nWritten;
     unsigned int lastPageWritten;
-
+    unsigned max_block_ms;
 };
 
 class PagedScanWriter;
@@ -111,8 +238,19 @@ public:
     unsigned scanSizeSamps() const { return scan_size_samps; }
 
     const short *next(int *nSkips, void **metaPtr = 0, unsigned *scans_returned = 0);
+    /// Same as next(), but blocks for up to timeout_ms for the next page to be committed.  See waitForNextPage().
+    const short *waitNext(unsigned timeout_ms, int *nSkips, void **metaPtr = 0, unsigned *scans_returned = 0);
+
+    /** Describes this buffer's scans in the shared header, for readers in other processes (see ShmClient/SpikeGLShm.h).
+        chanIds and chanFlags have scanSizeSamps() entries each, or are NULL for channels 0,1,2... with no flags.
+        Call this after bzero(), before the writer starts, and retractLayout() before the memory goes away. */
+    void publishLayout(double srate, const unsigned short *chanIds = 0, const unsigned char *chanFlags = 0);
+    /// Tells readers in other processes that this buffer is done with, so they should detach
+    void retractLayout();
 
 private:
+    const short *gotPage(const short *scans, int skips, int *nSkips, void **metaPtr, unsigned *scans_returned);
+
     unsigned scan_size_samps, meta_data_size_bytes;
     unsigned nScansPerPage;
     unsigned long long scanCt, scanCtV;
@@ -146,8 +284,21 @@ public:
     bool writePartial(const void *partialData, unsigned bytes, const void *meta_of_size_metaDataSizeBytes = 0);
     bool writePartialEnd(); // call this when your partial write is done and you are *sure* you have a multiple of 1 or more full scans written
 
+    /// Zero-copy alternative to write(): returns a pointer into the current page with room for nScans full scans, for the caller to fill in
+    /// and then hand to writeDirectEnd().  Returns NULL if nScans won't fit in what is left of the current page, in which case use write().
+    short *writeDirectBegin(unsigned nScans);
+    /// Accounts for the nScans scans written to the pointer from writeDirectBegin(), committing the page (with its metadata) if it is now full.
+    bool writeDirectEnd(unsigned nScans, const void *meta = 0);
+    /// How many scans writeDirectBegin() can hand out right now: what is left of the current page, or a whole page.
+    unsigned scansFreeInPage() const { return currPage ? nScansPerPage - pageOffset : nScansPerPage; }
+
+
+    /// true if the chan_mapping given to the c'tor reorders channels, in which case each page is remapped as it is committed
+    bool remapsChannels() const { return remapping; }
+    /// the remap applied to each page, if remapsChannels()
+    const ScanGather & channelRemap() const { return remap; }
 
-    // same as super class but also initializes the ScanRemapper
+    // same as super class, but hands out the staging page when remapping channels
     /*virtual*/ void *grabNextPageForWrite();
 
 protected:
@@ -159,24 +310,12 @@ private:
     unsigned nScansPerPage, nBytesPerPage, pageOffset /*in scans*/, partial_offset /* in bytes */, partial_bytes_written, partial_rem;
     unsigned long long scanCt, sampleCt;
 
-    class ScanRemapper : public Thread, public Semaphore {
-    public:
-        ErrFunc_t ErrFunc, DbgFunc;
-
-        ScanRemapper(short *page, unsigned nScansPerPage, unsigned scanLen, const std::vector<int> & mapping);
-        ~ScanRemapper();
-        void wait() { Thread::wait(0xffffffff); }
-    protected:
-        void threadFunc();
-    private:
-        volatile bool pleaseStop;
-        short *scans;
-        unsigned nScansPerPage, scanLen;
-        const std::vector<int> & map;
-    };
-
-    const std::vector<int> chan_mapping;
-    ScanRemapper *mapper;
+    /* Channel remapping: scans are written to staging, then gathered into the real page (shmPage) by commit(),
+       so that readers only ever see whole, remapped pages. */
+    ScanGather remap;
+    bool remapping;
+    std::vector<short> staging;
+    short *shmPage;
 };
 
 
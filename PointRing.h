@@ -0,0 +1,89 @@
+#ifndef PointRing_H
+#define PointRing_H
+
+#include <vector>
+#include <string.h>
+#include "Vec.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/** A single-producer/single-consumer ring of graph points that never blocks the producer.
+
+    GraphsWindow::putScans() (the producer, on the data thread) appends a page's worth of points
+    at a time, and GraphsWindow::updateGraphs() (the consumer, on the GUI thread) takes whatever
+    accumulated since its last call.  If the consumer falls more than capacity() points behind,
+    the producer simply overwrites the oldest points.  Before writing, the producer announces how
+    far it is about to write, so after copying the consumer can tell which of the points it copied
+    may have been overwritten meanwhile, and drops those.  So the 2 threads share no lock, just
+    counters.
+
+    reset() is not thread safe: call it only while the producer is known to be idle. */
+class PointRing
+{
+public:
+    PointRing() : mask(0), wrEnd(0), wr(0), rd(0) {}
+
+    /// Clears the ring and sets its capacity, rounded up to a power of 2.  A capacity of 0 turns the ring off (see isOn()).
+    void reset(unsigned capacity) {
+        unsigned sz = 0;
+        if (capacity) for (sz = 1; sz < capacity; sz <<= 1) {}
+        buf.assign(sz, Vec2f());
+        mask = sz ? sz-1 : 0;
+        wrEnd = wr = rd = 0;
+    }
+    unsigned capacity() const { return unsigned(buf.size()); }
+    bool isOn() const { return !buf.empty(); }
+
+    // -- producer side --
+
+    /// announce that points 0..n-1 of the next batch are about to be written with put()
+    void beginWrite(unsigned n) { wrEnd = wr + n; barrier(); }
+    void put(unsigned k, const Vec2f & v) { buf[(wr + k) & mask] = v; }
+    /// publish the batch to the consumer
+    void endWrite(unsigned n) { barrier(); wr = wr + n; }
+
+    // -- consumer side --
+
+    /// Appends the points published since the last call to out, oldest first, or just discards them if out is null.
+    /// Returns the number of points appended.
+    unsigned take(std::vector<Vec2f> *out) {
+        const unsigned w = wr, cap = capacity();
+        barrier();
+        unsigned r = rd;
+        if (!out || !cap) { rd = w; return 0; }
+        if (w - r > cap) r = w - cap; // we fell behind, those are gone
+        const size_t o = out->size();
+        unsigned n = w - r;
+        out->resize(o + n);
+        const unsigned i = r & mask, n1 = n < cap - i ? n : cap - i;
+        if (n1) memcpy(&(*out)[o], &buf[i], n1*sizeof(Vec2f));
+        if (n > n1) memcpy(&(*out)[o + n1], &buf[0], (n-n1)*sizeof(Vec2f));
+        barrier();
+        const unsigned e = wrEnd;
+        if (e - r > cap) { // points before e - cap may have been overwritten while we copied them
+            unsigned torn = (e - r) - cap;
+            if (torn > n) torn = n;
+            out->erase(out->begin() + o, out->begin() + o + torn);
+            n -= torn;
+        }
+        rd = w;
+        return n;
+    }
+
+private:
+    static void barrier() {
+#ifdef _MSC_VER
+        _ReadWriteBarrier(); _mm_mfence();
+#else
+        __sync_synchronize();
+#endif
+    }
+
+    std::vector<Vec2f> buf;
+    unsigned mask;
+    volatile unsigned wrEnd, wr; ///< written by the producer only.  free-running, wrap around at 2^32
+    unsigned rd; ///< consumer only
+};
+
+#endif
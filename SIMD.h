@@ -0,0 +1,109 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/* Compile-time and run-time support for the hand-vectorized sample kernels (ScanGather, HPFilter, etc).
+   This header deliberately does not depend on Qt so that it may be shared with the MSVC-compiled
+   FG_SpikeGL.exe subprocess.
+
+   Kernels for instruction sets above the build's baseline are compiled with SIMD_TARGET("...") so the
+   rest of the program needs no special compiler flags, and are only called if SIMD::level() says the
+   CPU supports them. */
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#  define SIMD_X86 1
+#  define SIMD_TARGET(t) __attribute__((target(t)))
+#  include <cpuid.h>
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#  define SIMD_X86 1
+#  define SIMD_TARGET(t)
+#  include <intrin.h>
+#else
+#  define SIMD_TARGET(t)
+#endif
+
+#ifdef SIMD_X86
+#  include <emmintrin.h> /* SSE2 */
+#  include <tmmintrin.h> /* SSSE3 */
+#  include <smmintrin.h> /* SSE4.1 */
+#  include <immintrin.h> /* AVX2 */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef _MSC_VER
+#  include <strings.h>
+#endif
+
+namespace SIMD
+{
+    enum Level { Scalar = 0, SSE2, SSSE3, SSE41, AVX2 };
+
+    inline const char *levelName(Level l) {
+        switch (l) {
+        case SSE2: return "SSE2";
+        case SSSE3: return "SSSE3";
+        case SSE41: return "SSE4.1";
+        case AVX2: return "AVX2";
+        default: return "scalar";
+        }
+    }
+
+    inline Level detectLevel() {
+        Level ret = Scalar;
+#ifdef SIMD_X86
+        unsigned a = 0, b = 0, c = 0, d = 0;
+#  ifdef _MSC_VER
+        int r[4];
+        __cpuid(r, 0); const unsigned maxLeaf = unsigned(r[0]);
+        __cpuid(r, 1); a = r[0], b = r[1], c = r[2], d = r[3];
+#  else
+        const unsigned maxLeaf = __get_cpuid_max(0, 0);
+        if (maxLeaf >= 1) __cpuid(1, a, b, c, d);
+#  endif
+        if (maxLeaf < 1) return Scalar;
+        if (d & (1U<<26)) ret = SSE2; else return ret;
+        if (c & (1U<<9)) ret = SSSE3; else return ret;
+        if (c & (1U<<19)) ret = SSE41; else return ret;
+        const bool osxsave = !!(c & (1U<<27)), avx = !!(c & (1U<<28));
+        if (!osxsave || !avx || maxLeaf < 7) return ret;
+        // make sure the OS saves the ymm registers on context switch
+#  ifdef _MSC_VER
+        const unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(r, 7, 0); b = r[1];
+#  else
+        unsigned xlo = 0, xhi = 0;
+        __asm__ __volatile__ ("xgetbv" : "=a"(xlo), "=d"(xhi) : "c"(0));
+        const unsigned long long xcr0 = (static_cast<unsigned long long>(xhi) << 32) | xlo;
+        __cpuid_count(7, 0, a, b, c, d);
+#  endif
+        if ((xcr0 & 0x6) == 0x6 && (b & (1U<<5))) ret = AVX2;
+#endif
+        return ret;
+    }
+
+    /// The highest instruction set usable on this machine.  Set the environment variable SPIKEGL_SIMD to
+    /// "scalar", "sse2", "ssse3", "sse4.1" or "avx2" to cap it (handy for benchmarking the kernels against each other).
+    /// The first call does the detection, so each program calls this once from main() before it starts any threads;
+    /// after that it only reads the cached value.
+    inline Level level() {
+        static int lvl = -1; // a plain int with a constant initializer: no guard variable, and -1 is never a Level
+        if (lvl < 0) {
+            Level l = detectLevel();
+            const char *cap = getenv("SPIKEGL_SIMD");
+            if (cap) {
+                Level c = l;
+                for (int i = Scalar; i <= AVX2; ++i)
+#ifdef _MSC_VER
+                    if (!_stricmp(cap, levelName(Level(i)))) c = Level(i);
+#else
+                    if (!strcasecmp(cap, levelName(Level(i)))) c = Level(i);
+#endif
+                if (c < l) l = c;
+            }
+            lvl = int(l);
+        }
+        return Level(lvl);
+    }
+}
+
+#endif // SIMD_H
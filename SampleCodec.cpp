@@ -0,0 +1,173 @@
+#include "SampleCodec.h"
+#include <string.h>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* The coded block is one little endian bit stream, least significant bit first.  For each channel:
+   OrderBits for the predictor order, then for each partition KBits for its Rice parameter k and then
+   its residuals.  A residual r is zigzagged to u (0, -1, 1, -2, .. -> 0, 1, 2, 3, ..), then written
+   as q = u >> k zero bits, a one bit and the low k bits of u.  If q would be EscQ or more, it is
+   written as EscQ zero bits and u in RawBits instead.  The predictors start each block from 0. */
+
+namespace {
+    enum { OrderBits = 2, KBits = 5, MaxK = 18, EscQ = 24, RawBits = 18 };
+
+    typedef unsigned long long u64;
+
+    inline unsigned ctz64(u64 v) ///< v must not be 0
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long i; _BitScanForward64(&i, v); return unsigned(i);
+#elif defined(_MSC_VER)
+        unsigned long i;
+        if (_BitScanForward(&i, unsigned(v))) return unsigned(i);
+        _BitScanForward(&i, unsigned(v >> 32)); return unsigned(i) + 32;
+#else
+        return unsigned(__builtin_ctzll(v));
+#endif
+    }
+
+    struct BitWriter {
+        unsigned char *p;
+        u64 acc;
+        unsigned n; ///< bits in acc, always < 32 between calls
+
+        BitWriter(unsigned char *out) : p(out), acc(0), n(0) {}
+        /// appends the low nb bits of v, nb <= 32 and v < 2^nb
+        void put(unsigned v, unsigned nb) {
+            acc |= u64(v) << n;
+            n += nb;
+            if (n >= 32) {
+                p[0] = (unsigned char)acc; p[1] = (unsigned char)(acc >> 8); p[2] = (unsigned char)(acc >> 16); p[3] = (unsigned char)(acc >> 24);
+                p += 4; acc >>= 32; n -= 32;
+            }
+        }
+        unsigned char *flush() {
+            for ( ; n; n = n > 8 ? n-8 : 0, acc >>= 8) *p++ = (unsigned char)acc;
+            return p;
+        }
+    };
+
+    struct BitReader {
+        const unsigned char *p, *end;
+        u64 buf;
+        unsigned n; ///< valid bits in buf.  Bits above those may hold the next ones, or 0 at the end of the data.
+
+        BitReader(const unsigned char *in, size_t len) : p(in), end(in + len), buf(0), n(0) {}
+        /// gets at least 56 bits into buf, unless the data runs out
+        void refill() {
+            if (end - p >= 8) {
+                u64 w; memcpy(&w, p, sizeof(w)); // little endian, like the hosts we run on
+                buf |= w << n;
+                const unsigned nb = (63 - n) >> 3;
+                p += nb; n += nb*8;
+            } else {
+                for ( ; n <= 56 && p < end; n += 8) buf |= u64(*p++) << n;
+            }
+        }
+        bool get(unsigned nb, unsigned & v) {
+            if (n < nb) return false;
+            v = unsigned(buf & ((u64(1) << nb) - 1));
+            buf >>= nb; n -= nb;
+            return true;
+        }
+    };
+
+    inline unsigned zigzag(int r) { return (unsigned(r) << 1) ^ unsigned(r >> 31); }
+    inline int unzigzag(unsigned u) { return int(u >> 1) ^ -int(u & 1); }
+}
+
+size_t SampleCodec::maxEncodedBytes(unsigned nScans, unsigned nChans)
+{
+    const u64 nParts = (u64(nScans) + PartitionSize - 1) / PartitionSize;
+    const u64 bits = u64(nChans)*(OrderBits + nParts*KBits) + u64(nScans)*nChans*(EscQ + RawBits);
+    return size_t((bits + 7) / 8) + 8;
+}
+
+size_t SampleCodec::encode(const short *scans, unsigned nScans, unsigned nChans, unsigned char *out)
+{
+    BitWriter bw(out);
+    std::vector<int> x(nScans);
+    std::vector<unsigned> u(nScans);
+    for (unsigned c = 0; c < nChans; ++c) {
+        // pick the predictor with the smallest sum of |residual|
+        u64 s0 = 0, s1 = 0, s2 = 0;
+        int p1 = 0, p2 = 0;
+        for (unsigned i = 0; i < nScans; ++i) {
+            const int v = x[i] = scans[size_t(i)*nChans + c];
+            const int r1 = v - p1, r2 = r1 - p1 + p2;
+            s0 += unsigned(v < 0 ? -v : v); s1 += unsigned(r1 < 0 ? -r1 : r1); s2 += unsigned(r2 < 0 ? -r2 : r2);
+            p2 = p1; p1 = v;
+        }
+        const unsigned order = s2 < s1 && s2 < s0 ? 2 : (s1 < s0 ? 1 : 0);
+        bw.put(order, OrderBits);
+        p1 = p2 = 0;
+        for (unsigned i = 0; i < nScans; ++i) {
+            const int pred = order == 2 ? 2*p1 - p2 : (order == 1 ? p1 : 0);
+            u[i] = zigzag(x[i] - pred);
+            p2 = p1; p1 = x[i];
+        }
+        for (unsigned from = 0; from < nScans; from += PartitionSize) {
+            const unsigned to = nScans - from < unsigned(PartitionSize) ? nScans : from + PartitionSize;
+            u64 sum = 0;
+            for (unsigned i = from; i < to; ++i) sum += u[i];
+            unsigned k = 0; // ~log2 of the mean residual
+            while (k < MaxK && (u64(to - from) << (k+1)) <= sum) ++k;
+            bw.put(k, KBits);
+            for (unsigned i = from; i < to; ++i) {
+                const unsigned q = u[i] >> k;
+                if (q < unsigned(EscQ)) {
+                    const unsigned len = q + 1 + k, v = (1U << q) | ((u[i] & ((1U << k) - 1)) << (q + 1));
+                    if (len <= 32) bw.put(v, len);
+                    else { bw.put(1U << q, q + 1); bw.put(u[i] & ((1U << k) - 1), k); }
+                } else {
+                    bw.put(0, EscQ);
+                    bw.put(u[i], RawBits);
+                }
+            }
+        }
+    }
+    return size_t(bw.flush() - out);
+}
+
+bool SampleCodec::decode(const unsigned char *in, size_t nBytes, unsigned nScans, unsigned nChans, short *out)
+{
+    BitReader br(in, nBytes);
+    const u64 escMask = (u64(1) << EscQ) - 1;
+    for (unsigned c = 0; c < nChans; ++c) {
+        unsigned order = 0;
+        br.refill();
+        if (!br.get(OrderBits, order) || order > 2) return false;
+        int p1 = 0, p2 = 0;
+        short *o = out + c;
+        for (unsigned from = 0; from < nScans; from += PartitionSize) {
+            const unsigned to = nScans - from < unsigned(PartitionSize) ? nScans : from + PartitionSize;
+            unsigned k = 0;
+            br.refill();
+            if (!br.get(KBits, k) || k > MaxK) return false;
+            const unsigned kMask = (1U << k) - 1;
+            for (unsigned i = from; i < to; ++i, o += nChans) {
+                br.refill();
+                unsigned u;
+                if (br.buf & escMask) {
+                    const unsigned q = ctz64(br.buf), len = q + 1 + k;
+                    if (br.n < len) return false;
+                    u = (q << k) | (unsigned(br.buf >> (q + 1)) & kMask);
+                    br.buf >>= len; br.n -= len;
+                } else {
+                    if (br.n < unsigned(EscQ + RawBits)) return false;
+                    br.buf >>= EscQ; br.n -= EscQ;
+                    br.get(RawBits, u);
+                }
+                const int pred = order == 2 ? 2*p1 - p2 : (order == 1 ? p1 : 0);
+                const int v = unzigzag(u) + pred;
+                if (v < -32768 || v > 32767) return false;
+                *o = short(v);
+                p2 = p1; p1 = v;
+            }
+        }
+    }
+    return true;
+}
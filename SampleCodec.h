@@ -0,0 +1,34 @@
+#ifndef SampleCodec_H
+#define SampleCodec_H
+
+#include <stddef.h>
+
+/** Lossless compression of blocks of scans, for the compressed .bin format (see DataFile).
+
+    Each channel of the block is coded on its own: a fixed linear predictor (none, x[i-1], or
+    2*x[i-1] - x[i-2], whichever gives the smallest residuals for that channel in that block), then
+    the residuals are Rice coded in partitions of PartitionSize samples, each with its own Rice
+    parameter.  Neural data is mostly small differences from one sample to the next, so this gets
+    most of what a general purpose compressor would, at a small fraction of the CPU.  Residuals too
+    big for the partition's parameter are escaped and stored verbatim, so spikes and saturated
+    channels don't hurt much.
+
+    A block depends on nothing outside it, so blocks can be coded on any number of threads and
+    decoded in any order. */
+namespace SampleCodec
+{
+    enum { PartitionSize = 64 };
+
+    /// the most bytes encode() can produce for nScans scans of nChans channels
+    size_t maxEncodedBytes(unsigned nScans, unsigned nChans);
+
+    /// Encodes nScans scans of nChans channels from `scans' into `out', which must have room for
+    /// maxEncodedBytes(nScans, nChans).  Returns the number of bytes written.
+    size_t encode(const short *scans, unsigned nScans, unsigned nChans, unsigned char *out);
+
+    /// Decodes the nBytes of `in' written by encode(scans, nScans, nChans, ..) into `out', which has
+    /// room for nScans*nChans samples.  Returns false if the data is corrupt (or truncated).
+    bool decode(const unsigned char *in, size_t nBytes, unsigned nScans, unsigned nChans, short *out);
+}
+
+#endif
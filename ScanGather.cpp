@@ -0,0 +1,109 @@
+#include "ScanGather.h"
+#include "SIMD.h"
+#include <string.h>
+
+ScanGather::ScanGather()
+    : inSize(0), identity(true), simdOk(false)
+{}
+
+ScanGather::ScanGather(unsigned inScanSize, const std::vector<int> & srcIndices)
+    : inSize(0), identity(true), simdOk(false)
+{
+    setIndices(inScanSize, srcIndices);
+}
+
+void ScanGather::setSubset(const std::vector<bool> & keep)
+{
+    std::vector<int> ix;
+    ix.reserve(keep.size());
+    for (unsigned i = 0; i < keep.size(); ++i)
+        if (keep[i]) ix.push_back(int(i));
+    setIndices(unsigned(keep.size()), ix);
+}
+
+void ScanGather::setIndices(unsigned inScanSize, const std::vector<int> & srcIndices)
+{
+    inSize = inScanSize;
+    idx = srcIndices;
+    for (unsigned i = 0; i < idx.size(); ++i)
+        if (idx[i] < 0 || idx[i] >= int(inSize)) idx[i] = 0;
+    identity = idx.size() == inSize;
+    for (unsigned i = 0; identity && i < idx.size(); ++i)
+        identity = idx[i] == int(i);
+
+    // Precompute the shuffle runs.  A run is up to 8 consecutive output channels whose
+    // sources all lie within one 8-sample window of the input scan.
+    runs.clear();
+    simdOk = inSize >= 8 && !identity;
+    const unsigned n = unsigned(idx.size());
+    for (unsigned o = 0; simdOk && o < n; ) {
+        int lo = idx[o], hi = idx[o];
+        unsigned k = 1;
+        while (o+k < n && k < 8) {
+            const int nlo = idx[o+k] < lo ? idx[o+k] : lo, nhi = idx[o+k] > hi ? idx[o+k] : hi;
+            if (nhi - nlo >= 8) break;
+            lo = nlo, hi = nhi, ++k;
+        }
+        Run r;
+        r.srcOff = unsigned(lo);
+        if (r.srcOff + 8 > inSize) r.srcOff = inSize - 8; // never load past the end of the scan
+        r.dstOff = o;
+        memset(r.shuf, 0x80, sizeof(r.shuf));
+        for (unsigned j = 0; j < k; ++j) {
+            const unsigned char b = static_cast<unsigned char>((idx[o+j] - int(r.srcOff)) * 2);
+            r.shuf[j*2] = b; r.shuf[j*2+1] = b+1;
+        }
+        runs.push_back(r);
+        o += k;
+    }
+    // a scattered permutation (most runs 1 channel long) is quicker to do in scalar code than 1 shuffle per channel
+    if (simdOk && 3*runs.size() > 2*size_t(n)) simdOk = false;
+}
+
+bool ScanGather::usesSIMD() const
+{
+    return simdOk && SIMD::level() >= SIMD::SSSE3;
+}
+
+void ScanGather::applyScalar(const short *in, short *out, unsigned nScans) const
+{
+    const unsigned n = unsigned(idx.size());
+    const int * const ix = n ? &idx[0] : 0;
+    for (unsigned s = 0; s < nScans; ++s, in += inSize, out += n)
+        for (unsigned i = 0; i < n; ++i)
+            out[i] = in[ix[i]];
+}
+
+void ScanGather::apply(const short *in, short *out, unsigned nScans) const
+{
+    if (!nScans || idx.empty()) return;
+    if (identity) { memcpy(out, in, size_t(nScans)*inSize*sizeof(short)); return; }
+    if (usesSIMD()) { applySSSE3(in, out, nScans); return; }
+    applyScalar(in, out, nScans);
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("ssse3")
+void ScanGather::applySSSE3(const short *in, short *out, unsigned nScans) const
+{
+    // Each run does a full 8-sample store, which may spill up to 7 samples past its own outputs.  Runs are
+    // processed in order so the spillover is overwritten by the next run (or the next scan)..
+    // except at the very end of `out', so the last few scans are done in scalar code.
+    const unsigned n = unsigned(idx.size()), nRuns = unsigned(runs.size());
+    const unsigned nTail = (7 + n) / n, nVec = nScans > nTail ? nScans - nTail : 0;
+    const Run * const r0 = &runs[0];
+    for (unsigned s = 0; s < nVec; ++s, in += inSize, out += n) {
+        for (const Run *r = r0; r < r0+nRuns; ++r) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + r->srcOff));
+            const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r->shuf));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + r->dstOff), _mm_shuffle_epi8(v, m));
+        }
+    }
+    applyScalar(in, out, nScans - nVec);
+}
+#else
+void ScanGather::applySSSE3(const short *in, short *out, unsigned nScans) const
+{
+    applyScalar(in, out, nScans);
+}
+#endif
@@ -0,0 +1,58 @@
+#ifndef ScanGather_H
+#define ScanGather_H
+
+#include <vector>
+
+/** Copies a subset or a permutation of the channels of each scan in a block of scans
+    into a tightly packed output block.  Output channel i of each scan is taken from
+    input channel indices()[i].
+
+    The per-scan work is precomputed once when the indices are set: the output channels
+    are split into runs of up to 8 whose source channels all fall within one 8-sample
+    window of the input scan, and each run gets its own byte-shuffle control.  apply()
+    then does one unaligned load, one pshufb and one unaligned store per run, falling
+    back to plain scalar code on CPUs without SSSE3, or when most runs are just 1
+    channel long (a scattered permutation), where the shuffles don't pay off.
+
+    Does not depend on Qt so that it may be shared with FG_SpikeGL.exe. */
+class ScanGather
+{
+public:
+    ScanGather();
+    ScanGather(unsigned inScanSize, const std::vector<int> & srcIndices);
+
+    /// srcIndices[i] is the input channel that ends up in output channel i.  Indices >= inScanSize are illegal and clamped to 0.
+    void setIndices(unsigned inScanSize, const std::vector<int> & srcIndices);
+    /// convenience: keep (in order) only the channels whose keep[i] is true
+    void setSubset(const std::vector<bool> & keep);
+
+    unsigned inScanSize() const { return inSize; }
+    unsigned outScanSize() const { return unsigned(idx.size()); }
+    const std::vector<int> & indices() const { return idx; }
+    /// true if apply() is just a memcpy
+    bool isIdentity() const { return identity; }
+    /// true if apply() will use the vectorized kernel on this machine
+    bool usesSIMD() const;
+
+    /// Gathers nScans scans from `in' (inScanSize() samples each) into `out' (outScanSize() samples each).
+    /// in and out must not overlap.
+    void apply(const short *in, short *out, unsigned nScans) const;
+    /// The straightforward reference implementation of apply().
+    void applyScalar(const short *in, short *out, unsigned nScans) const;
+
+private:
+    struct Run {
+        unsigned srcOff; ///< the first sample of the 8-sample input window
+        unsigned dstOff; ///< first output channel produced by this run
+        unsigned char shuf[16]; ///< pshufb control for this window
+    };
+
+    void applySSSE3(const short *in, short *out, unsigned nScans) const;
+
+    unsigned inSize;
+    std::vector<int> idx;
+    std::vector<Run> runs;
+    bool identity, simdOk;
+};
+
+#endif
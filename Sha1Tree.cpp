@@ -0,0 +1,32 @@
+#include "Sha1Tree.h"
+#include <string.h>
+
+/* static */ void Sha1Tree::hashBlock(const void *data, unsigned len, uint8_t digest[20])
+{
+    SHA1 sha;
+    if (len) sha.UpdateHash(reinterpret_cast<const uint8_t *>(data), len);
+    sha.Final();
+    sha.GetHash(digest);
+}
+
+void Sha1Tree::setLeaf(unsigned long long i, const uint8_t digest[20])
+{
+    if (leaves.size() < size_t(i+1)*20) leaves.resize(size_t(i+1)*20, 0);
+    memcpy(&leaves[size_t(i)*20], digest, 20);
+}
+
+std::string Sha1Tree::result(unsigned long long fileSize) const
+{
+    SHA1 sha;
+    const size_t n = size_t(numBlocks(fileSize))*20;
+    if (n) {
+        std::vector<uint8_t> l(leaves);
+        l.resize(n, 0); // missing leaves (a bug in the caller) just give a wrong hash
+        sha.UpdateHash(&l[0], uint32_t(n));
+    }
+    uint8_t sz[8];
+    for (int i = 0; i < 8; ++i) sz[i] = uint8_t(fileSize >> (8*i));
+    sha.UpdateHash(sz, sizeof(sz));
+    sha.Final();
+    return sha.ReportHash();
+}
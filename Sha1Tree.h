@@ -0,0 +1,40 @@
+#ifndef Sha1Tree_H
+#define Sha1Tree_H
+
+#include <string>
+#include <vector>
+#include "sha1.h"
+
+/** A SHA1 hash of a file that can be computed one block at a time, in any order and on any number of
+    threads.  The file is cut into blocks of blockSize() bytes (the last one may be shorter), each block
+    gets its own SHA1 (a leaf), and the hash of the file is the SHA1 of all the leaves in order followed
+    by the file size as 8 little endian bytes.
+
+    SpikeGL saves it in the .meta file as sha1TreeHash, with sha1Tree = blockSize() next to it.  The sha1
+    field stays what it always was, a plain SHA1 of the whole file or 0 if that was never computed, so
+    older SpikeGLs and sha1sum-based scripts aren't confused by it.  The writer hashes each block it
+    writes (see DFWriteThread) and the verifier hashes the blocks in parallel (see Sha1Verifier). */
+class Sha1Tree
+{
+public:
+    enum { DefaultBlockSize = 4*1024*1024 }; ///< the same as DF_ASYNCH_BLOCK_SIZE, so that each block the writer writes is a leaf
+
+    explicit Sha1Tree(unsigned blockSize = DefaultBlockSize) : bs(blockSize ? blockSize : unsigned(DefaultBlockSize)) {}
+
+    unsigned blockSize() const { return bs; }
+    /// the number of leaves for a file of fileSize bytes
+    unsigned long long numBlocks(unsigned long long fileSize) const { return (fileSize + bs - 1) / bs; }
+
+    /// the leaf for the len bytes of a block
+    static void hashBlock(const void *data, unsigned len, uint8_t digest[20]);
+    /// sets leaf i, growing the list of leaves as needed
+    void setLeaf(unsigned long long i, const uint8_t digest[20]);
+    /// the hash of a file of fileSize bytes, whose numBlocks(fileSize) leaves have all been set, as 40 hex digits
+    std::string result(unsigned long long fileSize) const;
+
+private:
+    unsigned bs;
+    std::vector<uint8_t> leaves; ///< 20 bytes each
+};
+
+#endif
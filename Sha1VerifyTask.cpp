@@ -5,6 +5,10 @@
 #include <QFileInfo>
 #include <QFile>
 #include "sha1.h"
+#include "Sha1Tree.h"
+#include "SpikeGL.h"
+#include <QMutex>
+#include <vector>
 #include "ConsoleWindow.h"
 
 Sha1VerifyTask::Sha1VerifyTask(const QString & dfn, const QString & metaFP,
@@ -30,7 +34,7 @@ void Sha1VerifyTask::cancel()
 }
 
 Sha1Verifier::Sha1Verifier(const QString & dataFileName, const QString &meta, const Params & params)   ///< c'tor just initializes values to 0
-: dataFileName(dataFileName), metaFilePath(meta), pleaseStop(false), params(params)
+: dataFileName(dataFileName), metaFilePath(meta), pleaseStop(false), params(params), treeBlockSize(0)
 {
     dataFileNameShort = QFileInfo(dataFileName).fileName();
 }
@@ -38,28 +42,63 @@ Sha1Verifier::Sha1Verifier(const QString & dataFileName, const QString &meta, co
 Sha1Verifier::Result
 Sha1Verifier::verify(QString *hash_out)
 {
-    QByteArray buf(65536, 0);
-    QFile f(dataFileName);
     QFileInfo fi(dataFileName);
-    SHA1 sha1;
-    QString sha1FromMeta = params["sha1"].toString().trimmed();
+    // files recorded with a tree hash have it in sha1TreeHash, and sha1 = 0 unless a plain hash was added later
+    const QString treeHash = params.value("sha1TreeHash").toString().trimmed();
+    const qint64 treeBs = params.value("sha1Tree").toLongLong();
+    treeBlockSize = treeHash.length() && treeHash != "0" && treeBs > 0 && treeBs <= 0x7fffffff ? unsigned(treeBs) : 0;
+    const QString sha1FromMeta = treeBlockSize ? treeHash : params["sha1"].toString().trimmed();
     
     if (sha1FromMeta.isNull() || !sha1FromMeta.length()) {
         extendedError = "Meta file for " + dataFileNameShort + " does not appear to contain a saved sha1 sum!";    
         return Failure;
     }
     
-    if (!f.open(QIODevice::ReadOnly)) {
+    if (!fi.isReadable()) {
         extendedError = dataFileNameShort + " could not be opened for reading!";
         return Failure;
     }
     
-    qint64 size = fi.size(), read = 0, step = size/100, lastPct = -1;
+    qint64 size = fi.size();
     if (size != params["fileSizeBytes"].toLongLong()) {
         Warning() << dataFileNameShort << " file size on disk: `" << size << "' does not match file size saved in meta file: `" << params["fileSizeBytes"].toString() << "' !!";
     }
-    if (!step) step = 1;
     extendedError = QString::null;
+    QString theHash;
+    const double t0 = getTime();
+    const bool ok = treeBlockSize ? hashTree(size, treeBlockSize, theHash) : hashPlain(size, theHash);
+    Result r = Failure;
+    if (ok && !pleaseStop) {
+        progress(100);
+        Debug() << "Sha1Verifier: hashed " << dataFileNameShort << " (" << (treeBlockSize ? "tree" : "plain") << ") at " << (size/1024.0/1024.0/qMax(getTime()-t0, 1e-6)) << " MB/s";
+        if (hash_out) *hash_out = theHash;
+        if (sha1FromMeta.compare(theHash, Qt::CaseInsensitive) == 0) {
+            r = Success;
+        } else {
+            if (sha1FromMeta.trimmed() == "0" || !sha1FromMeta.trimmed().length()) {
+                extendedError = "SHA1 hash is missing from this data file, because it has never been computed for this file.";
+                r = MetaFileMissingSha1;
+            } else {
+                extendedError = "Computed SHA1 does not match saved hash in meta file!\n(This could mean the data file has some corruption!)";
+                r = Failure;
+            }
+        }
+    } else if (pleaseStop)
+        r = Canceled;
+    return r;
+}
+
+bool Sha1Verifier::hashPlain(qint64 size, QString & hash)
+{
+    QByteArray buf(65536, 0);
+    QFile f(dataFileName);
+    SHA1 sha1;
+    if (!f.open(QIODevice::ReadOnly)) {
+        extendedError = dataFileNameShort + " could not be opened for reading!";
+        return false;
+    }
+    qint64 read = 0, step = size/100, lastPct = -1;
+    if (!step) step = 1;
     while (!pleaseStop && !f.atEnd() && extendedError.isNull()) {
         qint64 ret = f.read(buf.data(), buf.size());
         if (ret < 0) {
@@ -76,26 +115,98 @@ Sha1Verifier::verify(QString *hash_out)
             break;
         }
     }
-    Result r = Failure;
-    if (!pleaseStop && f.atEnd() && extendedError.isNull()) {
-        progress(100);
-        sha1.Final();
-        QString theHash = sha1.ReportHash().c_str();
-        if (hash_out) *hash_out = theHash;
-        if (sha1FromMeta.compare(theHash, Qt::CaseInsensitive) == 0) {
-            r = Success;
-        } else {
-            if (sha1FromMeta.trimmed() == "0" || !sha1FromMeta.trimmed().length()) {
-                extendedError = "SHA1 hash is missing from this data file, because it has never been computed for this file.";
-                r = MetaFileMissingSha1;
+    if (pleaseStop || !f.atEnd() || !extendedError.isNull()) return false;
+    sha1.Final();
+    hash = sha1.ReportHash().c_str();
+    return true;
+}
+
+namespace {
+    /// what the hashTree() threads share: they take the blocks in order, and hash each one into the tree
+    struct TreeJob {
+        QString fileName;
+        qint64 size;
+        Sha1Tree tree;
+        u64 nBlocks;
+        volatile bool *stop;
+        QMutex mut;
+        u64 next, done; ///< locked by mut
+        QString error; ///< locked by mut
+
+        TreeJob(const QString & fn, qint64 sz, unsigned bs, volatile bool *stopflg)
+            : fileName(fn), size(sz), tree(bs), nBlocks(tree.numBlocks(u64(sz))), stop(stopflg), next(0), done(0) {}
+    };
+
+    struct TreeHashThread : public QThread {
+        TreeJob & j;
+        TreeHashThread(TreeJob & job) : QThread(0), j(job) {}
+    protected:
+        void run();
+    };
+
+    void TreeHashThread::run()
+    {
+        QFile f(j.fileName);
+        if (!f.open(QIODevice::ReadOnly)) {
+            QMutexLocker l(&j.mut);
+            j.error = QFileInfo(j.fileName).fileName() + " could not be opened for reading!";
+            return;
+        }
+        const unsigned bs = j.tree.blockSize();
+        QByteArray buf;
+        for (;;) {
+            u64 i;
+            {
+                QMutexLocker l(&j.mut);
+                if (j.next >= j.nBlocks || !j.error.isNull() || *j.stop) break;
+                i = j.next++;
+            }
+            const qint64 off = qint64(i)*bs, len = qMin(qint64(bs), j.size - off);
+            uint8_t digest[20];
+            // the blocks are a multiple of the mapping granularity, normally, so each can be mapped on its own
+            uchar *p = off % DF_MAP_ALIGN ? 0 : f.map(off, len);
+            if (p) {
+                Sha1Tree::hashBlock(p, unsigned(len), digest);
+                f.unmap(p);
             } else {
-                extendedError = "Computed SHA1 does not match saved hash in meta file!\n(This could mean the data file has some corruption!)";
-                r = Failure;
+                buf.resize(int(len));
+                if (!f.seek(off) || f.read(buf.data(), len) != len) {
+                    QMutexLocker l(&j.mut);
+                    j.error = f.errorString();
+                    break;
+                }
+                Sha1Tree::hashBlock(buf.constData(), unsigned(len), digest);
             }
+            QMutexLocker l(&j.mut);
+            j.tree.setLeaf(i, digest);
+            ++j.done;
         }
-    } else if (pleaseStop)
-        r = Canceled;
-    return r;
+    }
+}
+
+bool Sha1Verifier::hashTree(qint64 size, unsigned blockSize, QString & hash)
+{
+    TreeJob j(dataFileName, size, blockSize, &pleaseStop);
+    unsigned nThreads = unsigned(qMax(QThread::idealThreadCount(), 1));
+    if (u64(nThreads) > j.nBlocks) nThreads = unsigned(qMax(j.nBlocks, u64(1)));
+    std::vector<TreeHashThread *> threads;
+    for (unsigned i = 0; i < nThreads; ++i) {
+        threads.push_back(new TreeHashThread(j));
+        threads.back()->start();
+    }
+    int lastPct = -1;
+    for (unsigned i = 0; i < threads.size(); ++i) {
+        while (!threads[i]->wait(100)) {
+            int pct;
+            { QMutexLocker l(&j.mut); pct = j.nBlocks ? int(j.done*100/j.nBlocks) : 0; }
+            if (pct > lastPct) { progress(pct); lastPct = pct; }
+        }
+        delete threads[i], threads[i] = 0;
+    }
+    if (pleaseStop) return false;
+    if (!j.error.isNull()) { extendedError = j.error; return false; }
+    hash = QString::fromLatin1(j.tree.result(u64(size)).c_str());
+    return true;
 }
 
 void Sha1VerifyTask::run()
@@ -5,11 +5,17 @@
 
 class QProgressDialog;
 
+/** Checks a data file against the hash in its meta file.  If the meta file has a sha1TreeHash (and sha1Tree =
+    block size), that is checked: a Sha1Tree hash, which is computed on all cores with each thread hashing whole
+    blocks straight out of the memory-mapped file.  Otherwise it's the sha1 key, a plain SHA1 of the file, read
+    the old-fashioned way.  A file with neither (sha1 = 0) gets MetaFileMissingSha1 and the plain SHA1, to be
+    saved as sha1. */
 struct Sha1Verifier {
     QString dataFileName, dataFileNameShort, extendedError; 
     QString metaFilePath;
     volatile bool pleaseStop;
     Params params;    
+    unsigned treeBlockSize; ///< after verify(): the Sha1Tree block size of the hash computed, or 0 if it was a plain SHA1
     
     virtual void progress(int) {} /**< no-op, reimplemented in subclasses */
     
@@ -18,6 +24,10 @@ struct Sha1Verifier {
     Sha1Verifier(const QString & dataFileName, const QString & completeMetaFilepath, const Params & params);   ///< c'tor just initializes values to 0
     
     Result verify(QString *hash_out = 0); ///< the meat and potatoes of all this is here -- performs the verification, calling the optional function, etc
+
+private:
+    bool hashPlain(qint64 size, QString & hash); ///< false on error (extendedError is set) or cancel
+    bool hashTree(qint64 size, unsigned blockSize, QString & hash); ///< same
 };
 
 class Sha1VerifyTask : public QThread, public Sha1Verifier
@@ -0,0 +1,317 @@
+#if !defined(_WIN32) && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 600 /* clock_gettime(), nanosleep() and System V shared memory, even with -std=c99 */
+#endif
+#include "SpikeGLShm.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <time.h>
+#endif
+
+/* QSharedMemory's native key for "SpikeGL_SampleData": a prefix, the key's letters, and the SHA-1 of the key in hex */
+#define DEFAULT_NAME "qipc_sharedmemory_SpikeGLSampleData9702ce268ed81358f8c584ddc7472760fd77b9c0"
+
+/* PagedRingBuffer's shared header and page header, by offset, so as not to depend on this compiler laying out
+   structs the way SpikeGL's did.  These are PagedRingBuffer::ShmHeader, Layout and Header, version 2. */
+#define OFS_LATEST 0 /* ShmHeader::latestPNum */
+#define OFS_WRITER_ABI 4 /* ShmHeader::writerAbi */
+#define WRITER_ABI (0x53475700U + SGLSHM_LAYOUT_VERSION) /* PAGED_RINGBUFFER_WRITER_ABI */
+#define OFS_WAKEID 16 /* ShmHeader::wakeId, changes every time SpikeGL clears the buffer */
+#define OFS_LAYOUT 800 /* ShmHeader::layout */
+#define LAYOUT_MAGIC 0x53474c31U
+#define MAX_CHANS 4096
+#define L_MAGIC 0
+#define L_VERSION 4
+#define L_HEADER_BYTES 8
+#define L_PAGE_HEADER_BYTES 12
+#define L_PAGE_SIZE 16
+#define L_NPAGES 20
+#define L_SCAN_SIZE 24
+#define L_META_SIZE 28
+#define L_SCANS_PER_PAGE 32
+#define L_NCHANS 36
+#define L_SRATE 40
+#define L_CHAN_IDS 48
+#define L_CHAN_FLAGS (L_CHAN_IDS + 2*MAX_CHANS)
+#define HEADER_BYTES (OFS_LAYOUT + L_CHAN_FLAGS + MAX_CHANS) /* sizeof(ShmHeader) */
+#define PAGE_MAGIC 0x4a6ef00dU
+#define PAGE_HEADER_BYTES 8
+
+struct SpikeGLShm {
+    const char *base;
+    unsigned long long size;
+#ifdef _WIN32
+    HANDLE h;
+#endif
+    unsigned wakeId;
+    unsigned pageSize, nPages, pageStride, scanSize, metaSize, scansPerPage, nChans;
+    double srate;
+    unsigned pollUs;
+    unsigned short chanIds[MAX_CHANS];
+    unsigned char chanFlags[MAX_CHANS];
+    unsigned lastPageRead;
+    int pageIdx;
+    unsigned long long scanCt, scanCtV;
+};
+
+static void barrier(void)
+{
+#ifdef _MSC_VER
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+static unsigned u32At(const char *p, unsigned ofs) { return *(const volatile unsigned *)(p + ofs); }
+
+static unsigned long long nowUs(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, ct;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&ct);
+    return (unsigned long long)(ct.QuadPart / freq.QuadPart) * 1000000ULL
+         + (unsigned long long)((ct.QuadPart % freq.QuadPart) * 1000000LL / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)(ts.tv_nsec / 1000);
+#endif
+}
+
+static void sleepUs(unsigned us)
+{
+#ifdef _WIN32
+    Sleep((us + 999) / 1000);
+#else
+    struct timespec ts;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (long)(us % 1000000) * 1000L;
+    nanosleep(&ts, 0);
+#endif
+}
+
+const char *sglshm_default_name(void) { return DEFAULT_NAME; }
+
+const char *sglshm_strerror(int err)
+{
+    switch (err) {
+    case SGLSHM_OK: return "no error";
+    case SGLSHM_ERR_NOT_FOUND: return "SpikeGL's sample buffer was not found (not acquiring, or not sharing its samples?)";
+    case SGLSHM_ERR_ATTACH: return "could not attach to SpikeGL's sample buffer";
+    case SGLSHM_ERR_NO_LAYOUT: return "SpikeGL hasn't described its sample buffer yet";
+    case SGLSHM_ERR_VERSION: return "SpikeGL's sample buffer layout is of an unsupported version";
+    case SGLSHM_ERR_BAD_LAYOUT: return "SpikeGL's sample buffer layout is inconsistent";
+    case SGLSHM_ERR_ENDED: return "SpikeGL is done with the sample buffer";
+    case SGLSHM_ERR_NOMEM: return "out of memory";
+    case SGLSHM_ERR_WRITER: return "the program writing the sample buffer was built for a different buffer layout (a stale FG_SpikeGL.exe?)";
+    }
+    return "unknown error";
+}
+
+static int attach(SpikeGLShm *s, const char *name)
+{
+#ifdef _WIN32
+    MEMORY_BASIC_INFORMATION mbi;
+    s->h = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (!s->h) return GetLastError() == ERROR_FILE_NOT_FOUND ? SGLSHM_ERR_NOT_FOUND : SGLSHM_ERR_ATTACH;
+    s->base = (const char *)MapViewOfFile(s->h, FILE_MAP_READ, 0, 0, 0);
+    if (!s->base) { CloseHandle(s->h); s->h = 0; return SGLSHM_ERR_ATTACH; }
+    if (!VirtualQuery(s->base, &mbi, sizeof(mbi))) return SGLSHM_ERR_ATTACH;
+    s->size = mbi.RegionSize;
+    return SGLSHM_OK;
+#else
+    /* QSharedMemory's System V backend: the key comes from ftok() on a file named after the native key */
+    char path[1024];
+    const char *tmp = getenv("TMPDIR");
+    key_t key;
+    int id;
+    struct shmid_ds ds;
+    void *p;
+    if (strchr(name, '/')) snprintf(path, sizeof(path), "%s", name);
+    else {
+        size_t len;
+        if (!tmp || !*tmp) tmp = "/tmp";
+        len = strlen(tmp);
+        while (len > 1 && tmp[len-1] == '/') --len;
+        snprintf(path, sizeof(path), "%.*s/%s", (int)len, tmp, name);
+    }
+    key = ftok(path, 'Q');
+    if (key == (key_t)-1) return SGLSHM_ERR_NOT_FOUND;
+    id = shmget(key, 0, 0);
+    if (id < 0) return SGLSHM_ERR_NOT_FOUND;
+    if (shmctl(id, IPC_STAT, &ds) != 0) return SGLSHM_ERR_ATTACH;
+    p = shmat(id, 0, SHM_RDONLY);
+    if (p == (void *)-1) return SGLSHM_ERR_ATTACH;
+    s->base = (const char *)p;
+    s->size = (unsigned long long)ds.shm_segsz;
+    return SGLSHM_OK;
+#endif
+}
+
+static void detach(SpikeGLShm *s)
+{
+#ifdef _WIN32
+    if (s->base) UnmapViewOfFile(s->base);
+    if (s->h) CloseHandle(s->h);
+    s->h = 0;
+#else
+    if (s->base) shmdt(s->base);
+#endif
+    s->base = 0;
+}
+
+/* copies the layout into s and checks it, like PagedRingBuffer::resetToBeginning() but stricter */
+static int readLayout(SpikeGLShm *s)
+{
+    const char *l = s->base + OFS_LAYOUT;
+    unsigned perPage;
+    double srate;
+    if (s->size < HEADER_BYTES) return SGLSHM_ERR_BAD_LAYOUT;
+    s->wakeId = u32At(s->base, OFS_WAKEID);
+    if (u32At(l, L_MAGIC) != LAYOUT_MAGIC) return SGLSHM_ERR_NO_LAYOUT;
+    barrier(); /* pairs with PagedScanReader::publishLayout(): the magic is stored last */
+    if (u32At(l, L_VERSION) != SGLSHM_LAYOUT_VERSION) return SGLSHM_ERR_VERSION;
+    if (u32At(l, L_HEADER_BYTES) != HEADER_BYTES || u32At(l, L_PAGE_HEADER_BYTES) != PAGE_HEADER_BYTES) return SGLSHM_ERR_BAD_LAYOUT;
+    s->pageSize = u32At(l, L_PAGE_SIZE);
+    s->nPages = u32At(l, L_NPAGES);
+    s->scanSize = u32At(l, L_SCAN_SIZE);
+    s->metaSize = u32At(l, L_META_SIZE);
+    s->scansPerPage = u32At(l, L_SCANS_PER_PAGE);
+    s->nChans = u32At(l, L_NCHANS);
+    memcpy(&srate, l + L_SRATE, sizeof(srate));
+    s->srate = srate;
+    memcpy(s->chanIds, l + L_CHAN_IDS, sizeof(s->chanIds));
+    memcpy(s->chanFlags, l + L_CHAN_FLAGS, sizeof(s->chanFlags));
+    s->pageStride = s->pageSize + PAGE_HEADER_BYTES;
+    if (!s->pageSize || !s->nPages || !s->scanSize || s->metaSize > s->pageSize || s->pageStride < s->pageSize)
+        return SGLSHM_ERR_BAD_LAYOUT;
+    perPage = (s->pageSize - s->metaSize) / (s->scanSize * 2U);
+    if (!perPage || perPage != s->scansPerPage) return SGLSHM_ERR_BAD_LAYOUT;
+    if (s->nChans != (s->scanSize < MAX_CHANS ? s->scanSize : MAX_CHANS)) return SGLSHM_ERR_BAD_LAYOUT;
+    if (HEADER_BYTES + (unsigned long long)s->nPages * s->pageStride > s->size) return SGLSHM_ERR_BAD_LAYOUT;
+    /* SpikeGL may have republished while we copied */
+    barrier();
+    if (u32At(l, L_MAGIC) != LAYOUT_MAGIC || u32At(s->base, OFS_WAKEID) != s->wakeId) return SGLSHM_ERR_NO_LAYOUT;
+    /* poll a few times per page when waiting, but not so often we'd spin */
+    if (s->srate > 0.) {
+        const double us = s->scansPerPage / s->srate * 1e6 / 4.;
+        s->pollUs = us < 50. ? 50U : (us > 1000. ? 1000U : (unsigned)us);
+    } else
+        s->pollUs = 1000U;
+    return SGLSHM_OK;
+}
+
+int sglshm_open(const char *name, SpikeGLShm **out)
+{
+    SpikeGLShm *s;
+    int r;
+    if (!out) return SGLSHM_ERR_ATTACH;
+    *out = 0;
+    s = (SpikeGLShm *)calloc(1, sizeof(SpikeGLShm));
+    if (!s) return SGLSHM_ERR_NOMEM;
+    r = attach(s, name && *name ? name : DEFAULT_NAME);
+    if (r == SGLSHM_OK) r = readLayout(s);
+    if (r != SGLSHM_OK) {
+        detach(s);
+        free(s);
+        return r;
+    }
+    sglshm_seek_latest(s);
+    *out = s;
+    return SGLSHM_OK;
+}
+
+void sglshm_close(SpikeGLShm *s)
+{
+    if (!s) return;
+    detach(s);
+    free(s);
+}
+
+unsigned sglshm_scan_size(const SpikeGLShm *s) { return s->scanSize; }
+unsigned sglshm_scans_per_page(const SpikeGLShm *s) { return s->scansPerPage; }
+unsigned sglshm_meta_size(const SpikeGLShm *s) { return s->metaSize; }
+unsigned sglshm_page_count(const SpikeGLShm *s) { return s->nPages; }
+double sglshm_srate(const SpikeGLShm *s) { return s->srate; }
+unsigned sglshm_chan_count(const SpikeGLShm *s) { return s->nChans; }
+unsigned sglshm_chan_id(const SpikeGLShm *s, unsigned i) { return i < s->nChans ? s->chanIds[i] : 0; }
+unsigned sglshm_chan_flags(const SpikeGLShm *s, unsigned i) { return i < s->nChans ? s->chanFlags[i] : 0; }
+unsigned sglshm_latest_page(const SpikeGLShm *s) { return u32At(s->base, OFS_LATEST); }
+unsigned sglshm_last_page_read(const SpikeGLShm *s) { return s->lastPageRead; }
+unsigned long long sglshm_scans_read(const SpikeGLShm *s) { return s->scanCt; }
+unsigned long long sglshm_scans_read_virtual(const SpikeGLShm *s) { return s->scanCtV; }
+
+static const char *pageHeader(const SpikeGLShm *s, int idx)
+{
+    return s->base + HEADER_BYTES + (unsigned long long)s->pageStride * (unsigned)idx;
+}
+
+/* clearing the buffer for a new acquisition renames its wakeup object, and stopping retracts the layout */
+static int restarted(const SpikeGLShm *s) { return u32At(s->base, OFS_WAKEID) != s->wakeId; }
+static int ended(const SpikeGLShm *s) { return restarted(s) || u32At(s->base + OFS_LAYOUT, L_MAGIC) != LAYOUT_MAGIC; }
+/* like PagedRingBuffer::writerMismatch(): the writer's pages aren't where the layout says */
+static int badWriter(const SpikeGLShm *s) { return u32At(s->base, OFS_LATEST) && u32At(s->base, OFS_WRITER_ABI) != WRITER_ABI; }
+
+void sglshm_seek_latest(SpikeGLShm *s)
+{
+    /* same as PagedRingBuffer::resetToLatest(): page number p (they start at 1) is at index (p-1) % nPages */
+    const unsigned p = sglshm_latest_page(s);
+    s->lastPageRead = p;
+    s->pageIdx = p ? (int)((p-1) % s->nPages) : -1;
+}
+
+int sglshm_next(SpikeGLShm *s, const short **scans, unsigned *nScans, int *nSkips, const void **meta)
+{
+    const int nxt = (s->pageIdx + 1) % (int)s->nPages;
+    const char *h = pageHeader(s, nxt);
+    unsigned magic, pageNum;
+    if (scans) *scans = 0;
+    if (nScans) *nScans = 0;
+    if (nSkips) *nSkips = 0;
+    if (meta) *meta = 0;
+    if (restarted(s)) return SGLSHM_ERR_ENDED;
+    if (badWriter(s)) return SGLSHM_ERR_WRITER;
+    magic = u32At(h, 0);
+    pageNum = u32At(h, 4);
+    /* pages written before SpikeGL stopped are still handed out */
+    if (magic != PAGE_MAGIC || pageNum < s->lastPageRead + 1U) return ended(s) ? SGLSHM_ERR_ENDED : 0;
+    barrier(); /* the writer stores the page header after the page */
+    if (nSkips) *nSkips = (int)(pageNum - (s->lastPageRead + 1U));
+    s->scanCtV += (unsigned long long)s->scansPerPage * (pageNum - s->lastPageRead);
+    s->scanCt += s->scansPerPage;
+    s->lastPageRead = pageNum;
+    s->pageIdx = nxt;
+    if (scans) *scans = (const short *)(h + PAGE_HEADER_BYTES);
+    if (nScans) *nScans = s->scansPerPage;
+    if (meta && s->metaSize) *meta = h + PAGE_HEADER_BYTES + (size_t)s->scansPerPage * s->scanSize * 2U;
+    return 1;
+}
+
+int sglshm_wait_next(SpikeGLShm *s, unsigned timeout_ms, const short **scans, unsigned *nScans, int *nSkips, const void **meta)
+{
+    const unsigned long long t0 = nowUs(), tmo = (unsigned long long)timeout_ms * 1000ULL;
+    int r;
+    while (!(r = sglshm_next(s, scans, nScans, nSkips, meta))) {
+        const unsigned long long el = nowUs() - t0;
+        if (el >= tmo) break;
+        sleepUs(tmo - el < s->pollUs ? (unsigned)(tmo - el) : s->pollUs);
+    }
+    return r;
+}
+
+int sglshm_still_valid(const SpikeGLShm *s)
+{
+    const char *h;
+    if (s->pageIdx < 0 || !s->lastPageRead) return 0;
+    barrier(); /* our reads of the page come before this check */
+    h = pageHeader(s, s->pageIdx);
+    return u32At(h, 0) == PAGE_MAGIC && u32At(h, 4) == s->lastPageRead && !ended(s) && !badWriter(s);
+}
@@ -0,0 +1,110 @@
+#ifndef SpikeGLShm_H
+#define SpikeGLShm_H
+
+/*
+   SpikeGLShm -- read SpikeGL's live sample buffer from another process.
+
+   While it acquires, SpikeGL keeps every scan in a ring of pages in a shared memory segment
+   (the "SpikeGL_SampleData" QSharedMemory, see PagedRingBuffer.h).  For framegrabber
+   acquisitions the segment always exists; for the others SpikeGL only puts its samples in
+   shared memory if it was started with the environment variable SPIKEGL_SHARED_SAMPLES=1.
+
+   This library attaches to the segment read-only, checks the versioned layout SpikeGL
+   describes it with (scan size, metadata size, page geometry, sample rate, channel layout),
+   and then hands out pages of scans the way PagedScanReader::next() does, as pointers
+   straight into the segment.  Being read-only, it never slows down or blocks SpikeGL: a
+   reader that falls behind by more than the ring loses pages, which sglshm_next() reports.
+
+   Plain C99 plus the OS's shared memory and clock calls; no Qt.  Build SpikeGLShm.c into your program
+   (or use SpikeGLShmClient.pro).  See SpikeGLShmReader.h for a C++ wrapper.
+
+   Typical use:
+
+       SpikeGLShm *s;
+       const short *scans; unsigned n; int skips, r;
+       if (sglshm_open(0, &s) != SGLSHM_OK) ...
+       while ((r = sglshm_wait_next(s, 100, &scans, &n, &skips, 0)) >= 0)
+           if (r) process(scans, n, sglshm_scan_size(s)); // n scans of sglshm_scan_size() samples each
+       sglshm_close(s); // r < 0: the acquisition ended, detach!
+
+   Detach promptly once a call returns SGLSHM_ERR_ENDED: SpikeGL refuses to start its next
+   acquisition while the old segment is still attached by somebody.
+
+   A handle must only be used by one thread at a time.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SpikeGLShm SpikeGLShm;
+
+/* return codes */
+#define SGLSHM_OK 0
+#define SGLSHM_ERR_NOT_FOUND (-1) /* no such segment: SpikeGL isn't acquiring, or isn't sharing its samples */
+#define SGLSHM_ERR_ATTACH (-2) /* the segment exists but could not be mapped (permissions?) */
+#define SGLSHM_ERR_NO_LAYOUT (-3) /* SpikeGL hasn't described the buffer yet: it is starting up, try again shortly */
+#define SGLSHM_ERR_VERSION (-4) /* the buffer is described in a layout version this library doesn't know */
+#define SGLSHM_ERR_BAD_LAYOUT (-5) /* the layout is inconsistent, or doesn't fit in the segment */
+#define SGLSHM_ERR_ENDED (-6) /* the acquisition stopped (or restarted): close the handle */
+#define SGLSHM_ERR_NOMEM (-7)
+#define SGLSHM_ERR_WRITER (-8) /* the program writing the buffer disagrees with SpikeGL about its layout, so its pages can't be found */
+
+/* the layout version this library reads.  Same as PAGED_RINGBUFFER_LAYOUT_VERSION in PagedRingBuffer.h. */
+#define SGLSHM_LAYOUT_VERSION 2
+
+/* sglshm_chan_flags() bits */
+#define SGLSHM_CHAN_AUX 0x1 /* not an electrode (photodiode, trigger, etc) */
+#define SGLSHM_CHAN_SAVED 0x2 /* in the channel subset that SpikeGL saves to its data file */
+
+/* The OS name of SpikeGL's sample segment, as QSharedMemory derives it from its key.  On Windows
+   this is the file mapping name, elsewhere the name of the key file in the temp dir ($TMPDIR or /tmp). */
+const char *sglshm_default_name(void);
+
+/* Attaches to the segment and validates its layout.  name is 0 for sglshm_default_name(), else a
+   file mapping name on Windows, or a key file name (relative to the temp dir) or path elsewhere.
+   On success *out is a new handle, positioned to read the next page SpikeGL writes. */
+int sglshm_open(const char *name, SpikeGLShm **out);
+void sglshm_close(SpikeGLShm *s);
+const char *sglshm_strerror(int err);
+
+/* the layout, as validated by sglshm_open() */
+unsigned sglshm_scan_size(const SpikeGLShm *s); /* samples per scan */
+unsigned sglshm_scans_per_page(const SpikeGLShm *s); /* scans per sglshm_next() */
+unsigned sglshm_meta_size(const SpikeGLShm *s); /* bytes of metadata per page, may be 0 */
+unsigned sglshm_page_count(const SpikeGLShm *s); /* capacity of the ring, in pages */
+double sglshm_srate(const SpikeGLShm *s); /* scans per second */
+/* Channel i's id (its electrode id, for mapped channels) and SGLSHM_CHAN_* flags, for i < sglshm_chan_count().
+   The channel count is the scan size, unless that's more than the layout has room for. */
+unsigned sglshm_chan_count(const SpikeGLShm *s);
+unsigned sglshm_chan_id(const SpikeGLShm *s, unsigned i);
+unsigned sglshm_chan_flags(const SpikeGLShm *s, unsigned i);
+
+/* Returns 1 and points *scans at the next page's *nScans scans if it has been written, or returns 0 if it hasn't
+   yet.  *nSkips gets the number of pages lost since the last page returned, because this reader fell behind.
+   *meta gets the page's metadata (sglshm_meta_size() bytes, after the scans), or 0.  Any of the out pointers may
+   be 0.  Returns SGLSHM_ERR_ENDED once SpikeGL is done with the buffer, SGLSHM_ERR_WRITER if the pages are being
+   written by a program built for another layout.
+   The page stays valid until SpikeGL wraps around to it again, which sglshm_still_valid() can check. */
+int sglshm_next(SpikeGLShm *s, const short **scans, unsigned *nScans, int *nSkips, const void **meta);
+/* Like sglshm_next(), but waits up to timeout_ms for the page.  Being read-only this can't ask SpikeGL
+   for a wakeup the way PagedScanReader::waitNext() does, so it polls, a few times per page's worth of time. */
+int sglshm_wait_next(SpikeGLShm *s, unsigned timeout_ms, const short **scans, unsigned *nScans, int *nSkips, const void **meta);
+/* 1 if the last page returned by sglshm_next() hasn't been overwritten since, else 0.  Call this after
+   copying out of the page, to know that what was copied is intact. */
+int sglshm_still_valid(const SpikeGLShm *s);
+/* Skips to the latest page written: the next page returned is the one SpikeGL writes after it. */
+void sglshm_seek_latest(SpikeGLShm *s);
+
+/* the number of the latest page SpikeGL wrote, and the last one this reader got.  The difference is how far behind it is. */
+unsigned sglshm_latest_page(const SpikeGLShm *s);
+unsigned sglshm_last_page_read(const SpikeGLShm *s);
+unsigned long long sglshm_scans_read(const SpikeGLShm *s);
+/* includes the scans on pages that were skipped */
+unsigned long long sglshm_scans_read_virtual(const SpikeGLShm *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,15 @@
+######################################################################
+# SpikeGLShm: standalone client library for SpikeGL's shared sample buffer.
+# No Qt needed at runtime; qmake is only used to build it.  Or just compile
+# SpikeGLShm.c into your own program.
+######################################################################
+
+TEMPLATE = lib
+TARGET = SpikeGLShm
+CONFIG += staticlib warn_on
+CONFIG -= qt
+INCLUDEPATH += .
+
+# Input
+HEADERS += SpikeGLShm.h SpikeGLShmReader.h
+SOURCES += SpikeGLShm.c
@@ -0,0 +1,67 @@
+#ifndef SpikeGLShmReader_H
+#define SpikeGLShmReader_H
+
+#include "SpikeGLShm.h"
+
+/** C++ wrapper for SpikeGLShm.h, shaped like PagedScanReader: next() returns a page of scans, or NULL if there
+    isn't a new one yet.  Once ended() (SpikeGL stopped or restarted its acquisition), destroy the reader or close()
+    it, and open() again for the next acquisition.  Header-only; link with SpikeGLShm.c. */
+class SpikeGLShmReader
+{
+public:
+    SpikeGLShmReader() : s(0), err(SGLSHM_ERR_NOT_FOUND) {}
+    /// name is as for sglshm_open(): 0 for SpikeGL's sample buffer
+    explicit SpikeGLShmReader(const char *name) : s(0), err(SGLSHM_ERR_NOT_FOUND) { open(name); }
+    ~SpikeGLShmReader() { close(); }
+
+    bool open(const char *name = 0) { close(); err = sglshm_open(name, &s); return s != 0; }
+    void close() { if (s) sglshm_close(s); s = 0; }
+    bool isOpen() const { return s != 0; }
+    /// the last error, an SGLSHM_ERR_* code
+    int error() const { return err; }
+    const char *errorString() const { return sglshm_strerror(err); }
+    bool ended() const { return err == SGLSHM_ERR_ENDED; }
+
+    unsigned scanSizeSamps() const { return sglshm_scan_size(s); }
+    unsigned scansPerPage() const { return sglshm_scans_per_page(s); }
+    unsigned metaDataSizeBytes() const { return sglshm_meta_size(s); }
+    unsigned nPages() const { return sglshm_page_count(s); }
+    double srate() const { return sglshm_srate(s); }
+    unsigned nChans() const { return sglshm_chan_count(s); }
+    unsigned chanId(unsigned i) const { return sglshm_chan_id(s, i); }
+    bool isAuxChan(unsigned i) const { return (sglshm_chan_flags(s, i) & SGLSHM_CHAN_AUX) != 0; }
+    bool isSavedChan(unsigned i) const { return (sglshm_chan_flags(s, i) & SGLSHM_CHAN_SAVED) != 0; }
+
+    const short *next(int *nSkips, const void **metaPtr = 0, unsigned *scans_returned = 0) {
+        const short *ret = 0;
+        if (!s) return 0;
+        const int r = sglshm_next(s, &ret, scans_returned, nSkips, metaPtr);
+        if (r < 0) err = r;
+        return ret;
+    }
+    /// Same as next(), but waits up to timeout_ms for the next page.
+    const short *waitNext(unsigned timeout_ms, int *nSkips, const void **metaPtr = 0, unsigned *scans_returned = 0) {
+        const short *ret = 0;
+        if (!s) return 0;
+        const int r = sglshm_wait_next(s, timeout_ms, &ret, scans_returned, nSkips, metaPtr);
+        if (r < 0) err = r;
+        return ret;
+    }
+    /// true if the last page next() returned hasn't been overwritten since
+    bool stillValid() const { return s && sglshm_still_valid(s); }
+    void resetToLatest() { if (s) sglshm_seek_latest(s); }
+
+    unsigned latest() const { return s ? sglshm_latest_page(s) : 0; }
+    unsigned latestPageRead() const { return s ? sglshm_last_page_read(s) : 0; }
+    unsigned long long scansRead() const { return s ? sglshm_scans_read(s) : 0; }
+    unsigned long long scansReadVirtual() const { return s ? sglshm_scans_read_virtual(s) : 0; }
+
+private:
+    SpikeGLShmReader(const SpikeGLShmReader &);
+    SpikeGLShmReader & operator=(const SpikeGLShmReader &);
+
+    SpikeGLShm *s;
+    int err;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SlidingMinMax_H
+#define SlidingMinMax_H
+
+#include <vector>
+
+/** Per channel, the min and max of the values pushed in a sliding window of time.
+
+    Each channel keeps 2 monotonic queues: one of values that could still become the window's
+    minimum (increasing from front to back), and likewise for the maximum.  push() drops from
+    the back the values the new one makes irrelevant, and from the front the ones that left the
+    window, so the min and max are always at the front.  Each value is added and dropped once,
+    so a push() is O(1) amortized no matter how long the window is.
+
+    The queues are rings that only ever grow, so once they're big enough for the window there
+    is no allocation either.  Not thread safe. */
+class SlidingMinMax
+{
+public:
+    SlidingMinMax() {}
+
+    /// clears everything and sets the number of channels
+    void reset(unsigned nChans) { mins.assign(nChans, Queue()); maxs.assign(nChans, Queue()); }
+    unsigned numChans() const { return unsigned(mins.size()); }
+
+    /// Adds channel ch's min and max over some span of data that starts at time t, then forgets what was added
+    /// more than window before t.  If t went backwards (a new acquisition?), everything before is forgotten.
+    void push(unsigned ch, double t, short vmin, short vmax, double window) {
+        mins[ch].push(t, vmin, window, false);
+        maxs[ch].push(t, vmax, window, true);
+    }
+
+    /// channel ch's min and max over its window.  Only valid after at least 1 push() to the channel.
+    short min(unsigned ch) const { return mins[ch].front(); }
+    short max(unsigned ch) const { return maxs[ch].front(); }
+    bool isEmpty(unsigned ch) const { return !mins[ch].n; }
+
+private:
+    struct Entry { double t; short v; };
+
+    struct Queue {
+        std::vector<Entry> buf; ///< a ring, size is a power of 2
+        unsigned head, n;
+        Queue() : head(0), n(0) {}
+
+        Entry & at(unsigned i) { return buf[(head + i) & unsigned(buf.size()-1)]; }
+        short front() const { return buf[head].v; }
+
+        void push(double t, short v, double window, bool keepMax) {
+            if (n && t < at(n-1).t) n = 0;
+            // pop the values that v makes irrelevant: they're older, and no lower (or no higher for the max)
+            while (n && (keepMax ? at(n-1).v <= v : at(n-1).v >= v)) --n;
+            if (n == buf.size()) grow();
+            Entry & e (at(n++));
+            e.t = t, e.v = v;
+            // and expire the ones that fell out of the window.  the new one never does.
+            while (n > 1 && t - at(0).t > window) head = (head + 1) & unsigned(buf.size()-1), --n;
+        }
+
+        void grow() {
+            std::vector<Entry> nb(buf.empty() ? 16 : buf.size()*2);
+            for (unsigned i = 0; i < n; ++i) nb[i] = at(i);
+            buf.swap(nb);
+            head = 0;
+        }
+    };
+
+    std::vector<Queue> mins, maxs;
+};
+
+#endif
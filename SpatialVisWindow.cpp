@@ -288,40 +288,24 @@ void SpatialVisWindow::putScans(const int16 *scans, unsigned scans_size_samps, u
 
     const int downSampleSkips = downsampleRatio > 1.0 ? qRound(downsampleRatio)-1 : 0;//params.srate >= 1000.0 ? qRound(params.srate/1000.0)-1 : 0;
 
-    ChanMinMaxs cmm; cmm.resize(params.nVAIChans);
+    const int nChans = params.nVAIChans;
     const bool doAutoScale = autoScaleColorRange;
 
     if (doAutoScale) {
         // bookkeeping -- keep track of min/max values seen, per channel for a window of time to determine scale..
-        double  now = double(u64(firstSamp/params.nVAIChans))/params.srate,
-                maxAge = 0;
-        for (int i = 0; i < graphTimes.size(); ++i) {
-            if (graphTimes[i] > maxAge) maxAge = graphTimes[i];
+        const double now = double(u64(firstSamp/nChans))/params.srate;
+        if (int(chanWindowMinMax.numChans()) != nChans) chanWindowMinMax.reset(nChans);
+        // the min/max of every Nth scan of this page...
+        const unsigned step = unsigned(downSampleSkips+1), nScans = scans_size_samps/unsigned(nChans), n = (nScans+step-1)/step;
+        if (n) {
+            pageMinMax.reset(nChans, n);
+            pageMinMaxTmp.resize(2*nChans);
+            pageMinMax.apply(scans, n, nChans*step, &pageMinMaxTmp[0]);
+            // ...goes into each channel's sliding window, which is as long as its graph's
+            for (int ch = 0; ch < nChans; ++ch)
+                chanWindowMinMax.push(ch, now, pageMinMaxTmp[ch], pageMinMaxTmp[nChans+ch], ch < graphTimes.size() ? graphTimes[ch] : 0.);
         }
-        // expire old chunk min/max's
-        while (!chunkChanMinMaxs.empty() && (now-chunkChanMinMaxs.begin().key()) > maxAge)
-            chunkChanMinMaxs.erase(chunkChanMinMaxs.begin());
-
-        // now scan entire data chunk to update chanMinMax state...
-        for (int i = 0, ch = 0; i < (int)scans_size_samps; /*nothing. i is incremented last line of loop below..*/) {
-            if (scans[i] <= cmm[ch].smin) cmm[ch].smin = scans[i];
-            if (scans[i] >= cmm[ch].smax) cmm[ch].smax = scans[i];
-            if ((ch=(++i % params.nVAIChans))==0)
-                i += params.nVAIChans*downSampleSkips;  // every Nth scan..
-        }
-        chunkChanMinMaxs[now] = cmm;
-
-        // now, get an up-to-date min/max state per channel based on each channel's window size... by looking at all recent chunks
-        for (ChunkChanMinMaxs::iterator it = chunkChanMinMaxs.begin(); it != chunkChanMinMaxs.end() && it.key() < now; ++it) {
-            for (int i = 0; i < nvai; ++i) {
-                if (now-it.key() <= graphTimes[i]) {
-                    const ChanMinMax & v(it.value()[i]);
-                    if (cmm[i].smin > v.smin) cmm[i].smin = v.smin;
-                    if (cmm[i].smax < v.smax) cmm[i].smax = v.smax;
-                }
-            }
-        }
-       // Debug() << " auto-scaling code took: " << (getTime()-t0)*1e3 << " ms, chunksize:"  << (scans_size_samps/nvai) << " scans" <<  " maxage=" << maxAge << " n_chunks_remembered:" << chunkChanMinMaxs.size() << " now=" << now;
+       // Debug() << " auto-scaling code took: " << (getTime()-t0)*1e3 << " ms, chunksize:"  << (scans_size_samps/nvai) << " scans";
     }
 
     //int firstidx = scans_size_samps - nvai;
@@ -339,15 +323,16 @@ void SpatialVisWindow::putScans(const int16 *scans, unsigned scans_size_samps, u
 
         val = ((sampval=double(scans[i]))+32768.) / 65535.;
 
-        if (doAutoScale) {
+        if (doAutoScale && ch < int(chanWindowMinMax.numChans()) && !chanWindowMinMax.isEmpty(ch)) {
             //double oldval = val;
-            if (cmm[ch].smax>cmm[ch].smin) {
-                val = (sampval-double(cmm[ch].smin)) / (double(cmm[ch].smax) - double(cmm[ch].smin));
+            const int16 smin = chanWindowMinMax.min(ch), smax = chanWindowMinMax.max(ch);
+            if (smax>smin) {
+                val = (sampval-double(smin)) / (double(smax) - double(smin));
                 if (val < 0.) val = 0.;
                 else if (val > 1.) val = 1.;
             }
 /*           if (excessiveDebug) {
-                Debug() << "Channel:" << ch << " sorting:" << chanId << " unscaled_val:" << oldval << " scaled_val:" << val << " sampval: " << sampval << " min:" << cmm[ch].smin << " max: " << cmm[ch].smax << " secs:" << graphTimes[ch];
+                Debug() << "Channel:" << ch << " sorting:" << chanId << " unscaled_val:" << oldval << " scaled_val:" << val << " sampval: " << sampval << " min:" << smin << " max: " << smax << " secs:" << graphTimes[ch];
             }
  */
         }
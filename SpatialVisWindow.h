@@ -6,6 +6,8 @@
 #include "GLSpatialVis.h"
 #include "TypeDefs.h"
 #include "VecWrapBuffer.h"
+#include "SlidingMinMax.h"
+#include "MinMaxDecimator.h"
 #include <QVector>
 #include <QMap>
 #include <vector>
@@ -145,13 +147,9 @@ private:
 
     volatile bool autoScaleColorRange;
     QVector<double> graphTimes;
-    struct ChanMinMax {
-        int16 smin, smax;
-        ChanMinMax() : smin(32767), smax(-32768) {}
-    };
-    typedef QVector<ChanMinMax> ChanMinMaxs;
-    typedef QMap<double, ChanMinMaxs> ChunkChanMinMaxs;
-    ChunkChanMinMaxs chunkChanMinMaxs;
+    SlidingMinMax chanWindowMinMax; ///< per channel: min/max over the last graphTimes[ch] seconds, for auto-scaling
+    MinMaxDecimator pageMinMax; ///< computes each page's per channel min/max
+    std::vector<int16> pageMinMaxTmp;
     volatile double downsampleRatio;
 
     QMutex mut;    
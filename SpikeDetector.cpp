@@ -0,0 +1,214 @@
+#include "SpikeDetector.h"
+#include "SIMD.h"
+#include <string.h>
+
+static const float noiseStepRel = 1.f/1024.f, noiseStepAbs = 1.f/32.f; ///< how much medAbs moves per update: a fraction of itself, plus a bit so it can leave 0
+static const unsigned settleScans = 32; ///< after a gap, scans to let the high-pass filter settle before detecting again
+
+SpikeDetector::SpikeDetector()
+    : hpf(0, 300.), ss(0), stride(0), rate(1.), nSigmas(4.5), pre(0), post(1), refr(0), warmup(0), tail(1),
+      noiseDecim(1), noisePhase(0), nextScan(0), holdoffUntil(0), lost(0), noiseInit(false)
+{
+}
+
+void SpikeDetector::reset(unsigned scanSize, double sr, double thresholdSigmas, double hpfCutoffHz,
+                          unsigned snippetPre, unsigned snippetPost, unsigned refractory)
+{
+    ss = scanSize;
+    stride = (ss + 7U) & ~7U;
+    rate = sr > 0. ? sr : 1.;
+    nSigmas = thresholdSigmas > 0. ? thresholdSigmas : 4.5;
+    pre = snippetPre;
+    post = snippetPost ? snippetPost : 1;
+    refr = refractory > 32767 ? 32767 : refractory;
+    tail = pre + post;
+    warmup = unsigned(rate/4.); // 250 ms
+    if (warmup < tail + settleScans) warmup = tail + settleScans;
+    noiseDecim = unsigned(rate/5000.); // the noise estimate only needs ~5 kHz worth of updates
+    if (!noiseDecim) noiseDecim = 1;
+    noisePhase = 0;
+    nextScan = holdoffUntil = lost = 0;
+    noiseInit = false;
+
+    // the padding channels up to stride are filtered and compared too, but stay 0 and are masked off
+    hpf.setScanSize(stride);
+    hpf.setCutoffFreqHz(hpfCutoffHz);
+    buf.assign(size_t(tail)*stride, 0);
+    medAbs.assign(stride, 0.f);
+    negThr.assign(stride, -32768);
+    dead.assign(stride, 0);
+    over.assign(stride, 0);
+    mask.assign(stride, 0);
+    for (unsigned i = 0; i < ss; ++i) mask[i] = -1;
+    pending.clear(); done.clear(); snips.clear();
+}
+
+void SpikeDetector::setChannelMask(const std::vector<bool> & chans)
+{
+    if (chans.size() < ss) return;
+    for (unsigned i = 0; i < ss; ++i) mask[i] = chans[i] ? -1 : 0;
+}
+
+unsigned SpikeDetector::apply(const short *scans, unsigned nScans, unsigned inStride, unsigned long long firstScan)
+{
+    return run(scans, nScans, inStride, firstScan, false);
+}
+
+unsigned SpikeDetector::applyScalar(const short *scans, unsigned nScans, unsigned inStride, unsigned long long firstScan)
+{
+    return run(scans, nScans, inStride, firstScan, true);
+}
+
+unsigned SpikeDetector::run(const short *scans, unsigned nScans, unsigned inStride, unsigned long long firstScan, bool scalar)
+{
+    done.clear();
+    snips.clear();
+    if (!ss || inStride < ss || !nScans) return 0; // error!
+    if (!noiseInit) {
+        holdoffUntil = firstScan + warmup;
+    } else if (firstScan != nextScan) {
+        // gap in the stream: what is in buf (and the filter state) doesn't lead up to these scans
+        lost += pending.size();
+        pending.clear();
+        if (holdoffUntil < firstScan + tail + settleScans) holdoffUntil = firstScan + tail + settleScans;
+    }
+
+    // buf is [the last `tail' scans][this block], so that snippets can reach back before the block
+    const size_t need = size_t(tail + nScans)*stride;
+    if (buf.size() < need) buf.resize(need, 0);
+    short *blk = &buf[size_t(tail)*stride];
+    for (unsigned i = 0; i < nScans; ++i)
+        memcpy(blk + size_t(i)*stride, scans + size_t(i)*inStride, ss*sizeof(short));
+    if (scalar) hpf.applyBlockScalar(blk, nScans, stride, 1./rate);
+    else hpf.applyBlock(blk, nScans, stride, 1./rate);
+
+    if (!noiseInit) { initNoise(tail, nScans); noiseInit = true; }
+    updateThresholds();
+#ifdef SIMD_X86
+    if (!scalar && SIMD::level() >= SIMD::SSE2) detectSSE2(tail, nScans, firstScan);
+    else
+#endif
+        detectScalar(tail, nScans, firstScan);
+    nextScan = firstScan + nScans;
+    finishSnippets(firstScan, nextScan);
+    memmove(&buf[0], &buf[size_t(nScans)*stride], size_t(tail)*stride*sizeof(short));
+    return unsigned(done.size());
+}
+
+/// starting point for the noise estimate: the median of |x| for gaussian noise is about 0.845 times the mean of |x|
+void SpikeDetector::initNoise(unsigned from, unsigned n)
+{
+    unsigned skip = n/2 < settleScans ? n/2 : settleScans; // the filter's start up transient
+    from += skip; n -= skip;
+    std::vector<double> sum(ss, 0.);
+    for (unsigned s = 0; s < n; ++s) {
+        const short *row = &buf[size_t(from + s)*stride];
+        for (unsigned c = 0; c < ss; ++c) sum[c] += row[c] < 0 ? -double(row[c]) : double(row[c]);
+    }
+    for (unsigned c = 0; c < ss; ++c) medAbs[c] = n ? float(0.845*sum[c]/n) : 0.f;
+}
+
+void SpikeDetector::updateThresholds()
+{
+    const float k = float(nSigmas/0.6745);
+    for (unsigned c = 0; c < ss; ++c) {
+        float t = k*medAbs[c] + 0.5f;
+        if (t < 1.f) t = 1.f;
+        if (t > 32767.f) t = 32767.f;
+        negThr[c] = short(-int(t));
+    }
+}
+
+void SpikeDetector::noiseScalar(const short *row)
+{
+    for (unsigned c = 0; c < stride; ++c) {
+        const float a = row[c] < 0 ? -float(row[c]) : float(row[c]), m = medAbs[c];
+        const float step = m*noiseStepRel + noiseStepAbs;
+        medAbs[c] = m + (a > m ? step : -step);
+    }
+}
+
+void SpikeDetector::detectScalar(unsigned from, unsigned n, unsigned long long firstScan)
+{
+    for (unsigned s = 0; s < n; ++s) {
+        const short *row = &buf[size_t(from + s)*stride];
+        const unsigned long long scan = firstScan + s;
+        if (++noisePhase >= noiseDecim) { noisePhase = 0; noiseScalar(row); }
+        const bool armed = scan >= holdoffUntil;
+        for (unsigned c = 0; c < stride; ++c) {
+            const short o = row[c] < negThr[c] ? -1 : 0;
+            const bool ev = armed && o && !over[c] && !dead[c] && mask[c];
+            over[c] = o;
+            dead[c] = ev ? short(refr) : (dead[c] ? short(dead[c] - 1) : short(0));
+            if (ev) { const Spike sp = { scan, c }; pending.push_back(sp); }
+        }
+    }
+}
+
+#ifdef SIMD_X86
+void SpikeDetector::noiseSSE2(const short *row)
+{
+    const __m128 rel = _mm_set1_ps(noiseStepRel), abs_ = _mm_set1_ps(noiseStepAbs);
+    const __m128 sign = _mm_set1_ps(-0.f);
+    for (unsigned c = 0; c < stride; c += 8) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + c));
+        // sign extend to 32 bits, to float, then |x|
+        const __m128 a0 = _mm_andnot_ps(sign, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)));
+        const __m128 a1 = _mm_andnot_ps(sign, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)));
+        const __m128 m0 = _mm_loadu_ps(&medAbs[c]), m1 = _mm_loadu_ps(&medAbs[c+4]);
+        const __m128 s0 = _mm_add_ps(_mm_mul_ps(m0, rel), abs_), s1 = _mm_add_ps(_mm_mul_ps(m1, rel), abs_);
+        const __m128 g0 = _mm_cmpgt_ps(a0, m0), g1 = _mm_cmpgt_ps(a1, m1);
+        // m + (a > m ? step : -step)
+        _mm_storeu_ps(&medAbs[c], _mm_add_ps(m0, _mm_or_ps(_mm_and_ps(g0, s0), _mm_andnot_ps(g0, _mm_xor_ps(s0, sign)))));
+        _mm_storeu_ps(&medAbs[c+4], _mm_add_ps(m1, _mm_or_ps(_mm_and_ps(g1, s1), _mm_andnot_ps(g1, _mm_xor_ps(s1, sign)))));
+    }
+}
+
+void SpikeDetector::detectSSE2(unsigned from, unsigned n, unsigned long long firstScan)
+{
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1), refrv = _mm_set1_epi16(short(refr));
+    for (unsigned s = 0; s < n; ++s) {
+        const short *row = &buf[size_t(from + s)*stride];
+        const unsigned long long scan = firstScan + s;
+        if (++noisePhase >= noiseDecim) { noisePhase = 0; noiseSSE2(row); }
+        const __m128i armed = scan >= holdoffUntil ? _mm_set1_epi16(-1) : zero;
+        for (unsigned c = 0; c < stride; c += 8) {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + c));
+            __m128i * const op = reinterpret_cast<__m128i *>(&over[c]), * const dp = reinterpret_cast<__m128i *>(&dead[c]);
+            const __m128i o = _mm_cmplt_epi16(x, _mm_loadu_si128(reinterpret_cast<const __m128i *>(&negThr[c])));
+            const __m128i d = _mm_loadu_si128(dp);
+            // fires: below threshold now but not on the previous scan, not refractory, and enabled
+            __m128i ev = _mm_andnot_si128(_mm_loadu_si128(op), o);
+            ev = _mm_and_si128(ev, _mm_and_si128(_mm_cmpeq_epi16(d, zero), armed));
+            ev = _mm_and_si128(ev, _mm_loadu_si128(reinterpret_cast<const __m128i *>(&mask[c])));
+            _mm_storeu_si128(op, o);
+            _mm_storeu_si128(dp, _mm_or_si128(_mm_andnot_si128(ev, _mm_subs_epu16(d, one)), _mm_and_si128(ev, refrv)));
+            int bits = _mm_movemask_epi8(ev);
+            for (unsigned j = c; bits; ++j, bits >>= 2)
+                if (bits & 1) { const Spike sp = { scan, j }; pending.push_back(sp); }
+        }
+    }
+}
+#else
+void SpikeDetector::noiseSSE2(const short *row) { noiseScalar(row); }
+void SpikeDetector::detectSSE2(unsigned from, unsigned n, unsigned long long firstScan) { detectScalar(from, n, firstScan); }
+#endif
+
+/// buf holds the filtered scans [blockStart - tail, blockEnd).  Moves the pending spikes whose snippets are all in there to done.
+void SpikeDetector::finishSnippets(unsigned long long blockStart, unsigned long long blockEnd)
+{
+    const unsigned len = pre + post;
+    size_t k = 0;
+    for (size_t i = 0; i < pending.size(); ++i) {
+        const Spike & sp (pending[i]);
+        if (sp.scan + post > blockEnd) { pending[k++] = sp; continue; } // needs scans from the next block
+        if (sp.scan + post < blockStart) { ++lost; continue; } // can't happen thanks to holdoffUntil, but just in case
+        // the snippet's first scan, sp.scan - pre, is buf's row sp.scan - pre - (blockStart - tail)
+        const short *src = &buf[size_t(sp.scan + post - blockStart)*stride + sp.chan];
+        const size_t o = snips.size();
+        snips.resize(o + len);
+        for (unsigned j = 0; j < len; ++j) snips[o + j] = src[size_t(j)*stride];
+        done.push_back(sp);
+    }
+    pending.resize(k);
+}
@@ -0,0 +1,111 @@
+#ifndef SpikeDetector_H
+#define SpikeDetector_H
+
+#include <vector>
+#include "HPFilter.h"
+
+/** Online threshold spike detector, for a stream of scans such as the pages of the sample buffer.
+
+    Each block of scans is high-pass filtered (HPFilter), then each channel's filtered signal is
+    compared against -thresholdSigmas() times its noise level.  A spike is a downward crossing of
+    the threshold; once a channel fires it can't fire again for refractory() scans.  For each spike
+    a snippet of the filtered signal is kept: snippetPre() scans before the crossing and
+    snippetPost() from it.
+
+    The noise level is a running MAD-style estimate: each channel tracks the median of its |filtered
+    signal| by nudging it up or down a little on each (decimated) scan, and sigma = median/0.6745.
+    The first warmupScans() scans, and a few after each gap in the stream, are only used to settle
+    the filter and the noise estimate.
+
+    Snippets that need scans from the next block are completed by a later apply().  A gap in the
+    stream (the scan numbers passed to apply() not following on, e.g. after pages were dropped)
+    discards those.
+
+    The channels are processed 8 at a time (SSE2), see SIMD.h. */
+class SpikeDetector
+{
+public:
+    struct Spike {
+        unsigned long long scan; ///< scan number of the threshold crossing
+        unsigned chan;
+    };
+
+    SpikeDetector();
+
+    /// Sets everything up for scans of scanSize samples and discards all state.  Times are in scans.
+    void reset(unsigned scanSize, double srate, double thresholdSigmas = 4.5, double hpfCutoffHz = 300.,
+               unsigned snippetPre = 10, unsigned snippetPost = 22, unsigned refractory = 25);
+    /// Which channels to detect spikes on (chans[i] == true -> detect).  The default is all channels.
+    void setChannelMask(const std::vector<bool> & chans);
+
+    unsigned scanSize() const { return ss; }
+    double srate() const { return rate; }
+    double thresholdSigmas() const { return nSigmas; }
+    unsigned snippetPre() const { return pre; }
+    unsigned snippetPost() const { return post; }
+    unsigned snippetLength() const { return pre + post; }
+    unsigned refractory() const { return refr; }
+    unsigned warmupScans() const { return warmup; }
+    /// the current noise estimate (sigma) of channel chan, in ADC counts
+    float noise(unsigned chan) const { return chan < ss ? medAbs[chan] / 0.6745f : 0.f; }
+    /// spikes discarded because a gap in the stream cut their snippet short
+    unsigned long long nLost() const { return lost; }
+
+    /// Feeds nScans consecutive scans, the first of which is scan number firstScan of the stream.  Scan i starts
+    /// at scans + i*stride, and stride must be >= scanSize().  Returns the number of spikes whose snippets were
+    /// completed, which are then in spikes() and snippets().
+    unsigned apply(const short *scans, unsigned nScans, unsigned stride, unsigned long long firstScan);
+    /// Same as apply() but never uses the SIMD kernels.  Gives the same results; here for benchmarking.
+    unsigned applyScalar(const short *scans, unsigned nScans, unsigned stride, unsigned long long firstScan);
+
+    /// the spikes completed by the last apply(), in order of scan
+    const std::vector<Spike> & spikes() const { return done; }
+    /// their snippets, snippetLength() samples each: spike i's is at &snippets()[i*snippetLength()]
+    const std::vector<short> & snippets() const { return snips; }
+
+private:
+    unsigned run(const short *scans, unsigned nScans, unsigned stride, unsigned long long firstScan, bool scalar);
+    void initNoise(unsigned from, unsigned n);
+    void updateThresholds();
+    void detectScalar(unsigned from, unsigned n, unsigned long long firstScan);
+    void detectSSE2(unsigned from, unsigned n, unsigned long long firstScan);
+    void noiseScalar(const short *row);
+    void noiseSSE2(const short *row);
+    void finishSnippets(unsigned long long blockStart, unsigned long long blockEnd);
+
+    HPFilter hpf;
+    unsigned ss, stride; ///< stride is ss rounded up to a multiple of 8
+    double rate, nSigmas;
+    unsigned pre, post, refr, warmup, tail;
+    unsigned noiseDecim, noisePhase;
+    unsigned long long nextScan, holdoffUntil, lost;
+    bool noiseInit;
+
+    std::vector<short> buf; ///< the last `tail' filtered scans, then the current block, stride samples each
+    std::vector<float> medAbs; ///< per channel: running median of |filtered signal|
+    std::vector<short> negThr, dead, over, mask; ///< per channel: -threshold, refractory countdown, was below threshold, detect (-1) or not (0)
+    std::vector<Spike> pending, done;
+    std::vector<short> snips;
+};
+
+/** The sidecar file SpikeGL writes the detected spikes to: this header, then for each spike its
+    scan number (8 bytes), channel (4 bytes) and snippet (snippetPre + snippetPost shorts of the
+    high-pass filtered signal, in ADC counts).  Little endian, no padding.
+
+    There is one of these per acquisition, and its scan numbers count from the start of the
+    acquisition, while a .bin file can start later (triggered, timed and PD modes) and there may be
+    several.  Each .bin's meta file has acqFirstScan, the acquisition scan number of its first scan,
+    and spikeFile, this file's name: spike scan - acqFirstScan is the scan in that .bin. */
+struct SpikeFileHeader {
+    char magic[8]; ///< "SGLSPIKE"
+    unsigned version; ///< 1
+    unsigned nChans;
+    double srate;
+    unsigned snippetPre, snippetPost;
+    float thresholdSigmas;
+    float hpfCutoffHz;
+};
+
+#define SPIKE_FILE_VERSION 1
+
+#endif
@@ -30,6 +30,10 @@
 #define MAX_NUM_GRAPHS_PER_GRAPH_TAB 64
 #define DEFAULT_NUM_GRAPHS_PER_GRAPH_TAB 36
 #define SAMPLE_BUF_Q_SIZE 128
+#define DF_ASYNCH_BLOCK_SIZE (4*1024*1024) /* 4MB blocks handed to the DataFile writer thread -- must be a multiple of DF_DIRECT_IO_ALIGN */
+#define DF_ASYNCH_QUEUE_SIZE 16 /* number of blocks in the DataFile writer thread's pool, 64MB total */
+#define DF_DIRECT_IO_ALIGN 4096 /* buffer/offset/length alignment required for unbuffered (O_DIRECT) writes */
+#define DF_COMPRESS_CHUNK_BYTES (2*1024*1024) /* uncompressed size of each independently compressed chunk of a compressed DataFile */
 
 #define SAMPLES_SHM_NAME "SpikeGL_SampleData"
 #ifdef WIN64
@@ -40,6 +44,12 @@
 #define DEF_SAMPLES_SHM_SIZE_REG (1024*1024*384) /* 384 MB samples shm/buffer size */
 #endif
 #define SAMPLES_SHM_DESIRED_PAGETIME_MS (33) /* 33 ms  */
+#if defined(WIN64) || defined(_WIN64) || defined(__LP64__)
+#define DF_MAP_WINDOW_SIZE (1024ULL*1024ULL*1024ULL) /* 1GB window onto a memory-mapped DataFile being read */
+#else
+#define DF_MAP_WINDOW_SIZE (1024*1024*64) /* 64 MB window: keep it small, 32-bit processes are short on address space */
+#endif
+#define DF_MAP_ALIGN 65536 /* map offsets are rounded down to this -- the Windows allocation granularity, and a multiple of every page size */
 
 extern bool excessiveDebug; ///< If true, print lots of debug output.. mainly daq related.. enable in console with control-D
 #endif
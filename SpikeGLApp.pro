@@ -22,6 +22,7 @@ HEADERS += SpikeGL.h DataFile.h Params.h sha1.h Util.h TypeDefs.h \
            FG_ConfigDialog.h \
            FrameGrabber/FG_SpikeGL/FG_SpikeGL/XtCmd.h \
            PagedRingBuffer.h stdafx.h \
+           SIMD.h ScanGather.h Bug3Protocol.h EnvelopeIndex.h DataExporter.h PointRing.h GLGraphCanvas.h MinMaxDecimator.h SlidingMinMax.h IntanDemux.h SpikeDetector.h SampleCodec.h Sha1Tree.h \
     Thread_Compat.h \
     GenericGrapher.h
 
@@ -36,7 +37,17 @@ SOURCES += DataFile.cpp osdep.cpp Params.cpp sha1.cpp Util.cpp \
            SpatialVisWindow.cpp \
            Bug_ConfigDialog.cpp Bug_Popout.cpp \
            FG_ConfigDialog.cpp \
-           PagedRingBuffer.cpp
+           PagedRingBuffer.cpp \
+           ScanGather.cpp \
+           Bug3Protocol.cpp \
+           EnvelopeIndex.cpp \
+           DataExporter.cpp \
+           GLGraphCanvas.cpp \
+           MinMaxDecimator.cpp \
+           IntanDemux.cpp \
+           SpikeDetector.cpp \
+           SampleCodec.cpp \
+           Sha1Tree.cpp
 
 
 FORMS += ConfigureDialog.ui AcqPDParams.ui AcqTimedParams.ui Par2Window.ui \
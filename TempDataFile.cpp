@@ -3,15 +3,51 @@
 #include "SpikeGL.h"
 #include "MainApp.h"
 #include "ConfigureDialogController.h"
+#include "ScanGather.h"
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
+/* scanCount and scanCountEnd are 64 bits, which a 32-bit build can't load or store with 1
+   instruction.  Going through cmpxchg8b means a reader never sees half of an update, and gives
+   the full barrier the writer needs between publishing a counter and touching the ring anyway. */
+static inline i64 loadCount(const volatile i64 *p)
+{
+#ifdef _MSC_VER
+    return _InterlockedCompareExchange64(const_cast<volatile __int64 *>(p), 0, 0);
+#else
+    return __sync_val_compare_and_swap(const_cast<volatile i64 *>(p), i64(0), i64(0));
+#endif
+}
+
+static inline void storeCount(volatile i64 *p, i64 v)
+{
+    i64 old = *p, cur;
+#ifdef _MSC_VER
+    while ((cur = _InterlockedCompareExchange64(p, v, old)) != old) old = cur;
+#else
+    while ((cur = __sync_val_compare_and_swap(p, old, v)) != old) old = cur;
+#endif
+}
 
 TempDataFile::TempDataFile()
     :   maxSize(1048576000),
 		currSize(0),
         nChans(1),
-        scanCount(0)
+        scanCount(0),
+        scanCountEnd(0),
+        mapPtr(0),
+        mapScans(0),
+        mapOk(qgetenv("SPIKEGL_TEMPFILE_MMAP") != "0")
 {
     Util::removeTempDataFiles();
-    fileName = QDir::tempPath() +
+    QString dir = QString::fromLocal8Bit(qgetenv("SPIKEGL_TEMPFILE_DIR"));
+    if (dir.isEmpty()) dir = QDir::tempPath();
+    fileName = dir +
                "/SpikeGL_DSTemp_" +
                QString::number(QCoreApplication::applicationPid()) +
                ".bin";
@@ -21,13 +57,26 @@ TempDataFile::TempDataFile()
 
 TempDataFile::~TempDataFile() 
 {
+    unmapRing();
+    tempFile.close();
+    QFile::remove(fileName);
     Util::removeTempDataFiles();
 }
 
+qint64 TempDataFile::getScanCount() const
+{
+    return loadCount(&scanCount);
+}
+
 bool TempDataFile::writeScans(const int16 * scans, unsigned nsamps)
 {
     if (!tempFile.isOpen() && !openForWrite())
         return false;
+
+    QReadLocker mapLocker(&mapLock);
+
+    if (!tempFile.isOpen()) return false; // closed meanwhile
+    if (mapPtr) return writeScansMapped(scans, nsamps / nChans);
 	
     qint64 pos = tempFile.pos();
 
@@ -71,7 +120,8 @@ bool TempDataFile::writeScans(const int16 * scans, unsigned nsamps)
 
     lock.lock();
 
-    scanCount += nWritten + nWritten0;
+    storeCount(&scanCount, scanCount + nWritten + nWritten0);
+    storeCount(&scanCountEnd, scanCount);
 	currSize = tempFile.size();
 
     lock.unlock();
@@ -79,8 +129,32 @@ bool TempDataFile::writeScans(const int16 * scans, unsigned nsamps)
     return true;
 }
 
+/// called with mapLock held for read.  We are the only writer of the counters, so reading them back directly is fine.
+bool TempDataFile::writeScansMapped(const int16 * scans, unsigned nScans)
+{
+    const i64 cap = mapScans, count = scanCount, scanSz = i64(nChans) * i64(sizeof(int16));
+    i64 skip = 0;
+    if (i64(nScans) > cap) skip = i64(nScans) - cap; // only the last cap scans would survive anyway
+
+    // announce the slots about to be overwritten, so that readScans() can drop what it copied from them
+    storeCount(&scanCountEnd, count + nScans);
+    const int16 *src = scans + skip * nChans;
+    for (i64 s = count + skip, left = i64(nScans) - skip; left > 0; ) {
+        const i64 slot = s % cap, n = left < cap - slot ? left : cap - slot;
+        memcpy(mapPtr + slot * scanSz, src, size_t(n * scanSz));
+        src += n * nChans, s += n, left -= n;
+    }
+    storeCount(&scanCount, count + nScans);
+    return true;
+}
+
 bool TempDataFile::readScans(QVector<int16> & out, qint64 nfrom, qint64 nread, const QBitArray &channelSubset, unsigned downsample) const
 {
+    {
+        QReadLocker mapLocker(&mapLock);
+        if (mapPtr) return readScansMapped(out, nfrom, nread, channelSubset, downsample);
+    }
+
     QFile readFile;
 	
     if (!openForRead(readFile))
@@ -88,7 +162,7 @@ bool TempDataFile::readScans(QVector<int16> & out, qint64 nfrom, qint64 nread, c
 
     lock.lock();
 
-	const qint64 my_scanCount = scanCount, my_currSize = currSize;
+	const qint64 my_scanCount = loadCount(&scanCount), my_currSize = currSize;
 	
 	lock.unlock();
 	
@@ -177,20 +251,136 @@ bool TempDataFile::readScans(QVector<int16> & out, qint64 nfrom, qint64 nread, c
     return true;
 }
 
+/// called with mapLock held for read.  Same results as reading the file, only copied straight out of the map, a
+/// contiguous run of scans at a time.
+bool TempDataFile::readScansMapped(QVector<int16> & out, i64 nfrom, i64 nread, const QBitArray & channelSubset, unsigned downsample) const
+{
+    const i64 cap = mapScans, count = loadCount(&scanCount);
+
+    i64 readCount = nread >= 0 ? nread : 1;
+
+    if (readCount > cap) readCount = cap;
+    if (readCount > 20000000) readCount = 20000000; // max 20 million scans
+    if (nfrom + readCount > count) readCount = count - nfrom;
+
+    if (nfrom < 0 || nfrom+readCount > count) {
+        Error() << "Specified invalid scan range for nfrom and nread parameters to TempDataFile::readScans()";
+        return false;
+    }
+    if (readCount <= 0) { out.clear(); return true; } // nfrom at or past the last scan: nothing to read yet
+    if (nfrom < count - cap) {
+        Error() << "Scans from " << nfrom << " were already overwritten in the temporary file, which holds the last " << cap << " scans";
+        return false;
+    }
+
+    if (downsample <= 0) downsample = 1;
+
+    std::vector<int> chansOn;
+    for (int i = 0, n = channelSubset.size(); i < n; ++i)
+        if (channelSubset.testBit(i))
+            chansOn.push_back(i);
+    const ScanGather g(nChans, chansOn);
+    const i64 nOn = i64(chansOn.size()), nOut = (readCount + downsample - 1) / downsample;
+
+    out.clear();
+    if (!nOn || !nOut) return true;
+    out.resize(int(nOut * nOn));
+
+    const int16 *ring = reinterpret_cast<const int16 *>(mapPtr);
+    int16 *o = out.data();
+    if (downsample == 1) {
+        for (i64 s = nfrom, left = readCount; left > 0; ) {
+            const i64 slot = s % cap, n = left < cap - slot ? left : cap - slot;
+            g.apply(ring + slot * nChans, o, unsigned(n));
+            o += n * nOn, s += n, left -= n;
+        }
+    } else {
+        for (i64 s = nfrom, end = nfrom + readCount; s < end; s += downsample, o += nOn)
+            g.apply(ring + (s % cap) * nChans, o, 1);
+    }
+
+    // the writer may have lapped us while we copied
+    const i64 end = loadCount(&scanCountEnd);
+    if (nfrom < end - cap) {
+        Error() << "Scans from " << nfrom << " were overwritten in the temporary file while being read";
+        out.clear();
+        return false;
+    }
+    return true;
+}
+
 bool TempDataFile::openForWrite() 
 {	
+    QWriteLocker mapLocker(&mapLock);
 	if (tempFile.isOpen()) return true;
 	lock.lock();
-	scanCount = currSize = 0;
+	storeCount(&scanCount, 0);
+	storeCount(&scanCountEnd, 0);
+	currSize = 0;
 	lock.unlock();
-    if (!tempFile.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+    // read/write, not just write: some platforms won't map a write-only file
+    if (!tempFile.open(QIODevice::ReadWrite|QIODevice::Truncate)) {
         Error() << "Failed to open the temporary file " << tempFile.fileName() << " for write";
         return false;
     }
-	Debug() << "Opened Matlab data API temp file for write: " << tempFile.fileName();
+    if (mapOk && !mapRing()) {
+        unmapRing();
+        tempFile.resize(0);
+        tempFile.seek(0);
+    }
+	Debug() << "Opened Matlab data API temp file for write: " << tempFile.fileName() << (mapPtr ? " (memory-mapped, " + QString::number(mapScans) + " scans)" : QString());
+    return true;
+}
+
+bool TempDataFile::mapRing()
+{
+    const i64 scanSz = i64(nChans) * i64(sizeof(int16));
+    i64 ringSize = maxSize;
+    // the whole file is allocated up front, so check the free space once, here.  leave 10MB of it, like writeScans() does.
+    const quint64 freeSpace = Util::availableDiskSpace();
+    if (quint64(ringSize) + 10485760 > freeSpace)
+        ringSize = freeSpace > 10485760 ? i64(freeSpace - 10485760) : 0;
+    const i64 cap = scanSz ? ringSize / scanSz : 0;
+    if (cap <= 0) {
+        Warning() << "No room for the temporary file ring, writing " << fileName << " instead of mapping it.";
+        return false;
+    }
+    i64 len = cap * scanSz;
+    len += (TEMP_FILE_MAP_ALIGN - len % TEMP_FILE_MAP_ALIGN) % TEMP_FILE_MAP_ALIGN;
+    if (len > i64(TEMP_FILE_MAP_MAX)) {
+        Debug() << "Temporary file ring of " << len << " bytes is too large to map, writing it instead.";
+        return false;
+    }
+    if (!tempFile.resize(len)) {
+        Warning() << "Could not size " << fileName << " to " << len << " bytes (" << tempFile.errorString() << "), writing it instead of mapping it.";
+        return false;
+    }
+#ifdef Q_OS_LINUX
+    // resize() leaves a sparse file.  reserve the blocks now: running out of them later would kill the writer with SIGBUS
+    const int err = posix_fallocate(tempFile.handle(), 0, len);
+    if (err) {
+        Warning() << "Could not reserve " << len << " bytes for " << fileName << " (" << strerror(err) << "), writing it instead of mapping it.";
+        return false;
+    }
+#endif
+    mapPtr = tempFile.map(0, len);
+    if (!mapPtr) {
+        Warning() << "Could not memory-map " << fileName << " (" << tempFile.errorString() << "), writing it instead.";
+        return false;
+    }
+    mapScans = cap;
+    lock.lock();
+    currSize = cap * scanSz;
+    lock.unlock();
     return true;
 }
 
+void TempDataFile::unmapRing()
+{
+    if (mapPtr) tempFile.unmap(mapPtr);
+    mapPtr = 0, mapScans = 0;
+}
+
 bool TempDataFile::openForRead(QFile & file) const
 {
 	file.setFileName(fileName);
@@ -219,10 +409,15 @@ QString TempDataFile::getChannelSubset() const
 
 void TempDataFile::close()
 {
+    QWriteLocker mapLocker(&mapLock);
+    unmapRing();
 	tempFile.close();
+    QFile::remove(fileName); // may not be in the temp dir
     Util::removeTempDataFiles();
 	lock.lock();
-	scanCount = currSize = 0;
+	storeCount(&scanCount, 0);
+	storeCount(&scanCountEnd, 0);
+	currSize = 0;
 	lock.unlock();
 	Debug() << "Closed and removed Matlab API temp file.";
 }
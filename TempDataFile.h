@@ -1,6 +1,7 @@
 #include <QString>
 #include <QFile>
 #include <QMutex>
+#include <QReadWriteLock>
 #include "TypeDefs.h"
 #ifndef TempDataFile_H
 #define TempDataFile_H
@@ -9,7 +10,25 @@
 
 #define TEMP_FILE_NAME_PREFIX "SpikeGL_DSTemp_"
 #define TEMP_FILE_NAME_SUFFIX ".bin"
+#define TEMP_FILE_MAP_ALIGN (2*1024*1024) /* the mapped ring's file length is rounded up to this, so that it may live on a hugetlbfs mount */
+#if defined(WIN64) || defined(_WIN64) || defined(__LP64__)
+#define TEMP_FILE_MAP_MAX (1024LL*1024LL*1024LL*64LL) /* rings larger than this are not mapped but read and written */
+#else
+#define TEMP_FILE_MAP_MAX (1024*1024*256) /* 32-bit processes are short on address space */
+#endif
+
+/** The ring of the most recent scans, on disk, that the Matlab API's GETDAQDATA reads from.
+
+    Normally the file is created at its full size when the first scans come in, and mapped into
+    memory once: writeScans() copies each page into the map (wrapping around at the end), and
+    readScans() copies the requested scans (channel subset and every downsample_factor'th scan)
+    straight out of it.  The writer never waits for readers: like PointRing, it announces how
+    far it is about to write, writes, then publishes the new scan count.  So a reader can check
+    that what it copied wasn't overwritten meanwhile.
 
+    The file goes in the system temp dir, or in the dir named by the SPIKEGL_TEMPFILE_DIR
+    environment variable (a tmpfs or hugetlbfs mount, say).  SPIKEGL_TEMPFILE_MMAP=0, or the
+    mapping failing, falls back to plain file writes and reads. */
 class TempDataFile
 {
 public:
@@ -26,18 +45,29 @@ public:
     bool readScans(QVector<int16> & outbuf, i64 nfrom, i64 nread, const QBitArray & channelSubset, unsigned downsample_factor = 1) const;
     void setTempFileSize(qint64 newSize) { maxSize = newSize; }
 
-    qint64 getTempFileSize() const { return maxSize; }    
-    qint64 getScanCount() const { return scanCount; }
+    qint64 getTempFileSize() const { return maxSize; }
+    qint64 getScanCount() const;
 
     QString getChannelSubset() const;
 
 private:
+    bool mapRing(); ///< sizes the freshly opened file for the ring, reserves its disk space and maps it
+    void unmapRing();
+    bool writeScansMapped(const int16 * scans, unsigned nScans);
+    bool readScansMapped(QVector<int16> & out, i64 nfrom, i64 nread, const QBitArray & channelSubset, unsigned downsample) const;
+
     QFile tempFile;
     i64 maxSize, currSize; // in bytes
     unsigned nChans;
-    i64 scanCount;
+    volatile i64 scanCount; ///< published by the writer once the scans are in the file
+    volatile i64 scanCountEnd; ///< the writer is (or was last) writing the scans before this one
     QString fileName;
 
+    uchar *mapPtr; ///< the whole ring, or 0 if not mapped
+    i64 mapScans; ///< ring capacity in scans, when mapped
+    bool mapOk;
+
     mutable QMutex lock;
+    mutable QReadWriteLock mapLock; ///< held for write only to open and close, so the map can't go away under a writeScans() or readScans()
 };
 #endif
@@ -22,6 +22,12 @@ public:
     }
 	
     bool isBufferWrapped() const { return WrapBuffer::isBufferWrapped(); }
+
+    /// see WrapBuffer, but in units of VECT
+    const VECT *rawData() const { return (const VECT *)WrapBuffer::rawData(); }
+    unsigned headIndex() const { return WrapBuffer::headOffset()/sizeof(VECT); }
+    unsigned long long totalPut() const { return WrapBuffer::totalPut()/sizeof(VECT); }
+    unsigned generation() const { return WrapBuffer::generation(); }
 	
     /// returns a pointer to the first piece of the data in the ringbuffer, along with its length.  if buffer is empty ptr will be valid but length will be 0
     void dataPtr1(VECT * & ptr, unsigned & lenVecs) const
@@ -2,7 +2,7 @@
 #include <string.h>
 
 WrapBuffer::WrapBuffer(unsigned theSize)
-    : buf(0), bufsz(0)
+    : buf(0), bufsz(0), gen(0)
 {
     reserve(theSize);
 }
@@ -14,7 +14,7 @@ WrapBuffer::~WrapBuffer()
 }
 
 WrapBuffer::WrapBuffer(const WrapBuffer & rhs)
-    : buf(0)
+    : buf(0), gen(0)
 {
     (*this) = rhs;
 }
@@ -26,6 +26,8 @@ WrapBuffer & WrapBuffer::operator=(const WrapBuffer & rhs)
     buf = new char[bufsz];
     len = rhs.len;
     head = rhs.head;
+    nPut = rhs.nPut;
+    ++gen;
     memcpy(buf, rhs.buf, bufsz);
     return *this;
 }
@@ -36,6 +38,8 @@ void WrapBuffer::reserve(unsigned newSize)
     if (newSize) buf = new char[newSize];
     bufsz = newSize;
     len = head = 0;
+    nPut = 0;
+    ++gen;
 }
 
 unsigned WrapBuffer::putData(const void *data, unsigned nBytes)
@@ -71,6 +75,7 @@ unsigned WrapBuffer::putData(const void *data, unsigned nBytes)
         }
         len += nBytes;
     }
+    nPut += nBytes;
     return size();
 }
 
@@ -11,7 +11,7 @@ public:
     /// invalidates (clears) old data if reserve is called!
     void reserve(unsigned newSize);
     unsigned capacity() const { return bufsz; } ///< the capacity of the buffer in bytes
-    void clear() { head = len = 0; }
+    void clear() { head = len = 0; nPut = 0; ++gen; }
 
     unsigned size() const { return len; } ///< the size in bytes of real valid data in the buffer.. tops off at size() bytes
     unsigned unusedCapacity() const { return capacity() - size(); }
@@ -27,6 +27,14 @@ public:
     /// returns a pointer to the second piece of the data or NULL pointer if buffer is not wrapped (1 piece)
     void dataPtr2(void * & ptr, unsigned & lenBytes) const;
 
+    /// For mirroring the buffer somewhere else, a piece at a time (see GLGraph).  The raw storage, the byte offset
+    /// in it of the first valid byte, the number of bytes put since the last reserve() or clear(), and a number
+    /// that changes on every reserve() or clear().
+    const void *rawData() const { return buf; }
+    unsigned headOffset() const { return unsigned(head); }
+    unsigned long long totalPut() const { return nPut; }
+    unsigned generation() const { return gen; }
+
     /// copy construct0r, performs a deep copy of rhs
     WrapBuffer(const WrapBuffer & rhs);
     /// operator= deallocs current buffer and performs a deep copy of rhs
@@ -36,6 +44,8 @@ private:
     char *buf;  
     unsigned bufsz;
     int head, len; ///< head of buffer (first index) and length in bytes
+    unsigned long long nPut;
+    unsigned gen;
 };
 
 #endif
@@ -0,0 +1,218 @@
+/* bug3replay -- feeds a capture of bug3_spikegl.exe's output through both of SpikeGL's Bug3 block
+   decoders (text and binary, see Bug3Protocol.h) and checks that they produce bit-identical scans
+   and metadata.  Also reports how fast each decoder is.
+
+   To make a capture, run SpikeGL with the environment variables
+       BUG3_BLOCK_FORMAT=both            (bug3_spikegl.exe sends every block in both formats)
+       SPIKEGL_BUG3_CAPTURE=capture.bin  (SpikeGL appends everything the subprocess sends to this file)
+   and acquire for a while.
+
+   bug3replay -s runs Bug3::StreamParser over a few made up streams instead, and checks what it makes of them.
+
+   Build:  g++ -O2 -I. bug3replay.cpp Bug3Protocol.cpp `pkg-config --cflags --libs QtCore` -o bug3replay */
+#include <stdio.h>
+#include <iostream>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <QFile>
+#include <QElapsedTimer>
+#include "Bug3Protocol.h"
+
+static void printUsage() {
+    std::cerr << "Usage: bug3replay [-t ttl_mask] [-c nchans] capture_file\n"
+              << "       bug3replay -s\n"
+              << "  -s  parser self test, no capture needed\n"
+              << "  -t  which TTL lines SpikeGL keeps, as a bitmask (default 0x7ff, all 11)\n"
+              << "  -c  channels per scan (default 16 + number of TTL lines kept)\n";
+}
+
+/// appends a binary frame holding a RawBlock whose missingFrameCount is `tag'
+static void appendFrame(QByteArray & data, int tag) {
+    Bug3::FrameHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "\0B3B", 4);
+    h.version = Bug3::BinaryVersion;
+    h.headerBytes = sizeof(h);
+    h.payloadBytes = sizeof(Bug3::RawBlock);
+    Bug3::RawBlock b;
+    memset(&b, 0, sizeof(b));
+    b.missingFrameCount = tag;
+    data.append(reinterpret_cast<const char *>(&h), int(sizeof(h)));
+    data.append(reinterpret_cast<const char *>(&b), int(sizeof(b)));
+}
+
+/// appends a text block with all of its fields
+static void appendTextBlock(QByteArray & data) {
+    data.append("---> Console data out called at time: 0ms plotQueue.Count=1 numPagesLeftInRAM=0\n");
+    for (int i = 0; i < Bug3::NTextFields; ++i) data.append(QString("KEY_%1{0}\n").arg(i).toLatin1());
+}
+
+/// parses `data' in pieces of `chunk' bytes, the way DAQ::BugTask::gotInput() sees it arrive, into a string like "L:a B:1 T L:b"
+static QString parseAll(const QByteArray & data, int chunk) {
+    Bug3::StreamParser parser;
+    QStringList items;
+    QByteArray buf;
+    for (int from = 0; from < data.size(); from += chunk) {
+        buf.append(data.mid(from, chunk));
+        unsigned pos = 0;
+        for (Bug3::StreamParser::Item item; (item = parser.next(buf.constData(), unsigned(buf.size()), pos)) != Bug3::StreamParser::NeedMore; ) {
+            if (item == Bug3::StreamParser::Line) items.push_back("L:" + parser.line());
+            else if (item == Bug3::StreamParser::TextBlock) items.push_back("T");
+            else {
+                Bug3::RawBlock b;
+                memcpy(&b, parser.rawBlock(), sizeof(b));
+                items.push_back(QString("B:%1").arg(b.missingFrameCount));
+            }
+        }
+        buf.remove(0, int(pos));
+    }
+    return items.join(" ");
+}
+
+static int selfTest() {
+    struct Case { const char *name; QByteArray data; const char *expect; };
+    std::vector<Case> cases;
+    Case c;
+    // what bug3_spikegl.exe used to send in binary mode: the text block's first line before every frame
+    c.name = "marker line, binary frame, text line";
+    c.data = "USRMSG: a\n---> Console data out called at time: 0ms\n";
+    appendFrame(c.data, 1);
+    c.data.append("USRMSG: b\n---> Console data out called at time: 1ms\n");
+    appendFrame(c.data, 2);
+    c.data.append("WARNMSG: c\n");
+    c.expect = "L:USRMSG: a B:1 L:USRMSG: b B:2 L:WARNMSG: c";
+    cases.push_back(c);
+    // binary mode now
+    c.name = "binary frames only";
+    c.data = "LOGMSG: a\n";
+    appendFrame(c.data, 3);
+    appendFrame(c.data, 4);
+    c.data.append("LOGMSG: b\n");
+    c.expect = "L:LOGMSG: a B:3 B:4 L:LOGMSG: b";
+    cases.push_back(c);
+    // BUG3_BLOCK_FORMAT=both: each binary frame, then the same block as text
+    c.name = "both formats";
+    c.data = QByteArray();
+    appendFrame(c.data, 5);
+    appendTextBlock(c.data);
+    c.data.append("USRMSG: a\n");
+    appendFrame(c.data, 6);
+    appendTextBlock(c.data);
+    c.expect = "B:5 T L:USRMSG: a B:6 T";
+    cases.push_back(c);
+
+    int nfail = 0;
+    for (size_t i = 0; i < cases.size(); ++i) {
+        static const int chunks[] = { 1<<30, 4096, 7, 1 };
+        for (size_t j = 0; j < sizeof(chunks)/sizeof(*chunks); ++j) {
+            const QString got = parseAll(cases[i].data, chunks[j]);
+            if (got != cases[i].expect) {
+                std::cerr << "FAIL: " << cases[i].name << " (" << chunks[j] << " byte reads): got `" << got.toUtf8().constData()
+                          << "', expected `" << cases[i].expect << "'\n";
+                ++nfail;
+            }
+        }
+    }
+    std::cout << cases.size() << " parser tests, " << nfail << " failures\n";
+    return nfail ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned ttls = 0x7ff;
+    int nchans = 0, ret;
+    bool errFlag = false;
+
+    while ( (ret = getopt(argc, argv, "t:c:s")) > -1 ) {
+        switch (ret) {
+        case 't': ttls = unsigned(strtoul(optarg, 0, 0)); break;
+        case 'c': nchans = atoi(optarg); break;
+        case 's': return selfTest();
+        case '?': errFlag = true; break;
+        }
+    }
+    if (errFlag || optind != argc-1) {
+        printUsage();
+        exit(1);
+    }
+    if (nchans <= 0) {
+        nchans = Bug3::BaseNChans;
+        for (int i = 0; i < Bug3::TotalTTLChans; ++i) if (ttls & (0x1<<i)) ++nchans;
+    }
+
+    QFile f(argv[optind]);
+    if (!f.open(QIODevice::ReadOnly)) {
+        std::cerr << "Could not open " << argv[optind] << "\n";
+        exit(1);
+    }
+    const QByteArray data = f.readAll();
+
+    // split the capture up exactly like DAQ::BugTask::gotInput() does
+    std::vector< QMap<QString, QString> > textBlocks;
+    std::vector<QByteArray> binBlocks;
+    Bug3::StreamParser parser;
+    unsigned pos = 0;
+    for (Bug3::StreamParser::Item item; (item = parser.next(data.constData(), unsigned(data.size()), pos)) != Bug3::StreamParser::NeedMore; ) {
+        if (item == Bug3::StreamParser::TextBlock) textBlocks.push_back(parser.textBlock());
+        else if (item == Bug3::StreamParser::BinaryBlock) binBlocks.push_back(QByteArray(parser.rawBlock(), int(sizeof(Bug3::RawBlock))));
+    }
+    std::cout << data.size() << " bytes: " << textBlocks.size() << " text blocks, " << binBlocks.size() << " binary blocks, "
+              << parser.badFrames() << " bad frames, " << (data.size()-int(pos)) << " trailing bytes\n";
+    if (textBlocks.size() != binBlocks.size())
+        std::cerr << "WARNING: block counts differ, only comparing the first " << std::min(textBlocks.size(), binBlocks.size()) << "\n";
+
+    const Bug3::Decoder dec(nchans, ttls);
+    const size_t nsamps = size_t(nchans)*Bug3::ScansPerBlock;
+    std::vector<int16> txt(nsamps), bin(nsamps);
+    unsigned nbad = 0, nwarn = 0;
+    const size_t n = std::min(textBlocks.size(), binBlocks.size());
+    for (size_t i = 0; i < n; ++i) {
+        Bug3::BlockMetaData mt, mb;
+        mt.blockNum = mb.blockNum = i;
+        memset(&txt[0], 0, nsamps*sizeof(int16));
+        memset(&bin[0], 0, nsamps*sizeof(int16));
+        QStringList warnings;
+        dec.decodeText(textBlocks[i], &txt[0], mt, &warnings);
+        dec.decodeBinary(binBlocks[i].constData(), &bin[0], mb);
+        nwarn += unsigned(warnings.size());
+        const bool sampsOk = !memcmp(&txt[0], &bin[0], nsamps*sizeof(int16)), metaOk = !memcmp(&mt, &mb, sizeof(mt));
+        if (!sampsOk || !metaOk) {
+            if (nbad < 10) {
+                std::cerr << "block " << i << ": " << (sampsOk ? "" : "samples differ ") << (metaOk ? "" : "metadata differs");
+                for (size_t s = 0; s < nsamps && !sampsOk; ++s)
+                    if (txt[s] != bin[s]) { std::cerr << " (first at scan " << s/nchans << " chan " << s%nchans << ": " << txt[s] << " vs " << bin[s] << ")"; break; }
+                std::cerr << "\n";
+            }
+            ++nbad;
+        }
+        for (int w = 0; w < warnings.size() && nwarn <= 10; ++w)
+            std::cerr << "block " << i << ": " << warnings[w].toUtf8().constData() << "\n";
+    }
+
+    // decoder throughput.  The text timing includes splitting up the lines, since that's a big part of its cost
+    double tText = 0., tBin = 0.;
+    if (n) {
+        QElapsedTimer t;
+        t.start();
+        Bug3::StreamParser p2;
+        unsigned pos2 = 0, nb = 0;
+        for (Bug3::StreamParser::Item item; (item = p2.next(data.constData(), unsigned(data.size()), pos2)) != Bug3::StreamParser::NeedMore; ) {
+            Bug3::BlockMetaData m;
+            if (item == Bug3::StreamParser::TextBlock) { dec.decodeText(p2.textBlock(), &txt[0], m); ++nb; }
+        }
+        tText = double(t.nsecsElapsed()) / 1e9 / (nb ? nb : 1);
+        t.restart();
+        for (size_t i = 0; i < binBlocks.size(); ++i) {
+            Bug3::BlockMetaData m;
+            dec.decodeBinary(binBlocks[i].constData(), &bin[0], m);
+        }
+        tBin = double(t.nsecsElapsed()) / 1e9 / double(binBlocks.size());
+        std::cout << "text decoder: " << (tText*1e6) << " us/block, binary decoder: " << (tBin*1e6) << " us/block"
+                  << " (one block is " << (Bug3::ScansPerBlock / (16.0 / 0.0006144) * 1e3) << " ms of data)\n";
+    }
+
+    std::cout << n << " blocks compared, " << nbad << " mismatched, " << nwarn << " text decoder warnings\n";
+    return (nbad || !n) ? 1 : 0;
+}
@@ -0,0 +1,379 @@
+/* kernelbench -- times SpikeGL's sample kernels on synthetic scans: the vectorized code against the
+   scalar reference code each kernel keeps for this, and against the code it replaced where there was
+   some.  SpikeGL itself no longer times anything at run time, since doing it there held up whatever
+   happened to start the measurement (acquisition start, opening a file, the sample buffer readers).
+
+   kernelbench [-c nchans] [-t secs] [kernel ...] runs the named kernels (all of them by default) at
+   a few typical channel counts, or just at nchans, and times each variant for about secs seconds
+   (default 0.1).  Set SPIKEGL_SIMD to cap the instruction set the kernels use, see SIMD.h.
+
+   kernelbench -c nchans -f file.bin codec reports how well (the first 32 MB of) a plain .bin file of
+   nchans channels would compress, and how fast.
+
+   The kernels don't depend on Qt, and neither does this.
+
+   Build:  g++ -O2 -I. kernelbench.cpp ScanGather.cpp HPFilter.cpp MinMaxDecimator.cpp IntanDemux.cpp SpikeDetector.cpp SampleCodec.cpp -o kernelbench */
+#include <stdio.h>
+#include <iostream>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "SIMD.h"
+#include "ScanGather.h"
+#include "HPFilter.h"
+#include "MinMaxDecimator.h"
+#include "IntanDemux.h"
+#include "SpikeDetector.h"
+#include "SampleCodec.h"
+
+static double minSecs = 0.1;
+static const char *binFile = 0; ///< -f: the codec compresses (the start of) this .bin instead of synthetic scans
+
+static double getTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec)/1e9;
+}
+
+/// calls op() back to back for at least minSecs, returns the number of calls per second
+template <class Op> static double callsPerSec(Op & op)
+{
+    int reps = 0;
+    const double t0 = getTime();
+    double t1 = t0;
+    do {
+        op();
+        ++reps;
+    } while ((t1 = getTime()) - t0 < minSecs);
+    return double(reps) / (t1-t0);
+}
+
+/// nChans if it was given on the command line, otherwise the defaults
+static std::vector<unsigned> chanCounts(unsigned nChans, const unsigned *defaults, unsigned nDefaults)
+{
+    if (nChans) return std::vector<unsigned>(1, nChans);
+    return std::vector<unsigned>(defaults, defaults + nDefaults);
+}
+
+/// enough scans of nChans channels for about 8 MB of samples, so that the big channel counts don't measure just the cache
+static unsigned scansFor(unsigned nChans) { const unsigned n = (4U*1024U*1024U)/nChans; return n ? n : 1; }
+
+/// ScanGather::apply() (or applyScalar()) on nScans scans
+struct GatherOp {
+    const ScanGather & g; const short *in; short *out; unsigned nScans; bool scalar;
+    GatherOp(const ScanGather & sg, const short *i, short *o, unsigned n, bool s) : g(sg), in(i), out(o), nScans(n), scalar(s) {}
+    void operator()() { if (scalar) g.applyScalar(in, out, nScans); else g.apply(in, out, nScans); }
+};
+
+/// The save path's channel subset before ScanGather: a bit test and a push_back per sample, into a vector
+/// reserved for the expected size.  keep stands in for the QBitArray it tested.
+struct OldGatherOp {
+    const std::vector<short> & in; const std::vector<bool> & keep; unsigned nChans, nOn; std::vector<short> out;
+    OldGatherOp(const std::vector<short> & i, const std::vector<bool> & k, unsigned nOut) : in(i), keep(k), nChans(unsigned(k.size())), nOn(nOut) {}
+    void operator()() {
+        const int n = int(in.size());
+        out.resize(0);
+        out.reserve(size_t(double(n) * (double(nOn) / nChans) + .5) + 256);
+        for (int i = 0; i < n; ++i)
+            if (keep[i % nChans])
+                out.push_back(in[i]);
+    }
+};
+
+/// the save channel subset, keeping 3 of every 4 channels
+static void benchGather(unsigned nChansArg)
+{
+    static const unsigned defaults[] = { 64, 256, 2304 };
+    const std::vector<unsigned> chans(chanCounts(nChansArg, defaults, sizeof(defaults)/sizeof(*defaults)));
+    for (unsigned c = 0; c < unsigned(chans.size()); ++c) {
+        const unsigned nChans = chans[c], nScans = scansFor(nChans);
+        std::vector<bool> keep(nChans);
+        for (unsigned i = 0; i < nChans; ++i) keep[i] = (i & 3) != 3;
+        ScanGather g;
+        g.setSubset(keep);
+        std::vector<short> in(size_t(nScans)*nChans), out(size_t(nScans)*g.outScanSize());
+        for (size_t i = 0; i < in.size(); ++i) in[i] = short(i*7919);
+        GatherOp simd(g, &in[0], &out[0], nScans, false), scalar(g, &in[0], &out[0], nScans, true);
+        OldGatherOp old(in, keep, g.outScanSize());
+        const double m = nScans/1e6;
+        printf("gather   %5u chans: %8.2f Mscans/s %s, %8.2f scalar, %8.2f old per-sample loop\n", nChans,
+               callsPerSec(simd)*m, g.usesSIMD() ? "SSSE3" : "scalar", callsPerSec(scalar)*m, callsPerSec(old)*m);
+    }
+}
+
+/// HPFilter::applyBlock() (or applyBlockScalar()) on nScans scans, in place
+struct HPFOp {
+    HPFilter & f; short *scans; unsigned nScans, nChans; bool scalar;
+    HPFOp(HPFilter & hpf, short *s, unsigned n, unsigned nc, bool sc) : f(hpf), scans(s), nScans(n), nChans(nc), scalar(sc) {}
+    void operator()() {
+        if (scalar) f.applyBlockScalar(scans, nScans, nChans, 1.0/25000.);
+        else f.applyBlock(scans, nScans, nChans, 1.0/25000.);
+    }
+};
+
+/// the graphs' high-pass filter, on every other channel, 4096 scans at a time
+static void benchHPF(unsigned nChansArg)
+{
+    static const unsigned defaults[] = { 60, 128, 256, 2304 };
+    const std::vector<unsigned> chans(chanCounts(nChansArg, defaults, sizeof(defaults)/sizeof(*defaults)));
+    for (unsigned c = 0; c < unsigned(chans.size()); ++c) {
+        const unsigned nChans = chans[c], nScans = 4096;
+        std::vector<short> scans(size_t(nScans)*nChans);
+        std::vector<bool> which(nChans);
+        for (size_t i = 0; i < scans.size(); ++i) scans[i] = short(i*7919);
+        for (unsigned i = 0; i < nChans; ++i) which[i] = !(i&1);
+        HPFilter f(nChans, 300.0);
+        f.setChannelMask(which);
+        HPFOp simd(f, &scans[0], nScans, nChans, false), scalar(f, &scans[0], nScans, nChans, true);
+        const double m = nScans/1e6;
+        printf("hpf      %5u chans: %8.2f Mscans/s %s, %8.2f scalar\n", nChans, callsPerSec(simd)*m, SIMD::levelName(SIMD::level()), callsPerSec(scalar)*m);
+    }
+}
+
+/// MinMaxDecimator::apply() (or applyScalar()) on nScans scans
+struct DecimateOp {
+    MinMaxDecimator & d; const short *scans; short *out; unsigned nScans; bool scalar;
+    DecimateOp(MinMaxDecimator & dec, const short *s, short *o, unsigned n, bool sc) : d(dec), scans(s), out(o), nScans(n), scalar(sc) {}
+    void operator()() {
+        if (scalar) d.applyScalar(scans, nScans, d.scanSize(), out);
+        else d.apply(scans, nScans, d.scanSize(), out);
+    }
+};
+
+/// the live graphs' min/max envelope decimation, 16 to 1 (25 kHz down to about 1.5 kHz), 4096 scans at a time
+static void benchDecimate(unsigned nChansArg)
+{
+    static const unsigned defaults[] = { 60, 128, 256, 2304 };
+    const std::vector<unsigned> chans(chanCounts(nChansArg, defaults, sizeof(defaults)/sizeof(*defaults)));
+    for (unsigned c = 0; c < unsigned(chans.size()); ++c) {
+        const unsigned nChans = chans[c], nScans = 4096, ratio = 16;
+        std::vector<short> scans(size_t(nScans)*nChans), out(size_t(2*(nScans/ratio + 1))*nChans);
+        for (size_t i = 0; i < scans.size(); ++i) scans[i] = short(i*7919);
+        MinMaxDecimator d(nChans, ratio);
+        DecimateOp simd(d, &scans[0], &out[0], nScans, false), scalar(d, &scans[0], &out[0], nScans, true);
+        const double m = nScans/1e6;
+        printf("decimate %5u chans: %8.2f Mscans/s %s, %8.2f scalar\n", nChans, callsPerSec(simd)*m, SIMD::levelName(SIMD::level()), callsPerSec(scalar)*m);
+    }
+}
+
+/// the NI MUX modes, as in DAQ.h/DAQ.cpp, minus AIRegular which has nothing to demux
+struct MuxMode { const char *name; unsigned nChansPerIntan, nIntans; };
+static const MuxMode muxModes[] = {
+    { "AI60Demux", 15, 4 }, { "AI120Demux", 15, 8 }, { "JFRCIntan32", 16, 2 }, { "AI128Demux", 16, 8 },
+    { "AI256Demux", 32, 8 }, { "AI64Demux", 16, 4 }, { "AI96Demux", 16, 6 }, { "AI128_32_Demux", 32, 4 },
+};
+
+/// IntanDemux::apply() (or applyScalar()) on nScans scans
+struct DemuxOp {
+    const IntanDemux & d; const short *in; short *out; unsigned nScans; bool scalar;
+    DemuxOp(const IntanDemux & dm, const short *i, short *o, unsigned n, bool s) : d(dm), in(i), out(o), nScans(n), scalar(s) {}
+    void operator()() { if (scalar) d.applyScalar(in, out, nScans); else d.apply(in, out, nScans); }
+};
+
+/// IntanDemux::applyDual() (or applyDualScalar(), which merges then demuxes) on nScans scans of each device,
+/// each with 1 extra channel after its MUXed ones
+struct DualDemuxOp {
+    const IntanDemux & d; const short *in, *in2; short *out; unsigned ss1, ss2, nScans; bool scalar;
+    DualDemuxOp(const IntanDemux & dm, const short *i, unsigned s1, const short *i2, unsigned s2, short *o, unsigned n, bool s)
+        : d(dm), in(i), in2(i2), out(o), ss1(s1), ss2(s2), nScans(n), scalar(s) {}
+    void operator()() {
+        if (scalar) d.applyDualScalar(in, ss1, ss1-1, in2, ss2-1, out, nScans);
+        else d.applyDual(in, ss1, ss1-1, in2, ss2-1, out, nScans);
+    }
+};
+
+/// the Intan demux of each MUX mode, on 1 device and on 2 (twice the INTANs), with 1 extra channel per device,
+/// and for 2 devices also the merge of their scans done with it.  The MUX modes fix the channel counts, so -c
+/// doesn't apply.
+static void benchDemux(unsigned)
+{
+    for (unsigned m = 0; m < sizeof(muxModes)/sizeof(*muxModes); ++m) {
+        for (unsigned dual = 1; dual <= 2; ++dual) {
+            const unsigned nIntans = muxModes[m].nIntans*dual, nChans = muxModes[m].nChansPerIntan*nIntans + dual, nScans = 25000;
+            const IntanDemux d(nChans, muxModes[m].nChansPerIntan, nIntans);
+            std::vector<short> in(size_t(nScans)*nChans), out(in.size());
+            for (size_t i = 0; i < in.size(); ++i) in[i] = short(i*7919);
+            DemuxOp simd(d, &in[0], &out[0], nScans, false), scalar(d, &in[0], &out[0], nScans, true);
+            const double ms = nScans/1e6;
+            printf("demux    %-14s %s %4u chans: %8.2f Mscans/s %s, %8.2f scalar\n", muxModes[m].name, dual > 1 ? "2 devs" : "1 dev ", nChans,
+                   callsPerSec(simd)*ms, d.usesSIMD() ? "SSE2" : "scalar", callsPerSec(scalar)*ms);
+            if (dual > 1) {
+                // the same scans as the 2 devices deliver them, merged and demuxed as NITask::doFinalDemuxAndEnqueue() does
+                const unsigned ss1 = nChans/2, ss2 = nChans - ss1;
+                std::vector<short> in2(size_t(nScans)*ss2);
+                for (size_t i = 0; i < in2.size(); ++i) in2[i] = short(i*104729);
+                DualDemuxOp fused(d, &in[0], ss1, &in2[0], ss2, &out[0], nScans, false), merged(d, &in[0], ss1, &in2[0], ss2, &out[0], nScans, true);
+                printf("merge    %-14s 2 devs %4u chans: %8.2f Mscans/s fused, %8.2f merge then scalar demux\n", muxModes[m].name, nChans,
+                       callsPerSec(fused)*ms, callsPerSec(merged)*ms);
+            }
+        }
+    }
+}
+
+/// SpikeDetector::apply() (or applyScalar()) on the next nScans scans of the stream
+struct SpikeOp {
+    SpikeDetector & d; const short *page; unsigned nScans; unsigned long long scan; bool scalar;
+    SpikeOp(SpikeDetector & det, const short *p, unsigned n, bool s) : d(det), page(p), nScans(n), scan(0), scalar(s) {}
+    void operator()() {
+        if (scalar) d.applyScalar(page, nScans, d.scanSize(), scan);
+        else d.apply(page, nScans, d.scanSize(), scan);
+        scan += nScans;
+    }
+};
+
+/// the online spike detector at 25 kHz, on a 1024 scan page of noise fed over and over, so it sees a continuous stream
+static void benchSpikes(unsigned nChansArg)
+{
+    static const unsigned defaults[] = { 64, 256, 2304 };
+    const std::vector<unsigned> chans(chanCounts(nChansArg, defaults, sizeof(defaults)/sizeof(*defaults)));
+    for (unsigned c = 0; c < unsigned(chans.size()); ++c) {
+        const unsigned nChans = chans[c], nScans = 1024;
+        std::vector<short> page(size_t(nScans)*nChans);
+        unsigned r = 12345;
+        for (size_t i = 0; i < page.size(); ++i) { r = r*1103515245U + 12345U; page[i] = short(int((r >> 16) & 0x3f) - 32); }
+        SpikeDetector simdDet, scalarDet;
+        simdDet.reset(nChans, 25000.);
+        scalarDet.reset(nChans, 25000.);
+        SpikeOp simd(simdDet, &page[0], nScans, false), scalar(scalarDet, &page[0], nScans, true);
+        const double k = nScans/1e3;
+        printf("spikes   %5u chans: %8.1f kscans/s %s, %8.1f scalar\n", nChans, callsPerSec(simd)*k,
+               SIMD::level() >= SIMD::SSE2 ? "SSE2" : "scalar", callsPerSec(scalar)*k);
+    }
+}
+
+/// Synthetic neural-ish data for the codec: each channel a slow random walk plus noise, and now and then a spike.
+/// Random samples would make it look worse than it is, and a ramp much better.
+static void makeSignal(std::vector<short> & scans, unsigned nScans, unsigned nChans)
+{
+    scans.resize(size_t(nScans)*nChans);
+    std::vector<int> level(nChans, 0);
+    unsigned r = 12345;
+    for (unsigned s = 0; s < nScans; ++s)
+        for (unsigned c = 0; c < nChans; ++c) {
+            r = r*1103515245U + 12345U;
+            level[c] += int((r >> 16) & 7) - 3;
+            if (level[c] > 2000 || level[c] < -2000) level[c] /= 2;
+            const int spike = ((r >> 8) & 0xfff) == 0 ? -600 : 0;
+            scans[size_t(s)*nChans + c] = short(level[c] + int((r >> 20) & 0x1f) - 16 + spike);
+        }
+}
+
+/// SampleCodec::encode() (or decode()) of nScans scans, chunk by chunk as the compressed DataFile does it.  Each
+/// chunk's encoding goes to its own maxEncodedBytes() slot of enc.
+struct CodecOp {
+    const short *scans; short *dec; unsigned nScans, nChans, chunkScans; size_t slot; bool decode;
+    std::vector<unsigned char> enc;
+    std::vector<size_t> nBytes;
+    CodecOp(const short *s, short *d, unsigned n, unsigned nc, unsigned cs, bool dc)
+        : scans(s), dec(d), nScans(n), nChans(nc), chunkScans(cs), slot(SampleCodec::maxEncodedBytes(cs, nc)), decode(dc),
+          enc(slot*((n + cs - 1)/cs)), nBytes((n + cs - 1)/cs) {}
+    void operator()() {
+        for (unsigned pos = 0, i = 0; pos < nScans; pos += chunkScans, ++i) {
+            const unsigned n = nScans - pos < chunkScans ? nScans - pos : chunkScans;
+            if (decode) SampleCodec::decode(&enc[i*slot], nBytes[i], n, nChans, dec + size_t(pos)*nChans);
+            else nBytes[i] = SampleCodec::encode(scans + size_t(pos)*nChans, n, nChans, &enc[i*slot]);
+        }
+    }
+};
+
+/// The .bin compression on up to 32 MB of the -f file (-c gives its channel count) or of synthetic scans.
+/// Speeds are per core; the writer runs several.
+static void benchCodec(unsigned nChansArg)
+{
+    static const unsigned defaults[] = { 64, 256, 2304 };
+    const unsigned chunkBytes = 2*1024*1024, maxBytes = 32*1024*1024; ///< chunkBytes is DF_COMPRESS_CHUNK_BYTES
+    const std::vector<unsigned> chans(chanCounts(nChansArg, defaults, sizeof(defaults)/sizeof(*defaults)));
+    for (unsigned c = 0; c < unsigned(chans.size()); ++c) {
+        const unsigned nChans = chans[c];
+        unsigned chunkScans = unsigned(chunkBytes / (nChans*sizeof(short)));
+        if (chunkScans < unsigned(SampleCodec::PartitionSize)) chunkScans = SampleCodec::PartitionSize;
+        std::vector<short> scans;
+        if (binFile) {
+            FILE *f = fopen(binFile, "rb");
+            if (!f) { std::cerr << "Could not open " << binFile << "\n"; return; }
+            scans.resize(maxBytes/sizeof(short)/nChans*nChans);
+            scans.resize(fread(&scans[0], sizeof(short)*nChans, scans.size()/nChans, f)*nChans);
+            fclose(f);
+            if (scans.empty()) { std::cerr << binFile << " has no scans of " << nChans << " chans\n"; return; }
+        } else
+            makeSignal(scans, unsigned(maxBytes/sizeof(short)/nChans), nChans);
+
+        const unsigned nScans = unsigned(scans.size()/nChans);
+        std::vector<short> dec(scans.size());
+        CodecOp e(&scans[0], &dec[0], nScans, nChans, chunkScans, false);
+        const double encPerSec = callsPerSec(e);
+        CodecOp d(e);
+        d.decode = true;
+        const double decPerSec = callsPerSec(d);
+        double out = 0.;
+        for (size_t i = 0; i < e.nBytes.size(); ++i) {
+            const double raw = double(i+1 < e.nBytes.size() ? chunkScans : nScans - unsigned(i)*chunkScans)*nChans*sizeof(short);
+            out += 16 /* the chunk's header */ + (double(e.nBytes[i]) < raw ? double(e.nBytes[i]) : raw); // incompressible chunks are stored
+        }
+        const double mb = scans.size()*sizeof(short)/1024./1024.;
+        printf("codec    %5u chans: ratio %5.2f on %.1f MB%s, encode %7.1f MB/s, decode %7.1f MB/s%s\n", nChans, mb*1024.*1024./out, mb,
+               binFile ? " of the file" : "", mb*encPerSec, mb*decPerSec, dec == scans ? "" : " -- ROUNDTRIP MISMATCH!");
+    }
+}
+
+struct Kernel {
+    const char *name;
+    void (*bench)(unsigned nChans);
+};
+
+static const Kernel kernels[] = {
+    { "gather", benchGather },
+    { "hpf", benchHPF },
+    { "decimate", benchDecimate },
+    { "demux", benchDemux },
+    { "spikes", benchSpikes },
+    { "codec", benchCodec },
+};
+static const unsigned nKernels = sizeof(kernels)/sizeof(*kernels);
+
+static void printUsage() {
+    std::cerr << "Usage: kernelbench [-c nchans] [-t secs] [kernel ...]\n"
+              << "       kernelbench -c nchans -f file.bin [-t secs] codec\n"
+              << "Kernels:";
+    for (unsigned k = 0; k < nKernels; ++k) std::cerr << " " << kernels[k].name;
+    std::cerr << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    SIMD::level(); // detect the CPU's instruction sets before timing anything
+    unsigned nChans = 0;
+    int ret;
+    bool errFlag = false;
+
+    while ( (ret = getopt(argc, argv, "c:f:t:")) > -1 ) {
+        switch (ret) {
+        case 'c': nChans = unsigned(atoi(optarg)); if (!nChans) errFlag = true; break;
+        case 'f': binFile = optarg; break;
+        case 't': minSecs = atof(optarg); if (minSecs <= 0.) errFlag = true; break;
+        default: errFlag = true; break;
+        }
+    }
+    std::vector<const Kernel *> which;
+    for (int i = optind; i < argc; ++i) {
+        unsigned k = 0;
+        while (k < nKernels && strcmp(argv[i], kernels[k].name)) ++k;
+        if (k < nKernels) which.push_back(&kernels[k]);
+        else errFlag = true;
+    }
+    if (binFile && !nChans) errFlag = true;
+    if (errFlag) {
+        printUsage();
+        return 1;
+    }
+    if (which.empty())
+        for (unsigned k = 0; k < nKernels; ++k) which.push_back(&kernels[k]);
+
+    printf("Instruction set: %s\n", SIMD::levelName(SIMD::level()));
+    for (unsigned k = 0; k < unsigned(which.size()); ++k)
+        which[k]->bench(nChans);
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include "MainApp.h"
+#include "SIMD.h"
 int main(int argc, char *argv[])
 {
+    SIMD::level(); // detect the CPU's instruction sets now, before any of the threads that use the kernels exist
     MainApp app(argc, argv);
     return app.exec();
 }